@@ -3,24 +3,71 @@
 
 #include <bme68x.h>
 
+#include "i2c-bus.h"
+
 #include "hardware/i2c.h"
 
+#ifndef BME680_INTERFACE_XFER_NUM
+#define BME680_INTERFACE_XFER_NUM 4
+#endif
+
+#ifndef BME680_INTERFACE_XFER_MAX_LEN
+#define BME680_INTERFACE_XFER_MAX_LEN (I2C_BUS_XFER_MAX_LEN - 1)
+#endif
+
+/* Bus scheduling priority against other devices on the same bus */
+#ifndef BME680_INTERFACE_PRIO
+#define BME680_INTERFACE_PRIO 1
+#endif
+
+#ifndef BME680_INTERFACE_BAUD
+#define BME680_INTERFACE_BAUD 500000
+#endif
+
 #ifdef __cplusplus
 extern "C" {
 #endif /* #ifdef __cplusplus */
 
+	struct bme680_intf_node;
+
+	/**
+	 * @brief Completion callback for asynchronous transfers
+	 *
+	 * Called from the I2C interrupt once the transfer has
+	 * finished. @p rslt is BME68X_OK on success.
+	 */
+	typedef void (*bme680_xfer_cb)(struct bme680_intf_node *intf,
+				       int8_t rslt, void *ctx);
+
+	/**
+	 * @brief Preallocated asynchronous transfer
+	 */
+	typedef struct bme680_xfer_node {
+		i2c_bus_xfer x;
+		struct bme680_intf_node *intf;
+		bme680_xfer_cb cb;
+		void *ctx;
+	} bme680_xfer;
+
 	/**
 	 * @brief BME680 interface configuration struct
 	 *
 	 * This is passed to the initialize function to fill out
 	 */
-	typedef struct {
+	typedef struct bme680_intf_node {
 		i2c_inst_t *i2c;
 		uint8_t dev_addr;
 		int32_t timeout;
 		struct bme68x_dev bme_dev;
 		struct bme68x_conf conf;
 		struct bme68x_heatr_conf heatr;
+		i2c_bus *bus; /**< @brief Shared bus the sensor is on */
+		i2c_bus_dev dev;
+		i2c_bus_xfer sync; /**< @brief Used by the vendor library */
+		bme680_xfer xfers[BME680_INTERFACE_XFER_NUM];
+		uint8_t field_block[BME68X_LEN_FIELD];
+		/** @brief @p field_block holds the last burst read */
+		volatile bool field_ready;
 	} bme680_intf;
 
 	/**
@@ -36,16 +83,71 @@ extern "C" {
 
 	/**
 	 * @brief Pico-sdk user function to read sensor
+	 *
+	 * Synchronous adapter for the vendor library. The read is
+	 * queued on the shared bus and waited on.
 	 */
 	int8_t bme680_i2c_read(uint8_t reg_addr, uint8_t *reg_data,
 			       uint32_t len, void *intf_ptr);
 
 	/**
 	 * @brief Pico-sdk user function to write sensor
+	 *
+	 * Synchronous adapter for the vendor library. The write is
+	 * queued on the shared bus and waited on.
 	 */
 	int8_t bme680_i2c_write(uint8_t reg_addr, const uint8_t *reg_data,
 				uint32_t len, void *intf_ptr);
 
+	/**
+	 * @brief Queue a register read on the shared bus
+	 *
+	 * Returns immediately. @p cb is called from interrupt context
+	 * when @p len bytes starting at @p reg_addr have been stored
+	 * in @p reg_data, which must stay valid until then.
+	 *
+	 * @return BME68X_OK if queued, BME68X_E_COM_FAIL if no
+	 * transfer is free
+	 */
+	int8_t bme680_i2c_read_async(bme680_intf *intf, uint8_t reg_addr,
+				     uint8_t *reg_data, uint32_t len,
+				     bme680_xfer_cb cb, void *ctx);
+
+	/**
+	 * @brief Queue a register write on the shared bus
+	 *
+	 * The payload is copied into the transfer, so @p reg_data
+	 * may be reused as soon as this returns.
+	 */
+	int8_t bme680_i2c_write_async(bme680_intf *intf,
+				      uint8_t reg_addr,
+				      const uint8_t *reg_data,
+				      uint32_t len, bme680_xfer_cb cb,
+				      void *ctx);
+
+	/**
+	 * @brief Burst read the full field block into
+	 * @p intf->field_block in a single transaction
+	 *
+	 * The next @ref bme680_collect decodes the block instead of
+	 * reading the field registers again.
+	 */
+	int8_t bme680_read_field_block_async(bme680_intf *intf,
+					     bme680_xfer_cb cb,
+					     void *ctx);
+
+	/**
+	 * @brief Check if all transfers queued by @p intf finished
+	 */
+	bool bme680_i2c_idle(bme680_intf *intf);
+
+	/**
+	 * @brief Cancel all transfers queued by @p intf
+	 *
+	 * Their callbacks are not called.
+	 */
+	void bme680_i2c_cancel(bme680_intf *intf);
+
 	/**
 	 * @brief Pico-sdk user function for delays by sensor
 	 */
@@ -63,6 +165,22 @@ extern "C" {
 	int bme680_init(bme680_intf *b_intf, uint8_t dev_addr,
 			bme680_run_mode mode);
 
+	/**
+	 * @brief Trigger a measurement without waiting for it
+	 *
+	 * @param dur_us Filled with the time in microseconds until
+	 * the measurement can be collected
+	 */
+	int bme680_start(bme680_run_mode mode, bme680_intf *b_intf,
+			 uint32_t *dur_us);
+
+	/**
+	 * @brief Read a measurement started by @ref bme680_start
+	 * and fill @p d struct
+	 */
+	int bme680_collect(bme680_run_mode mode, bme680_intf *b_intf,
+			   struct bme68x_data *d);
+
 	/**
 	 * @brief Read measurement from sensor and fill @p d struct
 	 */
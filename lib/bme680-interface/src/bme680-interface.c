@@ -1,85 +1,211 @@
 #include "bme680-interface.h"
+#include "i2c-bus-pico.h"
 
 #include <stdint.h>
 #include <string.h>
 
 #include "pico/stdlib.h"
 
+#define ARRAY_LEN(array) sizeof(array)/sizeof(array[0])
+
+static void _bme680_bus_init(bme680_intf *intf, uint baudrate);
+static bme680_xfer *_bme680_xfer_claim(bme680_intf *intf);
+static void _bme680_xfer_done(i2c_bus_xfer *x, int rslt, void *ctx);
+static uint64_t _bme680_timeout_us(bme680_intf *intf, uint32_t periods);
+static int8_t _bme680_rslt(int rslt);
+
 int8_t bme680_i2c_read(uint8_t reg_addr, uint8_t *reg_data,
 		       uint32_t len, void *intf_ptr)
 {
-	int num_bytes;
 	bme680_intf *intf = (bme680_intf*) intf_ptr;
+	int ret;
 
 	if (intf_ptr == NULL) {
 		return BME68X_E_NULL_PTR;
 	}
 
-	/* Write a byte with the register offset first but don't send
-	 * stop. Then begin the read that will start at that offset */
-	if (intf->timeout < 0) {
-		i2c_write_blocking(intf->i2c, intf->dev_addr,
-				   &reg_addr, 1, true);
-		num_bytes = i2c_read_blocking(intf->i2c, intf->dev_addr,
-					      reg_data, (uint16_t) len, false);
-	} else {
-		absolute_time_t to;
-
-		to = make_timeout_time_ms(intf->timeout);
-		num_bytes = i2c_write_blocking_until(intf->i2c, intf->dev_addr,
-						     &reg_addr, 1, true, to);
+	if (len > BME680_INTERFACE_XFER_MAX_LEN) {
+		return BME68X_E_INVALID_LENGTH;
+	}
 
-		if (num_bytes == PICO_ERROR_TIMEOUT) {
-			return BME68X_E_COM_FAIL;
-		}
+	/* Serve the vendor library's field read from the block fetched
+	 * in the background, once */
+	if (intf->field_ready && reg_addr == BME68X_REG_FIELD0 &&
+	    len <= sizeof(intf->field_block)) {
+		intf->field_ready = false;
+		memcpy(reg_data, intf->field_block, len);
+		return BME68X_OK;
+	}
 
-		to = make_timeout_time_ms(intf->timeout * len);
-		num_bytes = i2c_read_blocking_until(intf->i2c, intf->dev_addr,
-						    reg_data, (uint16_t) len,
-						    false, to);
+	ret = i2c_bus_xfer_set(&intf->sync, &reg_addr, 1, reg_data, len,
+			       0, NULL, NULL);
 
-		if (num_bytes == PICO_ERROR_TIMEOUT) {
-			return BME68X_E_COM_FAIL;
-		}
+	if (ret == I2C_BUS_OK) {
+		ret = i2c_bus_submit(&intf->dev, &intf->sync);
 	}
 
-	if (num_bytes == PICO_ERROR_GENERIC) {
-		return BME68X_E_COM_FAIL;
+	if (ret != I2C_BUS_OK) {
+		return _bme680_rslt(ret);
 	}
 
-	return BME68X_OK;
+	/* One timeout period for the register byte plus one for each
+	 * byte read, as with the old blocking implementation */
+	return _bme680_rslt(i2c_bus_xfer_wait(&intf->sync,
+					      _bme680_timeout_us(intf,
+								 len + 1)));
 }
 
 int8_t bme680_i2c_write(uint8_t reg_addr, const uint8_t *reg_data,
 			uint32_t len, void *intf_ptr)
 {
-	int num_bytes;
 	bme680_intf *intf = (bme680_intf*) intf_ptr;
-	uint8_t d[len + 1];
+	int ret;
 
 	if (intf_ptr == NULL) {
 		return BME68X_E_NULL_PTR;
 	}
 
-	d[0] = reg_addr;
-	memcpy(&d[1], reg_data, len);
+	if (len > BME680_INTERFACE_XFER_MAX_LEN) {
+		return BME68X_E_INVALID_LENGTH;
+	}
 
-	/* Use timeout only if set with value greater than 0, other
-	 * wise fully block */
-	if (intf->timeout > 0) {
-		absolute_time_t to = make_timeout_time_ms(intf->timeout);
+	/* Register address first, and the data copied once straight
+	 * into the transfer */
+	ret = i2c_bus_xfer_set(&intf->sync, &reg_addr, 1, NULL, 0, 0,
+			       NULL, NULL);
+
+	if (ret == I2C_BUS_OK && len > 0) {
+		memcpy(&intf->sync.wbuf[1], reg_data, len);
+		intf->sync.wlen = len + 1;
+	}
+
+	if (ret == I2C_BUS_OK) {
+		ret = i2c_bus_submit(&intf->dev, &intf->sync);
+	}
+
+	if (ret != I2C_BUS_OK) {
+		return _bme680_rslt(ret);
+	}
+
+	return _bme680_rslt(i2c_bus_xfer_wait(&intf->sync,
+					      _bme680_timeout_us(intf, 1)));
+}
+
+int8_t bme680_i2c_read_async(bme680_intf *intf, uint8_t reg_addr,
+			     uint8_t *reg_data, uint32_t len,
+			     bme680_xfer_cb cb, void *ctx)
+{
+	bme680_xfer *b;
+	int ret;
+
+	if (!intf || !reg_data) {
+		return BME68X_E_NULL_PTR;
+	}
+
+	if (len == 0 || len > BME680_INTERFACE_XFER_MAX_LEN) {
+		return BME68X_E_INVALID_LENGTH;
+	}
+
+	b = _bme680_xfer_claim(intf);
+
+	if (!b) {
+		return BME68X_E_COM_FAIL;
+	}
+
+	b->cb = cb;
+	b->ctx = ctx;
+
+	ret = i2c_bus_xfer_set(&b->x, &reg_addr, 1, reg_data, len, 0,
+			       _bme680_xfer_done, b);
+
+	if (ret == I2C_BUS_OK) {
+		ret = i2c_bus_submit(&intf->dev, &b->x);
+	}
+
+	if (ret != I2C_BUS_OK) {
+		b->x.state = I2C_BUS_XFER_FREE;
+	}
+
+	return _bme680_rslt(ret);
+}
 
-		num_bytes = i2c_write_blocking_until(intf->i2c,
-						     intf->dev_addr,
-						     d, len + 1,
-						     false, to);
-	} else {
-		num_bytes = i2c_write_blocking(intf->i2c,
-					       intf->dev_addr,
-					       d, len + 1, false);
+int8_t bme680_i2c_write_async(bme680_intf *intf, uint8_t reg_addr,
+			      const uint8_t *reg_data, uint32_t len,
+			      bme680_xfer_cb cb, void *ctx)
+{
+	bme680_xfer *b;
+	int ret;
+
+	if (!intf || (len > 0 && !reg_data)) {
+		return BME68X_E_NULL_PTR;
+	}
+
+	if (len > BME680_INTERFACE_XFER_MAX_LEN) {
+		return BME68X_E_INVALID_LENGTH;
+	}
+
+	b = _bme680_xfer_claim(intf);
+
+	if (!b) {
+		return BME68X_E_COM_FAIL;
+	}
+
+	b->cb = cb;
+	b->ctx = ctx;
+
+	/* Fill out the claimed transfer in place, register address
+	 * first */
+	ret = i2c_bus_xfer_set(&b->x, &reg_addr, 1, NULL, 0, 0,
+			       _bme680_xfer_done, b);
+
+	if (ret == I2C_BUS_OK && len > 0) {
+		memcpy(&b->x.wbuf[1], reg_data, len);
+		b->x.wlen = len + 1;
+	}
+
+	if (ret == I2C_BUS_OK) {
+		ret = i2c_bus_submit(&intf->dev, &b->x);
+	}
+
+	if (ret != I2C_BUS_OK) {
+		b->x.state = I2C_BUS_XFER_FREE;
+	}
+
+	return _bme680_rslt(ret);
+}
+
+int8_t bme680_read_field_block_async(bme680_intf *intf,
+				     bme680_xfer_cb cb, void *ctx)
+{
+	if (!intf) {
+		return BME68X_E_NULL_PTR;
 	}
 
-	return num_bytes == len + 1 ? BME68X_OK : BME68X_E_COM_FAIL;
+	intf->field_ready = false;
+
+	return bme680_i2c_read_async(intf, BME68X_REG_FIELD0,
+				     intf->field_block,
+				     sizeof(intf->field_block), cb, ctx);
+}
+
+bool bme680_i2c_idle(bme680_intf *intf)
+{
+	for (unsigned int i = 0; i < ARRAY_LEN(intf->xfers); ++i) {
+		if (intf->xfers[i].x.state != I2C_BUS_XFER_FREE) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void bme680_i2c_cancel(bme680_intf *intf)
+{
+	for (unsigned int i = 0; i < ARRAY_LEN(intf->xfers); ++i) {
+		if (i2c_bus_xfer_busy(&intf->xfers[i].x)) {
+			i2c_bus_cancel(&intf->xfers[i].x);
+		}
+	}
 }
 
 void bme680_delay_us(uint32_t period, void *intf_ptr)
@@ -92,21 +218,8 @@ int bme680_init(bme680_intf *b_intf, uint8_t dev_addr,
 {
 	uint8_t ret;
 
-	/* Initialize I2C,
-	 * note: given baudrate may note match actual */
-	if (!b_intf->i2c) {
-		b_intf->i2c = i2c_default;
-	}
-
-	i2c_init(b_intf->i2c, 500000);
-
-	/* TODO: Alow gpio of non-default i2c pins to be set up */
-	gpio_set_function(PICO_DEFAULT_I2C_SDA_PIN, GPIO_FUNC_I2C);
-	gpio_set_function(PICO_DEFAULT_I2C_SCL_PIN, GPIO_FUNC_I2C);
-	gpio_pull_up(PICO_DEFAULT_I2C_SDA_PIN);
-	gpio_pull_up(PICO_DEFAULT_I2C_SCL_PIN);
-
 	b_intf->dev_addr = dev_addr;
+	_bme680_bus_init(b_intf, BME680_INTERFACE_BAUD);
 
 	/* Set up BME680 */
 	b_intf->bme_dev.intf_ptr = (void*) b_intf;
@@ -151,12 +264,13 @@ int bme680_init(bme680_intf *b_intf, uint8_t dev_addr,
 	return 0;
 }
 
-int bme680_sample(bme680_run_mode mode, bme680_intf *b_intf,
-		  struct bme68x_data *d)
+int bme680_start(bme680_run_mode mode, bme680_intf *b_intf,
+		 uint32_t *dur_us)
 {
-	uint8_t ret;
-	uint32_t dur;
-	uint8_t num_fields;
+	int8_t ret;
+
+	/* A block fetched before this measurement is stale */
+	b_intf->field_ready = false;
 
 	switch (mode) {
 	case FORCED_MODE:
@@ -167,11 +281,28 @@ int bme680_sample(bme680_run_mode mode, bme680_intf *b_intf,
 			return ret;
 		}
 
-		dur = bme68x_get_meas_dur(BME68X_FORCED_MODE, &b_intf->conf,
-					  &b_intf->bme_dev)
+		*dur_us = bme68x_get_meas_dur(BME68X_FORCED_MODE,
+					      &b_intf->conf,
+					      &b_intf->bme_dev)
 			+ (b_intf->heatr.heatr_dur * 1000);
 
-		b_intf->bme_dev.delay_us(dur, b_intf->bme_dev.intf_ptr);
+		break;
+
+	default:
+		return 1;
+	}
+
+	return 0;
+}
+
+int bme680_collect(bme680_run_mode mode, bme680_intf *b_intf,
+		   struct bme68x_data *d)
+{
+	int8_t ret;
+	uint8_t num_fields = 0;
+
+	switch (mode) {
+	case FORCED_MODE:
 		ret = bme68x_get_data(BME68X_FORCED_MODE, d, &num_fields,
 				      &b_intf->bme_dev);
 
@@ -192,13 +323,32 @@ int bme680_sample(bme680_run_mode mode, bme680_intf *b_intf,
 	return 1;
 }
 
+int bme680_sample(bme680_run_mode mode, bme680_intf *b_intf,
+		  struct bme68x_data *d)
+{
+	int ret;
+	uint32_t dur;
+
+	ret = bme680_start(mode, b_intf, &dur);
+
+	if (ret != 0) {
+		return ret;
+	}
+
+	b_intf->bme_dev.delay_us(dur, b_intf->bme_dev.intf_ptr);
+
+	return bme680_collect(mode, b_intf, d);
+}
+
 int bme680_deinit(bme680_intf *b_intf)
 {
-	if (!b_intf->i2c) {
+	if (!b_intf->i2c || !b_intf->bus) {
 		return 1;
 	}
 
-	i2c_deinit(b_intf->i2c);
+	i2c_bus_dev_remove(&b_intf->dev);
+	i2c_bus_pico_deinit(b_intf->i2c);
+	b_intf->bus = NULL;
 
 	return 0;
 }
@@ -211,21 +361,8 @@ int8_t bme680_selftest(bme680_intf *b_intf, uint8_t dev_addr)
 		return 1;
 	}
 
-	/* Initialize I2C,
-	 * note: given baudrate may note match actual */
-	if (!b_intf->i2c) {
-		b_intf->i2c = i2c_default;
-	}
-
-	i2c_init(b_intf->i2c, 100000);
-
-	/* TODO: Alow gpio of non-default i2c pins to be set up */
-	gpio_set_function(PICO_DEFAULT_I2C_SDA_PIN, GPIO_FUNC_I2C);
-	gpio_set_function(PICO_DEFAULT_I2C_SCL_PIN, GPIO_FUNC_I2C);
-	gpio_pull_up(PICO_DEFAULT_I2C_SDA_PIN);
-	gpio_pull_up(PICO_DEFAULT_I2C_SCL_PIN);
-
 	b_intf->dev_addr = dev_addr;
+	_bme680_bus_init(b_intf, 100000);
 
 	/* Set up BME680 */
 	b_intf->bme_dev.intf_ptr = (void*) b_intf;
@@ -242,3 +379,82 @@ int8_t bme680_selftest(bme680_intf *b_intf, uint8_t dev_addr)
 
 	return ret;
 }
+
+/*
+**********************************************************************
+*********************** INTERNAL FUNCTIONS ***************************
+**********************************************************************
+*/
+
+void _bme680_bus_init(bme680_intf *intf, uint baudrate)
+{
+	/* NULL i2c selects the default block */
+	if (!intf->i2c) {
+		intf->i2c = i2c_default;
+	}
+
+	intf->bus = i2c_bus_pico_init(intf->i2c, baudrate);
+	i2c_bus_dev_add(intf->bus, &intf->dev, intf->dev_addr,
+			BME680_INTERFACE_PRIO);
+
+	intf->sync.state = I2C_BUS_XFER_FREE;
+	intf->field_ready = false;
+
+	for (unsigned int i = 0; i < ARRAY_LEN(intf->xfers); ++i) {
+		intf->xfers[i].intf = intf;
+		intf->xfers[i].x.state = I2C_BUS_XFER_FREE;
+	}
+}
+
+bme680_xfer *_bme680_xfer_claim(bme680_intf *intf)
+{
+	if (!intf->bus) {
+		return NULL;
+	}
+
+	for (unsigned int i = 0; i < ARRAY_LEN(intf->xfers); ++i) {
+		if (i2c_bus_xfer_claim(&intf->dev, &intf->xfers[i].x)) {
+			return &intf->xfers[i];
+		}
+	}
+
+	return NULL;
+}
+
+void _bme680_xfer_done(i2c_bus_xfer *x, int rslt, void *ctx)
+{
+	bme680_xfer *b = (bme680_xfer*) ctx;
+
+	if (rslt == I2C_BUS_OK && x->rbuf == b->intf->field_block) {
+		b->intf->field_ready = true;
+	}
+
+	if (b->cb) {
+		b->cb(b->intf, _bme680_rslt(rslt), b->ctx);
+	}
+}
+
+uint64_t _bme680_timeout_us(bme680_intf *intf, uint32_t periods)
+{
+	/* Use timeout only if set with value greater than 0, other
+	 * wise fully block */
+	if (intf->timeout <= 0) {
+		return 0;
+	}
+
+	return (uint64_t) intf->timeout * 1000 * periods;
+}
+
+int8_t _bme680_rslt(int rslt)
+{
+	switch (rslt) {
+	case I2C_BUS_OK:
+		return BME68X_OK;
+	case I2C_BUS_E_NULL_PTR:
+		return BME68X_E_NULL_PTR;
+	case I2C_BUS_E_INVALID_LEN:
+		return BME68X_E_INVALID_LENGTH;
+	default:
+		return BME68X_E_COM_FAIL;
+	}
+}
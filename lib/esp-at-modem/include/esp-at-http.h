@@ -0,0 +1,169 @@
+/*
+* Copyright (c) 2022 Tyler J. Anderson.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions
+* are met:
+*
+* 1. Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+*
+* 2. Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in
+*    the documentation and/or other materials provided with the
+*    distribution.
+*
+* 3. Neither the name of the copyright holder nor the names of its
+*    contributors may be used to endorse or promote products derived
+*    from this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+* "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+* LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+* FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+* COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+* INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+* BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+* CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+* LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+* ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+ * @file esp-at-http.h
+ *
+ * @brief Minimal HTTP endpoint on the server of the ESP-AT module
+ *
+ * Answers GET requests that clients of the server of
+ * @ref esp_at_cipserver_init send as +IPD data, with bodies the
+ * program renders ahead of time. A body is rendered into the spare
+ * one of two buffers and published at once, so requests never wait
+ * for rendering and any number of them cost one send each.
+ */
+
+#ifndef ESP_AT_HTTP_H
+#define ESP_AT_HTTP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "esp-at-modem.h"
+
+#ifdef ESP_AT_MULTICORE_ENABLED
+#include "pico/critical_section.h"
+#endif /* #ifdef ESP_AT_MULTICORE_ENABLED */
+
+/**
+ * @defgroup espathttp ESP-AT HTTP Endpoint
+ * @{
+ */
+
+/** @brief Max number of paths served */
+#ifndef ESP_AT_HTTP_MAX_ROUTES
+#define ESP_AT_HTTP_MAX_ROUTES 4
+#endif
+
+/** @brief Part of a request kept, enough for the request line */
+#ifndef ESP_AT_HTTP_REQ_LEN
+#define ESP_AT_HTTP_REQ_LEN 128
+#endif
+
+/** @brief Time a new client is kept out of
+ * @ref esp_at_cipsend_string, to see if it sends a request
+ */
+#ifndef ESP_AT_HTTP_HOLD_MS
+#define ESP_AT_HTTP_HOLD_MS 1000
+#endif
+
+/** @brief A path and its published body */
+typedef struct {
+	const char *path; /**< Path of the request line, like /latest */
+	const char *type; /**< Content-Type of the body */
+	char *buf[2]; /**< Published and spare body */
+	size_t size; /**< Size of each of buf */
+	size_t len[2]; /**< Length of the body in each of buf */
+	volatile unsigned int front; /**< Index of the published body */
+	volatile bool published; /**< A body was published */
+	volatile bool busy[2]; /**< The body in buf is being sent */
+	uint32_t requests; /**< Requests answered with the body */
+} esp_at_http_route;
+
+/** @brief Request being received on a link */
+typedef struct {
+	char buf[ESP_AT_HTTP_REQ_LEN]; /**< Start of the request */
+	size_t len; /**< Characters in buf */
+	bool open; /**< The link connected and wasn't answered yet */
+	absolute_time_t hold; /**< End of the hold of the link */
+} esp_at_http_req;
+
+/** @brief State of the endpoint */
+typedef struct {
+	esp_at_cfg *cfg; /**< Module of the server */
+	esp_at_http_route routes[ESP_AT_HTTP_MAX_ROUTES];
+	unsigned int nroutes; /**< Entries in routes */
+	esp_at_http_req req[ESP_AT_MAX_CONN]; /**< Request per link */
+
+	/** @brief Bit per link with a whole request to answer */
+	volatile unsigned int ready;
+	uint32_t errors; /**< Requests answered with an error status */
+
+#ifdef ESP_AT_MULTICORE_ENABLED
+	/* Guards the published body of each route between the core
+	 * rendering and the one serving */
+	critical_section_t cs;
+#endif /* #ifdef ESP_AT_MULTICORE_ENABLED */
+} esp_at_http;
+
+/** @brief Start answering requests on the server of @p cfg
+ *
+ * Registers a URC callback. New clients are left out of
+ * @ref esp_at_cipsend_string for @ref ESP_AT_HTTP_HOLD_MS, and for
+ * good if they send a request.
+ *
+ * @return 0 on success, <0 if no URC callback is free
+ */
+int esp_at_http_init(esp_at_http *srv, esp_at_cfg *cfg);
+
+/** @brief Serve bodies for @p path
+ *
+ * @param store Room for two bodies, the published one and the one
+ * being rendered, 2 * @p size bytes
+ *
+ * @return Index of the route on success, <0 if all are in use
+ */
+int esp_at_http_route_add(esp_at_http *srv, const char *path,
+			  const char *type, char *store, size_t size);
+
+/** @brief Get the spare buffer of a route to render the next body
+ *
+ * @param size Set to the size of the buffer
+ *
+ * @return The buffer, or NULL if the route doesn't exist or the
+ * spare buffer is still being sent
+ */
+char *esp_at_http_render(esp_at_http *srv, int route, size_t *size);
+
+/** @brief Publish the body rendered with @ref esp_at_http_render
+ *
+ * Requests after this get the new body.
+ */
+void esp_at_http_publish(esp_at_http *srv, int route, size_t len);
+
+/** @brief Answer the requests received so far
+ *
+ * Sends the header of each answer in front of its body with
+ * @ref esp_at_cipsend_head, and closes the link after it. Call from
+ * the core that drives the module.
+ *
+ * @return Number of requests answered
+ */
+int esp_at_http_process(esp_at_http *srv);
+
+/**
+ * @}
+ */
+
+#endif /* #ifndef ESP_AT_HTTP_H */
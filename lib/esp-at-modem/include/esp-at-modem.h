@@ -44,6 +44,7 @@
 #include <stdint.h>
 
 #include "uart_pio.h"
+#include "at-parse.h"
 
 /**
  * @defgroup espatlibrary RPi Pico ESP-AT WiFi Library
@@ -54,6 +55,135 @@
 #define ESP_AT_MAX_CONN 8
 #endif
 
+/** @brief Time before the addresses of the module are queried again */
+#ifndef ESP_AT_TTL_ADDR_MS
+#define ESP_AT_TTL_ADDR_MS 300000
+#endif
+
+/** @brief Time before the clients are queried again
+ *
+ * URCs keep the list current in between, the query fills in the
+ * remote address of new clients and catches missed events.
+ */
+#ifndef ESP_AT_TTL_CLIENTS_MS
+#define ESP_AT_TTL_CLIENTS_MS 60000
+#endif
+
+/** @brief Time before the muxing mode is queried again */
+#ifndef ESP_AT_TTL_MUX_MS
+#define ESP_AT_TTL_MUX_MS 3600000
+#endif
+
+/** @brief Time a send may wait for its SEND OK
+ *
+ * Sends still unanswered after this are counted as failed so their
+ * link is no longer skipped as backlogged.
+ */
+#ifndef ESP_AT_SEND_ACK_MS
+#define ESP_AT_SEND_ACK_MS 5000
+#endif
+
+/** @brief Time a single link may take in a fan-out until its data
+ * is accepted by the module
+ */
+#ifndef ESP_AT_FANOUT_LINK_MS
+#define ESP_AT_FANOUT_LINK_MS 1000
+#endif
+
+/** @brief Largest payload of a single CIPSEND */
+#ifndef ESP_AT_CIPSEND_MAX_LEN
+#define ESP_AT_CIPSEND_MAX_LEN 2048
+#endif
+
+/** @brief Largest payload of a single CIPSENDL, for modules with
+ * @ref ESP_AT_CAP_CIPSENDL
+ */
+#ifndef ESP_AT_CIPSENDL_MAX_LEN
+#define ESP_AT_CIPSENDL_MAX_LEN 65536
+#endif
+
+/** @brief Fastest UART rate @ref esp_at_init_module negotiates
+ *
+ * 0 keeps the rate passed to it.
+ */
+#ifndef ESP_AT_BAUD_MAX
+#define ESP_AT_BAUD_MAX 921600
+#endif
+
+/** @brief Fastest UART rate negotiated with RTS/CTS flow control */
+#ifndef ESP_AT_BAUD_MAX_FLOW
+#define ESP_AT_BAUD_MAX_FLOW 3000000
+#endif
+
+/** @brief Max number of URC callbacks per module */
+#ifndef ESP_AT_URC_MAX_CB
+#define ESP_AT_URC_MAX_CB 4
+#endif
+
+/** @brief Largest piece of +IPD data handed to a URC callback */
+#ifndef ESP_AT_IPD_CHUNK_LEN
+#define ESP_AT_IPD_CHUNK_LEN 128
+#endif
+
+/** @brief Silence on the line before and after the +++ that ends
+ * transparent transmission
+ */
+#ifndef ESP_AT_TRANSPARENT_GUARD_MS
+#define ESP_AT_TRANSPARENT_GUARD_MS 20
+#endif
+
+/** @brief Time the module needs after +++ before it takes commands */
+#ifndef ESP_AT_TRANSPARENT_EXIT_MS
+#define ESP_AT_TRANSPARENT_EXIT_MS 1000
+#endif
+
+/** @brief Bytes of the sequence number in front of each datagram
+ * of @ref esp_at_udp_send, most significant first
+ */
+#define ESP_AT_UDP_SEQ_LEN 4
+
+/** @brief Commands that can wait in the queue of a module */
+#ifndef ESP_AT_CMD_QUEUE_LEN
+#define ESP_AT_CMD_QUEUE_LEN 4
+#endif
+
+/** @brief Time from submitting a command until it times out, for
+ * commands without an entry in the table of limits
+ *
+ * See @ref esp_at_cmd_timeout_ms.
+ */
+#ifndef ESP_AT_CMD_TIMEOUT_MS
+#define ESP_AT_CMD_TIMEOUT_MS 5000
+#endif
+
+/** @brief Commands with a time limit of their own */
+#define ESP_AT_CMD_LIMIT_COUNT 18
+
+/** @brief Bit of an @ref at_frame_event in @ref esp_at_cmd ends */
+#define ESP_AT_CMD_END(ev) (1u << (ev))
+
+/** @brief Result codes a command ends with by default */
+#define ESP_AT_CMD_END_RESULT						\
+	(ESP_AT_CMD_END(AT_FRAME_OK) | ESP_AT_CMD_END(AT_FRAME_ERROR) |	\
+	 ESP_AT_CMD_END(AT_FRAME_SEND_OK) |				\
+	 ESP_AT_CMD_END(AT_FRAME_SEND_FAIL) |				\
+	 ESP_AT_CMD_END(AT_FRAME_PROMPT))
+
+/** @brief Version of the AT firmware as in @ref esp_at_cfg */
+#define ESP_AT_VERSION(major, minor) (((major) << 8) | (minor))
+
+/** @brief Commands found by @ref esp_at_init_module, the library
+ * uses the cheaper one of a pair when the module has it
+ */
+typedef enum {
+	/** @brief AT+CIPSTATE, lists the links without the station
+	 * state of AT+CIPSTATUS */
+	ESP_AT_CAP_CIPSTATE = 0x01,
+	/** @brief AT+CIPSENDL, takes data of any length in one
+	 * command, from AT version 2.4 */
+	ESP_AT_CAP_CIPSENDL = 0x02
+} esp_at_cap;
+
 /** @brief AT device status flags */
 typedef enum {
 	ESP_AT_STATUS_WIFI_CONNECTED = 0x01,
@@ -85,18 +215,102 @@ typedef struct {
 	uint8_t passive; /**< 1, ESP device is server, 0 it is a client */
 } esp_at_clients;
 
-/** @brief Configuration object for WiFi co-processor
+/** @brief Unsolicited result codes sent by the co-processor */
+typedef enum {
+	ESP_AT_URC_CONNECT, /**< <link>,CONNECT */
+	ESP_AT_URC_CLOSED, /**< <link>,CLOSED */
+	ESP_AT_URC_WIFI_CONNECTED, /**< WIFI CONNECTED */
+	ESP_AT_URC_WIFI_GOT_IP, /**< WIFI GOT IP */
+	ESP_AT_URC_WIFI_DISCONNECT, /**< WIFI DISCONNECT */
+	ESP_AT_URC_IPD /**< +IPD,<link>,<len>:<data> */
+} esp_at_urc_type;
+
+/** @brief Unsolicited result code passed to callbacks */
+typedef struct {
+	esp_at_urc_type type; /**< Kind of URC */
+	int link; /**< Link index, or -1 if not for a link */
+
+	/** @brief Received data for @ref ESP_AT_URC_IPD
+	 *
+	 * Data longer than @ref ESP_AT_IPD_CHUNK_LEN is passed in
+	 * several calls, with @p left the data still to come after
+	 * this piece.
+	 */
+	const char *data;
+	size_t len; /**< Length of @p data */
+	size_t left; /**< Data of the +IPD still to come */
+} esp_at_urc;
+
+/** @brief Callback for unsolicited result codes */
+typedef void (*esp_at_urc_cb)(const esp_at_urc *urc, void *ctx);
+
+/** @brief Send counters of a link */
+typedef struct {
+	uint32_t sent; /**< Sends accepted by the module */
+	uint32_t acked; /**< Sends answered with SEND OK */
+	uint32_t failed; /**< Sends that failed or got no answer */
+	uint32_t skipped; /**< Sends skipped while the link was backlogged */
+} esp_at_link_stats;
+
+/** @brief Outcomes of the commands of one name */
+typedef struct {
+	uint32_t count; /**< Commands finished */
+	uint32_t timeouts; /**< Commands that ran past their deadline */
+	uint32_t errors; /**< Commands that ended with an error */
+	uint32_t max_us; /**< Longest time from sending one to its end */
+} esp_at_cmd_stats;
+
+/** @brief Send waiting for its SEND OK */
+typedef struct {
+	int link;
+	absolute_time_t deadline;
+} esp_at_pending_send;
+
+/** @brief Registered URC callback */
+typedef struct {
+	esp_at_urc_cb cb;
+	void *ctx;
+} esp_at_urc_handler;
+
+/** @brief Progress of a queued command */
+typedef enum {
+	ESP_AT_CMD_QUEUED, /**< Waiting for earlier commands */
+	ESP_AT_CMD_RUNNING, /**< Sent, waiting for the result */
+	ESP_AT_CMD_OK, /**< Ended with OK, SEND OK or the prompt */
+	ESP_AT_CMD_ERROR, /**< Ended with ERROR or SEND FAIL, or the
+			   * response didn't fit */
+	ESP_AT_CMD_TIMEOUT /**< No result before the deadline */
+} esp_at_cmd_state;
+
+struct esp_at_cmd_node;
+
+/** @brief Callback for a finished command */
+typedef void (*esp_at_cmd_cb)(struct esp_at_cmd_node *cmd, void *ctx);
+
+/** @brief Command descriptor for the asynchronous queue
  *
- * Pass this structure to the initialization function first to fill
- * out all the information and start the UART. Then it may be used
- * to identify the module in the other library functions.
+ * Fill out the first block of members, best with
+ * @ref esp_at_cmd_init, before passing to @ref esp_at_cmd_submit.
+ * The descriptor, the command text and the response buffer belong
+ * to the module until the command is done.
  */
-typedef struct esp_at_cfg_node {
-	uart_pio_cfg uart_cfg; /**< UART config structure for module */
-	uint en_pin; /**< GPIO pin to use for enable */
-	uint reset_pin; /**< GPIO pin to use for reset */
-	struct esp_at_cfg_node  *ptr; /**< NULL if uninitialized, this if init */
-} esp_at_cfg;
+typedef struct esp_at_cmd_node {
+	const char *cmd; /**< Command text without line end */
+	unsigned int ends; /**< @ref ESP_AT_CMD_END bits ending it */
+	absolute_time_t deadline; /**< Time the command has to end by */
+	char *rsp; /**< Response sink, may be NULL */
+	size_t len; /**< Size of @p rsp */
+	esp_at_cmd_cb cb; /**< Called once done, may be NULL */
+	void *ctx; /**< Passed to @p cb and @p push */
+	const at_push_cb *push; /**< Gets each line of the response as
+				 * it arrives, may be NULL */
+
+	volatile esp_at_cmd_state state; /**< Progress, set by the queue */
+	int result; /**< Characters in @p rsp once OK, <0 otherwise */
+	absolute_time_t start; /**< When it was sent */
+	size_t rsp_len; /**< Characters received so far */
+	bool overflow; /**< The response didn't fit in @p rsp */
+} esp_at_cmd;
 
 /** @brief Structure with status information on co-processor
  *
@@ -113,10 +327,94 @@ typedef struct {
 	uint16_t port; /**< Port CIP server is listening on */
 	char ipv4_gateway[24]; /**< IP address of the gateway */
 	char ipv4_netmask[24]; /**< Netmask of local network */
+	uint8_t ipv4_prefix; /**< Netmask as a prefix length */
 	char ssid[128]; /**< SSID of wireless network */
-	esp_at_cfg *cfg; /**< Ptr to the config for this co-proc */
+	struct esp_at_cfg_node *cfg; /**< Ptr to the config for this co-proc */
 } esp_at_status;
 
+/** @brief Parts of @ref esp_at_status cached separately */
+typedef enum {
+	ESP_AT_FIELD_ADDR = 0x01, /**< Addresses, from AT+CIPSTA? */
+	/** @brief Clients, from AT+CIPSTATE or AT+CIPSTATUS */
+	ESP_AT_FIELD_CLIENTS = 0x02,
+	ESP_AT_FIELD_MUX = 0x04, /**< Muxing, from AT+CIPMUX? */
+	ESP_AT_FIELD_ALL = 0x07
+} esp_at_field;
+
+#define ESP_AT_FIELD_COUNT 3
+
+/** @brief Configuration object for WiFi co-processor
+ *
+ * Pass this structure to the initialization function first to fill
+ * out all the information and start the UART. Then it may be used
+ * to identify the module in the other library functions.
+ */
+typedef struct esp_at_cfg_node {
+	uart_pio_cfg uart_cfg; /**< UART config structure for module */
+	uint en_pin; /**< GPIO pin to use for enable */
+	uint reset_pin; /**< GPIO pin to use for reset */
+	struct esp_at_cfg_node  *ptr; /**< NULL if uninitialized, this if init */
+	unsigned int caps; /**< @ref esp_at_cap bits of the module */
+
+	/** @brief Version from AT+GMR as @ref ESP_AT_VERSION, 0 if
+	 * unknown */
+	unsigned int at_version;
+
+	at_framer framer; /**< Frames everything received from the module */
+	esp_at_urc_handler urc[ESP_AT_URC_MAX_CB]; /**< URC callbacks */
+	unsigned int nurc; /**< Number of URC callbacks */
+	esp_at_status status; /**< Cached status of the module */
+	unsigned int stale; /**< @ref esp_at_field bits to query again */
+	absolute_time_t expire[ESP_AT_FIELD_COUNT]; /**< End of each TTL */
+	int ipd_link; /**< Link of the +IPD being received */
+	size_t ipd_left; /**< Data of the +IPD not received yet */
+	size_t ipd_len; /**< Data waiting in ipd_buf */
+	char ipd_buf[ESP_AT_IPD_CHUNK_LEN];
+
+	/** @brief Sends waiting for SEND OK, oldest first */
+	esp_at_pending_send acks[ESP_AT_MAX_CONN];
+	unsigned int ack_head; /**< Oldest entry of acks */
+	unsigned int nacks; /**< Entries in acks */
+	esp_at_link_stats links[ESP_AT_MAX_CONN]; /**< Counters per link */
+
+	/** @brief Submitted commands, oldest first */
+	esp_at_cmd *cmdq[ESP_AT_CMD_QUEUE_LEN];
+	unsigned int cmdq_head; /**< Oldest entry of cmdq */
+	unsigned int ncmdq; /**< Entries in cmdq */
+	esp_at_cmd *cmd; /**< Command waiting for its result, or NULL */
+	bool cmd_busy; /**< The module refused cmd as busy */
+	absolute_time_t cmd_retry; /**< When to send cmd again if busy */
+
+	/** @brief Counters per entry of the table of limits, the last
+	 * one for all other commands */
+	esp_at_cmd_stats cmd_stats[ESP_AT_CMD_LIMIT_COUNT + 1];
+
+	/** @brief Query of @ref esp_at_status_update and
+	 * @ref esp_at_status_refresh, parsed as it is received */
+	esp_at_cmd status_cmd;
+	int status_field; /**< Index of the field queried, -1 if none */
+	int status_rslt; /**< Result of the last query */
+	esp_at_status status_next; /**< Answer of the query so far */
+	unsigned int status_lines; /**< Lines of the answer taken in */
+
+	/** @brief In transparent transmission, everything written is
+	 * data of link 0 and commands fail without being sent */
+	bool transparent;
+	absolute_time_t transparent_last; /**< End of the last write */
+
+	unsigned int udp_links; /**< Bit per link opened as UDP */
+
+	/** @brief Bit per link the program leaves out of
+	 * @ref esp_at_cipsend_string */
+	unsigned int quiet_links;
+
+	/** @brief Bit per link held by the HTTP endpoint, also left out
+	 * and with data that are requests */
+	unsigned int http_links;
+	uint32_t udp_seq[ESP_AT_MAX_CONN]; /**< Next sequence number */
+} esp_at_cfg;
+
+
 /** @brief Initialize interface to co-processor and test connection
  *
  * @param uart_pio PIO device to use for UART interface
@@ -128,6 +426,13 @@ typedef struct {
  * @param en_pin GPIO pin to use for enable
  * @param reset_pin GPIO pin to use for reset
  *
+ * For RTS/CTS flow control set flow, pin_cts and pin_rts of
+ * cfg->uart_cfg before, the module is then switched to flow control
+ * too. Its RTS goes to pin_cts and its CTS to pin_rts.
+ *
+ * The module is then asked for its firmware version and the
+ * commands it has, see @ref esp_at_cap.
+ *
  * @return Number of char returned from test cmd
  */
 int esp_at_init_module(esp_at_cfg *cfg, PIO uart_pio, uint uart_sm_tx,
@@ -142,6 +447,12 @@ int esp_at_init_module(esp_at_cfg *cfg, PIO uart_pio, uint uart_sm_tx,
 int esp_at_cipserver_init(esp_at_cfg *cfg);
 
 /** @brief Send string to all connected clients
+ *
+ * The clients are served back to back: the next CIPSEND is issued
+ * as soon as the module accepted the data of the previous one, and
+ * the SEND OK or SEND FAIL of each link is collected as it arrives,
+ * also after this returns. A link still waiting for the result of an
+ * earlier send is skipped as backlogged.
  *
  * @param s C-string to send
  *
@@ -151,13 +462,166 @@ int esp_at_cipserver_init(esp_at_cfg *cfg);
  * of clients. If NULL is passed, a client with index of 0 will be
  * used
  *
- * @return Number of char sent on success
- * @return <0 on failure
+ * @return 0 on success
+ * @return <0 if sending to any client failed
  */
 int esp_at_cipsend_string(esp_at_cfg *cfg, const char *s, size_t len,
 			  esp_at_status *clientlist);
 
+/** @brief Switch the UART of the module and the PIO to another rate
+ *
+ * The module is asked to change with AT+UART_CUR, which lasts until
+ * it resets, and the new rate is checked with AT. When that fails
+ * the module is asked to go back and the old rate is used again.
+ *
+ * @return 0 on success, <0 if the old rate is still in use
+ */
+int esp_at_set_baud(esp_at_cfg *cfg, uint baud);
+
+/** @brief Switch to the fastest rate up to @p max that works
+ *
+ * @return The rate in use afterwards
+ */
+uint esp_at_negotiate_baud(esp_at_cfg *cfg, uint max);
+
+/** @brief Measure the throughput to a client at the current rate
+ *
+ * Sends @p len bytes of filler to @p link, keeping several sends in
+ * flight, and waits until all of them are confirmed.
+ *
+ * @return Effective bytes per second, <0 on failure
+ */
+int32_t esp_at_measure_throughput(esp_at_cfg *cfg, int link,
+				  size_t len);
+
+/** @brief Send a buffer to one link and wait for the result
+ *
+ * Waits for the prompt of the CIPSEND, then streams @p data to the
+ * UART straight from the caller's buffer, and waits for SEND OK or
+ * SEND FAIL. Data longer than @ref ESP_AT_CIPSEND_MAX_LEN is sent
+ * with one CIPSENDL per @ref ESP_AT_CIPSENDL_MAX_LEN if the module
+ * has it, with several CIPSENDs otherwise.
+ *
+ * @param link Link index, 0 if muxing is off
+ *
+ * @return Number of bytes sent on success
+ * @return <0 on failure, the data may have been sent in part
+ */
+int esp_at_cipsend_data(esp_at_cfg *cfg, int link, const void *data,
+			size_t len);
+
+/** @brief Send a buffer to one link with a header in front of it
+ *
+ * Like @ref esp_at_cipsend_data, with @p head going out in the same
+ * CIPSEND as the start of @p data, from its own buffer.
+ *
+ * @param hlen Less than @ref ESP_AT_CIPSEND_MAX_LEN
+ *
+ * @return Number of bytes sent on success, with the header
+ * @return <0 on failure, the data may have been sent in part
+ */
+int esp_at_cipsend_head(esp_at_cfg *cfg, int link, const void *head,
+			size_t hlen, const void *data, size_t len);
+
+/** @brief Connect to one remote end and enter transparent
+ * transmission
+ *
+ * Turns muxing off, connects with AT+CIPSTART, and switches to
+ * AT+CIPMODE=1 and a bare AT+CIPSEND. After the prompt everything
+ * written is passed on as it is, without a CIPSEND per piece of
+ * data. Received data goes to the URC callbacks as
+ * @ref ESP_AT_URC_IPD of link 0.
+ *
+ * The module refuses to turn muxing off while the server of
+ * @ref esp_at_cipserver_init runs, this then fails.
+ *
+ * @param proto @ref ESP_AT_CIP_PROTO_TCP or @ref ESP_AT_CIP_PROTO_UDP
+ *
+ * @return 0 on success, <0 on failure
+ */
+int esp_at_transparent_enter(esp_at_cfg *cfg, esp_at_cip_proto proto,
+			     const char *host, uint16_t port);
+
+/** @brief Write data in transparent transmission
+ *
+ * The data goes out at the rate of the UART. A write of just +++
+ * after a pause can end the transmission, write it along with other
+ * data.
+ *
+ * @return Number of bytes written, <0 if not in transparent
+ * transmission or the UART timed out
+ */
+int esp_at_transparent_write(esp_at_cfg *cfg, const void *data,
+			     size_t len);
+
+/** @brief Leave transparent transmission
+ *
+ * Sends +++ with @ref ESP_AT_TRANSPARENT_GUARD_MS of silence around
+ * it, waits @ref ESP_AT_TRANSPARENT_EXIT_MS, and switches back to
+ * AT+CIPMODE=0. The link stays open.
+ *
+ * @return 0 on success, <0 if the module doesn't answer commands
+ */
+int esp_at_transparent_exit(esp_at_cfg *cfg);
+
+/** @brief Open a UDP link to a collector
+ *
+ * Connects @p link with AT+CIPSTART while muxing is on, next to the
+ * server of @ref esp_at_cipserver_init. @p host may be a single
+ * collector, the broadcast address of the network from
+ * @ref esp_at_broadcast_addr, or a multicast group the module
+ * supports. The link takes no part in @ref esp_at_cipsend_string.
+ *
+ * @return 0 on success, <0 on failure
+ */
+int esp_at_udp_open(esp_at_cfg *cfg, int link, const char *host,
+		    uint16_t port);
+
+/** @brief Close a link opened with @ref esp_at_udp_open
+ *
+ * @return 0 on success, <0 on failure
+ */
+int esp_at_udp_close(esp_at_cfg *cfg, int link);
+
+/** @brief Send one datagram on a UDP link
+ *
+ * The datagram is @ref ESP_AT_UDP_SEQ_LEN bytes of sequence number
+ * followed by @p data, sent once with a single CIPSEND and not
+ * waited for. The sequence number counts up with every call, also
+ * for datagrams that failed, so receivers see each loss as a gap.
+ * The SEND OK of the datagram before it is waited for first, which
+ * the module gives as soon as it passed the datagram on.
+ *
+ * @param len At most @ref ESP_AT_CIPSEND_MAX_LEN less
+ * @ref ESP_AT_UDP_SEQ_LEN
+ *
+ * @return 0 on success, <0 on failure
+ */
+int esp_at_udp_send(esp_at_cfg *cfg, int link, const void *data,
+		    size_t len);
+
+/** @brief Broadcast address of the network the module is on
+ *
+ * Derived from ipv4 and ipv4_prefix of @p status.
+ *
+ * @param buf Filled with the address as a dotted quad
+ *
+ * @return 0 on success, <0 if the address is unknown
+ */
+int esp_at_broadcast_addr(const esp_at_status *status, char *buf,
+			  size_t len);
+
+/** @brief Get the send counters of a link
+ *
+ * @return 0 on success, <0 if @p link is out of range
+ */
+int esp_at_link_get_stats(esp_at_cfg *cfg, int link,
+			  esp_at_link_stats *stats);
+
 /** @brief Get status information from co-processor
+ *
+ * Queries everything again, see @ref esp_at_status_update for the
+ * cached alternative.
  *
  * @param clientlist @ref esp_at_status structure to fill with data
  *
@@ -166,6 +630,60 @@ int esp_at_cipsend_string(esp_at_cfg *cfg, const char *s, size_t len,
  */
 int esp_at_cipstatus(esp_at_cfg *cfg, esp_at_status *clientlist);
 
+/** @brief Register a callback for unsolicited result codes
+ *
+ * URCs are recognised anywhere in the received data, both while
+ * waiting for the response of a command and in @ref esp_at_poll.
+ * Callbacks run in the context of those calls.
+ *
+ * @return 0 on success, <0 if all callbacks are in use
+ */
+int esp_at_urc_register(esp_at_cfg *cfg, esp_at_urc_cb cb, void *ctx);
+
+/** @brief Query the parts of the cached status that are out of date
+ *
+ * Each @ref esp_at_field is queried again once its TTL ran out, or
+ * after an event invalidated it, so most calls send no AT commands.
+ * Clients are added and removed on CONNECT and CLOSED, and the WiFi
+ * flag follows WIFI GOT IP and WIFI DISCONNECT, in between.
+ *
+ * @return 0 on success, <0 if a query failed
+ */
+int esp_at_status_update(esp_at_cfg *cfg);
+
+/** @brief Update the cached status without waiting for the module
+ *
+ * Like @ref esp_at_status_update, but the query of the next part out
+ * of date is only queued, and its answer is taken into the cache by
+ * a later call. Whenever the module isn't in use by the other core
+ * the cached status is copied to @p status.
+ *
+ * @param status Filled with the cached status, may be NULL
+ *
+ * @return 0 on success, <0 if the last query failed
+ */
+int esp_at_status_refresh(esp_at_cfg *cfg, esp_at_status *status);
+
+/** @brief Copy the cached status without talking to the module */
+void esp_at_status_snapshot(esp_at_cfg *cfg, esp_at_status *status);
+
+/** @brief Mark parts of the cached status to be queried again
+ *
+ * @param fields @ref esp_at_field bits
+ */
+void esp_at_status_invalidate(esp_at_cfg *cfg, unsigned int fields);
+
+/** @brief Process data received outside of commands
+ *
+ * Dispatches any URCs received since the last command or poll,
+ * finishes queued commands whose result came in or whose deadline
+ * passed, and sends the next one, all without waiting for the
+ * module. Call this regularly from the core owning the module.
+ *
+ * @return Number of characters processed
+ */
+int esp_at_poll(esp_at_cfg *cfg);
+
 /** @brief Command co-processor to enter deep sleep
  *
  * @param time_ms Number of ms to sleep before waking up
@@ -188,6 +706,12 @@ int esp_at_sleep(esp_at_cfg *cfg);
 int esp_at_wake_up(esp_at_cfg *cfg);
 
 /** @brief Send the provided command and store the response
+ *
+ * The command goes through the queue like any other, after the
+ * commands submitted before it, and this waits for it to finish. It
+ * times out @ref esp_at_cmd_timeout_ms after the call, however much
+ * the module sends meanwhile. The call returns once the commands
+ * before it are done too, each within its own limit.
  *
  * @note Use of the higher level commands in the API is recommended
  * when there is one for the desired effect instead of this one
@@ -198,6 +722,53 @@ int esp_at_wake_up(esp_at_cfg *cfg);
 int esp_at_send_cmd(esp_at_cfg *cfg, const char *cmd, char *rsp,
 		    unsigned int len);
 
+/** @brief Fill out a command descriptor with the defaults
+ *
+ * The command ends with any result code, and times out
+ * @ref esp_at_cmd_timeout_ms from now. Set @p cb of the descriptor
+ * to be called back, or check it with @ref esp_at_cmd_done.
+ */
+void esp_at_cmd_init(esp_at_cmd *cmd, const char *text, char *rsp,
+		     size_t len);
+
+/** @brief Queue a command without waiting for the module
+ *
+ * Safe to call from either core while the other one talks to the
+ * module. The command is sent by @ref esp_at_poll, or by any call
+ * waiting on the module, once the commands before it are done, and
+ * the callback runs in that call.
+ *
+ * @return 0 on success, <0 if the queue is full
+ */
+int esp_at_cmd_submit(esp_at_cfg *cfg, esp_at_cmd *cmd);
+
+/** @brief Check if a submitted command is done */
+bool esp_at_cmd_done(const esp_at_cmd *cmd);
+
+/** @brief Drive the queue until a submitted command is done
+ *
+ * @return @p result of the command
+ */
+int esp_at_cmd_wait(esp_at_cfg *cfg, esp_at_cmd *cmd);
+
+/** @brief Time limit of a command, from its submission to its result
+ *
+ * Commands are looked up by name, the text up to any '=' or '?', in
+ * a table of limits. All others get @ref ESP_AT_CMD_TIMEOUT_MS.
+ *
+ * @return Limit in ms
+ */
+uint32_t esp_at_cmd_timeout_ms(const char *cmd);
+
+/** @brief Get the counters of the commands with the name of @p cmd
+ *
+ * Commands without an entry in the table of limits share one set of
+ * counters. Sends of data count as AT+CIPSEND, or as AT+CIPSENDL
+ * when they took one.
+ */
+void esp_at_cmd_get_stats(esp_at_cfg *cfg, const char *cmd,
+			  esp_at_cmd_stats *stats);
+
 /** @brief Open stdio shell to send cmds directly to co-processor
  *
  * Primarily this is for debugging. Type ESP-AT commands on CLI prompt
@@ -0,0 +1,167 @@
+/*
+* Copyright (c) 2022 Tyler J. Anderson.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions
+* are met:
+*
+* 1. Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+*
+* 2. Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in
+*    the documentation and/or other materials provided with the
+*    distribution.
+*
+* 3. Neither the name of the copyright holder nor the names of its
+*    contributors may be used to endorse or promote products derived
+*    from this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+* "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+* LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+* FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+* COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+* INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+* BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+* CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+* LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+* ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+/**
+ * @file esp-at-replay.h
+ *
+ * @brief Window of recent frames in RAM, for clients to catch up
+ *
+ * Each frame of output added gets the next 32-bit sequence number and
+ * a CRC32 of its bytes, computed by the DMA sniffer with
+ * ESP_AT_DMA_CRC_ENABLED. Frames are kept back to back in a ring
+ * buffer the program provides, and the oldest ones are evicted to
+ * make room. A client that reconnects names the first sequence number
+ * it missed, and gets the frames from there on with
+ * @ref esp_at_replay_send.
+ *
+ * The CRC guards the frames while they are kept and is not sent
+ * along with them.
+ */
+
+#ifndef ESP_AT_REPLAY_H
+#define ESP_AT_REPLAY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "esp-at-modem.h"
+
+#ifdef ESP_AT_MULTICORE_ENABLED
+#include "pico/critical_section.h"
+#endif /* #ifdef ESP_AT_MULTICORE_ENABLED */
+
+/**
+ * @defgroup espatreplay ESP-AT Replay Window
+ * @{
+ */
+
+/** @brief Max number of frames kept, however short */
+#ifndef ESP_AT_REPLAY_FRAMES
+#define ESP_AT_REPLAY_FRAMES 64
+#endif
+
+/** @brief Where a kept frame is in the ring */
+typedef struct {
+	uint32_t crc; /**< CRC32 of the frame */
+	uint16_t off; /**< Start of the frame in the ring */
+	uint16_t len; /**< Length of the frame */
+} esp_at_replay_frame;
+
+/** @brief State of the window
+ *
+ * The frame at index first has sequence number seq, the ones after it
+ * follow on. Numbers wrap around after 0xffffffff.
+ */
+typedef struct {
+	char *store; /**< Ring of frame bytes */
+	size_t size; /**< Size of store, at most 64 KiB */
+	esp_at_replay_frame frames[ESP_AT_REPLAY_FRAMES];
+	unsigned int first; /**< Index of the oldest frame */
+	unsigned int count; /**< Frames kept */
+	uint32_t seq; /**< Sequence number of the oldest frame */
+	uint32_t next; /**< Sequence number of the next frame added */
+	uint32_t evicted; /**< Frames evicted for room */
+	uint32_t dropped; /**< Frames too long to keep */
+	uint32_t corrupt; /**< Frames that failed their CRC on replay */
+
+#ifdef ESP_AT_MULTICORE_ENABLED
+	/* Guards the ring between the core adding frames and the one
+	 * replaying them */
+	critical_section_t cs;
+#endif /* #ifdef ESP_AT_MULTICORE_ENABLED */
+} esp_at_replay;
+
+/** @brief CRC32 (IEEE 802.3, as in zlib) of @p data
+ *
+ * Uses a DMA channel with the sniffer with ESP_AT_DMA_CRC_ENABLED,
+ * and a table otherwise. Call from one core at a time.
+ */
+uint32_t esp_at_crc32(const void *data, size_t len);
+
+/** @brief Start an empty window over @p store
+ *
+ * @param seq Sequence number of the first frame added
+ */
+void esp_at_replay_init(esp_at_replay *rp, char *store, size_t size,
+			uint32_t seq);
+
+/** @brief Add a frame, evicting the oldest ones as needed
+ *
+ * A frame longer than the ring, or with NULL @p data for one the
+ * program couldn't collect, still takes its sequence number, but
+ * empties the window, since the frames kept must follow on.
+ *
+ * @return Sequence number of the frame
+ */
+uint32_t esp_at_replay_add(esp_at_replay *rp, const void *data,
+			   size_t len);
+
+/** @brief Sequence number the next frame added gets */
+uint32_t esp_at_replay_next(esp_at_replay *rp);
+
+/** @brief Copy the frame @p seq out of the window
+ *
+ * @param len Set to the length of the frame
+ *
+ * @return 0 on success
+ * @return -1 if the frame isn't kept
+ * @return -2 if it doesn't fit in @p size
+ * @return -3 if it failed its CRC
+ */
+int esp_at_replay_get(esp_at_replay *rp, uint32_t seq, void *buf,
+		      size_t size, size_t *len);
+
+/** @brief Send the frames from @p seq on to @p link
+ *
+ * Frames are copied into @p buf one at a time and checked against
+ * their CRC before they are sent, so frames keep being added
+ * meanwhile. Frames added after the call starts are left to the live
+ * output. A @p seq ahead of the window, like from before a restart,
+ * sends nothing.
+ *
+ * @param lost Set to the frames from @p seq that are no longer kept
+ * or failed their CRC
+ *
+ * @return Number of frames sent, <0 if a send failed
+ */
+int esp_at_replay_send(esp_at_replay *rp, esp_at_cfg *cfg, int link,
+		       uint32_t seq, void *buf, size_t size,
+		       uint32_t *lost);
+
+/**
+ * @}
+ */
+
+#endif /* #ifndef ESP_AT_REPLAY_H */
@@ -40,6 +40,9 @@
 #ifndef AT_PARSE_H
 #define AT_PARSE_H
 
+#include <stddef.h>
+#include <stdbool.h>
+
 /**
  * @defgroup atparseapi AT Command and Response Parsing Library
  * @{
@@ -194,6 +197,11 @@ int at_rsp_tokenize_line(const char *line,
  * @param lines Structure to store parsed lines
  *
  * @return number of parsed lines
+ *
+ * @note This copies the response, keeps at most
+ * @ref AT_RESPONSE_MAX_LINES lines and cuts tokens to
+ * @ref AT_RESPONSE_STR_LEN. @ref at_rsp_iter_init parses in place
+ * without those limits.
  */
 int at_rsp_get_lines(const char *rsp,
 		     at_rsp_lines *lines);
@@ -212,6 +220,293 @@ int at_rsp_get_lines(const char *rsp,
 at_rsp_line_tokens *at_rsp_get_property(const char *prop,
 					at_rsp_lines *lines);
 
+/** @brief Token viewed in place in a response
+ *
+ * Points into the response instead of holding a copy, so it is only
+ * valid as long as the response, and it is not null-terminated.
+ * String tokens are viewed without their quotes, with any escapes
+ * left in place, see @ref at_rsp_view_copy.
+ */
+typedef struct {
+	const char *ptr; /**< First character of the token */
+	size_t len; /**< Number of characters */
+	at_rsp_tk_type type; /**< Type the token is convertable to */
+} at_rsp_view;
+
+/** @brief Line of a response viewed in place
+ *
+ * @verbatim
+ * <preamble>:<args>
+ * @endverbatim
+ *
+ * The preamble ends at the first ':' outside quotes. Lines without
+ * one have an empty preamble, and all of the line is in args.
+ */
+typedef struct {
+	const char *ptr; /**< First character of the line */
+	size_t len; /**< Characters on the line, without its line end */
+	at_rsp_view preamble; /**< Part before the ':' */
+	const char *args; /**< Part after the ':' */
+	size_t args_len; /**< Characters in args */
+} at_rsp_line_view;
+
+/** @brief Iterator over the lines of a response
+ *
+ * Lines are only found as they are asked for, and nothing of the
+ * response is copied or changed.
+ */
+typedef struct {
+	const char *pos; /**< Where the next line is looked for */
+	const char *end; /**< End of the response */
+} at_rsp_iter;
+
+/** @brief Start iterating over the lines of a response
+ *
+ * @param rsp Raw response, it has to stay unchanged while any view
+ * of it is used
+ *
+ * @param len Characters in @p rsp, it also ends at a '\0'
+ */
+void at_rsp_iter_init(at_rsp_iter *it, const char *rsp, size_t len);
+
+/** @brief View the next line of a response
+ *
+ * Both CR and LF end a line, and empty lines are skipped.
+ *
+ * @return true if @p line was set, false at the end of the response
+ */
+bool at_rsp_iter_next(at_rsp_iter *it, at_rsp_line_view *line);
+
+/** @brief View the next line with a given preamble
+ *
+ * @param prop Preamble to match exactly, such as "+CIPSTATUS"
+ *
+ * @return true if @p line was set, false at the end of the response
+ */
+bool at_rsp_find(at_rsp_iter *it, const char *prop,
+		 at_rsp_line_view *line);
+
+/** @brief View the tokens of a line
+ *
+ * Tokens are separated by ',' or ':' outside quotes, so both
+ * @verbatim +CIPSTATUS:0,"TCP" @endverbatim and
+ * @verbatim +CIPSTA:ip:"192.168.5.105" @endverbatim give two. The
+ * parentheses around lists such as +CWLAP are not part of the
+ * tokens.
+ *
+ * @param tk Array the tokens are viewed in
+ *
+ * @param ntk Size of @p tk, further tokens are counted but not set
+ *
+ * @return Number of tokens on the line
+ */
+size_t at_rsp_view_tokens(const at_rsp_line_view *line, at_rsp_view *tk,
+			  size_t ntk);
+
+/** @brief Check if a token or preamble is exactly @p s */
+bool at_rsp_view_eq(const at_rsp_view *v, const char *s);
+
+/** @brief Return the content of a token as an int */
+int at_rsp_view_as_int(const at_rsp_view *v);
+
+/** @brief Copy a token to a c-string, resolving escapes
+ *
+ * @param len Size of @p buf, the copy is cut to fit
+ *
+ * @return Number of characters written, without the '\0'
+ */
+size_t at_rsp_view_copy(const at_rsp_view *v, char *buf, size_t len);
+
+/** @brief Kinds of values an @ref at_rsp_field is stored as */
+typedef enum {
+	AT_RSP_FIELD_INT, /**< Integer of 1, 2, 4 or 8 bytes */
+	AT_RSP_FIELD_STR, /**< Character array, see @ref at_rsp_view_copy */
+	AT_RSP_FIELD_NAME /**< Integer looked up by the token's name */
+} at_rsp_field_type;
+
+/** @brief Name of an @ref AT_RSP_FIELD_NAME token and its value
+ *
+ * Lists of names end with a NULL name, whose value is stored for
+ * tokens not in the list.
+ */
+typedef struct {
+	const char *name; /**< Token as sent, such as "TCP" */
+	int value; /**< Value stored for it */
+} at_rsp_field_name;
+
+/** @brief Where a token of a response is stored
+ *
+ * A table of fields describes a response once, at compile time, so
+ * @ref at_rsp_extract converts the tokens of each line straight into
+ * the members of a structure. Fill offset and size with
+ * @ref AT_RSP_MEMBER.
+ */
+typedef struct {
+	const char *preamble; /**< Preamble of the lines it is on */
+	const char *key; /**< First token the line must have, or NULL */
+	unsigned int index; /**< Token counting from 0 */
+	at_rsp_field_type type; /**< How the token is stored */
+	size_t offset; /**< Offset of the member in the structure */
+	size_t size; /**< Size of the member */
+	const at_rsp_field_name *names; /**< For @ref AT_RSP_FIELD_NAME */
+} at_rsp_field;
+
+/** @brief Offset and size of a member for an @ref at_rsp_field */
+#define AT_RSP_MEMBER(type, member)				\
+	.offset = offsetof(type, member),			\
+		.size = sizeof(((type*) 0)->member)
+
+/** @brief Store the fields of a line in a structure
+ *
+ * Each field is converted straight from the line into @p dst,
+ * without an array of tokens. Lines without any field of the table
+ * are not tokenized, and tables listing the fields of a line in the
+ * order of their tokens walk it only once.
+ *
+ * @param fields Table of the fields, fields on the same lines next
+ * to each other
+ *
+ * @param dst Structure the offsets of @p fields are in
+ *
+ * @return Number of fields stored, 0 if the line has none of them
+ */
+int at_rsp_extract(const at_rsp_line_view *line, const at_rsp_field *fields,
+		   size_t nfields, void *dst);
+
+/** @brief Longest line kept by the response framer
+ *
+ * Longer lines are still framed, but only their start is kept.
+ */
+#ifndef AT_FRAMER_LINE_LEN
+#define AT_FRAMER_LINE_LEN 256
+#endif /* #ifndef AT_FRAMER_LINE_LEN */
+
+/** @brief Events found by the response framer
+ *
+ * Everything from @ref AT_FRAME_OK on ends a response.
+ */
+typedef enum {
+	AT_FRAME_NONE		= 0, /**< No complete line yet */
+	AT_FRAME_LINE		= 1, /**< A line that is not a result code */
+	AT_FRAME_OK		= 2, /**< OK */
+	AT_FRAME_ERROR		= 3, /**< ERROR */
+	AT_FRAME_SEND_OK	= 4, /**< SEND OK */
+	AT_FRAME_SEND_FAIL	= 5, /**< SEND FAIL */
+	AT_FRAME_PROMPT		= 6  /**< The '>' data prompt */
+} at_frame_event;
+
+/** @brief Incremental AT response framer
+ *
+ * Splits the response into lines as characters arrive, and matches
+ * result codes while the line comes in, so each character costs the
+ * same no matter how long the response already is.
+ *
+ * @note Initialize with @ref at_framer_init, the members are
+ * internal
+ */
+typedef struct {
+	char line[AT_FRAMER_LINE_LEN]; /**< Current line */
+	unsigned int len; /**< Characters on the current line */
+	unsigned int match; /**< Result codes the line may still be */
+	bool done; /**< The line was handed out already */
+} at_framer;
+
+/** @brief Prepare a framer for a new response */
+void at_framer_init(at_framer *f);
+
+/** @brief Feed a received character to the framer
+ *
+ * CR is ignored and LF ends a line. Empty lines are skipped, and a
+ * '>' at the start of a line is reported as a prompt right away,
+ * since the ESP sends no line end after it.
+ *
+ * @return @ref AT_FRAME_NONE until a line is complete, then the
+ * kind of line, which may be read with @ref at_framer_line until the
+ * next character is fed
+ */
+at_frame_event at_framer_feed(at_framer *f, char c);
+
+/** @brief Feed characters until the first complete line
+ *
+ * @param ev Set to the event that stopped the framer, or
+ * @ref AT_FRAME_NONE if all of @p buf was used without one
+ *
+ * @return Number of characters used from @p buf
+ */
+size_t at_framer_feed_buf(at_framer *f, const char *buf, size_t len,
+			  at_frame_event *ev);
+
+/** @brief Get the line of the last event
+ *
+ * Before the line is complete this is the part received so far.
+ *
+ * @param len Set to the length of the line if not NULL
+ *
+ * @return The null-terminated line, cut to
+ * AT_FRAMER_LINE_LEN - 1 characters
+ */
+const char *at_framer_line(const at_framer *f, size_t *len);
+
+/** @brief Check if an event ends a response */
+bool at_frame_is_result(at_frame_event ev);
+
+/** @brief Callbacks of the push parser, any of them may be NULL
+ *
+ * The views passed point into the line being parsed and are only
+ * valid during the call.
+ */
+typedef struct {
+	/** @brief Called for every line, result codes included, with
+	 * the event of the framer that ended it */
+	void (*line)(const at_rsp_line_view *line, at_frame_event ev,
+		     void *ctx);
+
+	/** @brief Called for lines with a preamble, before their
+	 * tokens */
+	void (*preamble)(const at_rsp_view *preamble, void *ctx);
+
+	/** @brief Called for each token of a line with a preamble,
+	 * @p i counting from 0 */
+	void (*token)(const at_rsp_view *tk, unsigned int i, void *ctx);
+} at_push_cb;
+
+/** @brief Resumable parser fed with chunks of a response
+ *
+ * Only the current line is kept, see @ref AT_FRAMER_LINE_LEN, so
+ * there is no need to collect the response first.
+ *
+ * @note Initialize with @ref at_push_init, the members are internal
+ */
+typedef struct {
+	at_framer framer; /**< Splits the chunks into lines */
+	const at_push_cb *cb; /**< Callbacks for the lines */
+	void *ctx; /**< Passed to the callbacks */
+} at_push_parser;
+
+/** @brief Prepare a push parser for a new response */
+void at_push_init(at_push_parser *p, const at_push_cb *cb, void *ctx);
+
+/** @brief Feed the next chunk of a response
+ *
+ * Chunks may be split anywhere, the callbacks run for each line as
+ * soon as it is complete, with the same lines and tokens
+ * @ref at_rsp_iter_next and @ref at_rsp_view_tokens find in the
+ * whole response.
+ *
+ * @return The last result code in the chunk, or
+ * @ref AT_FRAME_NONE
+ */
+at_frame_event at_push_feed(at_push_parser *p, const char *buf,
+			    size_t len);
+
+/** @brief Run the callbacks for a line framed elsewhere
+ *
+ * For users of their own @ref at_framer, such as one that frames
+ * everything received.
+ */
+void at_push_line(const at_push_cb *cb, void *ctx, at_frame_event ev,
+		  const char *line, size_t len);
+
 /**
  * @}
  */
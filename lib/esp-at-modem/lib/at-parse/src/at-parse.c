@@ -41,16 +41,84 @@
 
 #include <stddef.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <limits.h>
 #include <ctype.h>
 
+/* Delimiters are scanned for a word at a time, or with SSE2 or AVX2
+ * on x86 hosts built for them. Define AT_PARSE_NO_SIMD to only use
+ * words, or AT_PARSE_NO_SWAR to scan a byte at a time */
+#if defined(AT_PARSE_NO_SWAR) && !defined(AT_PARSE_NO_SIMD)
+#define AT_PARSE_NO_SIMD
+#endif
+
+#if !defined(AT_PARSE_NO_SIMD) && defined(__AVX2__)
+#include <immintrin.h>
+#define _AT_SCAN_AVX2
+#define _AT_SCAN_SSE2
+#elif !defined(AT_PARSE_NO_SIMD) && defined(__SSE2__)
+#include <emmintrin.h>
+#define _AT_SCAN_SSE2
+#endif
+
 #define ARRAY_LEN(array) sizeof(array)/sizeof(array[0])
 
+/* Word of the word at a time scan, 4 bytes on the RP2040 */
+typedef uintptr_t _at_word;
+
+#define _AT_WORD_ONES ((_at_word) -1 / 0xff)
+#define _AT_WORD_HIGHS (_AT_WORD_ONES * 0x80)
+
+/* Non-zero if any byte of v is zero */
+#define _AT_WORD_HAS_ZERO(v) (((v) - _AT_WORD_ONES) & ~(v) & _AT_WORD_HIGHS)
+
+#define _AT_IS_ANY(x, a, b, c, d)					\
+	((x) == (a) || (x) == (b) || (x) == (c) || (x) == (d))
+
+/* Result codes matched by the framer, all of them are candidates at
+ * the start of a line */
+static const struct {
+	const char *code;
+	at_frame_event ev;
+} _at_results[] = {
+	{"OK", AT_FRAME_OK},
+	{"ERROR", AT_FRAME_ERROR},
+	{"SEND OK", AT_FRAME_SEND_OK},
+	{"SEND FAIL", AT_FRAME_SEND_FAIL}
+};
+
+#define _AT_RESULTS_ALL ((1u << ARRAY_LEN(_at_results)) - 1)
+
+/* Walks the tokens of a line one at a time */
+typedef struct {
+	const at_rsp_line_view *line;
+	const char *p; /* Start of the next token, NULL after the last */
+	const char *end;
+	unsigned int n; /* Tokens read, the last of them in tk */
+	at_rsp_view tk;
+} _at_cursor;
+
+static inline const char *_at_scan(const char *p, const char *end,
+				   char a, char b, char c, char d);
 static int _at_replace_cr(char *result, const char *str,
 			  unsigned int len);
+static at_frame_event _at_framer_end_line(at_framer *f);
+static const char *_at_find_unquoted(const char *p, const char *end,
+				     const char *seps);
+static void _at_view_line(const char *p, size_t len,
+			  at_rsp_line_view *line);
+static void _at_view_token(const char *p, size_t len, at_rsp_view *tk);
+static size_t _at_tokens(const at_rsp_line_view *line, at_rsp_view *tk,
+			 size_t ntk, const at_push_cb *cb, void *ctx);
+static void _at_cursor_init(_at_cursor *c, const at_rsp_line_view *line);
+static bool _at_cursor_next(_at_cursor *c);
+static bool _at_cursor_seek(_at_cursor *c, unsigned int i);
+static void _at_store(const at_rsp_field *f, const at_rsp_view *tk,
+		      unsigned char *dst);
+static void _at_store_int(void *p, size_t size, int val);
 
 const char *at_rsp_token_as_str(const at_rsp_tk *tk)
 {
@@ -130,7 +198,9 @@ int at_rsp_tokenize_line(const char *line,
 
 	for (char *tk = strtok_r(str, ":", &lastp); tk;
 	     tk = strtok_r(NULL, ":", &lastp)) {
-		if (lastp && tk != lastp) {
+		/* The last token is either followed by NULL or the
+		 * end of the string, depending on the libc */
+		if (lastp && *lastp != '\0') {
 			strncpy(tok->preamble, tk,
 				sizeof(tok->preamble) - 1);
 			tok->preamble[ARRAY_LEN(tok->preamble) - 1] = '\0';
@@ -189,31 +259,634 @@ at_rsp_line_tokens *at_rsp_get_property(const char * prop,
 	return NULL;
 }
 
+void at_rsp_iter_init(at_rsp_iter *it, const char *rsp, size_t len)
+{
+	it->pos = rsp;
+	it->end = rsp + len;
+}
+
+bool at_rsp_iter_next(at_rsp_iter *it, at_rsp_line_view *line)
+{
+	const char *p = it->pos;
+	const char *e;
+
+	while (p < it->end && (*p == '\r' || *p == '\n')) {
+		++p;
+	}
+
+	if (p >= it->end || *p == '\0') {
+		it->pos = p;
+		return false;
+	}
+
+	e = _at_scan(p, it->end, '\r', '\n', '\0', '\0');
+
+	it->pos = e;
+	_at_view_line(p, e - p, line);
+
+	return true;
+}
+
+bool at_rsp_find(at_rsp_iter *it, const char *prop,
+		 at_rsp_line_view *line)
+{
+	while (at_rsp_iter_next(it, line)) {
+		if (at_rsp_view_eq(&line->preamble, prop)) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+size_t at_rsp_view_tokens(const at_rsp_line_view *line, at_rsp_view *tk,
+			  size_t ntk)
+{
+	return _at_tokens(line, tk, ntk, NULL, NULL);
+}
+
+bool at_rsp_view_eq(const at_rsp_view *v, const char *s)
+{
+	return strncmp(v->ptr, s, v->len) == 0 && s[v->len] == '\0';
+}
+
+int at_rsp_view_as_int(const at_rsp_view *v)
+{
+	const char *p = v->ptr;
+	const char *end = p + v->len;
+	bool neg = false;
+	int val = 0;
+
+	/* Like strtol, which would need the token null-terminated */
+	while (p < end && isspace((unsigned char) *p)) {
+		++p;
+	}
+
+	if (p < end && (*p == '-' || *p == '+')) {
+		neg = *p == '-';
+		++p;
+	}
+
+	for (; p < end && isdigit((unsigned char) *p); ++p) {
+		val = val * 10 + (*p - '0');
+	}
+
+	return neg ? -val : val;
+}
+
+size_t at_rsp_view_copy(const at_rsp_view *v, char *buf, size_t len)
+{
+	size_t wi = 0;
+
+	if (len == 0) {
+		return 0;
+	}
+
+	for (size_t i = 0; i < v->len && wi < len - 1; ++i) {
+		char c = v->ptr[i];
+
+		if (c == '\\' && v->type == AT_RSP_TK_TYPE_STR &&
+		    i + 1 < v->len) {
+			c = v->ptr[++i];
+		}
+
+		buf[wi] = c;
+		++wi;
+	}
+
+	buf[wi] = '\0';
+
+	return wi;
+}
+
+int at_rsp_extract(const at_rsp_line_view *line, const at_rsp_field *fields,
+		   size_t nfields, void *dst)
+{
+	_at_cursor c;
+	bool on = false;
+	int n = 0;
+
+	_at_cursor_init(&c, line);
+
+	for (size_t j = 0; j < nfields; ++j) {
+		const at_rsp_field *f = &fields[j];
+
+		/* Fields on the same lines as the one before share its
+		 * comparison of the preamble */
+		if (j == 0 || f->preamble != fields[j - 1].preamble) {
+			on = at_rsp_view_eq(&line->preamble, f->preamble);
+		}
+
+		if (!on) {
+			continue;
+		}
+
+		/* Lines keyed by their first token only have the
+		 * fields of their key */
+		if (f->key && (!_at_cursor_seek(&c, 0) ||
+			       !at_rsp_view_eq(&c.tk, f->key))) {
+			continue;
+		}
+
+		/* Tables in the order of the tokens take a single pass
+		 * over the line */
+		if (_at_cursor_seek(&c, f->index)) {
+			_at_store(f, &c.tk, dst);
+			++n;
+		}
+	}
+
+	return n;
+}
+
+void at_framer_init(at_framer *f)
+{
+	f->line[0] = '\0';
+	f->len = 0;
+	f->match = _AT_RESULTS_ALL;
+	f->done = false;
+}
+
+at_frame_event at_framer_feed(at_framer *f, char c)
+{
+	/* Start the next line once the last one was handed out */
+	if (f->done) {
+		at_framer_init(f);
+	}
+
+	switch (c) {
+	case '\r':
+		return AT_FRAME_NONE;
+	case '\n':
+		return _at_framer_end_line(f);
+	case '>':
+		if (f->len == 0) {
+			f->line[0] = c;
+			f->line[1] = '\0';
+			f->len = 1;
+			f->done = true;
+
+			return AT_FRAME_PROMPT;
+		}
+
+		break;
+	default:
+		break;
+	}
+
+	/* Drop the result codes that differ at this position, the
+	 * terminator of a shorter code never matches */
+	for (unsigned int i = 0; f->match && i < ARRAY_LEN(_at_results);
+	     ++i) {
+		if ((f->match & (1u << i)) &&
+		    (_at_results[i].code[f->len] != c || c == '\0')) {
+			f->match &= ~(1u << i);
+		}
+	}
+
+	if (f->len < ARRAY_LEN(f->line) - 1) {
+		f->line[f->len] = c;
+		f->line[f->len + 1] = '\0';
+	}
+
+	++f->len;
+
+	return AT_FRAME_NONE;
+}
+
+size_t at_framer_feed_buf(at_framer *f, const char *buf, size_t len,
+			  at_frame_event *ev)
+{
+	for (size_t i = 0; i < len; ++i) {
+		/* Once the line can't be a prompt or a result code any
+		 * more, the rest of it up to its end is copied as is */
+		if (!f->done && f->len && !f->match) {
+			const char *e = _at_scan(&buf[i], &buf[len], '\r',
+						 '\n', '\r', '\r');
+			size_t n = e - &buf[i];
+			size_t room = ARRAY_LEN(f->line) - 1 - f->len;
+
+			if (f->len < ARRAY_LEN(f->line) - 1) {
+				memcpy(&f->line[f->len], &buf[i],
+				       n < room ? n : room);
+				f->line[f->len + (n < room ? n : room)] = '\0';
+			}
+
+			f->len += n;
+			i += n;
+
+			if (i == len) {
+				break;
+			}
+		}
+
+		if ((*ev = at_framer_feed(f, buf[i])) != AT_FRAME_NONE) {
+			return i + 1;
+		}
+	}
+
+	*ev = AT_FRAME_NONE;
+
+	return len;
+}
+
+const char *at_framer_line(const at_framer *f, size_t *len)
+{
+	if (len) {
+		*len = f->len < ARRAY_LEN(f->line) - 1 ? f->len :
+			ARRAY_LEN(f->line) - 1;
+	}
+
+	return f->line;
+}
+
+bool at_frame_is_result(at_frame_event ev)
+{
+	return ev >= AT_FRAME_OK;
+}
+
+void at_push_init(at_push_parser *p, const at_push_cb *cb, void *ctx)
+{
+	at_framer_init(&p->framer);
+	p->cb = cb;
+	p->ctx = ctx;
+}
+
+at_frame_event at_push_feed(at_push_parser *p, const char *buf,
+			    size_t len)
+{
+	at_frame_event rslt = AT_FRAME_NONE;
+
+	while (len) {
+		at_frame_event ev;
+		size_t used = at_framer_feed_buf(&p->framer, buf, len, &ev);
+		size_t n;
+		const char *line;
+
+		buf += used;
+		len -= used;
+
+		if (ev == AT_FRAME_NONE) {
+			break;
+		}
+
+		line = at_framer_line(&p->framer, &n);
+		at_push_line(p->cb, p->ctx, ev, line, n);
+
+		if (at_frame_is_result(ev)) {
+			rslt = ev;
+		}
+	}
+
+	return rslt;
+}
+
+void at_push_line(const at_push_cb *cb, void *ctx, at_frame_event ev,
+		  const char *line, size_t len)
+{
+	at_rsp_line_view view;
+
+	_at_view_line(line, len, &view);
+
+	if (cb->line) {
+		cb->line(&view, ev, ctx);
+	}
+
+	if (view.preamble.len == 0) {
+		return;
+	}
+
+	if (cb->preamble) {
+		cb->preamble(&view.preamble, ctx);
+	}
+
+	if (cb->token) {
+		_at_tokens(&view, NULL, 0, cb, ctx);
+	}
+}
+
+/*
+**********************************************************************
+*********************** INTERNAL FUNCTIONS ***************************
+**********************************************************************
+*/
+
+static at_frame_event _at_framer_end_line(at_framer *f)
+{
+	unsigned int end = f->len;
+
+	if (end == 0) {
+		return AT_FRAME_NONE;
+	}
+
+	if (end > ARRAY_LEN(f->line) - 1) {
+		end = ARRAY_LEN(f->line) - 1;
+	}
+
+	f->line[end] = '\0';
+	f->done = true;
+
+	for (unsigned int i = 0; i < ARRAY_LEN(_at_results); ++i) {
+		if ((f->match & (1u << i)) &&
+		    _at_results[i].code[f->len] == '\0') {
+			return _at_results[i].ev;
+		}
+	}
+
+	return AT_FRAME_LINE;
+}
+
+static inline const char *_at_scan(const char *p, const char *end,
+				   char a, char b, char c, char d)
+{
+#ifdef _AT_SCAN_AVX2
+	const __m256i ya = _mm256_set1_epi8(a);
+	const __m256i yb = _mm256_set1_epi8(b);
+	const __m256i yc = _mm256_set1_epi8(c);
+	const __m256i yd = _mm256_set1_epi8(d);
+
+	for (; end - p >= 32; p += 32) {
+		const __m256i x = _mm256_loadu_si256((const __m256i*) p);
+		const __m256i m = _mm256_or_si256(
+			_mm256_or_si256(_mm256_cmpeq_epi8(x, ya),
+					_mm256_cmpeq_epi8(x, yb)),
+			_mm256_or_si256(_mm256_cmpeq_epi8(x, yc),
+					_mm256_cmpeq_epi8(x, yd)));
+		const unsigned int bits = _mm256_movemask_epi8(m);
+
+		if (bits) {
+			return p + __builtin_ctz(bits);
+		}
+	}
+#endif /* #ifdef _AT_SCAN_AVX2 */
+
+#ifdef _AT_SCAN_SSE2
+	const __m128i xa = _mm_set1_epi8(a);
+	const __m128i xb = _mm_set1_epi8(b);
+	const __m128i xc = _mm_set1_epi8(c);
+	const __m128i xd = _mm_set1_epi8(d);
+
+	for (; end - p >= 16; p += 16) {
+		const __m128i x = _mm_loadu_si128((const __m128i*) p);
+		const __m128i m = _mm_or_si128(
+			_mm_or_si128(_mm_cmpeq_epi8(x, xa),
+				     _mm_cmpeq_epi8(x, xb)),
+			_mm_or_si128(_mm_cmpeq_epi8(x, xc),
+				     _mm_cmpeq_epi8(x, xd)));
+		const unsigned int bits = _mm_movemask_epi8(m);
+
+		if (bits) {
+			return p + __builtin_ctz(bits);
+		}
+	}
+#endif /* #ifdef _AT_SCAN_SSE2 */
+
+#ifndef AT_PARSE_NO_SWAR
+	const _at_word wa = _AT_WORD_ONES * (unsigned char) a;
+	const _at_word wb = _AT_WORD_ONES * (unsigned char) b;
+	const _at_word wc = _AT_WORD_ONES * (unsigned char) c;
+	const _at_word wd = _AT_WORD_ONES * (unsigned char) d;
+
+	/* The Cortex-M0+ only loads whole words when aligned */
+	for (; p < end && ((uintptr_t) p & (sizeof(_at_word) - 1)); ++p) {
+		if (_AT_IS_ANY(*p, a, b, c, d)) {
+			return p;
+		}
+	}
+
+	/* A byte equal to one looked for is zero in the XOR, the
+	 * rest of the word that has it is scanned byte by byte */
+	for (; end - p >= (ptrdiff_t) sizeof(_at_word);
+	     p += sizeof(_at_word)) {
+		_at_word v;
+
+		memcpy(&v, __builtin_assume_aligned(p, sizeof(_at_word)),
+		       sizeof(v));
+
+		if (_AT_WORD_HAS_ZERO(v ^ wa) | _AT_WORD_HAS_ZERO(v ^ wb) |
+		    _AT_WORD_HAS_ZERO(v ^ wc) | _AT_WORD_HAS_ZERO(v ^ wd)) {
+			break;
+		}
+	}
+#endif /* #ifndef AT_PARSE_NO_SWAR */
+
+	for (; p < end; ++p) {
+		if (_AT_IS_ANY(*p, a, b, c, d)) {
+			return p;
+		}
+	}
+
+	return end;
+}
+
 static int _at_replace_cr(char *result, const char *str,
 			   unsigned int len)
 {
+	/* Only the string itself is scanned, never past its end */
+	const char *p = str;
+	const char *end = str + strnlen(str, len - 1);
 	unsigned int wi = 0;
 
-	for (unsigned int i = 0; i < len - 1; ++i) {
-		char c = str[i];
+	while (p < end) {
+		const char *cr = _at_scan(p, end, '\r', '\r', '\r', '\r');
 
-		switch (c) {
-		case '\0':
-			return wi;
-		case '\r':
-			if (str[i + 1] != '\n') {
-				result[wi] = '\n';
-				++wi;
-			}
+		memcpy(&result[wi], p, cr - p);
+		wi += cr - p;
+		p = cr;
+
+		if (p == end) {
 			break;
-		default:
-			result[wi] = c;
+		}
+
+		/* CR LF becomes LF, and so does a CR of its own */
+		if (p[1] != '\n') {
+			result[wi] = '\n';
 			++wi;
-			break;	
 		}
+
+		++p;
+	}
+
+	if (end < str + len - 1) {
+		result[wi] = '\0';
+		return wi;
 	}
 
 	result[len - 1] = '\0';
 
 	return len - 1;
 }
+
+static const char *_at_find_unquoted(const char *p, const char *end,
+				     const char *seps)
+{
+	const char s0 = seps[0];
+	const char s1 = seps[1] != '\0' ? seps[1] : seps[0];
+
+	for (;;) {
+		p = _at_scan(p, end, s0, s1, '"', '"');
+
+		if (p == end) {
+			return NULL;
+		} else if (*p != '"') {
+			return p;
+		}
+
+		/* Skip the quoted part, and what follows each escape */
+		for (++p;; p += 2) {
+			p = _at_scan(p, end, '"', '\\', '"', '"');
+
+			if (p == end) {
+				return NULL;
+			} else if (*p == '"') {
+				break;
+			} else if (end - p < 2) {
+				return NULL;
+			}
+		}
+
+		++p;
+	}
+}
+
+static void _at_view_line(const char *p, size_t len,
+			  at_rsp_line_view *line)
+{
+	const char *colon = _at_find_unquoted(p, p + len, ":");
+
+	line->ptr = p;
+	line->len = len;
+	line->preamble.ptr = p;
+	line->preamble.len = colon ? (size_t) (colon - p) : 0;
+	line->preamble.type = AT_RSP_TK_TYPE_STR;
+	line->args = colon ? colon + 1 : p;
+	line->args_len = len - (line->args - p);
+}
+
+static void _at_view_token(const char *p, size_t len, at_rsp_view *tk)
+{
+	if (len == 0 || *p != '"') {
+		tk->ptr = p;
+		tk->len = len;
+		tk->type = AT_RSP_TK_TYPE_INT;
+
+		return;
+	}
+
+	/* Without the quotes, a missing closing one is tolerated */
+	tk->ptr = p + 1;
+	tk->len = len >= 2 && p[len - 1] == '"' ? len - 2 : len - 1;
+	tk->type = AT_RSP_TK_TYPE_STR;
+}
+
+static size_t _at_tokens(const at_rsp_line_view *line, at_rsp_view *tk,
+			 size_t ntk, const at_push_cb *cb, void *ctx)
+{
+	_at_cursor c;
+
+	_at_cursor_init(&c, line);
+
+	while (_at_cursor_next(&c)) {
+		if (c.n <= ntk) {
+			tk[c.n - 1] = c.tk;
+		}
+
+		if (cb) {
+			cb->token(&c.tk, c.n - 1, ctx);
+		}
+	}
+
+	return c.n;
+}
+
+static void _at_cursor_init(_at_cursor *c, const at_rsp_line_view *line)
+{
+	const char *p = line->args;
+	const char *end = p + line->args_len;
+
+	if (end - p >= 2 && *p == '(' && end[-1] == ')') {
+		++p;
+		--end;
+	}
+
+	c->line = line;
+	c->p = p == end ? NULL : p;
+	c->end = end;
+	c->n = 0;
+}
+
+static bool _at_cursor_next(_at_cursor *c)
+{
+	const char *sep;
+
+	if (!c->p) {
+		return false;
+	}
+
+	sep = _at_find_unquoted(c->p, c->end, ",:");
+	_at_view_token(c->p, (sep ? sep : c->end) - c->p, &c->tk);
+	c->p = sep ? sep + 1 : NULL;
+	++c->n;
+
+	return true;
+}
+
+static bool _at_cursor_seek(_at_cursor *c, unsigned int i)
+{
+	/* Tokens behind are found again from the start */
+	if (c->n > i + 1) {
+		_at_cursor_init(c, c->line);
+	}
+
+	while (c->n < i + 1) {
+		if (!_at_cursor_next(c)) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static void _at_store(const at_rsp_field *f, const at_rsp_view *tk,
+		      unsigned char *dst)
+{
+	const at_rsp_field_name *nm;
+	void *p = dst + f->offset;
+
+	switch (f->type) {
+	case AT_RSP_FIELD_INT:
+		_at_store_int(p, f->size, at_rsp_view_as_int(tk));
+		break;
+	case AT_RSP_FIELD_STR:
+		at_rsp_view_copy(tk, p, f->size);
+		break;
+	case AT_RSP_FIELD_NAME:
+		for (nm = f->names; nm->name; ++nm) {
+			if (at_rsp_view_eq(tk, nm->name)) {
+				break;
+			}
+		}
+
+		_at_store_int(p, f->size, nm->value);
+		break;
+	}
+}
+
+static void _at_store_int(void *p, size_t size, int val)
+{
+	/* Members of any width, signed or not, take the low bits */
+	switch (size) {
+	case sizeof(int8_t):
+		*(int8_t*) p = val;
+		break;
+	case sizeof(int16_t):
+		*(int16_t*) p = val;
+		break;
+	case sizeof(int32_t):
+		*(int32_t*) p = val;
+		break;
+	case sizeof(int64_t):
+		*(int64_t*) p = val;
+		break;
+	}
+}
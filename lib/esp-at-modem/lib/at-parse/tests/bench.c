@@ -0,0 +1,646 @@
+/**
+ * @file bench.c
+ * @brief Host benchmark of AT response end detection
+ *
+ * Feeds recorded ESP-AT transcripts one character at a time, the
+ * way they arrive from the UART, through the incremental framer and
+ * through the previous approach of searching the whole response for
+ * its end after every character.
+ *
+ * Then parses the AT+CIPSTATUS transcript into a status structure
+ * with the copying parser, with views converted field by field, and
+ * with a table of fields, in cycles per parse where the host has a
+ * cycle counter.
+ *
+ * Last, the throughput of each parser on all of the transcripts, in
+ * MB/s, for the delimiter scan the library was built with.
+ */
+
+#include "at-parse.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define BENCH_ROUNDS 200
+#define BENCH_PARSE_ROUNDS 20000
+#define BENCH_PARSE_BATCHES 5
+#define BENCH_CLIENTS 8
+#define BENCH_CORPUS_LEN (64 * 1024)
+#define BENCH_CORPUS_ROUNDS 50
+#define BENCH_CHUNK 64
+
+#if defined(AT_PARSE_NO_SWAR)
+#define BENCH_SCAN "bytes"
+#elif defined(AT_PARSE_NO_SIMD)
+#define BENCH_SCAN "swar"
+#elif defined(__AVX2__)
+#define BENCH_SCAN "avx2"
+#elif defined(__SSE2__)
+#define BENCH_SCAN "sse2"
+#else
+#define BENCH_SCAN "swar"
+#endif
+
+typedef struct {
+	const char *name;
+	const char *msg;
+} bench_transcript;
+
+static const bench_transcript transcripts[] = {
+	{
+		.name = "AT+CIPMUX?",
+		.msg =
+		"AT+CIPMUX?\r\n"
+		"+CIPMUX:1\r\n"
+		"\r\n"
+		"OK\r\n"
+	},
+	{
+		.name = "AT+CIPSTA?",
+		.msg =
+		"AT+CIPSTA?\r\n"
+		"+CIPSTA:ip:\"192.168.5.105\"\r\n"
+		"+CIPSTA:gateway:\"192.168.5.1\"\r\n"
+		"+CIPSTA:netmask:\"255.255.255.0\"\r\n"
+		"\r\n"
+		"OK\r\n"
+	},
+	{
+		.name = "AT+CIPSTATUS",
+		.msg =
+		"AT+CIPSTATUS\r\n"
+		"STATUS:3\r\n"
+		"+CIPSTATUS:0,\"TCP\",\"192.168.5.114\",48706,333,1\r\n"
+		"+CIPSTATUS:1,\"UDP\",\"192.168.5.211\",48740,333,1\r\n"
+		"+CIPSTATUS:2,\"TCP\",\"192.168.5.118\",48712,333,1\r\n"
+		"+CIPSTATUS:3,\"TCP\",\"192.168.5.120\",48733,333,1\r\n"
+		"+CIPSTATUS:4,\"TCP\",\"192.168.5.131\",48790,333,1\r\n"
+		"\r\n"
+		"OK\r\n"
+	},
+	{
+		.name = "AT+CIPSEND",
+		.msg =
+		"AT+CIPSEND=0,312\r\n"
+		"\r\n"
+		"OK\r\n"
+	},
+	{
+		.name = "AT+CWLAP",
+		.msg =
+		"AT+CWLAP\r\n"
+		"+CWLAP:(3,\"HomeNet\",-41,\"a4:2b:b0:d1:11:20\",1,-12,0,4,4,7,0)\r\n"
+		"+CWLAP:(4,\"HomeNet-5G\",-48,\"a4:2b:b0:d1:11:21\",1,-12,0,4,4,7,0)\r\n"
+		"+CWLAP:(3,\"Neighbour\",-67,\"c8:3a:35:0a:2e:90\",6,-8,0,4,4,7,0)\r\n"
+		"+CWLAP:(0,\"CoffeeShop\",-72,\"f0:9f:c2:7a:55:01\",6,-5,0,0,0,7,0)\r\n"
+		"+CWLAP:(3,\"DIRECT-7F-Printer\",-75,\"fa:8f:ca:31:7f:02\",6,4,0,4,4,7,0)\r\n"
+		"+CWLAP:(4,\"Office-Guest\",-78,\"00:1e:58:aa:bb:cc\",11,-2,0,4,4,7,0)\r\n"
+		"+CWLAP:(3,\"Office\",-79,\"00:1e:58:aa:bb:cd\",11,-2,0,4,4,7,0)\r\n"
+		"+CWLAP:(3,\"Upstairs\",-81,\"b0:be:76:12:34:56\",1,-12,0,4,4,7,0)\r\n"
+		"+CWLAP:(3,\"Garage-Ext\",-83,\"b0:be:76:12:34:57\",1,-12,0,4,4,7,0)\r\n"
+		"+CWLAP:(2,\"OldRouter\",-85,\"00:14:bf:01:02:03\",3,-10,0,2,2,7,0)\r\n"
+		"+CWLAP:(3,\"Apt-204\",-86,\"d8:07:b6:90:aa:01\",9,3,0,4,4,7,0)\r\n"
+		"+CWLAP:(3,\"Apt-305\",-86,\"d8:07:b6:90:aa:02\",9,3,0,4,4,7,0)\r\n"
+		"+CWLAP:(3,\"Apt-406\",-87,\"d8:07:b6:90:aa:03\",9,3,0,4,4,7,0)\r\n"
+		"+CWLAP:(4,\"SmartTV-Setup\",-88,\"3c:bd:3e:44:55:66\",11,-2,0,4,4,7,0)\r\n"
+		"+CWLAP:(3,\"Camper\",-89,\"e4:5f:01:aa:10:20\",6,-5,0,4,4,7,0)\r\n"
+		"+CWLAP:(3,\"Shed\",-90,\"e4:5f:01:aa:10:21\",6,-5,0,4,4,7,0)\r\n"
+		"+CWLAP:(0,\"Library-Free\",-90,\"8c:3b:ad:00:11:22\",1,-12,0,0,0,7,0)\r\n"
+		"+CWLAP:(3,\"Bakery\",-91,\"8c:3b:ad:00:11:23\",1,-12,0,4,4,7,0)\r\n"
+		"+CWLAP:(3,\"Workshop\",-92,\"8c:3b:ad:00:11:24\",1,-12,0,4,4,7,0)\r\n"
+		"+CWLAP:(3,\"Barn\",-93,\"8c:3b:ad:00:11:25\",1,-12,0,4,4,7,0)\r\n"
+		"+CWLAP:(3,\"Hangar\",-93,\"8c:3b:ad:00:11:26\",1,-12,0,4,4,7,0)\r\n"
+		"+CWLAP:(3,\"Far-Away\",-94,\"8c:3b:ad:00:11:27\",1,-12,0,4,4,7,0)\r\n"
+		"+CWLAP:(3,\"Farther\",-95,\"8c:3b:ad:00:11:28\",1,-12,0,4,4,7,0)\r\n"
+		"+CWLAP:(3,\"Faintest\",-96,\"8c:3b:ad:00:11:29\",1,-12,0,4,4,7,0)\r\n"
+		"+CWLAP:(3,\"Edge\",-97,\"8c:3b:ad:00:11:2a\",1,-12,0,4,4,7,0)\r\n"
+		"+CWLAP:(3,\"Horizon\",-98,\"8c:3b:ad:00:11:2b\",1,-12,0,4,4,7,0)\r\n"
+		"+CWLAP:(3,\"Static\",-99,\"8c:3b:ad:00:11:2c\",1,-12,0,4,4,7,0)\r\n"
+		"+CWLAP:(3,\"Noise\",-99,\"8c:3b:ad:00:11:2d\",1,-12,0,4,4,7,0)\r\n"
+		"+CWLAP:(3,\"Ghost\",-100,\"8c:3b:ad:00:11:2e\",1,-12,0,4,4,7,0)\r\n"
+		"\r\n"
+		"OK\r\n"
+	},
+	{
+		.name = "AT+HTTPCLIENT",
+		.msg =
+		"AT+HTTPCLIENT=2,0,\"http://10.0.0.2/latest\",,,1\r\n"
+		"+HTTPCLIENT:655,"
+		"{\"device\":\"aq-sensor-04\",\"fw\":\"1.4.2\",\"uptime\""
+		":86231,\"readings\":[{\"t\":1700000000,\"pm25\":5.0,\"pm"
+		"10\":9.0,\"rh\":40},{\"t\":1700000060,\"pm25\":6.1,\"pm1"
+		"0\":10.3,\"rh\":41},{\"t\":1700000120,\"pm25\":7.2,\"pm1"
+		"0\":11.6,\"rh\":42},{\"t\":1700000180,\"pm25\":8.3,\"pm1"
+		"0\":12.9,\"rh\":43},{\"t\":1700000240,\"pm25\":9.4,\"pm1"
+		"0\":13.2,\"rh\":44},{\"t\":1700000300,\"pm25\":10.5,\"pm"
+		"10\":9.5,\"rh\":45},{\"t\":1700000360,\"pm25\":11.6,\"pm"
+		"10\":10.8,\"rh\":46},{\"t\":1700000420,\"pm25\":5.7,\"pm"
+		"10\":11.1,\"rh\":47},{\"t\":1700000480,\"pm25\":6.8,\"pm"
+		"10\":12.4,\"rh\":48},{\"t\":1700000540,\"pm25\":7.9,\"pm"
+		"10\":13.7,\"rh\":49},{\"t\":1700000600,\"pm25\":8.0,\"pm"
+		"10\":9.0,\"rh\":50},{\"t\":1700000660,\"pm25\":9.1,\"pm1"
+		"0\":10.3,\"rh\":51}],\"status\":\"ok\"}"
+		"\r\n"
+		"\r\n"
+		"OK\r\n"
+	},
+	{
+		.name = "data",
+		.msg =
+		"Recv 312 bytes\r\n"
+		"\r\n"
+		"SEND OK\r\n"
+	}
+};
+
+/* End detection as done before the framer, searching the whole
+ * response after every character */
+static int _bench_legacy_end(const char *rsp)
+{
+	const char *okptrn = "OK\r\n";
+	const char *errptrn = "ERROR\r\n";
+	const int len = strlen(rsp);
+	const int okpos = len - (int) strlen(okptrn);
+	const int errpos = len - (int) strlen(errptrn);
+
+	if (len < 2 || strncmp(&rsp[len - 2], "\r\n", 2)) {
+		return 0;
+	}
+
+	if (okpos >= 0 && !strcmp(&rsp[okpos], okptrn)) {
+		return 1;
+	}
+
+	if (errpos >= 0 && !strcmp(&rsp[errpos], errptrn)) {
+		return -1;
+	}
+
+	return 0;
+}
+
+static size_t _bench_legacy(const char *msg, char *rsp, size_t len)
+{
+	memset(rsp, '\0', len);
+
+	for (size_t i = 0; i < len - 1 && msg[i] != '\0'; ++i) {
+		rsp[i] = msg[i];
+
+		if (_bench_legacy_end(rsp)) {
+			return i + 1;
+		}
+	}
+
+	return 0;
+}
+
+static size_t _bench_framer(const char *msg, char *rsp, size_t len)
+{
+	at_framer f;
+
+	at_framer_init(&f);
+
+	for (size_t i = 0; i < len - 1 && msg[i] != '\0'; ++i) {
+		rsp[i] = msg[i];
+
+		if (at_frame_is_result(at_framer_feed(&f, msg[i]))) {
+			rsp[i + 1] = '\0';
+			return i + 1;
+		}
+	}
+
+	return 0;
+}
+
+static double _bench_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static double _bench_run(size_t (*fn)(const char*, char*, size_t),
+			 const char *msg, size_t *used)
+{
+	static char rsp[4096];
+	double start = _bench_now_ns();
+
+	for (unsigned int r = 0; r < BENCH_ROUNDS; ++r) {
+		*used = fn(msg, rsp, sizeof(rsp));
+	}
+
+	return (_bench_now_ns() - start) / BENCH_ROUNDS;
+}
+
+/* Status as the modem library keeps it */
+typedef struct {
+	int index;
+	char ipv4[16];
+	int proto;
+	uint16_t r_port;
+	uint16_t l_port;
+	uint8_t passive;
+} bench_client;
+
+typedef struct {
+	int status;
+	bench_client cli[BENCH_CLIENTS];
+	unsigned int ncli;
+} bench_status;
+
+static const at_rsp_field_name bench_protos[] = {
+	{"TCP", 1},
+	{"UDP", 4},
+	{"SSL", 16},
+	{NULL, 0}
+};
+
+static const at_rsp_field bench_status_fields[] = {
+	{.preamble = "STATUS", .index = 0, .type = AT_RSP_FIELD_INT,
+	 AT_RSP_MEMBER(bench_status, status)}
+};
+
+static const at_rsp_field bench_client_fields[] = {
+	{.preamble = "+CIPSTATUS", .index = 0, .type = AT_RSP_FIELD_INT,
+	 AT_RSP_MEMBER(bench_client, index)},
+	{.preamble = "+CIPSTATUS", .index = 1, .type = AT_RSP_FIELD_NAME,
+	 AT_RSP_MEMBER(bench_client, proto), .names = bench_protos},
+	{.preamble = "+CIPSTATUS", .index = 2, .type = AT_RSP_FIELD_STR,
+	 AT_RSP_MEMBER(bench_client, ipv4)},
+	{.preamble = "+CIPSTATUS", .index = 3, .type = AT_RSP_FIELD_INT,
+	 AT_RSP_MEMBER(bench_client, r_port)},
+	{.preamble = "+CIPSTATUS", .index = 4, .type = AT_RSP_FIELD_INT,
+	 AT_RSP_MEMBER(bench_client, l_port)},
+	{.preamble = "+CIPSTATUS", .index = 5, .type = AT_RSP_FIELD_INT,
+	 AT_RSP_MEMBER(bench_client, passive)}
+};
+
+#define BENCH_NCLIENT_FIELDS \
+	(sizeof(bench_client_fields) / sizeof(bench_client_fields[0]))
+
+static int _bench_proto(const char *name)
+{
+	for (const at_rsp_field_name *nm = bench_protos; nm->name; ++nm) {
+		if (!strcmp(name, nm->name)) {
+			return nm->value;
+		}
+	}
+
+	return 0;
+}
+
+/* Copy and tokenize all of the response, then look the lines up */
+static void _bench_parse_copy(const char *msg, size_t len,
+			      bench_status *st)
+{
+	static at_rsp_lines lines;
+	at_rsp_line_tokens *tl;
+
+	at_rsp_get_lines(msg, &lines);
+	tl = at_rsp_get_property("STATUS", &lines);
+	st->status = tl ? at_rsp_token_as_int(&tl->tokenlist[0]) : -1;
+	st->ncli = 0;
+
+	for (unsigned int i = 0; i < lines.nlines &&
+		     st->ncli < BENCH_CLIENTS; ++i) {
+		bench_client *c = &st->cli[st->ncli];
+
+		tl = &lines.tokenlists[i];
+
+		if (strcmp(tl->preamble, "+CIPSTATUS") || tl->ntokens < 6) {
+			continue;
+		}
+
+		c->index = at_rsp_token_as_int(&tl->tokenlist[0]);
+		c->proto = _bench_proto(at_rsp_token_as_str(&tl->tokenlist[1]));
+		strncpy(c->ipv4, at_rsp_token_as_str(&tl->tokenlist[2]),
+			sizeof(c->ipv4) - 1);
+		c->ipv4[sizeof(c->ipv4) - 1] = '\0';
+		c->r_port = at_rsp_token_as_int(&tl->tokenlist[3]);
+		c->l_port = at_rsp_token_as_int(&tl->tokenlist[4]);
+		c->passive = at_rsp_token_as_int(&tl->tokenlist[5]);
+		++st->ncli;
+	}
+}
+
+/* View the tokens in place, then convert them one by one */
+static void _bench_parse_view(const char *msg, size_t len,
+			      bench_status *st)
+{
+	at_rsp_iter it;
+	at_rsp_line_view line;
+	at_rsp_view tk[6];
+
+	at_rsp_iter_init(&it, msg, len);
+	st->status = -1;
+	st->ncli = 0;
+
+	if (at_rsp_find(&it, "STATUS", &line) &&
+	    at_rsp_view_tokens(&line, tk, 1) >= 1) {
+		st->status = at_rsp_view_as_int(&tk[0]);
+	}
+
+	while (st->ncli < BENCH_CLIENTS &&
+	       at_rsp_find(&it, "+CIPSTATUS", &line)) {
+		bench_client *c = &st->cli[st->ncli];
+		const at_rsp_field_name *nm;
+
+		if (at_rsp_view_tokens(&line, tk, 6) < 6) {
+			continue;
+		}
+
+		c->index = at_rsp_view_as_int(&tk[0]);
+
+		for (nm = bench_protos; nm->name; ++nm) {
+			if (at_rsp_view_eq(&tk[1], nm->name)) {
+				break;
+			}
+		}
+
+		c->proto = nm->value;
+		at_rsp_view_copy(&tk[2], c->ipv4, sizeof(c->ipv4));
+		c->r_port = at_rsp_view_as_int(&tk[3]);
+		c->l_port = at_rsp_view_as_int(&tk[4]);
+		c->passive = at_rsp_view_as_int(&tk[5]);
+		++st->ncli;
+	}
+}
+
+/* Store the fields of each line as its tokens go by */
+static void _bench_parse_fields(const char *msg, size_t len,
+				bench_status *st)
+{
+	at_rsp_iter it;
+	at_rsp_line_view line;
+
+	at_rsp_iter_init(&it, msg, len);
+	st->status = -1;
+	st->ncli = 0;
+
+	while (at_rsp_iter_next(&it, &line)) {
+		if (at_rsp_extract(&line, bench_status_fields, 1, st) ||
+		    st->ncli >= BENCH_CLIENTS) {
+			continue;
+		}
+
+		if (at_rsp_extract(&line, bench_client_fields,
+				   BENCH_NCLIENT_FIELDS,
+				   &st->cli[st->ncli]) ==
+		    BENCH_NCLIENT_FIELDS) {
+			++st->ncli;
+		}
+	}
+}
+
+static uint64_t _bench_cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __builtin_ia32_rdtsc();
+#else
+	return 0;
+#endif
+}
+
+static double _bench_parse(void (*fn)(const char*, size_t, bench_status*),
+			   const char *msg, bench_status *st,
+			   double *cycles)
+{
+	const size_t len = strlen(msg);
+	double best = 0;
+
+	/* The quickest of a few batches, the others were interrupted */
+	for (unsigned int b = 0; b < BENCH_PARSE_BATCHES; ++b) {
+		double start = _bench_now_ns();
+		uint64_t c0 = _bench_cycles();
+		double ns;
+
+		for (unsigned int r = 0; r < BENCH_PARSE_ROUNDS; ++r) {
+			fn(msg, len, st);
+		}
+
+		ns = (_bench_now_ns() - start) / BENCH_PARSE_ROUNDS;
+
+		if (b == 0 || ns < best) {
+			best = ns;
+			*cycles = (double) (_bench_cycles() - c0) /
+				BENCH_PARSE_ROUNDS;
+		}
+	}
+
+	return best;
+}
+
+static int _bench_cipstatus(const char *msg)
+{
+	static const struct {
+		const char *name;
+		void (*fn)(const char*, size_t, bench_status*);
+	} parsers[] = {
+		{"copy", _bench_parse_copy},
+		{"view", _bench_parse_view},
+		{"fields", _bench_parse_fields}
+	};
+	bench_status ref, st;
+	int rslt = EXIT_SUCCESS;
+
+	printf("\n%-14s %12s %12s\n", "CIPSTATUS", "ns/parse",
+	       "cycles/parse");
+
+	for (size_t i = 0; i < sizeof(parsers) / sizeof(parsers[0]); ++i) {
+		double cycles = 0, ns;
+
+		memset(&st, 0, sizeof(st));
+		ns = _bench_parse(parsers[i].fn, msg, &st, &cycles);
+
+		if (cycles > 0) {
+			printf("%-14s %12.0f %12.0f\n", parsers[i].name, ns,
+			       cycles);
+		} else {
+			printf("%-14s %12.0f %12s\n", parsers[i].name, ns,
+			       "-");
+		}
+
+		/* All of them have to find the same status */
+		if (i == 0) {
+			ref = st;
+		} else if (memcmp(&ref, &st, sizeof(st))) {
+			printf("%s: status differs from %s\n",
+			       parsers[i].name, parsers[0].name);
+			rslt = EXIT_FAILURE;
+		}
+	}
+
+	if (ref.status != 3 || ref.ncli != 5) {
+		printf("CIPSTATUS: status %d with %u clients\n", ref.status,
+		       ref.ncli);
+		rslt = EXIT_FAILURE;
+	}
+
+	return rslt;
+}
+
+static char bench_corpus[BENCH_CORPUS_LEN];
+
+/* The transcripts one after the other, as in a log of the UART */
+static size_t _bench_corpus(void)
+{
+	const size_t n = sizeof(transcripts) / sizeof(transcripts[0]);
+	size_t len = 0;
+
+	for (size_t i = 0;; i = (i + 1) % n) {
+		const size_t tl = strlen(transcripts[i].msg);
+
+		if (len + tl > sizeof(bench_corpus)) {
+			return len;
+		}
+
+		memcpy(&bench_corpus[len], transcripts[i].msg, tl);
+		len += tl;
+	}
+}
+
+static size_t _bench_scan_views(const char *msg, size_t len)
+{
+	at_rsp_iter it;
+	at_rsp_line_view line;
+	at_rsp_view tk[16];
+	size_t n = 0;
+
+	at_rsp_iter_init(&it, msg, len);
+
+	while (at_rsp_iter_next(&it, &line)) {
+		n += at_rsp_view_tokens(&line, tk, 16);
+	}
+
+	return n;
+}
+
+static void _bench_count_token(const at_rsp_view *tk, unsigned int i,
+			       void *ctx)
+{
+	++*(size_t*) ctx;
+}
+
+static size_t _bench_scan_push(const char *msg, size_t len)
+{
+	static const at_push_cb cb = {.token = _bench_count_token};
+	at_push_parser p;
+	size_t n = 0;
+
+	at_push_init(&p, &cb, &n);
+
+	/* In chunks, as from a DMA buffer */
+	for (size_t i = 0; i < len; i += BENCH_CHUNK) {
+		at_push_feed(&p, &msg[i],
+			     len - i < BENCH_CHUNK ? len - i : BENCH_CHUNK);
+	}
+
+	return n;
+}
+
+static size_t _bench_scan_copy(const char *msg, size_t len)
+{
+	static at_rsp_lines lines;
+	size_t n = 0;
+
+	/* A response at a time, the copying parser is limited */
+	for (size_t i = 0; i < sizeof(transcripts) / sizeof(transcripts[0]);
+	     ++i) {
+		at_rsp_get_lines(transcripts[i].msg, &lines);
+
+		for (unsigned int j = 0; j < lines.nlines; ++j) {
+			n += lines.tokenlists[j].ntokens;
+		}
+	}
+
+	return n;
+}
+
+static void _bench_throughput(void)
+{
+	static const struct {
+		const char *name;
+		size_t (*fn)(const char*, size_t);
+		bool corpus;
+	} parsers[] = {
+		{"copy", _bench_scan_copy, false},
+		{"view", _bench_scan_views, true},
+		{"push", _bench_scan_push, true}
+	};
+	const size_t len = _bench_corpus();
+	size_t all = 0;
+
+	for (size_t i = 0; i < sizeof(transcripts) / sizeof(transcripts[0]);
+	     ++i) {
+		all += strlen(transcripts[i].msg);
+	}
+
+	printf("\n%-14s %12s %12s\n", "scan " BENCH_SCAN, "MB/s",
+	       "tokens");
+
+	for (size_t i = 0; i < sizeof(parsers) / sizeof(parsers[0]); ++i) {
+		const size_t bytes = parsers[i].corpus ? len : all;
+		double best = 0;
+		size_t n = 0;
+
+		/* The quickest of a few batches, as for the parses */
+		for (unsigned int b = 0; b < BENCH_PARSE_BATCHES; ++b) {
+			double start = _bench_now_ns();
+			double ns;
+
+			for (unsigned int r = 0; r < BENCH_CORPUS_ROUNDS;
+			     ++r) {
+				n = parsers[i].fn(bench_corpus, len);
+			}
+
+			ns = _bench_now_ns() - start;
+
+			if (b == 0 || ns < best) {
+				best = ns;
+			}
+		}
+
+		printf("%-14s %12.1f %12zu\n", parsers[i].name,
+		       bytes * BENCH_CORPUS_ROUNDS * 1e3 / best, n);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	int rslt = EXIT_SUCCESS;
+
+	printf("%-14s %6s %12s %12s %8s\n", "transcript", "bytes",
+	       "legacy ns", "framer ns", "speedup");
+
+	for (size_t i = 0; i < sizeof(transcripts) / sizeof(transcripts[0]);
+	     ++i) {
+		const bench_transcript *t = &transcripts[i];
+		size_t used_l, used_f;
+		double ns_l = _bench_run(_bench_legacy, t->msg, &used_l);
+		double ns_f = _bench_run(_bench_framer, t->msg, &used_f);
+
+		printf("%-14s %6zu %12.0f %12.0f %7.1fx\n", t->name,
+		       strlen(t->msg), ns_l, ns_f, ns_l / ns_f);
+
+		/* Both have to find the end of the response at the same
+		 * place */
+		if (used_l != strlen(t->msg) || used_f != used_l) {
+			printf("%s: end found at %zu and %zu of %zu\n",
+			       t->name, used_l, used_f, strlen(t->msg));
+			rslt = EXIT_FAILURE;
+		}
+	}
+
+	if (_bench_cipstatus(transcripts[2].msg) != EXIT_SUCCESS) {
+		rslt = EXIT_FAILURE;
+	}
+
+	_bench_throughput();
+
+	return rslt;
+}
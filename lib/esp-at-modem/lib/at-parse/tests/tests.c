@@ -4,6 +4,16 @@
 
 #include "string.h"
 
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#define TEST_VIEW_TOKENS 16
+#define TEST_STACK_LEN (64 * 1024)
+#define TEST_PAINT 0xa5
+#define TEST_BENCH_ROUNDS 1000
+
 typedef struct {
 	const char *name;
 	const char *msg;
@@ -60,7 +70,8 @@ static test_rsp_param rsp_params[] = {
 							.content = "1",
 							.type = AT_RSP_TK_TYPE_INT
 						}
-					}
+					},
+					.ntokens = 6
 				},
 				{
 					.preamble = "+CIPSTATUS",
@@ -89,7 +100,8 @@ static test_rsp_param rsp_params[] = {
 							.content = "1",
 							.type = AT_RSP_TK_TYPE_INT
 						}
-					}
+					},
+					.ntokens = 6
 				}
 			},
 			.nlines = 3
@@ -114,7 +126,8 @@ static test_rsp_param rsp_params[] = {
 							.content = "192.168.5.105",
 							.type = AT_RSP_TK_TYPE_STR
 						}
-					}
+					},
+					.ntokens = 1
 				},
 				{
 					.preamble = "gateway",
@@ -123,7 +136,8 @@ static test_rsp_param rsp_params[] = {
 							.content = "192.168.5.1",
 							.type = AT_RSP_TK_TYPE_STR
 						}
-					}
+					},
+					.ntokens = 1
 				},
 				{
 					.preamble = "netmask",
@@ -132,7 +146,8 @@ static test_rsp_param rsp_params[] = {
 							.content = "255.255.255.0",
 							.type = AT_RSP_TK_TYPE_STR
 						}
-					}
+					},
+					.ntokens = 1
 				}
 			},
 			.nlines = 3
@@ -161,6 +176,9 @@ static test_rsp_param rsp_params[] = {
 			},
 			.nlines = 1
 		}
+	},
+	{
+		.name = NULL
 	}
 };
 
@@ -186,7 +204,7 @@ test_rsp_param *get_at_test_param(void *fixture, const char *cmd)
 {
 	test_rsp_param *par = (test_rsp_param*) fixture;
 
-	for (unsigned int i = 0; &par[i]; ++i) {
+	for (unsigned int i = 0; par[i].name; ++i) {
 		if (strcmp(par[i].name, cmd) == 0) {
 			return &par[i];
 		}
@@ -204,6 +222,7 @@ static MunitResult test_checkparse(const MunitParameter params[],
 	at_rsp_lines parsed;
 
 	munit_assert_not_null(par);
+	memset(&parsed, 0, sizeof(parsed));
 
 	ret = at_rsp_get_lines(par->msg, &parsed);
 	munit_assert_int(ret, >=, 0);
@@ -212,12 +231,700 @@ static MunitResult test_checkparse(const MunitParameter params[],
 
 	for (unsigned int i = 0; i < parsed.nlines; ++i) {
 		at_rsp_line_tokens *tk_p = &parsed.tokenlists[i];
-		at_rsp_line_tokens *tk_x = &parsed.tokenlists[i];
+		const at_rsp_line_tokens *tk_x =
+			&par->expected.tokenlists[i];
 
+		munit_assert_string_equal(tk_p->preamble, tk_x->preamble);
 		munit_assert_uint(tk_p->ntokens, ==, tk_x->ntokens);
-		munit_assert_memory_equal(sizeof(tk_p->tokenlist),
-					  tk_p->tokenlist,
-					  tk_x->tokenlist);
+
+		for (unsigned int j = 0; j < tk_p->ntokens; ++j) {
+			munit_assert_string_equal(tk_p->tokenlist[j].content,
+						  tk_x->tokenlist[j].content);
+			munit_assert_int(tk_p->tokenlist[j].type, ==,
+					 tk_x->tokenlist[j].type);
+		}
+	}
+
+	return MUNIT_OK;
+}
+
+static MunitResult test_framer_response(const MunitParameter params[],
+					void *fixture)
+{
+	const char *cmd = munit_parameters_get(params, "cmd");
+	test_rsp_param *par = get_at_test_param(fixture, cmd);
+	at_framer f;
+	at_frame_event ev = AT_FRAME_NONE;
+	unsigned int nlines = 0;
+	size_t i;
+
+	munit_assert_not_null(par);
+
+	at_framer_init(&f);
+
+	/* Every line but the final OK is handed out, starting with the
+	 * echo of the command */
+	for (i = 0; par->msg[i] != '\0'; ++i) {
+		ev = at_framer_feed(&f, par->msg[i]);
+
+		if (ev == AT_FRAME_LINE) {
+			if (nlines++ == 0) {
+				munit_assert_string_equal(
+					at_framer_line(&f, NULL), cmd);
+			}
+		} else if (ev != AT_FRAME_NONE) {
+			break;
+		}
+	}
+
+	munit_assert_int(ev, ==, AT_FRAME_OK);
+	munit_assert_char(par->msg[i + 1], ==, '\0');
+	munit_assert_uint(nlines, ==, par->expected.nlines + 1);
+
+	return MUNIT_OK;
+}
+
+static MunitResult test_framer_codes(const MunitParameter params[],
+				     void *fixture)
+{
+	static const struct {
+		const char *in;
+		at_frame_event ev;
+		const char *line;
+	} cases[] = {
+		{"OK\r\n", AT_FRAME_OK, "OK"},
+		{"\r\nERROR\r\n", AT_FRAME_ERROR, "ERROR"},
+		{"SEND OK\r\n", AT_FRAME_SEND_OK, "SEND OK"},
+		{"SEND FAIL\r\n", AT_FRAME_SEND_FAIL, "SEND FAIL"},
+		{"\r\n> ", AT_FRAME_PROMPT, ">"},
+		{"OKAY\r\n", AT_FRAME_LINE, "OKAY"},
+		{"O\r\n", AT_FRAME_LINE, "O"},
+		{"SEND\r\n", AT_FRAME_LINE, "SEND"},
+		{"Recv 5 bytes\r\n", AT_FRAME_LINE, "Recv 5 bytes"},
+		{"a>b\n", AT_FRAME_LINE, "a>b"},
+		{"\r\n\r\n", AT_FRAME_NONE, ""}
+	};
+
+	for (unsigned int i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+		at_framer f;
+		at_frame_event ev;
+		size_t len = strlen(cases[i].in);
+		size_t used;
+
+		at_framer_init(&f);
+		used = at_framer_feed_buf(&f, cases[i].in, len, &ev);
+
+		munit_assert_int(ev, ==, cases[i].ev);
+
+		if (ev == AT_FRAME_NONE) {
+			munit_assert_size(used, ==, len);
+			continue;
+		}
+
+		munit_assert_string_equal(at_framer_line(&f, NULL),
+					  cases[i].line);
+
+		/* The prompt is not followed by a line end */
+		if (ev != AT_FRAME_PROMPT) {
+			munit_assert_size(used, ==, len);
+		}
+	}
+
+	return MUNIT_OK;
+}
+
+static MunitResult test_framer_long_line(const MunitParameter params[],
+					 void *fixture)
+{
+	at_framer f;
+	at_frame_event ev = AT_FRAME_NONE;
+	size_t len;
+
+	at_framer_init(&f);
+
+	/* Lines longer than the buffer are cut, but still end where
+	 * the line ends */
+	for (unsigned int i = 0; i < 2 * AT_FRAMER_LINE_LEN; ++i) {
+		munit_assert_int(at_framer_feed(&f, 'x'), ==, AT_FRAME_NONE);
+	}
+
+	ev = at_framer_feed(&f, '\n');
+
+	munit_assert_int(ev, ==, AT_FRAME_LINE);
+	munit_assert_size(strlen(at_framer_line(&f, &len)), ==,
+			  AT_FRAMER_LINE_LEN - 1);
+	munit_assert_size(len, ==, AT_FRAMER_LINE_LEN - 1);
+
+	/* The next line starts fresh */
+	at_framer_feed_buf(&f, "OK\r\n", 4, &ev);
+	munit_assert_int(ev, ==, AT_FRAME_OK);
+
+	return MUNIT_OK;
+}
+
+static MunitResult test_view_structure(const MunitParameter params[],
+				       void *fixture)
+{
+	const char *cmd = munit_parameters_get(params, "cmd");
+	test_rsp_param *par = get_at_test_param(fixture, cmd);
+	at_rsp_iter it;
+	at_rsp_line_view line;
+	at_rsp_view tk[TEST_VIEW_TOKENS];
+	unsigned int nlines = 0;
+
+	munit_assert_not_null(par);
+
+	at_rsp_iter_init(&it, par->msg, strlen(par->msg));
+
+	while (at_rsp_iter_next(&it, &line)) {
+		const at_rsp_line_tokens *x;
+		size_t n;
+		unsigned int skip = 0;
+
+		if (line.preamble.len == 0) {
+			continue;
+		}
+
+		munit_assert_uint(nlines, <, par->expected.nlines);
+		x = &par->expected.tokenlists[nlines++];
+		n = at_rsp_view_tokens(&line, tk, TEST_VIEW_TOKENS);
+
+		/* The key of key:value lines such as +CIPSTA is a token
+		 * of its own, where it was the preamble before */
+		if (!at_rsp_view_eq(&line.preamble, x->preamble)) {
+			munit_assert_true(at_rsp_view_eq(&tk[0], x->preamble));
+			skip = 1;
+		}
+
+		munit_assert_size(n, ==, x->ntokens + skip);
+
+		for (unsigned int j = 0; j < x->ntokens; ++j) {
+			munit_assert_true(at_rsp_view_eq(&tk[j + skip],
+							 x->tokenlist[j].content));
+			munit_assert_int(tk[j + skip].type, ==,
+					 x->tokenlist[j].type);
+		}
+	}
+
+	munit_assert_uint(nlines, ==, par->expected.nlines);
+
+	return MUNIT_OK;
+}
+
+static MunitResult test_view_limits(const MunitParameter params[],
+				    void *fixture)
+{
+	char msg[2048] = "AT+CIPSTATUS\r\nSTATUS:3\r\n";
+	const char *ssid =
+		"+CWSTATE:2,\"A network name, longer than 23 \\\"chars\\\"\"";
+	const char *lap =
+		"+CWLAP:(3,\"HomeNet\",-41,\"a4:2b:b0:d1:11:20\",1)";
+	at_rsp_iter it;
+	at_rsp_line_view line;
+	at_rsp_view tk[TEST_VIEW_TOKENS];
+	char buf[64];
+	unsigned int n = 0;
+
+	/* More lines than the copying parser keeps */
+	for (unsigned int i = 0; i < 2 * AT_RESPONSE_MAX_LINES; ++i) {
+		snprintf(&msg[strlen(msg)], sizeof(msg) - strlen(msg),
+			 "+CIPSTATUS:%u,\"TCP\",\"192.168.5.%u\",48706,333,1"
+			 "\r\n", i, 100 + i);
+	}
+
+	strcat(msg, "\r\nOK\r\n");
+	at_rsp_iter_init(&it, msg, strlen(msg));
+
+	while (at_rsp_find(&it, "+CIPSTATUS", &line)) {
+		munit_assert_size(at_rsp_view_tokens(&line, tk, 3), ==, 6);
+		munit_assert_int(at_rsp_view_as_int(&tk[0]), ==, n);
+		++n;
+	}
+
+	munit_assert_uint(n, ==, 2 * AT_RESPONSE_MAX_LINES);
+
+	/* Quoted commas and escapes stay part of the token, which is
+	 * not cut */
+	at_rsp_iter_init(&it, ssid, strlen(ssid));
+	munit_assert_true(at_rsp_find(&it, "+CWSTATE", &line));
+	munit_assert_size(at_rsp_view_tokens(&line, tk, TEST_VIEW_TOKENS),
+			  ==, 2);
+	munit_assert_int(tk[1].type, ==, AT_RSP_TK_TYPE_STR);
+	at_rsp_view_copy(&tk[1], buf, sizeof(buf));
+	munit_assert_string_equal(buf,
+				  "A network name, longer than 23 \"chars\"");
+
+	/* Copies are cut to the buffer */
+	munit_assert_size(at_rsp_view_copy(&tk[1], buf, 8), ==, 7);
+	munit_assert_string_equal(buf, "A netwo");
+
+	/* Lists lose their parentheses, colons in quotes don't split */
+	at_rsp_iter_init(&it, lap, strlen(lap));
+	munit_assert_true(at_rsp_iter_next(&it, &line));
+	munit_assert_true(at_rsp_view_eq(&line.preamble, "+CWLAP"));
+	munit_assert_size(at_rsp_view_tokens(&line, tk, TEST_VIEW_TOKENS),
+			  ==, 5);
+	munit_assert_int(at_rsp_view_as_int(&tk[0]), ==, 3);
+	munit_assert_int(at_rsp_view_as_int(&tk[2]), ==, -41);
+	munit_assert_true(at_rsp_view_eq(&tk[3], "a4:2b:b0:d1:11:20"));
+	munit_assert_int(at_rsp_view_as_int(&tk[4]), ==, 1);
+	munit_assert_false(at_rsp_iter_next(&it, &line));
+
+	return MUNIT_OK;
+}
+
+/* Output of a parse, kept off the stack so only the parser's own
+ * use of it is measured */
+typedef struct {
+	const char *msg;
+	at_rsp_lines lines;
+	at_rsp_view tk[TEST_VIEW_TOKENS];
+	unsigned int nlines;
+} test_parse_job;
+
+static void *test_parse_none(void *arg)
+{
+	return arg;
+}
+
+static void *test_parse_copy(void *arg)
+{
+	test_parse_job *job = arg;
+
+	job->nlines = at_rsp_get_lines(job->msg, &job->lines);
+
+	return NULL;
+}
+
+static void *test_parse_view(void *arg)
+{
+	test_parse_job *job = arg;
+	at_rsp_iter it;
+	at_rsp_line_view line;
+
+	job->nlines = 0;
+	at_rsp_iter_init(&it, job->msg, strlen(job->msg));
+
+	while (at_rsp_iter_next(&it, &line)) {
+		if (line.preamble.len) {
+			at_rsp_view_tokens(&line, job->tk, TEST_VIEW_TOKENS);
+			++job->nlines;
+		}
+	}
+
+	return NULL;
+}
+
+/* Run a parse on a painted stack of its own, and count the bytes of
+ * the stack and of the output it wrote */
+static size_t test_measure(void *(*fn)(void*), test_parse_job *job,
+			   size_t *out)
+{
+	static unsigned char stack[TEST_STACK_LEN]
+		__attribute__((aligned(64)));
+	const unsigned char *o = (const unsigned char*) &job->lines;
+	pthread_attr_t attr;
+	pthread_t th;
+	size_t i;
+
+	memset(stack, TEST_PAINT, sizeof(stack));
+	memset(&job->lines, TEST_PAINT,
+	       sizeof(*job) - offsetof(test_parse_job, lines));
+
+	pthread_attr_init(&attr);
+	pthread_attr_setstack(&attr, stack, sizeof(stack));
+	munit_assert_int(pthread_create(&th, &attr, fn, job), ==, 0);
+	pthread_join(th, NULL);
+	pthread_attr_destroy(&attr);
+
+	*out = 0;
+
+	for (i = 0; i < sizeof(*job) - offsetof(test_parse_job, lines); ++i) {
+		*out += o[i] != TEST_PAINT;
+	}
+
+	for (i = 0; i < sizeof(stack) && stack[i] == TEST_PAINT; ++i) {
+	}
+
+	return sizeof(stack) - i;
+}
+
+static double test_time_ns(void *(*fn)(void*), test_parse_job *job)
+{
+	struct timespec t0, t1;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+
+	for (unsigned int r = 0; r < TEST_BENCH_ROUNDS; ++r) {
+		fn(job);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	return ((t1.tv_sec - t0.tv_sec) * 1e9 +
+		(t1.tv_nsec - t0.tv_nsec)) / TEST_BENCH_ROUNDS;
+}
+
+static MunitResult test_view_bench(const MunitParameter params[],
+				   void *fixture)
+{
+	const char *cmd = munit_parameters_get(params, "cmd");
+	test_rsp_param *par = get_at_test_param(fixture, cmd);
+	static test_parse_job job;
+	size_t base, stack_c, stack_v, out_c, out_v, out;
+	unsigned int nlines_c;
+	double ns_c, ns_v;
+
+	munit_assert_not_null(par);
+	job.msg = par->msg;
+
+	/* Timed first, so the library calls are resolved before the
+	 * stack is measured */
+	ns_c = test_time_ns(test_parse_copy, &job);
+	ns_v = test_time_ns(test_parse_view, &job);
+
+	/* Thread start-up itself takes some of the stack */
+	base = test_measure(test_parse_none, &job, &out);
+	stack_c = test_measure(test_parse_copy, &job, &out_c) - base;
+	nlines_c = job.nlines;
+	stack_v = test_measure(test_parse_view, &job, &out_v) - base;
+
+	/* Shown with --show-stderr */
+	munit_logf(MUNIT_LOG_INFO, "%s: stack %zu -> %zu B, "
+		   "output %zu -> %zu B, %.0f -> %.0f ns", cmd, stack_c,
+		   stack_v, out_c, out_v, ns_c, ns_v);
+
+	munit_assert_uint(job.nlines, ==, nlines_c);
+	munit_assert_size(stack_v, <, stack_c / 4);
+	munit_assert_size(out_v, <, out_c);
+
+	return MUNIT_OK;
+}
+
+/* Everything a parser found, in order */
+typedef struct {
+	char buf[4096];
+	size_t len;
+} test_log;
+
+static void test_log_add(test_log *log, const char *kind, const char *s,
+			 size_t len)
+{
+	int n = snprintf(&log->buf[log->len], sizeof(log->buf) - log->len,
+			 "%s:%.*s\n", kind, (int) len, s);
+
+	munit_assert_int(n, >, 0);
+	munit_assert_size(log->len + n, <, sizeof(log->buf));
+	log->len += n;
+}
+
+static void test_push_line(const at_rsp_line_view *line, at_frame_event ev,
+			   void *ctx)
+{
+	test_log_add(ctx, "L", line->ptr, line->len);
+}
+
+static void test_push_preamble(const at_rsp_view *preamble, void *ctx)
+{
+	test_log_add(ctx, "P", preamble->ptr, preamble->len);
+}
+
+static void test_push_token(const at_rsp_view *tk, unsigned int i,
+			    void *ctx)
+{
+	char kind[16];
+
+	snprintf(kind, sizeof(kind), "T%u%c", i,
+		 tk->type == AT_RSP_TK_TYPE_STR ? 's' : 'i');
+	test_log_add(ctx, kind, tk->ptr, tk->len);
+}
+
+static const at_push_cb test_push_cbs = {
+	.line = test_push_line,
+	.preamble = test_push_preamble,
+	.token = test_push_token
+};
+
+/* The same events from the whole response */
+static void test_batch_log(const char *msg, test_log *log)
+{
+	at_rsp_iter it;
+	at_rsp_line_view line;
+	at_rsp_view tk[TEST_VIEW_TOKENS];
+
+	log->len = 0;
+	log->buf[0] = '\0';
+	at_rsp_iter_init(&it, msg, strlen(msg));
+
+	while (at_rsp_iter_next(&it, &line)) {
+		size_t n;
+
+		test_push_line(&line, AT_FRAME_NONE, log);
+
+		if (line.preamble.len == 0) {
+			continue;
+		}
+
+		test_push_preamble(&line.preamble, log);
+		n = at_rsp_view_tokens(&line, tk, TEST_VIEW_TOKENS);
+		munit_assert_size(n, <=, TEST_VIEW_TOKENS);
+
+		for (size_t i = 0; i < n; ++i) {
+			test_push_token(&tk[i], i, log);
+		}
+	}
+}
+
+/* Feed a response in chunks ending at the given offsets */
+static void test_push_split(const char *msg, const size_t *cuts,
+			    unsigned int ncuts, const test_log *batch)
+{
+	const size_t len = strlen(msg);
+	at_push_parser p;
+	test_log log = {.len = 0};
+	at_frame_event rslt = AT_FRAME_NONE;
+	size_t start = 0;
+
+	at_push_init(&p, &test_push_cbs, &log);
+
+	for (unsigned int i = 0; i <= ncuts; ++i) {
+		size_t end = i < ncuts ? cuts[i] : len;
+		at_frame_event ev = at_push_feed(&p, &msg[start],
+						 end - start);
+
+		if (ev != AT_FRAME_NONE) {
+			/* Only the last chunk holds the result code */
+			munit_assert_size(end, ==, len);
+			rslt = ev;
+		}
+
+		start = end;
+	}
+
+	munit_assert_int(rslt, ==, AT_FRAME_OK);
+	munit_assert_size(log.len, ==, batch->len);
+	munit_assert_memory_equal(log.len, log.buf, batch->buf);
+}
+
+static MunitResult test_push_splits(const MunitParameter params[],
+				    void *fixture)
+{
+	const char *cmd = munit_parameters_get(params, "cmd");
+	test_rsp_param *par = get_at_test_param(fixture, cmd);
+	test_log batch;
+	test_log log = {.len = 0};
+	at_push_parser p;
+	size_t len, cuts[16];
+
+	munit_assert_not_null(par);
+	len = strlen(par->msg);
+	test_batch_log(par->msg, &batch);
+
+	/* Every split point into two and three chunks, empty chunks
+	 * included */
+	for (size_t i = 0; i <= len; ++i) {
+		for (size_t j = i; j <= len; ++j) {
+			cuts[0] = i;
+			cuts[1] = j;
+			test_push_split(par->msg, cuts, 1, &batch);
+			test_push_split(par->msg, cuts, 2, &batch);
+		}
+	}
+
+	/* Byte by byte, as from the UART */
+	at_push_init(&p, &test_push_cbs, &log);
+
+	for (size_t i = 0; i < len; ++i) {
+		at_push_feed(&p, &par->msg[i], 1);
+	}
+
+	munit_assert_size(log.len, ==, batch.len);
+	munit_assert_memory_equal(log.len, log.buf, batch.buf);
+
+	/* And random chunks */
+	for (unsigned int r = 0; r < 1000; ++r) {
+		unsigned int n = munit_rand_int_range(1, 16);
+
+		for (unsigned int i = 0; i < n; ++i) {
+			cuts[i] = munit_rand_int_range(0, len);
+		}
+
+		/* Offsets have to grow */
+		for (unsigned int i = 1; i < n; ++i) {
+			for (unsigned int j = i; j > 0 &&
+				     cuts[j - 1] > cuts[j]; --j) {
+				size_t t = cuts[j];
+
+				cuts[j] = cuts[j - 1];
+				cuts[j - 1] = t;
+			}
+		}
+
+		test_push_split(par->msg, cuts, n, &batch);
+	}
+
+	return MUNIT_OK;
+}
+
+/* Destination of the extraction test, with members of each width */
+typedef struct {
+	int status;
+	struct {
+		int8_t index;
+		char ipv4[16];
+		int proto;
+		uint16_t r_port;
+		int64_t l_port;
+		uint8_t passive;
+	} cli;
+	char ip[8];
+	char netmask[16];
+} test_extract_dst;
+
+static const at_rsp_field_name test_protos[] = {
+	{"TCP", 1},
+	{"UDP", 4},
+	{NULL, -1}
+};
+
+static const at_rsp_field test_fields[] = {
+	{.preamble = "STATUS", .index = 0, .type = AT_RSP_FIELD_INT,
+	 AT_RSP_MEMBER(test_extract_dst, status)},
+	{.preamble = "+CIPSTATUS", .index = 0, .type = AT_RSP_FIELD_INT,
+	 AT_RSP_MEMBER(test_extract_dst, cli.index)},
+	{.preamble = "+CIPSTATUS", .index = 1, .type = AT_RSP_FIELD_NAME,
+	 AT_RSP_MEMBER(test_extract_dst, cli.proto),
+	 .names = test_protos},
+	{.preamble = "+CIPSTATUS", .index = 2, .type = AT_RSP_FIELD_STR,
+	 AT_RSP_MEMBER(test_extract_dst, cli.ipv4)},
+	{.preamble = "+CIPSTATUS", .index = 3, .type = AT_RSP_FIELD_INT,
+	 AT_RSP_MEMBER(test_extract_dst, cli.r_port)},
+	{.preamble = "+CIPSTATUS", .index = 4, .type = AT_RSP_FIELD_INT,
+	 AT_RSP_MEMBER(test_extract_dst, cli.l_port)},
+	{.preamble = "+CIPSTATUS", .index = 5, .type = AT_RSP_FIELD_INT,
+	 AT_RSP_MEMBER(test_extract_dst, cli.passive)},
+	{.preamble = "+CIPSTA", .key = "ip", .index = 1,
+	 .type = AT_RSP_FIELD_STR, AT_RSP_MEMBER(test_extract_dst, ip)},
+	{.preamble = "+CIPSTA", .key = "netmask", .index = 1,
+	 .type = AT_RSP_FIELD_STR,
+	 AT_RSP_MEMBER(test_extract_dst, netmask)}
+};
+
+static int test_extract(const char *msg, test_extract_dst *dst)
+{
+	at_rsp_line_view line;
+	at_rsp_iter it;
+
+	at_rsp_iter_init(&it, msg, strlen(msg));
+	munit_assert_true(at_rsp_iter_next(&it, &line));
+
+	return at_rsp_extract(&line, test_fields,
+			      sizeof(test_fields) / sizeof(test_fields[0]),
+			      dst);
+}
+
+static MunitResult test_extract_fields(const MunitParameter params[],
+				       void *fixture)
+{
+	test_extract_dst dst;
+
+	memset(&dst, 0x5a, sizeof(dst));
+
+	munit_assert_int(test_extract("STATUS:3\r\n", &dst), ==, 1);
+	munit_assert_int(dst.status, ==, 3);
+
+	/* Each member takes the width it has */
+	munit_assert_int(test_extract("+CIPSTATUS:2,\"UDP\","
+				      "\"192.168.5.211\",48740,-333,1",
+				      &dst), ==, 6);
+	munit_assert_int(dst.cli.index, ==, 2);
+	munit_assert_int(dst.cli.proto, ==, 4);
+	munit_assert_string_equal(dst.cli.ipv4, "192.168.5.211");
+	munit_assert_uint(dst.cli.r_port, ==, 48740);
+	munit_assert_llong(dst.cli.l_port, ==, -333);
+	munit_assert_uint(dst.cli.passive, ==, 1);
+
+	/* Names not listed take the value of the end of the list, and
+	 * short lines only store what they have */
+	munit_assert_int(test_extract("+CIPSTATUS:3,\"SSL\"", &dst),
+			 ==, 2);
+	munit_assert_int(dst.cli.index, ==, 3);
+	munit_assert_int(dst.cli.proto, ==, -1);
+	munit_assert_uint(dst.cli.r_port, ==, 48740);
+
+	/* Keyed lines only store the fields of their key, cut to the
+	 * member */
+	munit_assert_int(test_extract("+CIPSTA:ip:\"192.168.5.105\"",
+				      &dst), ==, 1);
+	munit_assert_string_equal(dst.ip, "192.168");
+	munit_assert_int(test_extract("+CIPSTA:gateway:\"192.168.5.1\"",
+				      &dst), ==, 0);
+	munit_assert_int(test_extract("+CIPSTA:netmask:\"255.255.255.0\"",
+				      &dst), ==, 1);
+	munit_assert_string_equal(dst.netmask, "255.255.255.0");
+	munit_assert_string_equal(dst.ip, "192.168");
+
+	/* Other lines are left alone */
+	munit_assert_int(test_extract("+CIPMUX:1", &dst), ==, 0);
+	munit_assert_int(test_extract("+CIPSTATUSES:1", &dst), ==, 0);
+	munit_assert_int(dst.status, ==, 3);
+
+	return MUNIT_OK;
+}
+
+/* Check a line of k a's, then a quoted token of m b's ending in an
+ * escaped quote, then c */
+static void test_scan_line(char *msg, size_t k, size_t m)
+{
+	at_rsp_line_view line;
+	at_rsp_view tk[4];
+	at_rsp_iter it;
+	at_framer f;
+	at_frame_event ev;
+	size_t len = 0, n;
+
+	memcpy(msg, "+P:", 3);
+	len += 3;
+	memset(&msg[len], 'a', k);
+	len += k;
+	memcpy(&msg[len], ",\"", 2);
+	len += 2;
+	memset(&msg[len], 'b', m);
+	len += m;
+	memcpy(&msg[len], "\\\"\",c\r\n", 7);
+	len += 7;
+
+	at_rsp_iter_init(&it, msg, len);
+	munit_assert_true(at_rsp_iter_next(&it, &line));
+	munit_assert_size(line.len, ==, len - 2);
+	munit_assert_size(line.preamble.len, ==, 2);
+	munit_assert_size(at_rsp_view_tokens(&line, tk, 4), ==, 3);
+	munit_assert_size(tk[0].len, ==, k);
+	munit_assert_size(tk[1].len, ==, m + 2);
+	munit_assert_true(at_rsp_view_eq(&tk[2], "c"));
+	munit_assert_false(at_rsp_iter_next(&it, &line));
+
+	/* The framer copies the same line */
+	at_framer_init(&f);
+	munit_assert_size(at_framer_feed_buf(&f, msg, len, &ev), ==, len);
+	munit_assert_int(ev, ==, AT_FRAME_LINE);
+	munit_assert_memory_equal(len - 2, at_framer_line(&f, &n), msg);
+	munit_assert_size(n, ==, len - 2);
+}
+
+/* Delimiters at every offset from the alignment of the buffer and
+ * of each word or vector the scan takes at a time */
+static MunitResult test_scan_offsets(const MunitParameter params[],
+				     void *fixture)
+{
+	static char buf[256] __attribute__((aligned(64)));
+
+	for (size_t shift = 0; shift < 32; ++shift) {
+		for (size_t k = 0; k < 40; ++k) {
+			for (size_t m = 0; m < 40; m += 3) {
+				test_scan_line(&buf[shift], k, m);
+			}
+		}
 	}
 
 	return MUNIT_OK;
@@ -232,6 +939,78 @@ static MunitTest at_parse_tests[] = {
 		.options = MUNIT_TEST_OPTION_NONE,
 		.parameters = test_param_list
 	},
+	{
+		.name = "/framer-response-test",
+		.test = test_framer_response,
+		.setup = NULL,
+		.tear_down = NULL,
+		.options = MUNIT_TEST_OPTION_NONE,
+		.parameters = test_param_list
+	},
+	{
+		.name = "/framer-codes-test",
+		.test = test_framer_codes,
+		.setup = NULL,
+		.tear_down = NULL,
+		.options = MUNIT_TEST_OPTION_NONE,
+		.parameters = NULL
+	},
+	{
+		.name = "/framer-long-line-test",
+		.test = test_framer_long_line,
+		.setup = NULL,
+		.tear_down = NULL,
+		.options = MUNIT_TEST_OPTION_NONE,
+		.parameters = NULL
+	},
+	{
+		.name = "/view-structure-test",
+		.test = test_view_structure,
+		.setup = NULL,
+		.tear_down = NULL,
+		.options = MUNIT_TEST_OPTION_NONE,
+		.parameters = test_param_list
+	},
+	{
+		.name = "/view-limits-test",
+		.test = test_view_limits,
+		.setup = NULL,
+		.tear_down = NULL,
+		.options = MUNIT_TEST_OPTION_NONE,
+		.parameters = NULL
+	},
+	{
+		.name = "/view-bench",
+		.test = test_view_bench,
+		.setup = NULL,
+		.tear_down = NULL,
+		.options = MUNIT_TEST_OPTION_NONE,
+		.parameters = test_param_list
+	},
+	{
+		.name = "/push-split-test",
+		.test = test_push_splits,
+		.setup = NULL,
+		.tear_down = NULL,
+		.options = MUNIT_TEST_OPTION_NONE,
+		.parameters = test_param_list
+	},
+	{
+		.name = "/extract-test",
+		.test = test_extract_fields,
+		.setup = NULL,
+		.tear_down = NULL,
+		.options = MUNIT_TEST_OPTION_NONE,
+		.parameters = NULL
+	},
+	{
+		.name = "/scan-offsets-test",
+		.test = test_scan_offsets,
+		.setup = NULL,
+		.tear_down = NULL,
+		.options = MUNIT_TEST_OPTION_NONE,
+		.parameters = NULL
+	},
 	{
 		.name = NULL,
 		.test = NULL,
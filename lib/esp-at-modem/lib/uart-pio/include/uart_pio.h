@@ -8,7 +8,9 @@
 #define UART_PIO_H
 
 #include <stdint.h>
+#include <stddef.h>
 
+#include "pico/stdlib.h"
 #include "hardware/pio.h"
 
 /**
@@ -20,9 +22,39 @@
 #define UART_PIO_E_HARDWARE_FAIL	-1
 #define UART_PIO_E_NULL_PTR		-2
 
+/** @brief Size of the RX ring buffer as a power of two
+ *
+ * The DMA fills the ring without CPU involvement, so this sets how
+ * long received data may go unread before it is overwritten. At most
+ * 15, the largest ring the DMA can wrap.
+ */
+#ifndef UART_PIO_RX_RING_BITS
+#define UART_PIO_RX_RING_BITS 10
+#endif /* #ifndef UART_PIO_RX_RING_BITS */
+
+#define UART_PIO_RX_RING_SIZE (1u << UART_PIO_RX_RING_BITS)
+
+/** @brief RX FIFO level RTS is deasserted at with flow control
+ *
+ * The rest of the 8 entries take what the sender has on its way
+ * when it sees RTS go.
+ */
+#ifndef UART_PIO_RTS_LEVEL
+#define UART_PIO_RTS_LEVEL 4
+#endif /* #ifndef UART_PIO_RTS_LEVEL */
+
+/** @brief Receive counters of a UART PIO */
+typedef struct {
+	uint32_t received; /**< @brief Bytes received */
+	uint32_t overruns; /**< @brief Bytes lost to a full ring, none
+			    * with flow control */
+	uint32_t framing; /**< @brief Framing errors or breaks seen */
+} uart_pio_rx_stats;
+
 /** @brief Config for the PIO uart
  *
- * Fill out completely before passing to the init function
+ * Fill out the first block of members before passing to the init
+ * function, the rest are set up by it
  */
 typedef struct {
 	PIO pio; /**< @brief Hardware PIO to use */
@@ -31,6 +63,27 @@ typedef struct {
 	uint pin_tx; /**< @brief GPIO pin for TX */
 	uint pin_rx; /**< @brief GPIO pin for RX */
 	uint baud; /**< @brief The UART speed setting */
+
+	/** @brief Use RTS/CTS flow control, both active low
+	 *
+	 * TX characters are held while CTS is deasserted. RTS is
+	 * deasserted once the RX FIFO fills, and the RX ring is never
+	 * overwritten, unread data holds off the sender instead.
+	 */
+	bool flow;
+	uint pin_cts; /**< @brief GPIO pin for CTS input, with flow */
+	uint pin_rts; /**< @brief GPIO pin for RTS output, with flow */
+
+	int dma_tx; /**< @brief DMA channel feeding the TX FIFO */
+	int dma_rx; /**< @brief DMA channel filling the RX ring */
+	uint32_t rx_armed; /**< @brief Count the channel started with */
+	uint32_t rx_base; /**< @brief Bytes received before that */
+	uint32_t rx_read; /**< @brief Bytes taken from the ring */
+	uart_pio_rx_stats rx_stats;
+
+	/** @brief RX ring, aligned to its size for the DMA to wrap */
+	uint8_t rx_ring[UART_PIO_RX_RING_SIZE]
+	__attribute__((aligned(UART_PIO_RX_RING_SIZE)));
 } uart_pio_cfg;
 
 /** @brief Initialize a PIO as a UART */
@@ -65,18 +118,60 @@ bool uart_pio_putc_timeout(uart_pio_cfg *cfg, char c, uint64_t us);
 /** @brief Attempt to transmit a character string with a timeout
  *
  * Will block for a given timeout until the timeout is reached, or
- * all the characters in the string are sent.
+ * all the characters in the string are sent. The string is sent by
+ * DMA, see @ref uart_pio_write_timeout.
  *
  * @param cfg The UART PIO object to send the characters on
  * @param s The character string to send
- * @param us The number of microseconds to block until returning
- * failure
+ * @param us The number of microseconds the whole string may take
+ * before returning failure
  *
  * @return true on success, false on failure
  */
 bool uart_pio_puts_timeout(uart_pio_cfg *cfg, const char *s,
 			   uint64_t us);
 
+/** @brief Start transmitting a buffer by DMA and return immediately
+ *
+ * The DMA is paced by the TX state machine, so the CPU is free while
+ * the buffer is sent. @p buf must stay valid until the transfer is
+ * no longer busy.
+ *
+ * @return false if a transfer is already in progress
+ */
+bool uart_pio_write_async(uart_pio_cfg *cfg, const void *buf,
+			  size_t len);
+
+/** @brief Check if a transfer started by @ref uart_pio_write_async
+ * is still in progress
+ *
+ * A transfer is finished once all of it is in the TX FIFO, the last
+ * few characters may still be going out on the line.
+ */
+bool uart_pio_write_busy(uart_pio_cfg *cfg);
+
+/** @brief Wait for the current transfer to finish
+ *
+ * @return true if it finished before @p deadline, the transfer keeps
+ * running otherwise
+ */
+bool uart_pio_write_wait(uart_pio_cfg *cfg, absolute_time_t deadline);
+
+/** @brief Stop the current transfer
+ *
+ * @return Number of bytes that were not sent
+ */
+size_t uart_pio_write_abort(uart_pio_cfg *cfg);
+
+/** @brief Transmit a buffer by DMA, blocking until it is sent
+ *
+ * The transfer is aborted if it doesn't finish within @p us.
+ *
+ * @return true on success, false on failure
+ */
+bool uart_pio_write_timeout(uart_pio_cfg *cfg, const void *buf,
+			    size_t len, uint64_t us);
+
 /** @brief Receive a character from the UART PIO, blocking until
  * complete
  */
@@ -96,10 +191,50 @@ char uart_pio_getc_blocking(uart_pio_cfg *cfg);
  */
 bool uart_pio_getc_timeout(uart_pio_cfg *cfg, char *c, uint64_t us);
 
+/** @brief Number of received bytes waiting in the RX ring */
+size_t uart_pio_rx_available(uart_pio_cfg *cfg);
+
+/** @brief Take a character from the RX ring without waiting
+ *
+ * @return true if @p c was filled, false if nothing was received
+ */
+bool uart_pio_try_getc(uart_pio_cfg *cfg, char *c);
+
+/** @brief Take up to @p len received bytes without waiting
+ *
+ * @return Number of bytes copied to @p buf
+ */
+size_t uart_pio_read(uart_pio_cfg *cfg, uint8_t *buf, size_t len);
+
+/** @brief Wait until at least @p n bytes are in the RX ring
+ *
+ * @p n is capped at the size of the ring.
+ *
+ * @return true if they arrived before @p deadline
+ */
+bool uart_pio_rx_wait_until(uart_pio_cfg *cfg, size_t n,
+			    absolute_time_t deadline);
+
+/** @brief Get the receive counters, including framing errors
+ * reported by the RX program
+ */
+void uart_pio_get_rx_stats(uart_pio_cfg *cfg, uart_pio_rx_stats *s);
+
+/** @brief Change the rate of both directions
+ *
+ * Waits for everything queued for TX to go out at the old rate
+ * first. Characters being received during the change are lost.
+ *
+ * @param us Time the TX may take to drain
+ *
+ * @return false if the TX didn't drain, the rate is unchanged then
+ */
+bool uart_pio_set_baud(uart_pio_cfg *cfg, uint baud, uint64_t us);
+
 /** @brief Flush TX FIFO */
 void uart_pio_flush_tx(uart_pio_cfg *cfg);
 
-/** @brief Flush RX FIFO */
+/** @brief Discard everything received so far */
 void uart_pio_flush_rx(uart_pio_cfg *cfg);
 
 /**
@@ -14,6 +14,26 @@
 #include <stdio.h>
 
 #include "pico/stdlib.h"
+#include "hardware/dma.h"
+
+#define _UART_PIO_RX_MASK (UART_PIO_RX_RING_SIZE - 1)
+
+/* The RX channel runs for as long as it can and is restarted from
+ * wherever it got to once it is half way through its count */
+#define _UART_PIO_RX_COUNT 0xffffffffu
+#define _UART_PIO_RX_REARM 0x80000000u
+
+/* uart_rx.pio raises irq 4 rel on a framing error or break, which
+ * can't be routed to the CPU so it is polled */
+#define _UART_PIO_RX_FLAG(cfg) (1u << (4 + (cfg)->sm_rx))
+
+/* Time of a character with start and stop bit, rounded up */
+#define _UART_PIO_CHAR_US(baud) ((10000000u + (baud) - 1) / (baud))
+
+static void _uart_pio_rx_start(uart_pio_cfg *cfg);
+static uint32_t _uart_pio_rx_written(uart_pio_cfg *cfg);
+static bool _uart_pio_rx_rearm_due(uart_pio_cfg *cfg);
+static size_t _uart_pio_rx_update(uart_pio_cfg *cfg);
 
 uint uart_pio_init(uart_pio_cfg *cfg)
 {
@@ -23,15 +43,47 @@ uint uart_pio_init(uart_pio_cfg *cfg)
 		return UART_PIO_E_NULL_PTR;
 	}
 
-	/* Install and start the TX program */
-	offset = pio_add_program(cfg->pio, &uart_tx_program);
-	uart_tx_program_init(cfg->pio, cfg->sm_tx, offset, cfg->pin_tx,
-			     cfg->baud);
+	/* Install and start the TX and RX programs */
+	if (cfg->flow) {
+		offset = pio_add_program(cfg->pio, &uart_tx_cts_program);
+		uart_tx_cts_program_init(cfg->pio, cfg->sm_tx, offset,
+					 cfg->pin_tx, cfg->pin_cts,
+					 cfg->baud);
+
+		offset = pio_add_program(cfg->pio, &uart_rx_rts_program);
+		uart_rx_rts_program_init(cfg->pio, cfg->sm_rx, offset,
+					 cfg->pin_rx, cfg->pin_rts,
+					 UART_PIO_RTS_LEVEL, cfg->baud);
+	} else {
+		offset = pio_add_program(cfg->pio, &uart_tx_program);
+		uart_tx_program_init(cfg->pio, cfg->sm_tx, offset,
+				     cfg->pin_tx, cfg->baud);
+
+		offset = pio_add_program(cfg->pio, &uart_rx_program);
+		uart_rx_program_init(cfg->pio, cfg->sm_rx, offset,
+				     cfg->pin_rx, cfg->baud);
+	}
+
+	cfg->dma_tx = dma_claim_unused_channel(false);
 
-	/* Install and start the RX program */
-	offset = pio_add_program(cfg->pio, &uart_rx_program);
-	uart_rx_program_init(cfg->pio, cfg->sm_rx, offset,
-			     cfg->pin_rx, cfg->baud);
+	if (cfg->dma_tx < 0) {
+		return UART_PIO_E_HARDWARE_FAIL;
+	}
+
+	/* Drain the RX FIFO into the ring from now on */
+	cfg->dma_rx = dma_claim_unused_channel(false);
+
+	if (cfg->dma_rx < 0) {
+		dma_channel_unclaim(cfg->dma_tx);
+		return UART_PIO_E_HARDWARE_FAIL;
+	}
+
+	cfg->rx_base = 0;
+	cfg->rx_read = 0;
+	memset(&cfg->rx_stats, 0, sizeof(cfg->rx_stats));
+	cfg->pio->irq = _UART_PIO_RX_FLAG(cfg);
+
+	_uart_pio_rx_start(cfg);
 
 	return UART_PIO_OK;
 }
@@ -43,11 +95,16 @@ bool uart_pio_is_writable(uart_pio_cfg *cfg)
 
 bool uart_pio_is_readable(uart_pio_cfg *cfg)
 {
-	return !pio_sm_is_rx_fifo_empty(cfg->pio, cfg->sm_rx);
+	return _uart_pio_rx_update(cfg) > 0;
 }
 
 void uart_pio_putc_blocking(uart_pio_cfg *cfg, char c)
 {
+	/* Keep the order of characters sent by DMA */
+	while (uart_pio_write_busy(cfg)) {
+		tight_loop_contents();
+	}
+
 	uart_tx_program_putc(cfg->pio, cfg->sm_tx, c);
 }
 
@@ -64,10 +121,10 @@ bool uart_pio_putc_timeout(uart_pio_cfg *cfg, char c, uint64_t us)
 {
 	absolute_time_t to = make_timeout_time_us(us);
 
-	while (!uart_pio_is_writable(cfg) &&
+	while ((uart_pio_write_busy(cfg) || !uart_pio_is_writable(cfg)) &&
 	       absolute_time_diff_us(to, get_absolute_time()) < 0);
 
-	if (uart_pio_is_writable(cfg)) {
+	if (!uart_pio_write_busy(cfg) && uart_pio_is_writable(cfg)) {
 		uart_pio_putc_blocking(cfg, c);
 		return true;
 	}
@@ -78,42 +135,195 @@ bool uart_pio_putc_timeout(uart_pio_cfg *cfg, char c, uint64_t us)
 bool uart_pio_puts_timeout(uart_pio_cfg *cfg, const char *s,
 			   uint64_t us)
 {
-	int i = 0;
+	return uart_pio_write_timeout(cfg, s, strlen(s), us);
+}
 
-	while (s[i] != '\0') {
-		if (!uart_pio_putc_timeout(cfg, s[i++], us)) {
-			return false;
+bool uart_pio_write_async(uart_pio_cfg *cfg, const void *buf,
+			  size_t len)
+{
+	dma_channel_config c;
+
+	if (uart_pio_write_busy(cfg)) {
+		return false;
+	}
+
+	/* Narrow writes are replicated across the FIFO word, and the
+	 * TX program shifts out the low byte */
+	c = dma_channel_get_default_config(cfg->dma_tx);
+	channel_config_set_transfer_data_size(&c, DMA_SIZE_8);
+	channel_config_set_read_increment(&c, true);
+	channel_config_set_write_increment(&c, false);
+	channel_config_set_dreq(&c, pio_get_dreq(cfg->pio, cfg->sm_tx,
+						 true));
+
+	dma_channel_configure(cfg->dma_tx, &c, &cfg->pio->txf[cfg->sm_tx],
+			      buf, len, true);
+
+	return true;
+}
+
+bool uart_pio_write_busy(uart_pio_cfg *cfg)
+{
+	return dma_channel_is_busy(cfg->dma_tx);
+}
+
+bool uart_pio_write_wait(uart_pio_cfg *cfg, absolute_time_t deadline)
+{
+	while (uart_pio_write_busy(cfg)) {
+		if (time_reached(deadline)) {
+			return !uart_pio_write_busy(cfg);
 		}
+
+		tight_loop_contents();
 	}
 
 	return true;
 }
 
-char uart_pio_getc_blocking(uart_pio_cfg *cfg)
+size_t uart_pio_write_abort(uart_pio_cfg *cfg)
 {
-	return uart_rx_program_getc(cfg->pio, cfg->sm_rx);
+	dma_channel_abort(cfg->dma_tx);
+
+	return dma_channel_hw_addr(cfg->dma_tx)->transfer_count;
 }
 
-bool uart_pio_getc_timeout(uart_pio_cfg *cfg, char *c, uint64_t us)
+bool uart_pio_write_timeout(uart_pio_cfg *cfg, const void *buf,
+			    size_t len, uint64_t us)
 {
 	absolute_time_t to = make_timeout_time_us(us);
-	bool readable;
 
-	while (!(readable = uart_pio_is_readable(cfg)) &&
-	       absolute_time_diff_us(to, get_absolute_time()) < 0) {
-		tight_loop_contents();
+	/* Finish anything still going out first, within the same
+	 * deadline */
+	if (!uart_pio_write_wait(cfg, to) ||
+	    !uart_pio_write_async(cfg, buf, len)) {
+		return false;
 	}
 
-	if (readable) {
-		*c = uart_pio_getc_blocking(cfg);
+	if (uart_pio_write_wait(cfg, to)) {
 		return true;
 	}
 
+	DEBUGMSG("UART PIO write timeout");
+	uart_pio_write_abort(cfg);
+
+	return false;
+}
+
+char uart_pio_getc_blocking(uart_pio_cfg *cfg)
+{
+	char c;
+
+	while (!uart_pio_try_getc(cfg, &c)) {
+		tight_loop_contents();
+	}
+
+	return c;
+}
+
+bool uart_pio_getc_timeout(uart_pio_cfg *cfg, char *c, uint64_t us)
+{
+	if (uart_pio_rx_wait_until(cfg, 1, make_timeout_time_us(us))) {
+		return uart_pio_try_getc(cfg, c);
+	}
+
 	*c = '\0';
 
 	return false;
 }
 
+size_t uart_pio_rx_available(uart_pio_cfg *cfg)
+{
+	return _uart_pio_rx_update(cfg);
+}
+
+bool uart_pio_try_getc(uart_pio_cfg *cfg, char *c)
+{
+	if (!_uart_pio_rx_update(cfg)) {
+		return false;
+	}
+
+	*c = (char) cfg->rx_ring[cfg->rx_read++ & _UART_PIO_RX_MASK];
+
+	return true;
+}
+
+size_t uart_pio_read(uart_pio_cfg *cfg, uint8_t *buf, size_t len)
+{
+	size_t n = _uart_pio_rx_update(cfg);
+	size_t tail = cfg->rx_read & _UART_PIO_RX_MASK;
+	size_t first;
+
+	if (n > len) {
+		n = len;
+	}
+
+	/* Copy up to the end of the ring, then from its start */
+	first = UART_PIO_RX_RING_SIZE - tail;
+
+	if (first > n) {
+		first = n;
+	}
+
+	memcpy(buf, &cfg->rx_ring[tail], first);
+	memcpy(&buf[first], cfg->rx_ring, n - first);
+
+	cfg->rx_read += n;
+
+	return n;
+}
+
+bool uart_pio_rx_wait_until(uart_pio_cfg *cfg, size_t n,
+			    absolute_time_t deadline)
+{
+	if (n > UART_PIO_RX_RING_SIZE) {
+		n = UART_PIO_RX_RING_SIZE;
+	}
+
+	while (_uart_pio_rx_update(cfg) < n) {
+		if (time_reached(deadline)) {
+			return _uart_pio_rx_update(cfg) >= n;
+		}
+
+		tight_loop_contents();
+	}
+
+	return true;
+}
+
+void uart_pio_get_rx_stats(uart_pio_cfg *cfg, uart_pio_rx_stats *s)
+{
+	_uart_pio_rx_update(cfg);
+
+	*s = cfg->rx_stats;
+	s->received = _uart_pio_rx_written(cfg);
+}
+
+bool uart_pio_set_baud(uart_pio_cfg *cfg, uint baud, uint64_t us)
+{
+	absolute_time_t to = make_timeout_time_us(us);
+
+	if (!uart_pio_write_wait(cfg, to)) {
+		return false;
+	}
+
+	while (!pio_sm_is_tx_fifo_empty(cfg->pio, cfg->sm_tx)) {
+		if (time_reached(to)) {
+			return false;
+		}
+
+		tight_loop_contents();
+	}
+
+	/* The last character is still being shifted out */
+	sleep_us(_UART_PIO_CHAR_US(cfg->baud));
+
+	uart_tx_program_set_baud(cfg->pio, cfg->sm_tx, baud);
+	uart_rx_program_set_baud(cfg->pio, cfg->sm_rx, baud);
+	cfg->baud = baud;
+
+	return true;
+}
+
 void uart_pio_flush_tx(uart_pio_cfg *cfg)
 {
 	pio_sm_clear_fifos(cfg->pio, cfg->sm_tx);
@@ -121,5 +331,92 @@ void uart_pio_flush_tx(uart_pio_cfg *cfg)
 
 void uart_pio_flush_rx(uart_pio_cfg *cfg)
 {
-	/* pio_sm_clear_fifos(cfg->pio, cfg->sm_rx); */
+	_uart_pio_rx_update(cfg);
+	cfg->rx_read = _uart_pio_rx_written(cfg);
+}
+
+/*
+**********************************************************************
+*********************** INTERNAL FUNCTIONS ***************************
+**********************************************************************
+*/
+
+void _uart_pio_rx_start(uart_pio_cfg *cfg)
+{
+	dma_channel_config c = dma_channel_get_default_config(cfg->dma_rx);
+
+	/* Data is left justified in the FIFO word, so only read its
+	 * upper byte */
+	channel_config_set_transfer_data_size(&c, DMA_SIZE_8);
+	channel_config_set_read_increment(&c, false);
+	channel_config_set_write_increment(&c, true);
+	channel_config_set_ring(&c, true, UART_PIO_RX_RING_BITS);
+	channel_config_set_dreq(&c, pio_get_dreq(cfg->pio, cfg->sm_rx,
+						 false));
+
+	/* With flow control the channel only takes what the ring has
+	 * room for, the rest stays in the FIFO and holds off the
+	 * sender with RTS */
+	if (cfg->flow) {
+		cfg->rx_armed = UART_PIO_RX_RING_SIZE -
+			(cfg->rx_base - cfg->rx_read);
+	} else {
+		cfg->rx_armed = _UART_PIO_RX_COUNT;
+	}
+
+	dma_channel_configure(cfg->dma_rx, &c,
+			      &cfg->rx_ring[cfg->rx_base & _UART_PIO_RX_MASK],
+			      (io_rw_8*) &cfg->pio->rxf[cfg->sm_rx] + 3,
+			      cfg->rx_armed, cfg->rx_armed > 0);
+}
+
+uint32_t _uart_pio_rx_written(uart_pio_cfg *cfg)
+{
+	return cfg->rx_base + (cfg->rx_armed -
+			       dma_channel_hw_addr(cfg->dma_rx)->transfer_count);
+}
+
+bool _uart_pio_rx_rearm_due(uart_pio_cfg *cfg)
+{
+	const uint32_t left = dma_channel_hw_addr(cfg->dma_rx)->transfer_count;
+	uint32_t unarmed;
+
+	if (!cfg->flow) {
+		return left < _UART_PIO_RX_REARM;
+	}
+
+	/* Room the reader made since the channel was started, taken
+	 * once it is worth restarting for or the channel ran out */
+	unarmed = UART_PIO_RX_RING_SIZE - (cfg->rx_base + cfg->rx_armed -
+					   cfg->rx_read);
+
+	return unarmed >= UART_PIO_RX_RING_SIZE / 2 || (!left && unarmed);
+}
+
+size_t _uart_pio_rx_update(uart_pio_cfg *cfg)
+{
+	uint32_t avail;
+
+	if (cfg->pio->irq & _UART_PIO_RX_FLAG(cfg)) {
+		cfg->pio->irq = _UART_PIO_RX_FLAG(cfg);
+		++cfg->rx_stats.framing;
+	}
+
+	/* Anything received meanwhile waits in the FIFO */
+	if (_uart_pio_rx_rearm_due(cfg)) {
+		dma_channel_abort(cfg->dma_rx);
+		cfg->rx_base = _uart_pio_rx_written(cfg);
+		_uart_pio_rx_start(cfg);
+	}
+
+	/* If the DMA lapped the reader the oldest data is gone */
+	avail = _uart_pio_rx_written(cfg) - cfg->rx_read;
+
+	if (avail > UART_PIO_RX_RING_SIZE) {
+		cfg->rx_stats.overruns += avail - UART_PIO_RX_RING_SIZE;
+		cfg->rx_read += avail - UART_PIO_RX_RING_SIZE;
+		avail = UART_PIO_RX_RING_SIZE;
+	}
+
+	return avail;
 }
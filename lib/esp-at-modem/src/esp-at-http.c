@@ -0,0 +1,363 @@
+/*
+* Copyright (c) 2022 Tyler J. Anderson.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions
+* are met:
+*
+* 1. Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+*
+* 2. Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in
+*    the documentation and/or other materials provided with the
+*    distribution.
+*
+* 3. Neither the name of the copyright holder nor the names of its
+*    contributors may be used to endorse or promote products derived
+*    from this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+* "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+* LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+* FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+* COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+* INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+* BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+* CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+* LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+* ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+ * @file esp-at-http.c
+ *
+ * @brief Minimal HTTP endpoint on the server of the ESP-AT module
+ */
+
+#include "esp-at-http.h"
+#include "debugmsg.h"
+
+#include <string.h>
+#include <stdio.h>
+
+#include "pico/stdlib.h"
+
+#define _ESP_HTTP_HEAD_LEN 192
+
+#define ARRAY_LEN(array) sizeof(array)/sizeof(array[0])
+
+static void _esp_http_urc(const esp_at_urc *urc, void *ctx);
+static void _esp_http_ipd(esp_at_http *srv, int link, const char *data,
+			  size_t len);
+static bool _esp_http_method(const char *req);
+static void _esp_http_answer(esp_at_http *srv, int link);
+static void _esp_http_release(esp_at_http *srv, int link);
+static void _esp_http_lock(esp_at_http *srv);
+static void _esp_http_unlock(esp_at_http *srv);
+
+int esp_at_http_init(esp_at_http *srv, esp_at_cfg *cfg)
+{
+	memset(srv, 0, sizeof(*srv));
+	srv->cfg = cfg;
+
+#ifdef ESP_AT_MULTICORE_ENABLED
+	critical_section_init(&srv->cs);
+#endif /* #ifdef ESP_AT_MULTICORE_ENABLED */
+
+	return esp_at_urc_register(cfg, _esp_http_urc, srv);
+}
+
+int esp_at_http_route_add(esp_at_http *srv, const char *path,
+			  const char *type, char *store, size_t size)
+{
+	esp_at_http_route *r;
+
+	if (srv->nroutes >= ARRAY_LEN(srv->routes)) {
+		return -1;
+	}
+
+	r = &srv->routes[srv->nroutes];
+	memset(r, 0, sizeof(*r));
+	r->path = path;
+	r->type = type;
+	r->buf[0] = store;
+	r->buf[1] = &store[size];
+	r->size = size;
+
+	return srv->nroutes++;
+}
+
+char *esp_at_http_render(esp_at_http *srv, int route, size_t *size)
+{
+	esp_at_http_route *r;
+	char *buf = NULL;
+
+	if (route < 0 || route >= (int) srv->nroutes) {
+		return NULL;
+	}
+
+	r = &srv->routes[route];
+
+	/* The spare body may still be going out from before the last
+	 * publish */
+	_esp_http_lock(srv);
+
+	if (!r->busy[!r->front]) {
+		buf = r->buf[!r->front];
+	}
+
+	_esp_http_unlock(srv);
+
+	*size = r->size;
+
+	return buf;
+}
+
+void esp_at_http_publish(esp_at_http *srv, int route, size_t len)
+{
+	esp_at_http_route *r;
+
+	if (route < 0 || route >= (int) srv->nroutes) {
+		return;
+	}
+
+	r = &srv->routes[route];
+
+	_esp_http_lock(srv);
+
+	r->len[!r->front] = len < r->size ? len : r->size;
+	r->front = !r->front;
+	r->published = true;
+
+	_esp_http_unlock(srv);
+}
+
+int esp_at_http_process(esp_at_http *srv)
+{
+	int n = 0;
+
+	for (int link = 0; link < ESP_AT_MAX_CONN; ++link) {
+		esp_at_http_req *req = &srv->req[link];
+
+		if (srv->ready & (1u << link)) {
+			_esp_http_answer(srv, link);
+			++n;
+		} else if (req->open && req->len == 0 &&
+			   time_reached(req->hold)) {
+			/* Quiet for too long, a client of the stream */
+			_esp_http_release(srv, link);
+		}
+	}
+
+	return n;
+}
+
+/*
+**********************************************************************
+*********************** INTERNAL FUNCTIONS ***************************
+**********************************************************************
+*/
+
+void _esp_http_urc(const esp_at_urc *urc, void *ctx)
+{
+	esp_at_http *srv = ctx;
+	esp_at_cfg *cfg = srv->cfg;
+	esp_at_http_req *req;
+
+	if (urc->type == ESP_AT_URC_WIFI_DISCONNECT) {
+		/* All links are gone with the network */
+		memset(srv->req, 0, sizeof(srv->req));
+		srv->ready = 0;
+		cfg->http_links = 0;
+		return;
+	}
+
+	if (urc->link < 0 || urc->link >= ESP_AT_MAX_CONN) {
+		return;
+	}
+
+	req = &srv->req[urc->link];
+
+	switch (urc->type) {
+	case ESP_AT_URC_CONNECT:
+		if (cfg->udp_links & (1u << urc->link)) {
+			break;
+		}
+
+		/* Kept out of the stream until it turns out not to
+		 * send a request */
+		req->len = 0;
+		req->open = true;
+		req->hold = make_timeout_time_ms(ESP_AT_HTTP_HOLD_MS);
+		cfg->http_links |= 1u << urc->link;
+		break;
+	case ESP_AT_URC_CLOSED:
+		req->len = 0;
+		req->open = false;
+		srv->ready &= ~(1u << urc->link);
+		cfg->http_links &= ~(1u << urc->link);
+		break;
+	case ESP_AT_URC_IPD:
+		_esp_http_ipd(srv, urc->link, urc->data, urc->len);
+		break;
+	default:
+		break;
+	}
+}
+
+void _esp_http_ipd(esp_at_http *srv, int link, const char *data,
+		   size_t len)
+{
+	esp_at_http_req *req = &srv->req[link];
+	size_t n = ARRAY_LEN(req->buf) - 1 - req->len;
+
+	/* Only the start of the request is kept, the rest of it and
+	 * anything after it is dropped */
+	if (!req->open || (srv->ready & (1u << link))) {
+		return;
+	}
+
+	if (n > len) {
+		n = len;
+	}
+
+	memcpy(&req->buf[req->len], data, n);
+	req->len += n;
+	req->buf[req->len] = '\0';
+
+	/* Any other data is for the program, from a client of the
+	 * stream */
+	if (!_esp_http_method(req->buf)) {
+		_esp_http_release(srv, link);
+		return;
+	}
+
+	if (strstr(req->buf, "\r\n\r\n") ||
+	    (req->len == ARRAY_LEN(req->buf) - 1 &&
+	     strstr(req->buf, "\r\n"))) {
+		srv->ready |= 1u << link;
+	}
+}
+
+bool _esp_http_method(const char *req)
+{
+	static const char *const methods[] = {"GET ", "HEAD "};
+	const size_t len = strlen(req);
+
+	/* As far as it was received */
+	for (unsigned int i = 0; i < ARRAY_LEN(methods); ++i) {
+		const size_t n = strlen(methods[i]);
+
+		if (strncmp(req, methods[i], len < n ? len : n) == 0) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void _esp_http_answer(esp_at_http *srv, int link)
+{
+	esp_at_http_req *req = &srv->req[link];
+	const bool head = strncmp(req->buf, "HEAD ", 5) == 0;
+	const char *path = &req->buf[head ? 5 : 4];
+	const size_t plen = strcspn(path, " ?\r\n");
+	const char *status = "404 Not Found";
+	const char *type = "text/plain; charset=utf-8";
+	const char *body = "Not found\n";
+	size_t blen = strlen(body);
+	esp_at_http_route *r = NULL;
+	unsigned int b = 0;
+	bool served = false;
+	char hdr[_ESP_HTTP_HEAD_LEN];
+	char cmd[24];
+	char rsp[64];
+	int hlen;
+
+	for (unsigned int i = 0; i < srv->nroutes; ++i) {
+		if (strlen(srv->routes[i].path) == plen &&
+		    strncmp(srv->routes[i].path, path, plen) == 0) {
+			r = &srv->routes[i];
+			break;
+		}
+	}
+
+	/* The published body is sent from where it was rendered, and
+	 * not rendered into until it went out */
+	if (r) {
+		_esp_http_lock(srv);
+
+		if (r->published) {
+			b = r->front;
+			r->busy[b] = true;
+			served = true;
+			status = "200 OK";
+			type = r->type;
+			body = r->buf[b];
+			blen = r->len[b];
+		} else {
+			status = "503 Service Unavailable";
+			body = "No data yet\n";
+			blen = strlen(body);
+		}
+
+		_esp_http_unlock(srv);
+	}
+
+	hlen = snprintf(hdr, ARRAY_LEN(hdr),
+			"HTTP/1.1 %s\r\n"
+			"Content-Type: %s\r\n"
+			"Content-Length: %u\r\n"
+			"Cache-Control: no-cache\r\n"
+			"Connection: close\r\n\r\n",
+			status, type, (unsigned int) blen);
+
+	DEBUGDATA("HTTP answer", status, "%s");
+
+	if (esp_at_cipsend_head(srv->cfg, link, hdr, hlen, body,
+				head ? 0 : blen) < 0) {
+		DEBUGDATA("HTTP answer failed on link", link, "%d");
+	}
+
+	if (served) {
+		_esp_http_lock(srv);
+		r->busy[b] = false;
+		++r->requests;
+		_esp_http_unlock(srv);
+	} else {
+		++srv->errors;
+	}
+
+	srv->ready &= ~(1u << link);
+	req->open = false;
+	req->len = 0;
+
+	/* The answer ends with the connection, its CLOSED takes the
+	 * link off the HTTP ones */
+	snprintf(cmd, ARRAY_LEN(cmd), "AT+CIPCLOSE=%d", link);
+	esp_at_send_cmd(srv->cfg, cmd, rsp, ARRAY_LEN(rsp));
+}
+
+void _esp_http_release(esp_at_http *srv, int link)
+{
+	srv->req[link].open = false;
+	srv->req[link].len = 0;
+	srv->cfg->http_links &= ~(1u << link);
+}
+
+void _esp_http_lock(esp_at_http *srv)
+{
+#ifdef ESP_AT_MULTICORE_ENABLED
+	critical_section_enter_blocking(&srv->cs);
+#endif /* #ifdef ESP_AT_MULTICORE_ENABLED */
+}
+
+void _esp_http_unlock(esp_at_http *srv)
+{
+#ifdef ESP_AT_MULTICORE_ENABLED
+	critical_section_exit(&srv->cs);
+#endif /* #ifdef ESP_AT_MULTICORE_ENABLED */
+}
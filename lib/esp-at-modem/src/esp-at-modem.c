@@ -46,44 +46,231 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <limits.h>
+#include <ctype.h>
 
 #include "pico/stdlib.h"
 #ifdef ESP_AT_MULTICORE_ENABLED
 #include "pico/multicore.h"
+#include "pico/critical_section.h"
 #endif /* #ifdef ESP_AT_MULTICORE_ENABLED */
 
 #define _ESP_EN_DELAY_US 5000000
 #define _ESP_RESET_HOLD_US 20000
 #define _ESP_RESPONSE_BUFFER_LEN 2048
 #define _ESP_UART_WAIT_US 500000
+#define _ESP_BUSY_RETRY_US 10000
+#define _ESP_BAUD_SWITCH_US 20000
+#define _ESP_BAUD_TRIES 3
+#define _ESP_THROUGHPUT_CHUNK 1024
+#define _ESP_THROUGHPUT_LEN 16384
 
 #define ARRAY_LEN(array) sizeof(array)/sizeof(array[0])
 
 #ifdef ESP_AT_MULTICORE_ENABLED
 static recursive_mutex_t _esp_mtx;
-#endif /* #ifdef ESP_AT_MULTICORE_ENABLED */
 
-static int _esp_query(esp_at_cfg * cfg, const char * cmd,
-		      at_rsp_lines *rsp);
+/* Only guards the command queue, so submitting never waits for the
+ * core holding the module */
+static critical_section_t _esp_cmdq_cs;
+#endif /* #ifdef ESP_AT_MULTICORE_ENABLED */
 
 static void _esp_en_gpio_setup(esp_at_cfg * cfg);
 static void _esp_reset_gpio_setup(esp_at_cfg * cfg);
 static void _esp_set_enabled(esp_at_cfg * cfg, bool en); /* True to enable, false to disable */
 static void _esp_reset(esp_at_cfg * cfg);
-static int _esp_cipsend_data(esp_at_cfg * cfg, const char *data,
-			     size_t len,
-			     unsigned int client_index);
-static int _esp_check_cipsta(esp_at_cfg * cfg,
-			     esp_at_status *clientlist);
-static int _esp_check_cipstatus(esp_at_cfg * cfg,
-				esp_at_status *clientlist);
-static int _esp_check_cipmux(esp_at_cfg * cfg,
-			     esp_at_status *clientlist);
-static int _esp_transmit_cmd(esp_at_cfg *cfg, const char *cmd);
-static int _esp_receive_response(esp_at_cfg *cfg, char *rsp,
-				 size_t len);
-static bool _esp_check_at_end_sequence(const char *rsp);
-static int _esp_check_rsp_success(const char *rsp);
+static int _esp_fanout(esp_at_cfg *cfg, const char *data, size_t len,
+		       const int *links, unsigned int nlinks);
+static int _esp_send_link(esp_at_cfg *cfg, int link, const void *hdr,
+			  size_t hlen, const char *data, size_t len,
+			  absolute_time_t deadline);
+static int _esp_send_exchange(esp_at_cfg *cfg, int link, const char *cmd,
+			      const void *hdr, size_t hlen,
+			      const char *data, size_t len,
+			      absolute_time_t deadline);
+static int _esp_send_wait(esp_at_cfg *cfg, int link);
+static int _esp_uart_cur(esp_at_cfg *cfg, uint baud, bool answer);
+static int _esp_check_baud(esp_at_cfg *cfg, uint baud);
+static void _esp_probe(esp_at_cfg *cfg);
+static int _esp_next_event(esp_at_cfg *cfg, absolute_time_t deadline,
+			   at_frame_event *ev);
+static bool _esp_send_pending(esp_at_cfg *cfg, int link);
+static void _esp_send_queue(esp_at_cfg *cfg, int link);
+static void _esp_send_done(esp_at_cfg *cfg, bool ok);
+static void _esp_send_expire(esp_at_cfg *cfg);
+
+/* Rates tried when negotiating, fastest first */
+static const uint _esp_bauds[] = {3000000, 2000000, 1000000, 921600,
+				  460800, 230400, 115200};
+
+static void _esp_cipsta_line(const at_rsp_line_view *line,
+			     at_frame_event ev, void *ctx);
+static void _esp_cipstatus_line(const at_rsp_line_view *line,
+				at_frame_event ev, void *ctx);
+static void _esp_cipstate_line(const at_rsp_line_view *line,
+			       at_frame_event ev, void *ctx);
+static void _esp_cipmux_line(const at_rsp_line_view *line,
+			     at_frame_event ev, void *ctx);
+static bool _esp_client_line(esp_at_cfg *cfg,
+			     const at_rsp_line_view *line,
+			     const at_rsp_field *fields,
+			     unsigned int nfields);
+static int _esp_cipsta_commit(esp_at_cfg *cfg);
+static int _esp_cipstatus_commit(esp_at_cfg *cfg);
+static int _esp_cipstate_commit(esp_at_cfg *cfg);
+static int _esp_cipmux_commit(esp_at_cfg *cfg);
+
+/* A query for part of the cached status. The answer is parsed line
+ * by line into status_next as it arrives, and the commit takes the
+ * part of it into the cache once it is OK */
+typedef struct {
+	const char *cmd;
+	at_push_cb push;
+	int (*commit)(esp_at_cfg*);
+} _esp_query;
+
+/* Parts of the cached status, with the query answering each and a
+ * cheaper one for modules with the capability cap */
+static const struct {
+	unsigned int field;
+	_esp_query query;
+	unsigned int cap;
+	_esp_query fast;
+	uint32_t ttl_ms;
+} _esp_fields[ESP_AT_FIELD_COUNT] = {
+	{ESP_AT_FIELD_ADDR,
+	 {"AT+CIPSTA?", {_esp_cipsta_line, NULL, NULL}, _esp_cipsta_commit},
+	 0, {NULL}, ESP_AT_TTL_ADDR_MS},
+	/* Some ESP8266 firmware lacks AT+CIPSTATE, AT+CIPSTATUS has the
+	 * links too along with the station state */
+	{ESP_AT_FIELD_CLIENTS,
+	 {"AT+CIPSTATUS", {_esp_cipstatus_line, NULL, NULL},
+	  _esp_cipstatus_commit},
+	 ESP_AT_CAP_CIPSTATE,
+	 {"AT+CIPSTATE?", {_esp_cipstate_line, NULL, NULL},
+	  _esp_cipstate_commit},
+	 ESP_AT_TTL_CLIENTS_MS},
+	{ESP_AT_FIELD_MUX,
+	 {"AT+CIPMUX?", {_esp_cipmux_line, NULL, NULL}, _esp_cipmux_commit},
+	 0, {NULL}, ESP_AT_TTL_MUX_MS}
+};
+
+/* Fields of the answers to the status queries, in the order of
+ * their tokens */
+static const at_rsp_field _esp_cipsta_fields[] = {
+	{.preamble = "+CIPSTA", .key = "ip", .index = 1,
+	 .type = AT_RSP_FIELD_STR, AT_RSP_MEMBER(esp_at_status, ipv4)},
+	{.preamble = "+CIPSTA", .key = "gateway", .index = 1,
+	 .type = AT_RSP_FIELD_STR,
+	 AT_RSP_MEMBER(esp_at_status, ipv4_gateway)},
+	{.preamble = "+CIPSTA", .key = "netmask", .index = 1,
+	 .type = AT_RSP_FIELD_STR,
+	 AT_RSP_MEMBER(esp_at_status, ipv4_netmask)}
+};
+
+/* The value of STATUS, which is kept as bits */
+static const at_rsp_field _esp_stat_fields[] = {
+	{.preamble = "STATUS", .index = 0, .type = AT_RSP_FIELD_INT,
+	 .offset = 0, .size = sizeof(int)}
+};
+
+static const at_rsp_field_name _esp_protos[] = {
+	{"TCP", ESP_AT_CIP_PROTO_TCP},
+	{"TCPv6", ESP_AT_CIP_PROTO_TCPV6},
+	{"UDP", ESP_AT_CIP_PROTO_UDP},
+	{"UDPv6", ESP_AT_CIP_PROTO_UDPV6},
+	{"SSL", ESP_AT_CIP_PROTO_SSL},
+	{"SSLv6", ESP_AT_CIP_PROTO_SSLV6},
+	{NULL, ESP_AT_CIP_PROTO_NULL}
+};
+
+static const at_rsp_field _esp_client_fields[] = {
+	{.preamble = "+CIPSTATUS", .index = 0, .type = AT_RSP_FIELD_INT,
+	 AT_RSP_MEMBER(esp_at_clients, index)},
+	{.preamble = "+CIPSTATUS", .index = 1, .type = AT_RSP_FIELD_NAME,
+	 AT_RSP_MEMBER(esp_at_clients, proto), .names = _esp_protos},
+	{.preamble = "+CIPSTATUS", .index = 2, .type = AT_RSP_FIELD_STR,
+	 AT_RSP_MEMBER(esp_at_clients, ipv4)},
+	{.preamble = "+CIPSTATUS", .index = 3, .type = AT_RSP_FIELD_INT,
+	 AT_RSP_MEMBER(esp_at_clients, r_port)},
+	{.preamble = "+CIPSTATUS", .index = 4, .type = AT_RSP_FIELD_INT,
+	 AT_RSP_MEMBER(esp_at_clients, l_port)},
+	{.preamble = "+CIPSTATUS", .index = 5, .type = AT_RSP_FIELD_INT,
+	 AT_RSP_MEMBER(esp_at_clients, passive)}
+};
+
+/* The same fields in the lines of AT+CIPSTATE? */
+static const at_rsp_field _esp_cipstate_fields[] = {
+	{.preamble = "+CIPSTATE", .index = 0, .type = AT_RSP_FIELD_INT,
+	 AT_RSP_MEMBER(esp_at_clients, index)},
+	{.preamble = "+CIPSTATE", .index = 1, .type = AT_RSP_FIELD_NAME,
+	 AT_RSP_MEMBER(esp_at_clients, proto), .names = _esp_protos},
+	{.preamble = "+CIPSTATE", .index = 2, .type = AT_RSP_FIELD_STR,
+	 AT_RSP_MEMBER(esp_at_clients, ipv4)},
+	{.preamble = "+CIPSTATE", .index = 3, .type = AT_RSP_FIELD_INT,
+	 AT_RSP_MEMBER(esp_at_clients, r_port)},
+	{.preamble = "+CIPSTATE", .index = 4, .type = AT_RSP_FIELD_INT,
+	 AT_RSP_MEMBER(esp_at_clients, l_port)},
+	{.preamble = "+CIPSTATE", .index = 5, .type = AT_RSP_FIELD_INT,
+	 AT_RSP_MEMBER(esp_at_clients, passive)}
+};
+
+static const at_rsp_field _esp_cipmux_fields[] = {
+	{.preamble = "+CIPMUX", .index = 0, .type = AT_RSP_FIELD_INT,
+	 .offset = 0, .size = sizeof(int)}
+};
+
+/* Time each command may take from submission to its result. Keep
+ * ESP_AT_CMD_LIMIT_COUNT in step */
+static const struct {
+	const char *name;
+	uint32_t ms;
+} _esp_limits[ESP_AT_CMD_LIMIT_COUNT] = {
+	{"AT", 200},
+	{"AT+GMR", 500},
+	{"AT+CIPSTA", 500},
+	{"AT+CIPSTATUS", 500},
+	{"AT+CIPSTATE", 500},
+	{"AT+CIPMUX", 500},
+	{"AT+CIPMODE", 500},
+	{"AT+CWSTATE", 500},
+	{"AT+UART_CUR", 500},
+	{"AT+SLEEP", 500},
+	{"AT+GSLP", 500},
+	{"AT+CIPSERVER", 1000},
+	{"AT+CIPCLOSE", 1000},
+	{"AT+CIPSEND", 2000}, /* Prompt, data and its acceptance */
+	{"AT+CIPSENDL", 2000}, /* Plus the time the data takes */
+	{"AT+CIPSTART", 10000},
+	{"AT+CWLAP", 10000},
+	{"AT+CWJAP", 20000}
+};
+
+static int _esp_transmit_cmd(esp_at_cfg *cfg, const char *cmd,
+			     absolute_time_t deadline);
+static unsigned int _esp_cmd_limit(const char *cmd);
+static void _esp_cmd_record(esp_at_cfg *cfg, const char *cmd,
+			    esp_at_cmd_state state, int64_t us);
+static int _esp_poll(esp_at_cfg *cfg);
+static void _esp_cmd_feed(esp_at_cfg *cfg, char c, at_frame_event *ev);
+static void _esp_cmd_run(esp_at_cfg *cfg);
+static void _esp_cmd_finish(esp_at_cfg *cfg, esp_at_cmd *cmd,
+			    esp_at_cmd_state state);
+static void _esp_cmd_step(esp_at_cfg *cfg);
+static void _esp_cmd_drain(esp_at_cfg *cfg);
+static const _esp_query *_esp_field_query(esp_at_cfg *cfg,
+					  unsigned int i);
+static int _esp_status_query(esp_at_cfg *cfg, unsigned int i);
+static void _esp_status_done(esp_at_cmd *cmd, void *ctx);
+static int _esp_rx_char(esp_at_cfg *cfg, char c, at_frame_event *ev);
+static void _esp_urc_line(esp_at_cfg *cfg, const char *line);
+static size_t _esp_urc_ipd(esp_at_cfg *cfg, const char *line);
+static void _esp_ipd_flush(esp_at_cfg *cfg);
+static void _esp_transparent_on(esp_at_cmd *cmd, void *ctx);
+static void _esp_urc_track(esp_at_cfg *cfg, const esp_at_urc *urc);
+static void _esp_urc_dispatch(esp_at_cfg *cfg, const esp_at_urc *urc);
+static uint8_t _esp_netmask_prefix(const char *nm);
+static uint32_t _esp_ipv4_parse(const char *s);
+static void _esp_throughput_report(esp_at_cfg *cfg);
 
 /*
 **********************************************************************
@@ -103,12 +290,34 @@ int esp_at_init_module(esp_at_cfg *cfg, PIO pio, uint sm_tx,
 
 #ifdef ESP_AT_MULTICORE_ENABLED
 	recursive_mutex_init(&_esp_mtx);
+	critical_section_init(&_esp_cmdq_cs);
 #endif /* #ifdef ESP_AT_MULTICORE_ENABLED */
 
 	cfg->ptr = NULL;
+	cfg->caps = 0;
+	cfg->at_version = 0;
+	cfg->transparent = false;
 	cfg->en_pin = en_pin;
 	cfg->reset_pin = reset_pin;
 
+	at_framer_init(&cfg->framer);
+	cfg->nurc = 0;
+	memset(&cfg->status, 0, sizeof(cfg->status));
+	cfg->status.cfg = cfg;
+	cfg->stale = ESP_AT_FIELD_ALL;
+	cfg->ipd_left = 0;
+	cfg->ipd_len = 0;
+	cfg->ack_head = 0;
+	cfg->nacks = 0;
+	memset(cfg->links, 0, sizeof(cfg->links));
+	memset(cfg->cmd_stats, 0, sizeof(cfg->cmd_stats));
+	cfg->cmdq_head = 0;
+	cfg->ncmdq = 0;
+	cfg->cmd = NULL;
+	cfg->cmd_busy = false;
+	cfg->status_field = -1;
+	cfg->status_rslt = 0;
+
 	/* Initialize gpio pins for enable and reset */
 	_esp_en_gpio_setup(cfg);
 	_esp_reset_gpio_setup(cfg);
@@ -135,6 +344,20 @@ int esp_at_init_module(esp_at_cfg *cfg, PIO pio, uint sm_tx,
 
 	if (rslt > 0) {
 		cfg->ptr = cfg;
+
+		/* Flow control is set along with the rate, turn it on
+		 * even if the rate stays */
+		if (cfg->uart_cfg.flow) {
+			if (_esp_uart_cur(cfg, baud, true) < 0) {
+				DEBUGMSG("ESP refused flow control");
+			}
+
+			esp_at_negotiate_baud(cfg, ESP_AT_BAUD_MAX_FLOW);
+		} else if (ESP_AT_BAUD_MAX > baud) {
+			esp_at_negotiate_baud(cfg, ESP_AT_BAUD_MAX);
+		}
+
+		_esp_probe(cfg);
 	}
 
 	return rslt;
@@ -156,653 +379,2199 @@ int esp_at_cipserver_init(esp_at_cfg *cfg)
 	ret = esp_at_send_cmd(cfg, "AT+CIPSERVER=1", rsp,
 			      ARRAY_LEN(rsp));
 
+	esp_at_status_invalidate(cfg, ESP_AT_FIELD_MUX |
+				 ESP_AT_FIELD_CLIENTS);
+
 	if (ret < 0) {
 		return ret;
 	}
 
+	/* AT+CIPSTATE doesn't tell, so keep track of it here */
+	cfg->status.status |= ESP_AT_STATUS_SERVER_ON;
+
 	return 0;
 }
 
 int esp_at_cipsend_string(esp_at_cfg *cfg, const char *s, size_t len,
 			  esp_at_status *clientlist)
 {
-	int ret;
+	int links[ESP_AT_MAX_CONN] = {0};
+	unsigned int n = 1;
+
+	len = strnlen(s, len);
 
-	if (strnlen(s, len) == 0)
+	if (len == 0)
 		return 0;
 
-	if (!clientlist) {
-		ret = _esp_cipsend_data(cfg, s, len, 0);
-		return ret;
+	/* A CIPSEND would only end up as data */
+	if (cfg->transparent) {
+		return -1;
 	}
 
-	for (unsigned int i = 0; i < clientlist->ncli; ++i) {
-		unsigned int ci = clientlist->cli[i].index;
+	if (clientlist) {
+		n = 0;
 
-		ret = _esp_cipsend_data(cfg, s, len, ci);
+		/* UDP links only carry their own datagrams, and quiet
+		 * and HTTP ones are answered by other means */
+		for (unsigned int i = 0; i < clientlist->ncli &&
+			     n < ARRAY_LEN(links); ++i) {
+			const int link = clientlist->cli[i].index;
 
-		if (ret < 0) {
-			return ret;
+			if (!((cfg->udp_links | cfg->quiet_links |
+			       cfg->http_links) & (1u << link))) {
+				links[n++] = link;
+			}
 		}
 	}
 
-	return 0;
+	return _esp_fanout(cfg, s, len, links, n);
 }
 
-int esp_at_cipstatus(esp_at_cfg *cfg, esp_at_status *clientlist)
+int esp_at_set_baud(esp_at_cfg *cfg, uint baud)
 {
-	int ret;
+	const uint old = cfg->uart_cfg.baud;
+	int ret = 0;
 
-	clientlist->cfg = cfg;
+	if (baud == old) {
+		return 0;
+	}
 
-	ret = _esp_check_cipsta(cfg, clientlist);
+#ifdef ESP_AT_MULTICORE_ENABLED
+	recursive_mutex_enter_blocking(&_esp_mtx);
+#endif /* #ifdef ESP_AT_MULTICORE_ENABLED */
 
-	if (ret < 0) {
-		return ret;
+	/* The module answers at the old rate and changes after */
+	if (_esp_uart_cur(cfg, baud, true) < 0) {
+		ret = -1;
+	} else if (_esp_check_baud(cfg, baud) < 0) {
+		DEBUGDATA("Falling back from baud", baud, "%u");
+
+		/* The module may not have understood the request, or
+		 * changed and the line doesn't carry the new rate */
+		_esp_uart_cur(cfg, old, false);
+		_esp_check_baud(cfg, old);
+		ret = -1;
 	}
 
-	ret = _esp_check_cipstatus(cfg, clientlist);
+#ifdef ESP_AT_MULTICORE_ENABLED
+	recursive_mutex_exit(&_esp_mtx);
+#endif /* #ifdef ESP_AT_MULTICORE_ENABLED */
 
-	if (ret < 0) {
-		return ret;
-	}
+	return ret;
+}
 
-	ret = _esp_check_cipmux(cfg, clientlist);
+uint esp_at_negotiate_baud(esp_at_cfg *cfg, uint max)
+{
+	for (unsigned int i = 0; i < ARRAY_LEN(_esp_bauds); ++i) {
+		if (_esp_bauds[i] > max ||
+		    _esp_bauds[i] <= cfg->uart_cfg.baud) {
+			continue;
+		}
 
-	if (ret < 0) {
-		return ret;
+		if (esp_at_set_baud(cfg, _esp_bauds[i]) == 0) {
+			break;
+		}
 	}
 
-	return 0;
+	DEBUGDATA("ESP UART baud", cfg->uart_cfg.baud, "%u");
+
+	return cfg->uart_cfg.baud;
 }
 
-int esp_at_send_cmd(esp_at_cfg *cfg, const char *cmd, char *rsp,
-		    unsigned int len)
+int32_t esp_at_measure_throughput(esp_at_cfg *cfg, int link,
+				  size_t len)
 {
-	int rslt;
+	char chunk[_ESP_THROUGHPUT_CHUNK];
+	absolute_time_t start;
+	uint32_t failed;
+	int64_t us;
+	int ret = 0;
+
+	if (link < 0 || link >= (int) ARRAY_LEN(cfg->links) || len == 0) {
+		return -1;
+	}
 
-	DEBUGDATA("Sending AT command", cmd, "%s");
+	memset(chunk, 'x', sizeof(chunk));
 
 #ifdef ESP_AT_MULTICORE_ENABLED
 	recursive_mutex_enter_blocking(&_esp_mtx);
 #endif /* #ifdef ESP_AT_MULTICORE_ENABLED */
 
-	/* Remove any junk that found its way into the RX buffer
-	 * before we try any commands */
-	uart_pio_flush_rx(&cfg->uart_cfg);
+	esp_at_poll(cfg);
+	_esp_send_expire(cfg);
 
-	/* Returns 0 if successful */
-	rslt = _esp_transmit_cmd(cfg, cmd);
+	start = get_absolute_time();
+	failed = cfg->links[link].failed;
 
-	if (rslt != 0) {
-		DEBUGDATA("ESP response timeout", cmd, "%s");
-#ifdef ESP_AT_MULTICORE_ENABLED
-		recursive_mutex_exit(&_esp_mtx);
-#endif /* #ifdef ESP_AT_MULTICORE_ENABLED */
-		return -1;
+	/* Only wait for results once every slot for them is taken, so
+	 * the line is kept busy */
+	for (size_t sent = 0; ret == 0 && sent < len;
+	     sent += sizeof(chunk)) {
+		const absolute_time_t deadline =
+			make_timeout_time_ms(ESP_AT_SEND_ACK_MS);
+		size_t n = len - sent < sizeof(chunk) ?
+			len - sent : sizeof(chunk);
+		at_frame_event ev;
+
+		while (ret == 0 && cfg->nacks == ARRAY_LEN(cfg->acks)) {
+			ret = _esp_next_event(cfg, deadline, &ev);
+		}
+
+		if (ret == 0) {
+			ret = _esp_send_link(cfg, link, NULL, 0, chunk, n,
+					     make_timeout_time_ms(
+						     ESP_AT_FANOUT_LINK_MS));
+		}
 	}
 
-	DEBUGMSG("Checking AT response");
+	if (ret == 0) {
+		ret = _esp_send_wait(cfg, link);
+	}
 
-	rslt = _esp_receive_response(cfg, rsp, len);
+	us = absolute_time_diff_us(start, get_absolute_time());
 
 #ifdef ESP_AT_MULTICORE_ENABLED
 	recursive_mutex_exit(&_esp_mtx);
 #endif /* #ifdef ESP_AT_MULTICORE_ENABLED */
 
-	return rslt;
+	if (ret < 0 || cfg->links[link].failed != failed || us <= 0) {
+		return -1;
+	}
+
+	return (int32_t) ((uint64_t) len * 1000000 / us);
 }
 
-void esp_at_passthrough(esp_at_cfg *cfg)
+int esp_at_cipsend_data(esp_at_cfg *cfg, int link, const void *data,
+			size_t len)
 {
-	char cmd[128];
-	size_t i = 0;
-	const char *prompt = "Prompt> ";
+	return esp_at_cipsend_head(cfg, link, NULL, 0, data, len);
+}
 
-	printf("Initializing ESP-AT Command Passthrough...\n" "%s",
-	       prompt);
+int esp_at_cipsend_head(esp_at_cfg *cfg, int link, const void *head,
+			size_t hlen, const void *data, size_t len)
+{
+	/* Data that takes several CIPSENDs goes in one CIPSENDL if the
+	 * module has it */
+	const bool sendl = (cfg->caps & ESP_AT_CAP_CIPSENDL) &&
+		hlen + len > ESP_AT_CIPSEND_MAX_LEN;
+	const size_t max = sendl ? ESP_AT_CIPSENDL_MAX_LEN :
+		ESP_AT_CIPSEND_MAX_LEN;
+	const uint32_t limit_ms =
+		esp_at_cmd_timeout_ms(sendl ? "AT+CIPSENDL" : "AT+CIPSEND");
+	const size_t total = hlen + len;
+	const char *p = data;
+	size_t sent = 0;
+	int ret = 0;
+
+	if (link < 0 || link >= (int) ARRAY_LEN(cfg->links) ||
+	    hlen >= ESP_AT_CIPSEND_MAX_LEN || cfg->transparent) {
+		return -1;
+	}
 
-	for (;;) {
-		char c;
-		int rst;
+#ifdef ESP_AT_MULTICORE_ENABLED
+	recursive_mutex_enter_blocking(&_esp_mtx);
+#endif /* #ifdef ESP_AT_MULTICORE_ENABLED */
 
-		rst = getchar_timeout_us(30000);
+	esp_at_poll(cfg);
+	_esp_send_expire(cfg);
 
-		/* Ignore timeouts */
-		if (rst == PICO_ERROR_TIMEOUT)
-			continue;
+	/* Keep the data in order behind an earlier send on the link */
+	ret = _esp_send_wait(cfg, link);
 
-		c = (char) rst;
+	/* The header only goes with the first piece */
+	while (ret == 0 && (hlen || sent < len)) {
+		size_t n = len - sent;
+		uint32_t failed = cfg->links[link].failed;
+		uint64_t wire_us;
 
-		/* DEBUGDATA("Received char", c, "%c"); */
+		if (hlen + n > max) {
+			n = max - hlen;
+		}
 
-		switch (c) {
-		case '\n':
-		case '\r':
-			cmd[i] = '\0';
-			printf("\n");
+		/* Plus the time the data takes on the line, 10 bits a
+		 * byte */
+		wire_us = (hlen + n) * 10000000ull / cfg->uart_cfg.baud;
+		ret = _esp_send_link(cfg, link, head, hlen, &p[sent], n,
+				     make_timeout_time_us(limit_ms * 1000ull +
+							  wire_us));
 
-			/* User can break loop if desired */
-			if (strcmp(cmd, "exit") == 0) {
-				return;
-			}
+		if (ret < 0) {
+			++cfg->links[link].failed;
+			esp_at_status_invalidate(cfg, ESP_AT_FIELD_CLIENTS);
+			break;
+		}
 
-			/* Provide a help message */
-			if (strcmp(cmd, "help") == 0) {
-				printf("Help comes to those who ask for"
-				       " it.\n"
-				       "All commands are passed to WiFi"
-				       " co-MCU, except the following\n\n"
-				       "Commands:\n"
-				       "exit	Break loop and run main program\n"
-				       "help	Print this message\n");
-			} else if (strlen(cmd) == 0) {
-				/* Index to zero, string to empty */
-				i = 0;
-				cmd[0] = '\0';
-				printf("%s", prompt);
+		ret = _esp_send_wait(cfg, link);
 
-				break;
-			} else {
-				char rsp[258];
+		if (ret == 0 && cfg->links[link].failed != failed) {
+			ret = -1;
+		}
 
-				/* Send command to ESP module */
-				esp_at_send_cmd(cfg, cmd, rsp,
-						ARRAY_LEN(rsp));
-				printf("%s", rsp);
-			}
+		sent += n;
+		head = NULL;
+		hlen = 0;
+	}
 
-			/* Index to zero, string to empty */
-			i = 0;
-			cmd[0] = '\0';
-			printf("%s", prompt);
+#ifdef ESP_AT_MULTICORE_ENABLED
+	recursive_mutex_exit(&_esp_mtx);
+#endif /* #ifdef ESP_AT_MULTICORE_ENABLED */
 
-			break;
-		case 127: /* Backspace */
-			/* Only backspace if buffer isn't empty */
-			if (i > 0) {
-				printf("\b");
-				--i;
-			}
+	return ret < 0 ? ret : (int) total;
+}
 
-			break;
-		default:
-			cmd[i] = c;
+int esp_at_transparent_enter(esp_at_cfg *cfg, esp_at_cip_proto proto,
+			     const char *host, uint16_t port)
+{
+	char cmd[128];
+	char rsp[_ESP_RESPONSE_BUFFER_LEN];
+	esp_at_cmd send;
+	int ret;
 
-			/* Echo character */
-			printf("%c", c);
+	if (proto != ESP_AT_CIP_PROTO_TCP && proto != ESP_AT_CIP_PROTO_UDP) {
+		return -1;
+	}
 
-			++i;
+	if (cfg->transparent) {
+		return 0;
+	}
 
-			break;
-		}
+	snprintf(cmd, ARRAY_LEN(cmd), "AT+CIPSTART=\"%s\",\"%s\",%u",
+		 proto == ESP_AT_CIP_PROTO_TCP ? "TCP" : "UDP", host,
+		 (unsigned int) port);
+
+#ifdef ESP_AT_MULTICORE_ENABLED
+	recursive_mutex_enter_blocking(&_esp_mtx);
+#endif /* #ifdef ESP_AT_MULTICORE_ENABLED */
+
+	/* Transparent transmission takes a single connection */
+	ret = esp_at_send_cmd(cfg, "AT+CIPMUX=0", rsp, ARRAY_LEN(rsp));
+	esp_at_status_invalidate(cfg, ESP_AT_FIELD_MUX |
+				 ESP_AT_FIELD_CLIENTS);
+
+	/* A link left open by an earlier transmission is used again */
+	if (ret >= 0 && esp_at_send_cmd(cfg, cmd, rsp, ARRAY_LEN(rsp)) < 0 &&
+	    !strstr(rsp, "ALREADY CONNECTED")) {
+		ret = -1;
 	}
-}
 
-int esp_at_deep_sleep(esp_at_cfg *cfg, unsigned long time_ms)
-{
-	char buf[512] = {'\0'};
-	char cmd[36] = {'\0'};
+	if (ret >= 0) {
+		ret = esp_at_send_cmd(cfg, "AT+CIPMODE=1", rsp,
+				      ARRAY_LEN(rsp));
+	}
 
-	snprintf(cmd, sizeof(cmd) - 1, "AT+GSLP=%lu",
-		time_ms);
+	/* The bare CIPSEND answers OK before the prompt, and the
+	 * transmission starts right with the prompt */
+	if (ret >= 0) {
+		esp_at_cmd_init(&send, "AT+CIPSEND", NULL, 0);
+		send.ends = ESP_AT_CMD_END(AT_FRAME_PROMPT) |
+			ESP_AT_CMD_END(AT_FRAME_ERROR);
+		send.cb = _esp_transparent_on;
+		send.ctx = cfg;
+
+		while (esp_at_cmd_submit(cfg, &send) < 0) {
+			_esp_cmd_step(cfg);
+		}
 
-	return esp_at_send_cmd(cfg, cmd, buf, sizeof(buf));
-}
+		ret = esp_at_cmd_wait(cfg, &send);
+	}
 
-int esp_at_sleep(esp_at_cfg *cfg)
-{
-	char buf[512] = {'\0'};
+#ifdef ESP_AT_MULTICORE_ENABLED
+	recursive_mutex_exit(&_esp_mtx);
+#endif /* #ifdef ESP_AT_MULTICORE_ENABLED */
 
-	return esp_at_send_cmd(cfg, "AT+SLEEP=1", buf, sizeof(buf));
+	return ret < 0 ? -1 : 0;
 }
 
-int esp_at_wake_up(esp_at_cfg *cfg)
+int esp_at_transparent_write(esp_at_cfg *cfg, const void *data,
+			     size_t len)
 {
-	char buf[512] = {'\0'};
-
-	return esp_at_send_cmd(cfg, "AT+SLEEP=0", buf, sizeof(buf));
-}
+	/* The time of the data on the line, 10 bits a byte */
+	const uint64_t us = _ESP_UART_WAIT_US +
+		len * 10000000ull / cfg->uart_cfg.baud;
+	int ret;
 
-/*
-**********************************************************************
-******************* INTERNAL IMPLEMENTATION **************************
-**********************************************************************
-*/
+	if (!cfg->transparent) {
+		return -1;
+	}
 
-void _esp_en_gpio_setup(esp_at_cfg *cfg)
-{
-	const uint gpin = cfg->en_pin;
+#ifdef ESP_AT_MULTICORE_ENABLED
+	recursive_mutex_enter_blocking(&_esp_mtx);
+#endif /* #ifdef ESP_AT_MULTICORE_ENABLED */
 
-	gpio_init(gpin);
+	ret = uart_pio_write_timeout(&cfg->uart_cfg, data, len, us) ?
+		(int) len : -1;
+	cfg->transparent_last = get_absolute_time();
 
-	/* Set GPIO settings */
-	gpio_set_dir(gpin, true);
-	gpio_disable_pulls(gpin);
+#ifdef ESP_AT_MULTICORE_ENABLED
+	recursive_mutex_exit(&_esp_mtx);
+#endif /* #ifdef ESP_AT_MULTICORE_ENABLED */
 
-	/* Set GPIO low to start disabled */
-	gpio_put(gpin, false);
+	return ret;
 }
 
-void _esp_reset_gpio_setup(esp_at_cfg *cfg)
+int esp_at_transparent_exit(esp_at_cfg *cfg)
 {
-#ifndef AIR_QUALITY_COMPILE_TARGET_WING
-	const uint gpin = cfg->reset_pin;
+	char rsp[64];
+	int ret = 0;
 
-	gpio_init(gpin);
-
-	/* Set GPIO settings */
-	gpio_set_dir(gpin, true);
-	gpio_disable_pulls(gpin);
+	if (!cfg->transparent) {
+		return 0;
+	}
 
-	/* Set GPIO high to start in the non-reset position */
-	gpio_put(gpin, true);
-#endif
-}
+#ifdef ESP_AT_MULTICORE_ENABLED
+	recursive_mutex_enter_blocking(&_esp_mtx);
+#endif /* #ifdef ESP_AT_MULTICORE_ENABLED */
 
-void _esp_set_enabled(esp_at_cfg *cfg, bool en)
-{
-	const uint gpin = cfg->en_pin;
+	/* The module only takes a +++ with silence around it, and
+	 * needs a while after it */
+	sleep_until(delayed_by_ms(cfg->transparent_last,
+				  ESP_AT_TRANSPARENT_GUARD_MS));
 
-	/* High enabled, low disabled */
-	gpio_put(gpin, en);
-}
+	if (!uart_pio_puts_timeout(&cfg->uart_cfg, "+++",
+				   _ESP_UART_WAIT_US)) {
+		ret = -1;
+	} else {
+		sleep_ms(ESP_AT_TRANSPARENT_EXIT_MS);
 
-void _esp_reset(esp_at_cfg *cfg)
-{
-#ifdef AIR_QUALITY_COMPILE_TARGET_WING
-	_esp_set_enabled(cfg, false);
-	sleep_us(_ESP_RESET_HOLD_US);
-	_esp_set_enabled(cfg, true);
-#else
-	const uint gpin = cfg->reset_pin;
+		/* Data received until now still belongs to the link */
+		_esp_poll(cfg);
+		cfg->transparent = false;
+		at_framer_init(&cfg->framer);
 
-	gpio_put(gpin, false); /* Drive low to reset module */
+		if (esp_at_send_cmd(cfg, "AT+CIPMODE=0", rsp,
+				    ARRAY_LEN(rsp)) < 0) {
+			ret = -1;
+		}
+	}
 
-	sleep_us(_ESP_RESET_HOLD_US); /* Hold down reset for a bit */
+#ifdef ESP_AT_MULTICORE_ENABLED
+	recursive_mutex_exit(&_esp_mtx);
+#endif /* #ifdef ESP_AT_MULTICORE_ENABLED */
 
-	gpio_put(gpin, true); /* Return reset pin to normal */
-#endif
+	return ret;
 }
 
-int _esp_parse_cw_wifi_state(esp_at_cfg *cfg,
-			     esp_at_status *clientlist)
+int esp_at_udp_open(esp_at_cfg *cfg, int link, const char *host,
+		    uint16_t port)
 {
-	int ret;
+	char cmd[128];
 	char rsp[_ESP_RESPONSE_BUFFER_LEN];
-	const char *re_str = "+CWSTATE:";
-	char v[24][6];
-	int n = 0;
+	int ret = 0;
 
-	/* Get WiFi connection state */
-	ret = esp_at_send_cmd(cfg, "AT+CWSTATE?", rsp, ARRAY_LEN(rsp));
+	if (link < 0 || link >= (int) ARRAY_LEN(cfg->links) ||
+	    cfg->transparent) {
+		return -1;
+	}
+
+	snprintf(cmd, ARRAY_LEN(cmd), "AT+CIPSTART=%d,\"UDP\",\"%s\",%u",
+		 link, host, (unsigned int) port);
+
+#ifdef ESP_AT_MULTICORE_ENABLED
+	recursive_mutex_enter_blocking(&_esp_mtx);
+#endif /* #ifdef ESP_AT_MULTICORE_ENABLED */
+
+	/* Marked first, so its CONNECT isn't taken for a client of the
+	 * server */
+	cfg->udp_links |= 1u << link;
+	cfg->udp_seq[link] = 0;
+
+	/* The server already turned muxing on */
+	if (!(cfg->status.status & ESP_AT_STATUS_SERVER_ON)) {
+		ret = esp_at_send_cmd(cfg, "AT+CIPMUX=1", rsp,
+				      ARRAY_LEN(rsp));
+		esp_at_status_invalidate(cfg, ESP_AT_FIELD_MUX);
+	}
+
+	/* A link left open by an earlier call is used again */
+	if (ret >= 0 && esp_at_send_cmd(cfg, cmd, rsp, ARRAY_LEN(rsp)) < 0 &&
+	    !strstr(rsp, "ALREADY CONNECTED")) {
+		ret = -1;
+	}
+
+	if (ret < 0) {
+		cfg->udp_links &= ~(1u << link);
+	}
+
+#ifdef ESP_AT_MULTICORE_ENABLED
+	recursive_mutex_exit(&_esp_mtx);
+#endif /* #ifdef ESP_AT_MULTICORE_ENABLED */
+
+	return ret < 0 ? -1 : 0;
+}
+
+int esp_at_udp_close(esp_at_cfg *cfg, int link)
+{
+	char cmd[24];
+	char rsp[_ESP_RESPONSE_BUFFER_LEN];
+	int ret;
+
+	if (link < 0 || link >= (int) ARRAY_LEN(cfg->links) ||
+	    !(cfg->udp_links & (1u << link))) {
+		return -1;
+	}
+
+	snprintf(cmd, ARRAY_LEN(cmd), "AT+CIPCLOSE=%d", link);
+
+#ifdef ESP_AT_MULTICORE_ENABLED
+	recursive_mutex_enter_blocking(&_esp_mtx);
+#endif /* #ifdef ESP_AT_MULTICORE_ENABLED */
+
+	/* Its CLOSED clears the mark and the client entry */
+	ret = esp_at_send_cmd(cfg, cmd, rsp, ARRAY_LEN(rsp));
+	cfg->udp_links &= ~(1u << link);
+
+#ifdef ESP_AT_MULTICORE_ENABLED
+	recursive_mutex_exit(&_esp_mtx);
+#endif /* #ifdef ESP_AT_MULTICORE_ENABLED */
+
+	return ret < 0 ? -1 : 0;
+}
+
+int esp_at_udp_send(esp_at_cfg *cfg, int link, const void *data,
+		    size_t len)
+{
+	uint8_t hdr[ESP_AT_UDP_SEQ_LEN];
+	uint32_t seq;
+	int ret = 0;
+
+	if (link < 0 || link >= (int) ARRAY_LEN(cfg->links) ||
+	    !(cfg->udp_links & (1u << link)) || cfg->transparent ||
+	    len > ESP_AT_CIPSEND_MAX_LEN - ESP_AT_UDP_SEQ_LEN) {
+		return -1;
+	}
+
+#ifdef ESP_AT_MULTICORE_ENABLED
+	recursive_mutex_enter_blocking(&_esp_mtx);
+#endif /* #ifdef ESP_AT_MULTICORE_ENABLED */
+
+	/* Counted also if the datagram doesn't go out, so the
+	 * receivers see the gap */
+	seq = cfg->udp_seq[link]++;
+
+	for (unsigned int i = 0; i < ESP_AT_UDP_SEQ_LEN; ++i) {
+		hdr[i] = seq >> (8 * (ESP_AT_UDP_SEQ_LEN - 1 - i));
+	}
+
+	esp_at_poll(cfg);
+	_esp_send_expire(cfg);
+
+	/* A failed send before it is counted once it expires */
+	if (_esp_send_wait(cfg, link) < 0) {
+		ret = -1;
+	} else if (_esp_send_link(cfg, link, hdr, ARRAY_LEN(hdr), data, len,
+				  make_timeout_time_ms(ESP_AT_FANOUT_LINK_MS))
+		   < 0) {
+		DEBUGDATA("Send failed on UDP link", link, "%d");
+		++cfg->links[link].failed;
+		ret = -1;
+	}
+
+#ifdef ESP_AT_MULTICORE_ENABLED
+	recursive_mutex_exit(&_esp_mtx);
+#endif /* #ifdef ESP_AT_MULTICORE_ENABLED */
+
+	return ret;
+}
+
+int esp_at_broadcast_addr(const esp_at_status *status, char *buf,
+			  size_t len)
+{
+	uint32_t addr;
+
+	if (status->ipv4[0] == '\0' || status->ipv4_prefix == 0 ||
+	    status->ipv4_prefix > 32) {
+		return -1;
+	}
+
+	/* All host bits set */
+	addr = _esp_ipv4_parse(status->ipv4);
+
+	if (status->ipv4_prefix < 32) {
+		addr |= 0xfffffffful >> status->ipv4_prefix;
+	}
+
+	snprintf(buf, len, "%u.%u.%u.%u", (unsigned int) (addr >> 24),
+		 (unsigned int) (addr >> 16) & 0xff,
+		 (unsigned int) (addr >> 8) & 0xff,
+		 (unsigned int) addr & 0xff);
+
+	return 0;
+}
+
+int esp_at_link_get_stats(esp_at_cfg *cfg, int link,
+			  esp_at_link_stats *stats)
+{
+	if (link < 0 || link >= (int) ARRAY_LEN(cfg->links)) {
+		return -1;
+	}
+
+	*stats = cfg->links[link];
+
+	return 0;
+}
+
+int esp_at_cipstatus(esp_at_cfg *cfg, esp_at_status *clientlist)
+{
+	int ret;
+
+	esp_at_status_invalidate(cfg, ESP_AT_FIELD_ALL);
+	ret = esp_at_status_update(cfg);
+	esp_at_status_snapshot(cfg, clientlist);
+
+	return ret;
+}
+
+int esp_at_send_cmd(esp_at_cfg *cfg, const char *cmd, char *rsp,
+		    unsigned int len)
+{
+	esp_at_cmd c;
+	int rslt;
+
+	esp_at_cmd_init(&c, cmd, rsp, len);
+
+#ifdef ESP_AT_MULTICORE_ENABLED
+	recursive_mutex_enter_blocking(&_esp_mtx);
+#endif /* #ifdef ESP_AT_MULTICORE_ENABLED */
+
+	/* Hand anything received since the last command to the URC
+	 * handlers before we try any commands */
+	_esp_poll(cfg);
+
+	while (esp_at_cmd_submit(cfg, &c) < 0) {
+		_esp_cmd_step(cfg);
+	}
+
+	rslt = esp_at_cmd_wait(cfg, &c);
+
+#ifdef ESP_AT_MULTICORE_ENABLED
+	recursive_mutex_exit(&_esp_mtx);
+#endif /* #ifdef ESP_AT_MULTICORE_ENABLED */
+
+	return rslt;
+}
+
+void esp_at_cmd_init(esp_at_cmd *cmd, const char *text, char *rsp,
+		     size_t len)
+{
+	memset(cmd, 0, sizeof(*cmd));
+
+	cmd->cmd = text;
+	cmd->ends = ESP_AT_CMD_END_RESULT;
+	cmd->deadline = make_timeout_time_ms(esp_at_cmd_timeout_ms(text));
+	cmd->rsp = rsp;
+	cmd->len = len;
+}
+
+int esp_at_cmd_submit(esp_at_cfg *cfg, esp_at_cmd *cmd)
+{
+	int ret = -1;
+
+	cmd->state = ESP_AT_CMD_QUEUED;
+	cmd->result = -1;
+	cmd->rsp_len = 0;
+	cmd->overflow = false;
+
+#ifdef ESP_AT_MULTICORE_ENABLED
+	critical_section_enter_blocking(&_esp_cmdq_cs);
+#endif /* #ifdef ESP_AT_MULTICORE_ENABLED */
+
+	if (cfg->ncmdq < ESP_AT_CMD_QUEUE_LEN) {
+		cfg->cmdq[(cfg->cmdq_head + cfg->ncmdq) %
+			  ESP_AT_CMD_QUEUE_LEN] = cmd;
+		++cfg->ncmdq;
+		ret = 0;
+	}
+
+#ifdef ESP_AT_MULTICORE_ENABLED
+	critical_section_exit(&_esp_cmdq_cs);
+#endif /* #ifdef ESP_AT_MULTICORE_ENABLED */
+
+	return ret;
+}
+
+bool esp_at_cmd_done(const esp_at_cmd *cmd)
+{
+	return cmd->state != ESP_AT_CMD_QUEUED &&
+		cmd->state != ESP_AT_CMD_RUNNING;
+}
+
+int esp_at_cmd_wait(esp_at_cfg *cfg, esp_at_cmd *cmd)
+{
+#ifdef ESP_AT_MULTICORE_ENABLED
+	recursive_mutex_enter_blocking(&_esp_mtx);
+#endif /* #ifdef ESP_AT_MULTICORE_ENABLED */
+
+	while (!esp_at_cmd_done(cmd)) {
+		_esp_cmd_step(cfg);
+	}
+
+#ifdef ESP_AT_MULTICORE_ENABLED
+	recursive_mutex_exit(&_esp_mtx);
+#endif /* #ifdef ESP_AT_MULTICORE_ENABLED */
+
+	return cmd->result;
+}
+
+uint32_t esp_at_cmd_timeout_ms(const char *cmd)
+{
+	const unsigned int i = _esp_cmd_limit(cmd);
+
+	return i < ARRAY_LEN(_esp_limits) ? _esp_limits[i].ms :
+		ESP_AT_CMD_TIMEOUT_MS;
+}
+
+void esp_at_cmd_get_stats(esp_at_cfg *cfg, const char *cmd,
+			  esp_at_cmd_stats *stats)
+{
+#ifdef ESP_AT_MULTICORE_ENABLED
+	recursive_mutex_enter_blocking(&_esp_mtx);
+#endif /* #ifdef ESP_AT_MULTICORE_ENABLED */
+
+	*stats = cfg->cmd_stats[_esp_cmd_limit(cmd)];
+
+#ifdef ESP_AT_MULTICORE_ENABLED
+	recursive_mutex_exit(&_esp_mtx);
+#endif /* #ifdef ESP_AT_MULTICORE_ENABLED */
+}
+
+void esp_at_passthrough(esp_at_cfg *cfg)
+{
+	char cmd[128];
+	size_t i = 0;
+	const char *prompt = "Prompt> ";
+
+	printf("Initializing ESP-AT Command Passthrough...\n" "%s",
+	       prompt);
+
+	for (;;) {
+		char c;
+		int rst;
+
+		rst = getchar_timeout_us(30000);
+
+		/* Ignore timeouts */
+		if (rst == PICO_ERROR_TIMEOUT)
+			continue;
+
+		c = (char) rst;
+
+		/* DEBUGDATA("Received char", c, "%c"); */
+
+		switch (c) {
+		case '\n':
+		case '\r':
+			cmd[i] = '\0';
+			printf("\n");
+
+			/* User can break loop if desired */
+			if (strcmp(cmd, "exit") == 0) {
+				return;
+			}
+
+			/* Provide a help message */
+			if (strcmp(cmd, "help") == 0) {
+				printf("Help comes to those who ask for"
+				       " it.\n"
+				       "All commands are passed to WiFi"
+				       " co-MCU, except the following\n\n"
+				       "Commands:\n"
+				       "exit	Break loop and run main program\n"
+				       "help	Print this message\n"
+				       "throughput	Measure bytes/s to link 0"
+				       " at each UART rate\n");
+			} else if (strcmp(cmd, "throughput") == 0) {
+				_esp_throughput_report(cfg);
+			} else if (strlen(cmd) == 0) {
+				/* Index to zero, string to empty */
+				i = 0;
+				cmd[0] = '\0';
+				printf("%s", prompt);
+
+				break;
+			} else {
+				char rsp[258];
+
+				/* Send command to ESP module */
+				esp_at_send_cmd(cfg, cmd, rsp,
+						ARRAY_LEN(rsp));
+				printf("%s", rsp);
+			}
+
+			/* Index to zero, string to empty */
+			i = 0;
+			cmd[0] = '\0';
+			printf("%s", prompt);
+
+			break;
+		case 127: /* Backspace */
+			/* Only backspace if buffer isn't empty */
+			if (i > 0) {
+				printf("\b");
+				--i;
+			}
+
+			break;
+		default:
+			cmd[i] = c;
+
+			/* Echo character */
+			printf("%c", c);
+
+			++i;
+
+			break;
+		}
+	}
+}
+
+int esp_at_urc_register(esp_at_cfg *cfg, esp_at_urc_cb cb, void *ctx)
+{
+	if (cfg->nurc >= ARRAY_LEN(cfg->urc)) {
+		return -1;
+	}
+
+	cfg->urc[cfg->nurc].cb = cb;
+	cfg->urc[cfg->nurc].ctx = ctx;
+	++cfg->nurc;
+
+	return 0;
+}
+
+int esp_at_status_update(esp_at_cfg *cfg)
+{
+	int ret = 0;
+
+	if (!cfg->ptr) {
+		return -1;
+	}
+
+#ifdef ESP_AT_MULTICORE_ENABLED
+	recursive_mutex_enter_blocking(&_esp_mtx);
+#endif /* #ifdef ESP_AT_MULTICORE_ENABLED */
+
+	/* Events received meanwhile may invalidate fields */
+	esp_at_poll(cfg);
+
+	/* A query of esp_at_status_refresh may still be under way */
+	if (cfg->status_field >= 0) {
+		esp_at_cmd_wait(cfg, &cfg->status_cmd);
+	}
+
+	/* The module can't be asked in transparent transmission, the
+	 * cache stays as it is */
+	for (unsigned int i = 0; !cfg->transparent &&
+		     i < ARRAY_LEN(_esp_fields); ++i) {
+		if (!(cfg->stale & _esp_fields[i].field) &&
+		    !time_reached(cfg->expire[i])) {
+			continue;
+		}
+
+		while (_esp_status_query(cfg, i) < 0) {
+			_esp_cmd_step(cfg);
+		}
+
+		esp_at_cmd_wait(cfg, &cfg->status_cmd);
+
+		ret = cfg->status_rslt;
+
+		if (ret < 0) {
+			break;
+		}
+	}
+
+#ifdef ESP_AT_MULTICORE_ENABLED
+	recursive_mutex_exit(&_esp_mtx);
+#endif /* #ifdef ESP_AT_MULTICORE_ENABLED */
+
+	return ret < 0 ? ret : 0;
+}
+
+int esp_at_status_refresh(esp_at_cfg *cfg, esp_at_status *status)
+{
+	if (!cfg->ptr) {
+		return -1;
+	}
+
+#ifdef ESP_AT_MULTICORE_ENABLED
+	/* Try again on the next call rather than wait for the other
+	 * core */
+	if (!recursive_mutex_try_enter(&_esp_mtx, NULL)) {
+		return cfg->status_rslt < 0 ? -1 : 0;
+	}
+#endif /* #ifdef ESP_AT_MULTICORE_ENABLED */
+
+	/* The answer of the last query was taken in as it arrived,
+	 * one query at a time, for the first part out of date */
+	for (unsigned int i = 0; cfg->status_field < 0 &&
+		     !cfg->transparent && i < ARRAY_LEN(_esp_fields); ++i) {
+		if (!(cfg->stale & _esp_fields[i].field) &&
+		    !time_reached(cfg->expire[i])) {
+			continue;
+		}
+
+		if (_esp_status_query(cfg, i) < 0) {
+			break;
+		}
+	}
+
+	if (status) {
+		memcpy(status, &cfg->status, sizeof(*status));
+	}
+
+#ifdef ESP_AT_MULTICORE_ENABLED
+	recursive_mutex_exit(&_esp_mtx);
+#endif /* #ifdef ESP_AT_MULTICORE_ENABLED */
+
+	return cfg->status_rslt < 0 ? -1 : 0;
+}
+
+void esp_at_status_snapshot(esp_at_cfg *cfg, esp_at_status *status)
+{
+#ifdef ESP_AT_MULTICORE_ENABLED
+	recursive_mutex_enter_blocking(&_esp_mtx);
+#endif /* #ifdef ESP_AT_MULTICORE_ENABLED */
+
+	memcpy(status, &cfg->status, sizeof(*status));
+
+#ifdef ESP_AT_MULTICORE_ENABLED
+	recursive_mutex_exit(&_esp_mtx);
+#endif /* #ifdef ESP_AT_MULTICORE_ENABLED */
+}
+
+void esp_at_status_invalidate(esp_at_cfg *cfg, unsigned int fields)
+{
+	cfg->stale |= fields;
+}
+
+int esp_at_poll(esp_at_cfg *cfg)
+{
+	if (!cfg->ptr) {
+		return 0;
+	}
+
+	return _esp_poll(cfg);
+}
+
+int esp_at_deep_sleep(esp_at_cfg *cfg, unsigned long time_ms)
+{
+	char buf[512] = {'\0'};
+	char cmd[36] = {'\0'};
+
+	snprintf(cmd, sizeof(cmd) - 1, "AT+GSLP=%lu",
+		time_ms);
+
+	return esp_at_send_cmd(cfg, cmd, buf, sizeof(buf));
+}
+
+int esp_at_sleep(esp_at_cfg *cfg)
+{
+	char buf[512] = {'\0'};
+
+	return esp_at_send_cmd(cfg, "AT+SLEEP=1", buf, sizeof(buf));
+}
+
+int esp_at_wake_up(esp_at_cfg *cfg)
+{
+	char buf[512] = {'\0'};
+
+	return esp_at_send_cmd(cfg, "AT+SLEEP=0", buf, sizeof(buf));
+}
+
+/*
+**********************************************************************
+******************* INTERNAL IMPLEMENTATION **************************
+**********************************************************************
+*/
+
+void _esp_en_gpio_setup(esp_at_cfg *cfg)
+{
+	const uint gpin = cfg->en_pin;
+
+	gpio_init(gpin);
+
+	/* Set GPIO settings */
+	gpio_set_dir(gpin, true);
+	gpio_disable_pulls(gpin);
+
+	/* Set GPIO low to start disabled */
+	gpio_put(gpin, false);
+}
+
+void _esp_reset_gpio_setup(esp_at_cfg *cfg)
+{
+#ifndef AIR_QUALITY_COMPILE_TARGET_WING
+	const uint gpin = cfg->reset_pin;
+
+	gpio_init(gpin);
+
+	/* Set GPIO settings */
+	gpio_set_dir(gpin, true);
+	gpio_disable_pulls(gpin);
+
+	/* Set GPIO high to start in the non-reset position */
+	gpio_put(gpin, true);
+#endif
+}
+
+void _esp_set_enabled(esp_at_cfg *cfg, bool en)
+{
+	const uint gpin = cfg->en_pin;
+
+	/* High enabled, low disabled */
+	gpio_put(gpin, en);
+}
+
+void _esp_reset(esp_at_cfg *cfg)
+{
+#ifdef AIR_QUALITY_COMPILE_TARGET_WING
+	_esp_set_enabled(cfg, false);
+	sleep_us(_ESP_RESET_HOLD_US);
+	_esp_set_enabled(cfg, true);
+#else
+	const uint gpin = cfg->reset_pin;
+
+	gpio_put(gpin, false); /* Drive low to reset module */
+
+	sleep_us(_ESP_RESET_HOLD_US); /* Hold down reset for a bit */
+
+	gpio_put(gpin, true); /* Return reset pin to normal */
+#endif
+}
+
+int _esp_parse_cw_wifi_state(esp_at_cfg *cfg,
+			     esp_at_status *clientlist)
+{
+	int ret;
+	char rsp[_ESP_RESPONSE_BUFFER_LEN];
+	const char *re_str = "+CWSTATE:";
+	char v[24][6];
+	int n = 0;
+
+	/* Get WiFi connection state */
+	ret = esp_at_send_cmd(cfg, "AT+CWSTATE?", rsp, ARRAY_LEN(rsp));
+
+	if (ret < 0) {
+		return ret;
+	}
+
+	/* Match the response */
+	char *addr = strstr(rsp, re_str);
+
+	if (!addr) {
+		return -1;
+	}
+
+	for (char *si = strtok(&addr[1], ","); si; strtok(si, ",")) {
+		strcpy(v[n], si);
+		++n;
+	}
+
+	if (n == 0) {
+		DEBUGDATA("Failed to parse", rsp, "%s");
+		return -1;
+	}
+
+	int status = strtol(v[0], NULL, 10);
+
+	switch (status) {
+	case 0:
+	case 1:
+	case 3:
+	case 4:
+		clientlist->status &= ~ESP_AT_STATUS_WIFI_CONNECTED;
+		return 0;
+	case 2:
+		clientlist->status |= ESP_AT_STATUS_WIFI_CONNECTED;
+		break;
+	default:
+		return -1;
+	}
+
+	if (n > 1) {
+		strncpy(clientlist->ssid, v[1],
+			sizeof(clientlist->ssid) - 1);
+
+		clientlist->ssid[ARRAY_LEN(clientlist->ssid) - 1] = '\0';
+	}
+
+	return 0;
+}
+
+void _esp_cipsta_line(const at_rsp_line_view *line, at_frame_event ev,
+		      void *ctx)
+{
+	esp_at_cfg *cfg = ctx;
+
+	/* One line per address, with the key as the first token */
+	cfg->status_lines += at_rsp_extract(line, _esp_cipsta_fields,
+					    ARRAY_LEN(_esp_cipsta_fields),
+					    &cfg->status_next);
+}
+
+void _esp_cipstatus_line(const at_rsp_line_view *line,
+			 at_frame_event ev, void *ctx)
+{
+	esp_at_cfg *cfg = ctx;
+	esp_at_status *next = &cfg->status_next;
+	int stat;
+
+	if (at_rsp_extract(line, _esp_stat_fields,
+			   ARRAY_LEN(_esp_stat_fields), &stat)) {
+		switch (stat) {
+		case 0:
+		case 1:
+		case 5:
+			break;
+		case 2:
+		case 3:
+		case 4:
+			next->status |= ESP_AT_STATUS_SERVER_ON;
+			break;
+		default:
+			return; /* malformed case */
+		}
+
+		++cfg->status_lines;
+		return;
+	}
+
+	/* The client lines follow the status */
+	if (cfg->status_lines) {
+		_esp_client_line(cfg, line, _esp_client_fields,
+				 ARRAY_LEN(_esp_client_fields));
+	}
+}
+
+void _esp_cipstate_line(const at_rsp_line_view *line,
+			at_frame_event ev, void *ctx)
+{
+	esp_at_cfg *cfg = ctx;
+
+	/* Only the client lines, none at all without clients */
+	if (_esp_client_line(cfg, line, _esp_cipstate_fields,
+			     ARRAY_LEN(_esp_cipstate_fields))) {
+		++cfg->status_lines;
+	}
+}
+
+bool _esp_client_line(esp_at_cfg *cfg, const at_rsp_line_view *line,
+		      const at_rsp_field *fields, unsigned int nfields)
+{
+	esp_at_status *next = &cfg->status_next;
+	esp_at_clients *cptr;
+	unsigned int n;
+
+	if (next->ncli >= ARRAY_LEN(next->cli)) {
+		return false;
+	}
+
+	cptr = &next->cli[next->ncli];
+	n = at_rsp_extract(line, fields, nfields, cptr);
+
+	if (!n) {
+		return false;
+	} else if (n < nfields) {
+		DEBUGDATA("Short client line", fields[0].preamble, "%s");
+		return false;
+	}
+
+	DEBUGDATA("Working on index", cptr->index, "%d");
+
+	if (cptr->passive) {
+		next->status |= ESP_AT_STATUS_CLIENT_CONNECTED;
+	} else {
+		next->status |= ESP_AT_STATUS_AS_CLIENT;
+	}
+
+	++next->ncli;
+
+	return true;
+}
+
+void _esp_cipmux_line(const at_rsp_line_view *line, at_frame_event ev,
+		      void *ctx)
+{
+	esp_at_cfg *cfg = ctx;
+	int mux;
+
+	if (!at_rsp_extract(line, _esp_cipmux_fields,
+			    ARRAY_LEN(_esp_cipmux_fields), &mux)) {
+		return;
+	}
+
+	if (mux) {
+		cfg->status_next.status |= ESP_AT_STATUS_CIPMUX_ON;
+	}
+
+	++cfg->status_lines;
+}
+
+int _esp_cipsta_commit(esp_at_cfg *cfg)
+{
+	esp_at_status *clientlist = &cfg->status;
+	const esp_at_status *next = &cfg->status_next;
+
+	if (cfg->status_lines < 3) {
+		DEBUGMSG("No network detected");
+		clientlist->status &= ~ESP_AT_STATUS_WIFI_CONNECTED;
+		clientlist->ipv4[0] ='\0';
+		clientlist->ipv4_gateway[0] = '\0';
+		clientlist->ipv4_netmask[0] = '\0';
+		clientlist->ipv4_prefix = 0;
+		return 0;
+	}
+
+	memcpy(clientlist->ipv4, next->ipv4, sizeof(next->ipv4));
+	memcpy(clientlist->ipv4_gateway, next->ipv4_gateway,
+	       sizeof(next->ipv4_gateway));
+	memcpy(clientlist->ipv4_netmask, next->ipv4_netmask,
+	       sizeof(next->ipv4_netmask));
+
+	clientlist->status |= ESP_AT_STATUS_WIFI_CONNECTED;
+	clientlist->ipv4_prefix =
+		_esp_netmask_prefix(clientlist->ipv4_netmask);
+
+	return 0;
+}
+
+int _esp_cipstatus_commit(esp_at_cfg *cfg)
+{
+	const esp_at_status_byte mask = ESP_AT_STATUS_SERVER_ON |
+		ESP_AT_STATUS_CLIENT_CONNECTED | ESP_AT_STATUS_AS_CLIENT;
+	esp_at_status *clientlist = &cfg->status;
+	const esp_at_status *next = &cfg->status_next;
+
+	if (!cfg->status_lines) {
+		return -1;
+	}
+
+	memcpy(clientlist->cli, next->cli, sizeof(next->cli));
+	clientlist->ncli = next->ncli;
+	clientlist->status = (clientlist->status & ~mask) |
+		(next->status & mask);
+
+	return 0;
+}
+
+int _esp_cipstate_commit(esp_at_cfg *cfg)
+{
+	/* The server stays as esp_at_cipserver_init left it */
+	const esp_at_status_byte mask = ESP_AT_STATUS_CLIENT_CONNECTED |
+		ESP_AT_STATUS_AS_CLIENT;
+	esp_at_status *clientlist = &cfg->status;
+	const esp_at_status *next = &cfg->status_next;
+
+	memcpy(clientlist->cli, next->cli, sizeof(next->cli));
+	clientlist->ncli = next->ncli;
+	clientlist->status = (clientlist->status & ~mask) |
+		(next->status & mask);
+
+	return 0;
+}
+
+int _esp_cipmux_commit(esp_at_cfg *cfg)
+{
+	esp_at_status_byte *status = &cfg->status.status;
+
+	if (!cfg->status_lines) {
+		return -1;
+	}
+
+	if (cfg->status_next.status & ESP_AT_STATUS_CIPMUX_ON) {
+		*status |= ESP_AT_STATUS_CIPMUX_ON;
+	} else {
+		*status &= ~ESP_AT_STATUS_CIPMUX_ON;
+	}
+
+	return 0;
+}
+
+const _esp_query *_esp_field_query(esp_at_cfg *cfg, unsigned int i)
+{
+	if (cfg->caps & _esp_fields[i].cap) {
+		return &_esp_fields[i].fast;
+	}
+
+	return &_esp_fields[i].query;
+}
+
+int _esp_status_query(esp_at_cfg *cfg, unsigned int i)
+{
+	const _esp_query *q = _esp_field_query(cfg, i);
+
+	memset(&cfg->status_next, 0, sizeof(cfg->status_next));
+	cfg->status_lines = 0;
+
+	esp_at_cmd_init(&cfg->status_cmd, q->cmd, NULL, 0);
+	cfg->status_cmd.push = &q->push;
+	cfg->status_cmd.cb = _esp_status_done;
+	cfg->status_cmd.ctx = cfg;
+
+	if (esp_at_cmd_submit(cfg, &cfg->status_cmd) < 0) {
+		return -1;
+	}
+
+	cfg->status_field = i;
+
+	return 0;
+}
+
+void _esp_status_done(esp_at_cmd *cmd, void *ctx)
+{
+	esp_at_cfg *cfg = ctx;
+	const int i = cfg->status_field;
+
+	cfg->status_rslt = cmd->result < 0 ? -1 :
+		_esp_field_query(cfg, i)->commit(cfg);
+
+	if (cfg->status_rslt < 0) {
+		cfg->stale |= _esp_fields[i].field;
+	} else {
+		cfg->stale &= ~_esp_fields[i].field;
+		cfg->expire[i] = make_timeout_time_ms(_esp_fields[i].ttl_ms);
+	}
+
+	cfg->status_field = -1;
+}
+
+int _esp_transmit_cmd(esp_at_cfg *cfg, const char *cmd,
+		      absolute_time_t deadline)
+{
+	const char *parts[] = {cmd, "\r\n"};
+
+	DEBUGDATA("ESP RX is", cmd, "%s");
+
+	/* The command goes out by DMA straight from the caller's
+	 * buffer, followed by CR and LF, both within what is left of
+	 * the deadline of the command */
+	for (unsigned int i = 0; i < ARRAY_LEN(parts); ++i) {
+		const int64_t left =
+			absolute_time_diff_us(get_absolute_time(), deadline);
+
+		if (left <= 0 ||
+		    !uart_pio_puts_timeout(&cfg->uart_cfg, parts[i], left)) {
+			DEBUGMSG("ESP send cmd timeout");
+
+			/* Flush TX on failure */
+			uart_pio_flush_tx(&cfg->uart_cfg);
+
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+int _esp_poll(esp_at_cfg *cfg)
+{
+	at_frame_event ev;
+	int n = 0;
+	char c;
+
+#ifdef ESP_AT_MULTICORE_ENABLED
+	recursive_mutex_enter_blocking(&_esp_mtx);
+#endif /* #ifdef ESP_AT_MULTICORE_ENABLED */
+
+	while (uart_pio_try_getc(&cfg->uart_cfg, &c)) {
+		_esp_cmd_feed(cfg, c, &ev);
+		++n;
+	}
+
+	/* Data of transparent transmission has no length to wait
+	 * for, pass on what came */
+	if (cfg->transparent && cfg->ipd_len) {
+		_esp_ipd_flush(cfg);
+	}
+
+	_esp_cmd_run(cfg);
+
+#ifdef ESP_AT_MULTICORE_ENABLED
+	recursive_mutex_exit(&_esp_mtx);
+#endif /* #ifdef ESP_AT_MULTICORE_ENABLED */
+
+	return n;
+}
+
+void _esp_cmd_feed(esp_at_cfg *cfg, char c, at_frame_event *ev)
+{
+	esp_at_cmd *cmd = cfg->cmd;
+	int drop;
+
+	if (cmd && cmd->rsp) {
+		if (cmd->rsp_len + 1 < cmd->len) {
+			cmd->rsp[cmd->rsp_len] = c;
+		} else {
+			cmd->overflow = true;
+		}
+	}
+
+	if (cmd) {
+		++cmd->rsp_len;
+	}
+
+	drop = _esp_rx_char(cfg, c, ev);
+
+	if (!cmd) {
+		return;
+	}
+
+	/* Lines are parsed as they arrive for commands without a
+	 * buffer big enough for all of the response */
+	if (cmd->push && *ev != AT_FRAME_NONE) {
+		size_t n;
+		const char *line = at_framer_line(&cfg->framer, &n);
+
+		at_push_line(cmd->push, cmd->ctx, *ev, line, n);
+	}
+
+	/* +IPD data belongs to the URC handlers, not to the
+	 * response */
+	cmd->rsp_len = (size_t) drop > cmd->rsp_len ? 0 :
+		cmd->rsp_len - drop;
+
+	/* The module refuses commands while it is still sending, the
+	 * command is sent again a little later */
+	if (*ev == AT_FRAME_LINE &&
+	    strncmp(at_framer_line(&cfg->framer, NULL), "busy", 4) == 0) {
+		cfg->cmd_busy = true;
+		cfg->cmd_retry = make_timeout_time_us(_ESP_BUSY_RETRY_US);
+		return;
+	}
+
+	if (!(cmd->ends & ESP_AT_CMD_END(*ev))) {
+		return;
+	}
+
+	switch (*ev) {
+	case AT_FRAME_OK:
+	case AT_FRAME_SEND_OK:
+	case AT_FRAME_PROMPT:
+		_esp_cmd_finish(cfg, cmd, ESP_AT_CMD_OK);
+		break;
+	default:
+		_esp_cmd_finish(cfg, cmd, ESP_AT_CMD_ERROR);
+		break;
+	}
+}
+
+void _esp_cmd_run(esp_at_cfg *cfg)
+{
+	esp_at_cmd *cmd = cfg->cmd;
+
+	if (cmd && time_reached(cmd->deadline)) {
+		_esp_cmd_finish(cfg, cmd, ESP_AT_CMD_TIMEOUT);
+	} else if (cmd && cfg->cmd_busy && time_reached(cfg->cmd_retry)) {
+		cfg->cmd_busy = false;
+		cmd->rsp_len = 0;
+
+		if (_esp_transmit_cmd(cfg, cmd->cmd, cmd->deadline) != 0) {
+			_esp_cmd_finish(cfg, cmd, ESP_AT_CMD_ERROR);
+		}
+	}
+
+	/* Start the next command once the last one is done */
+	while (!cfg->cmd) {
+		cmd = NULL;
+
+#ifdef ESP_AT_MULTICORE_ENABLED
+		critical_section_enter_blocking(&_esp_cmdq_cs);
+#endif /* #ifdef ESP_AT_MULTICORE_ENABLED */
+
+		if (cfg->ncmdq) {
+			cmd = cfg->cmdq[cfg->cmdq_head];
+			cfg->cmdq_head = (cfg->cmdq_head + 1) %
+				ESP_AT_CMD_QUEUE_LEN;
+			--cfg->ncmdq;
+		}
+
+#ifdef ESP_AT_MULTICORE_ENABLED
+		critical_section_exit(&_esp_cmdq_cs);
+#endif /* #ifdef ESP_AT_MULTICORE_ENABLED */
+
+		if (!cmd) {
+			return;
+		}
+
+		if (time_reached(cmd->deadline)) {
+			_esp_cmd_finish(cfg, cmd, ESP_AT_CMD_TIMEOUT);
+			continue;
+		}
+
+		/* It would go to the remote end as data */
+		if (cfg->transparent) {
+			_esp_cmd_finish(cfg, cmd, ESP_AT_CMD_ERROR);
+			continue;
+		}
+
+		DEBUGDATA("Sending AT command", cmd->cmd, "%s");
+
+		cfg->cmd = cmd;
+		cmd->state = ESP_AT_CMD_RUNNING;
+		cmd->start = get_absolute_time();
+
+		if (_esp_transmit_cmd(cfg, cmd->cmd, cmd->deadline) != 0) {
+			_esp_cmd_finish(cfg, cmd, ESP_AT_CMD_ERROR);
+		}
+	}
+}
+
+void _esp_cmd_finish(esp_at_cfg *cfg, esp_at_cmd *cmd,
+		     esp_at_cmd_state state)
+{
+	if (cfg->cmd == cmd) {
+		cfg->cmd = NULL;
+		cfg->cmd_busy = false;
+	}
+
+	if (cmd->overflow && state == ESP_AT_CMD_OK) {
+		/* Ran out of buffer before the result */
+		state = ESP_AT_CMD_ERROR;
+	}
+
+	if (cmd->rsp && cmd->len) {
+		cmd->rsp[cmd->rsp_len < cmd->len ?
+			 cmd->rsp_len : cmd->len - 1] = '\0';
+		DEBUGDATA("AT Response", cmd->rsp, "%s");
+	}
+
+	/* Commands that expired in the queue took no time of the
+	 * module */
+	_esp_cmd_record(cfg, cmd->cmd, state,
+			cmd->state == ESP_AT_CMD_RUNNING ?
+			absolute_time_diff_us(cmd->start,
+					      get_absolute_time()) : -1);
+
+	cmd->result = state == ESP_AT_CMD_OK ? (int) cmd->rsp_len : -1;
+	cmd->state = state;
+
+	if (cmd->cb) {
+		cmd->cb(cmd, cmd->ctx);
+	}
+}
+
+void _esp_cmd_step(esp_at_cfg *cfg)
+{
+	absolute_time_t until;
+
+	_esp_poll(cfg);
+
+	if (!cfg->cmd) {
+		return;
+	}
+
+	/* Wake up in time to send a busy command again, or for the
+	 * deadline, which the next poll enforces */
+	until = cfg->cmd->deadline;
+
+	if (cfg->cmd_busy &&
+	    absolute_time_diff_us(until, cfg->cmd_retry) < 0) {
+		until = cfg->cmd_retry;
+	}
+
+	uart_pio_rx_wait_until(&cfg->uart_cfg, 1, until);
+}
+
+void _esp_cmd_drain(esp_at_cfg *cfg)
+{
+	while (cfg->cmd || cfg->ncmdq) {
+		_esp_cmd_step(cfg);
+	}
+}
+
+unsigned int _esp_cmd_limit(const char *cmd)
+{
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_LEN(_esp_limits); ++i) {
+		const size_t n = strlen(_esp_limits[i].name);
+
+		if (strncmp(cmd, _esp_limits[i].name, n) == 0 &&
+		    (cmd[n] == '\0' || cmd[n] == '=' || cmd[n] == '?')) {
+			break;
+		}
+	}
+
+	return i;
+}
+
+void _esp_cmd_record(esp_at_cfg *cfg, const char *cmd,
+		     esp_at_cmd_state state, int64_t us)
+{
+	esp_at_cmd_stats *st = &cfg->cmd_stats[_esp_cmd_limit(cmd)];
+
+	++st->count;
+
+	if (state == ESP_AT_CMD_TIMEOUT) {
+		DEBUGDATA("ESP command timed out", cmd, "%s");
+		++st->timeouts;
+	} else if (state == ESP_AT_CMD_ERROR) {
+		++st->errors;
+	}
+
+	if (us > (int64_t) st->max_us) {
+		st->max_us = us > UINT32_MAX ? UINT32_MAX : (uint32_t) us;
+	}
+}
 
-	if (ret < 0) {
-		return ret;
+int _esp_rx_char(esp_at_cfg *cfg, char c, at_frame_event *ev)
+{
+	*ev = AT_FRAME_NONE;
+
+	if (cfg->transparent) {
+		cfg->ipd_buf[cfg->ipd_len++] = c;
+
+		if (cfg->ipd_len == ARRAY_LEN(cfg->ipd_buf)) {
+			_esp_ipd_flush(cfg);
+		}
+
+		return 1;
 	}
 
-	/* Match the response */
-	char *addr = strstr(rsp, re_str);
+	if (cfg->ipd_left) {
+		cfg->ipd_buf[cfg->ipd_len++] = c;
+		--cfg->ipd_left;
 
-	if (!addr) {
-		return -1;
+		if (!cfg->ipd_left ||
+		    cfg->ipd_len == ARRAY_LEN(cfg->ipd_buf)) {
+			_esp_ipd_flush(cfg);
+		}
+
+		return 1;
 	}
 
-	for (char *si = strtok(&addr[1], ","); si; strtok(si, ",")) {
-		strcpy(v[n], si);
-		++n;
+	*ev = at_framer_feed(&cfg->framer, c);
+
+	switch (*ev) {
+	case AT_FRAME_SEND_OK:
+	case AT_FRAME_SEND_FAIL:
+		/* Results of pipelined sends arrive in order, and
+		 * before the result of anything issued after them */
+		if (cfg->nacks) {
+			_esp_send_done(cfg, *ev == AT_FRAME_SEND_OK);
+			*ev = AT_FRAME_LINE;
+		}
+
+		return 0;
+	case AT_FRAME_LINE:
+		_esp_urc_line(cfg, at_framer_line(&cfg->framer, NULL));
+		return 0;
+	case AT_FRAME_NONE:
+		/* The +IPD header is not followed by a line end, the
+		 * data comes right after the colon */
+		if (c == ':') {
+			return _esp_urc_ipd(cfg,
+					    at_framer_line(&cfg->framer,
+							   NULL));
+		}
+
+		return 0;
+	default:
+		return 0;
 	}
+}
 
-	if (n == 0) {
-		DEBUGDATA("Failed to parse", rsp, "%s");
-		return -1;
+void _esp_urc_line(esp_at_cfg *cfg, const char *line)
+{
+	static const struct {
+		const char *line;
+		esp_at_urc_type type;
+	} wifi_urcs[] = {
+		{"WIFI CONNECTED", ESP_AT_URC_WIFI_CONNECTED},
+		{"WIFI GOT IP", ESP_AT_URC_WIFI_GOT_IP},
+		{"WIFI DISCONNECT", ESP_AT_URC_WIFI_DISCONNECT}
+	};
+
+	esp_at_urc urc = {.link = -1};
+	char *end;
+
+	if (line[0] == 'W') {
+		for (unsigned int i = 0; i < ARRAY_LEN(wifi_urcs); ++i) {
+			if (strcmp(line, wifi_urcs[i].line) == 0) {
+				urc.type = wifi_urcs[i].type;
+				_esp_urc_track(cfg, &urc);
+				_esp_urc_dispatch(cfg, &urc);
+				return;
+			}
+		}
+
+		return;
 	}
 
-	int status = strtol(v[0], NULL, 10);
+	/* <link>,CONNECT and <link>,CLOSED */
+	if (!isdigit((unsigned char) line[0])) {
+		return;
+	}
 
-	switch (status) {
-	case 0:
-	case 1:
-	case 3:
-	case 4:
-		clientlist->status &= ~ESP_AT_STATUS_WIFI_CONNECTED;
+	urc.link = strtol(line, &end, 10);
+
+	/* The link selects a bit of the link masks */
+	if (urc.link < 0 || urc.link >= ESP_AT_MAX_CONN) {
+		return;
+	}
+
+	if (strcmp(end, ",CONNECT") == 0) {
+		urc.type = ESP_AT_URC_CONNECT;
+	} else if (strcmp(end, ",CLOSED") == 0) {
+		urc.type = ESP_AT_URC_CLOSED;
+	} else {
+		return;
+	}
+
+	DEBUGDATA("ESP URC", line, "%s");
+
+	_esp_urc_track(cfg, &urc);
+	_esp_urc_dispatch(cfg, &urc);
+}
+
+size_t _esp_urc_ipd(esp_at_cfg *cfg, const char *line)
+{
+	const char *pre = "+IPD,";
+	char *end;
+	long a, b;
+
+	if (strncmp(line, pre, strlen(pre)) != 0) {
 		return 0;
-	case 2:
-		clientlist->status |= ESP_AT_STATUS_WIFI_CONNECTED;
+	}
+
+	/* +IPD,<link>,<len>: with CIPMUX=1, +IPD,<len>: without.
+	 * The remote address may follow the length */
+	a = strtol(&line[strlen(pre)], &end, 10);
+
+	if (*end == ',') {
+		b = strtol(&end[1], &end, 10);
+	} else {
+		b = a;
+		a = 0;
+	}
+
+	if ((*end != ':' && *end != ',') || b <= 0) {
+		return 0;
+	}
+
+	cfg->ipd_link = a;
+	cfg->ipd_left = b;
+	cfg->ipd_len = 0;
+
+	/* Start a new line after the data */
+	at_framer_init(&cfg->framer);
+
+	return strlen(line);
+}
+
+void _esp_ipd_flush(esp_at_cfg *cfg)
+{
+	esp_at_urc urc = {
+		.type = ESP_AT_URC_IPD,
+		.link = cfg->ipd_link,
+		.data = cfg->ipd_buf,
+		.len = cfg->ipd_len,
+		.left = cfg->ipd_left
+	};
+
+	cfg->ipd_len = 0;
+	_esp_urc_dispatch(cfg, &urc);
+}
+
+void _esp_transparent_on(esp_at_cmd *cmd, void *ctx)
+{
+	esp_at_cfg *cfg = ctx;
+
+	/* Whatever comes after the prompt is data of the link */
+	if (cmd->result >= 0) {
+		cfg->transparent = true;
+		cfg->transparent_last = get_absolute_time();
+		cfg->ipd_link = 0;
+		cfg->ipd_left = 0;
+		cfg->ipd_len = 0;
+	}
+}
+
+void _esp_urc_track(esp_at_cfg *cfg, const esp_at_urc *urc)
+{
+	esp_at_status *st = &cfg->status;
+	unsigned int i;
+
+	switch (urc->type) {
+	case ESP_AT_URC_CONNECT:
+		for (i = 0; i < st->ncli; ++i) {
+			if (st->cli[i].index == urc->link) {
+				return;
+			}
+		}
+
+		if (st->ncli >= ARRAY_LEN(st->cli)) {
+			return;
+		}
+
+		/* Links opened here are UDP, all others were accepted
+		 * by the server. The remote address is filled out by
+		 * the next esp_at_cipstatus */
+		memset(&st->cli[st->ncli], 0, sizeof(st->cli[0]));
+		st->cli[st->ncli].index = urc->link;
+
+		if (cfg->udp_links & (1u << urc->link)) {
+			st->cli[st->ncli].proto = ESP_AT_CIP_PROTO_UDP;
+			st->status |= ESP_AT_STATUS_AS_CLIENT;
+		} else {
+			st->cli[st->ncli].proto = ESP_AT_CIP_PROTO_TCP;
+			st->cli[st->ncli].l_port = st->port;
+			st->cli[st->ncli].passive = 1;
+			st->status |= ESP_AT_STATUS_CLIENT_CONNECTED;
+		}
+
+		++st->ncli;
+
+		break;
+	case ESP_AT_URC_CLOSED:
+		if (urc->link >= 0 && urc->link < ESP_AT_MAX_CONN) {
+			cfg->udp_links &= ~(1u << urc->link);
+		}
+
+		for (i = 0; i < st->ncli; ++i) {
+			if (st->cli[i].index == urc->link) {
+				break;
+			}
+		}
+
+		if (i == st->ncli) {
+			return;
+		}
+
+		--st->ncli;
+		memmove(&st->cli[i], &st->cli[i + 1],
+			(st->ncli - i) * sizeof(st->cli[0]));
+
+		st->status &= ~(ESP_AT_STATUS_CLIENT_CONNECTED |
+				ESP_AT_STATUS_AS_CLIENT);
+
+		for (i = 0; i < st->ncli; ++i) {
+			st->status |= st->cli[i].passive ?
+				ESP_AT_STATUS_CLIENT_CONNECTED :
+				ESP_AT_STATUS_AS_CLIENT;
+		}
+
+		break;
+	case ESP_AT_URC_WIFI_GOT_IP:
+		/* The address may have changed with the network */
+		st->status |= ESP_AT_STATUS_WIFI_CONNECTED;
+		cfg->stale |= ESP_AT_FIELD_ADDR;
+		break;
+	case ESP_AT_URC_WIFI_DISCONNECT:
+		/* All links are gone with the network */
+		st->status &= ~(ESP_AT_STATUS_WIFI_CONNECTED |
+				ESP_AT_STATUS_CLIENT_CONNECTED |
+				ESP_AT_STATUS_AS_CLIENT);
+		st->ncli = 0;
+		st->ipv4[0] = '\0';
+		st->ipv4_gateway[0] = '\0';
+		st->ipv4_netmask[0] = '\0';
+		st->ipv4_prefix = 0;
+		cfg->udp_links = 0;
+		cfg->stale |= ESP_AT_FIELD_ADDR;
 		break;
 	default:
-		return -1;
+		break;
+	}
+}
+
+void _esp_urc_dispatch(esp_at_cfg *cfg, const esp_at_urc *urc)
+{
+	for (unsigned int i = 0; i < cfg->nurc; ++i) {
+		cfg->urc[i].cb(urc, cfg->urc[i].ctx);
 	}
+}
 
-	if (n > 1) {
-		strncpy(clientlist->ssid, v[1],
-			sizeof(clientlist->ssid) - 1);
+uint8_t _esp_netmask_prefix(const char *nm)
+{
+	const uint32_t mask = _esp_ipv4_parse(nm);
 
-		clientlist->ssid[ARRAY_LEN(clientlist->ssid) - 1] = '\0';
+	for (uint8_t i = 0; i < 32; ++i) {
+		if (mask & (1ul << i)) {
+			return 32 - i;
+		}
 	}
 
 	return 0;
 }
 
-int _esp_query(esp_at_cfg *cfg, const char * cmd, at_rsp_lines *rsp)
+uint32_t _esp_ipv4_parse(const char *s)
 {
-	int ret;
-	char buf[4096];
+	uint32_t addr = 0;
+	const char *p = s;
 
-	ret = esp_at_send_cmd(cfg, cmd, buf, ARRAY_LEN(buf));
+	/* Dotted quad, most significant byte first */
+	for (unsigned int i = 0; i < 4 && *p != '\0'; ++i) {
+		char *end;
 
-	if (ret < 0) {
-		return -1;
+		addr = (addr << 8) | (strtoul(p, &end, 10) & 0xff);
+		p = *end == '.' ? &end[1] : end;
 	}
 
-	ret = at_rsp_get_lines(buf, rsp);
-
-	return ret;
+	return addr;
 }
 
-int _esp_cipsend_data(esp_at_cfg *cfg, const char *data, size_t len,
-		      unsigned int client_index)
+int _esp_fanout(esp_at_cfg *cfg, const char *data, size_t len,
+		const int *links, unsigned int nlinks)
 {
-	int ret;
-	char cmd[64];
-	char rsp[2048];
-
-	snprintf(cmd, ARRAY_LEN(cmd) - 1, "AT+CIPSEND=%u,%u",
-		 client_index, strnlen(data, len));
+	int ret = 0;
 
 #ifdef ESP_AT_MULTICORE_ENABLED
-	/* Make sure cmd and data are given sequentially when
-	 * multithreaded */
 	recursive_mutex_enter_blocking(&_esp_mtx);
 #endif /* #ifdef ESP_AT_MULTICORE_ENABLED */
 
-	ret = esp_at_send_cmd(cfg, cmd, rsp, ARRAY_LEN(rsp));
+	/* Collect the results of earlier sends first, so only links
+	 * that are really behind are skipped */
+	esp_at_poll(cfg);
+	_esp_send_expire(cfg);
 
-	DEBUGDATA("AT Send CMD", rsp, "%s");
+	for (unsigned int i = 0; i < nlinks; ++i) {
+		esp_at_link_stats *st;
 
-	if (ret < 0)
-		return ret;
+		if (links[i] < 0 || links[i] >= (int) ARRAY_LEN(cfg->links)) {
+			continue;
+		}
+
+		st = &cfg->links[links[i]];
+
+		if (_esp_send_pending(cfg, links[i])) {
+			DEBUGDATA("Skipping backlogged link", links[i], "%d");
+			++st->skipped;
+			continue;
+		}
+
+		if (_esp_send_link(cfg, links[i], NULL, 0, data, len,
+				   make_timeout_time_ms(ESP_AT_FANOUT_LINK_MS))
+		    < 0) {
+			DEBUGDATA("Send failed on link", links[i], "%d");
+			++st->failed;
+			ret = -1;
 
-	ret = esp_at_send_cmd(cfg, data, rsp, sizeof(rsp));
+			/* The client may be gone */
+			esp_at_status_invalidate(cfg, ESP_AT_FIELD_CLIENTS);
+		}
+	}
 
 #ifdef ESP_AT_MULTICORE_ENABLED
-	/* Make sure cmd and data are given sequentially when
-	 * multithreaded */
 	recursive_mutex_exit(&_esp_mtx);
 #endif /* #ifdef ESP_AT_MULTICORE_ENABLED */
 
-	DEBUGDATA("AT data response", rsp, "%s");
-
 	return ret;
 }
 
-int _esp_check_cipsta(esp_at_cfg *cfg, esp_at_status *clientlist)
+int _esp_send_link(esp_at_cfg *cfg, int link, const void *hdr,
+		   size_t hlen, const char *data, size_t len,
+		   absolute_time_t deadline)
 {
+	char cmd[32];
+	absolute_time_t start;
 	int ret;
-	at_rsp_lines rsp;
-
-	at_rsp_tk *ipv4;
-	at_rsp_tk *gateway;
-	at_rsp_tk *netmask;
 
-	/* Get WiFi IP address */
-	ret = _esp_query(cfg, "AT+CIPSTA?", &rsp);
-
-	if (ret < 0) {
-		return ret;
-	}
+	snprintf(cmd, ARRAY_LEN(cmd), hlen + len > ESP_AT_CIPSEND_MAX_LEN ?
+		 "AT+CIPSENDL=%d,%u" : "AT+CIPSEND=%d,%u", link,
+		 (unsigned int) (hlen + len));
 
-	ipv4 = &at_rsp_get_property("ip", &rsp)->tokenlist[0];
-	gateway = &at_rsp_get_property("gateway", &rsp)->tokenlist[0];
-	netmask = &at_rsp_get_property("netmask", &rsp)->tokenlist[0];
+	/* The exchange takes the module to itself */
+	_esp_cmd_drain(cfg);
 
-	if (! (ipv4 && gateway && netmask)) {
-		DEBUGMSG("No network detected");
-		clientlist->status &= ~ESP_AT_STATUS_WIFI_CONNECTED;
-		clientlist->ipv4[0] ='\0';
-		clientlist->ipv4_gateway[0] = '\0';
-		clientlist->ipv4_netmask[0] = '\0';
-		return 0;
-	}
+	start = get_absolute_time();
+	ret = _esp_send_exchange(cfg, link, cmd, hdr, hlen, data, len,
+				 deadline);
 
-	clientlist->status |= ESP_AT_STATUS_WIFI_CONNECTED;
-	strncpy(clientlist->ipv4, at_rsp_token_as_str(ipv4),
-		sizeof(clientlist->ipv4) - 1);
-	clientlist->ipv4[ARRAY_LEN(clientlist->ipv4) - 1] = '\0';
-	strncpy(clientlist->ipv4_gateway,
-		at_rsp_token_as_str(gateway),
-		sizeof(clientlist->ipv4_gateway) - 1);
-	clientlist->ipv4_gateway[ARRAY_LEN(clientlist->ipv4_gateway) - 1] = '\0';
-	strncpy(clientlist->ipv4_netmask,
-		at_rsp_token_as_str(netmask),
-		sizeof(clientlist->ipv4_netmask) - 1);
-	clientlist->ipv4_netmask[ARRAY_LEN(clientlist->ipv4_netmask) - 1] = '\0';
+	_esp_cmd_record(cfg, cmd, ret == 0 ? ESP_AT_CMD_OK :
+			time_reached(deadline) ? ESP_AT_CMD_TIMEOUT :
+			ESP_AT_CMD_ERROR,
+			absolute_time_diff_us(start, get_absolute_time()));
 
-	return 0;
+	return ret;
 }
 
-
-int _esp_check_cipstatus(esp_at_cfg *cfg, esp_at_status *clientlist)
+int _esp_send_exchange(esp_at_cfg *cfg, int link, const char *cmd,
+		       const void *hdr, size_t hlen,
+		       const char *data, size_t len,
+		       absolute_time_t deadline)
 {
-	int ret;
-	at_rsp_lines rsp;
-	at_rsp_tk *status;
+	at_frame_event ev = AT_FRAME_NONE;
+	int64_t left;
+
+	/* Wait for the prompt. Some modules refuse commands while an
+	 * earlier send is still going out, so retry after it
+	 * finished. */
+	while (ev != AT_FRAME_PROMPT) {
+		if (_esp_transmit_cmd(cfg, cmd, deadline) != 0) {
+			return -1;
+		}
 
-	/* Some ESP8266 modules don't support AT+CIPSTATE, so use
-	 * AT+CIPSTATUS to get most of the networking info */
-	ret = _esp_query(cfg, "AT+CIPSTATUS", &rsp);
+		for (;;) {
+			unsigned int nacks = cfg->nacks;
 
-	if (ret < 0) {
-		return ret;
-	}
+			if (_esp_next_event(cfg, deadline, &ev) < 0 ||
+			    ev == AT_FRAME_ERROR ||
+			    ev == AT_FRAME_SEND_FAIL) {
+				return -1;
+			}
 
-	status = &at_rsp_get_property("STATUS", &rsp)->tokenlist[0];
+			if (ev == AT_FRAME_PROMPT) {
+				break;
+			}
 
-	switch (at_rsp_token_as_int(status)) {
-	case 0:
-	case 1:
-	case 5:
-		clientlist->status &= ~(ESP_AT_STATUS_SERVER_ON |
-					ESP_AT_STATUS_CLIENT_CONNECTED);
-		break;
-	case 2:
-	case 3:
-	case 4:
-		clientlist->status |= ESP_AT_STATUS_SERVER_ON;
-		break;
-	default:
-		return -1; /* malformed case */
-	}
+			if (ev != AT_FRAME_LINE ||
+			    strncmp(at_framer_line(&cfg->framer, NULL),
+				    "busy", 4) != 0) {
+				continue;
+			}
 
-	/* Clients must be zeroed out before re-examining
-	 * them */
-	clientlist->ncli = 0;
-	clientlist->status &= ~(ESP_AT_STATUS_CLIENT_CONNECTED |
-				ESP_AT_STATUS_AS_CLIENT);
+			if (!nacks) {
+				sleep_us(_ESP_BUSY_RETRY_US);
+				break;
+			}
 
-	for (unsigned int i = 0; i < rsp.nlines; ++i) {
-		esp_at_clients *cptr;
-		const char *preamble = rsp.tokenlists[i].preamble;
-		at_rsp_tk *tkptr;
-		char proto[6] = {'\0'};
+			while (cfg->nacks == nacks) {
+				if (_esp_next_event(cfg, deadline, &ev) < 0) {
+					return -1;
+				}
+			}
 
-		DEBUGDATA("CIPSTATUS line", i, "%u");
-		DEBUGDATA("Preamble", preamble, "%s");
+			break;
+		}
+	}
 
-		tkptr = rsp.tokenlists[i].tokenlist;
+	/* The data goes out straight from the caller's buffer, after
+	 * the header if there is one */
+	if (hlen) {
+		left = absolute_time_diff_us(get_absolute_time(), deadline);
 
-		if (strcmp(preamble, "+CIPSTATUS") != 0) {
-			DEBUGDATA("Doesn't match +CIPSTATUS",
-				  i, "%u");
-			continue;
+		if (left <= 0 ||
+		    !uart_pio_write_timeout(&cfg->uart_cfg, hdr, hlen,
+					    left)) {
+			return -1;
 		}
+	}
 
-		cptr = &clientlist->cli[clientlist->ncli];
-		cptr->index = at_rsp_token_as_int(&tkptr[0]);
-		DEBUGDATA("Working on index", cptr->index, "%d");
-
-		/* protocol requires furthur processing
-		 * later */
-		strncpy(proto, at_rsp_token_as_str(&tkptr[1]),
-			ARRAY_LEN(proto) - 1);
+	left = absolute_time_diff_us(get_absolute_time(), deadline);
 
-		strncpy(cptr->ipv4,
-			at_rsp_token_as_str(&tkptr[2]),
-			sizeof(cptr->ipv4) - 1);
-		cptr->r_port = at_rsp_token_as_int(&tkptr[3]);
-		cptr->l_port = at_rsp_token_as_int(&tkptr[4]);
-		cptr->passive = at_rsp_token_as_int(&tkptr[5]);
+	if (left <= 0 ||
+	    !uart_pio_write_timeout(&cfg->uart_cfg, data, len, left)) {
+		return -1;
+	}
 
-		if (cptr->passive) {
-			clientlist->status |= ESP_AT_STATUS_CLIENT_CONNECTED;
-		} else {
-			clientlist->status |= ESP_AT_STATUS_AS_CLIENT;
+	/* The module is ready for the next command once it confirmed
+	 * the data, the result of the send comes later */
+	for (;;) {
+		if (_esp_next_event(cfg, deadline, &ev) < 0) {
+			return -1;
 		}
 
-		/* This is the furthur processing for
-		 * protocol */
-		if (strcmp(proto, "TCP") == 0) {
-			cptr->proto = ESP_AT_CIP_PROTO_TCP;
-		} else if (strcmp(proto, "UDP") == 0) {
-			cptr->proto = ESP_AT_CIP_PROTO_UDP;
-		} else if (strcmp(proto, "SSL") == 0) {
-			cptr->proto = ESP_AT_CIP_PROTO_SSL;
-		} else {
-			cptr->proto = ESP_AT_CIP_PROTO_NULL;
+		switch (ev) {
+		case AT_FRAME_SEND_OK:
+			++cfg->links[link].sent;
+			++cfg->links[link].acked;
+			return 0;
+		case AT_FRAME_LINE:
+			/* CIPSENDL reports the length instead */
+			if (strncmp(at_framer_line(&cfg->framer, NULL),
+				    "Recv ", 5) == 0 ||
+			    strncmp(at_framer_line(&cfg->framer, NULL),
+				    "+CIPSENDL:", 10) == 0) {
+				++cfg->links[link].sent;
+				_esp_send_queue(cfg, link);
+				return 0;
+			}
+
+			break;
+		case AT_FRAME_NONE:
+		case AT_FRAME_OK:
+		case AT_FRAME_PROMPT:
+			break;
+		default:
+			return -1;
 		}
+	}
+}
 
-		++clientlist->ncli;
+int _esp_uart_cur(esp_at_cfg *cfg, uint baud, bool answer)
+{
+	char cmd[48];
+	char rsp[128];
+	absolute_time_t deadline;
+
+	/* 8 data bits, 1 stop bit, no parity, and RTS and CTS (3) if
+	 * the PIO uses them */
+	snprintf(cmd, ARRAY_LEN(cmd), "AT+UART_CUR=%u,8,1,0,%d", baud,
+		 cfg->uart_cfg.flow ? 3 : 0);
+
+	if (answer) {
+		return esp_at_send_cmd(cfg, cmd, rsp, ARRAY_LEN(rsp)) < 0 ?
+			-1 : 0;
 	}
 
-	return 0;
+	/* Sent blind, the answer may not be readable */
+	_esp_cmd_drain(cfg);
+
+	deadline = make_timeout_time_ms(esp_at_cmd_timeout_ms(cmd));
+
+	return _esp_transmit_cmd(cfg, cmd, deadline);
 }
 
-int _esp_check_cipmux(esp_at_cfg *cfg, esp_at_status *clientlist)
+int _esp_check_baud(esp_at_cfg *cfg, uint baud)
 {
-	int ret;
-	at_rsp_lines rsp;
-	at_rsp_tk *value;
-	esp_at_status_byte *status = &clientlist->status;
+	char rsp[64];
 
-	/* Query specific server parameters */
-	ret = _esp_query(cfg, "AT+CIPMUX?", &rsp);
+	/* Give the module time to answer and change */
+	sleep_us(_ESP_BAUD_SWITCH_US);
 
-	if (ret < 0) {
-		return ret;
+	if (!uart_pio_set_baud(&cfg->uart_cfg, baud, _ESP_UART_WAIT_US)) {
+		return -1;
 	}
 
-	value = &at_rsp_get_property("+CIPMUX", &rsp)->tokenlist[0];
+	/* Whatever arrived during the change is garbage */
+	uart_pio_flush_rx(&cfg->uart_cfg);
+	at_framer_init(&cfg->framer);
 
-	if (at_rsp_token_as_int(value)) {
-		*status |= ESP_AT_STATUS_CIPMUX_ON;
-	} else {
-		*status &= ~ESP_AT_STATUS_CIPMUX_ON;
+	for (unsigned int i = 0; i < _ESP_BAUD_TRIES; ++i) {
+		if (esp_at_send_cmd(cfg, "AT", rsp, ARRAY_LEN(rsp)) > 0) {
+			return 0;
+		}
 	}
 
-	return 0;
+	return -1;
 }
 
-int _esp_transmit_cmd(esp_at_cfg *cfg, const char *cmd)
+void _esp_probe(esp_at_cfg *cfg)
 {
-	const char *eot = "\r\n";
-	char outstr[256];
+	char rsp[_ESP_RESPONSE_BUFFER_LEN];
+	const char *v;
+	char *end;
+	long major, minor = 0;
 
-	/* Add CR and LF to string */
-	strlcpy(outstr, cmd, ARRAY_LEN(outstr) - strlen(eot) - 1);
-	strlcat(outstr, eot, ARRAY_LEN(outstr) - 1);
+	/* AT version:<major>.<minor>.<patch>.<build>(...) */
+	if (esp_at_send_cmd(cfg, "AT+GMR", rsp, ARRAY_LEN(rsp)) > 0 &&
+	    (v = strstr(rsp, "AT version:")) != NULL) {
+		major = strtol(&v[11], &end, 10);
 
-	DEBUGDATA("ESP RX is", outstr, "%s");
+		if (*end == '.') {
+			minor = strtol(&end[1], NULL, 10);
+		}
 
-	/* Semi-blocking with hard-coded timeout */
-	if (uart_pio_puts_timeout(&cfg->uart_cfg, outstr,
-				  _ESP_UART_WAIT_US)) {
-		return 0;
+		cfg->at_version = ESP_AT_VERSION(major, minor);
 	}
 
-	DEBUGMSG("ESP send cmd timeout");
+	DEBUGDATA("ESP AT version", cfg->at_version, "%#x");
 
-	/* Flush TX on failure */
-	uart_pio_flush_tx(&cfg->uart_cfg);
+	/* AT+CIPSENDL has no test command, it came with 2.4 */
+	if (cfg->at_version >= ESP_AT_VERSION(2, 4)) {
+		cfg->caps |= ESP_AT_CAP_CIPSENDL;
+	}
 
-	return -1;
+	if (esp_at_send_cmd(cfg, "AT+CIPSTATE=?", rsp, ARRAY_LEN(rsp)) > 0) {
+		cfg->caps |= ESP_AT_CAP_CIPSTATE;
+	}
 }
 
-int _esp_receive_response(esp_at_cfg *cfg, char *rsp, size_t len)
+int _esp_send_wait(esp_at_cfg *cfg, int link)
 {
-	int rslt = 0;
-	memset(rsp, '\0', sizeof(char) * len);
+	const absolute_time_t deadline =
+		make_timeout_time_ms(ESP_AT_SEND_ACK_MS);
+	at_frame_event ev;
+
+	while (_esp_send_pending(cfg, link)) {
+		if (_esp_next_event(cfg, deadline, &ev) < 0) {
+			/* Counted as failed once it expires */
+			_esp_send_expire(cfg);
+			return -1;
+		}
+	}
 
-	for (unsigned int i = 0; i < len - 1; i++) {
-		char *c = &rsp[i];
+	return 0;
+}
 
-		if (!uart_pio_getc_timeout(&cfg->uart_cfg, c,
-					   _ESP_UART_WAIT_US)) {
-			DEBUGMSG("ESP response timeout");
-			break;
+int _esp_next_event(esp_at_cfg *cfg, absolute_time_t deadline,
+		    at_frame_event *ev)
+{
+	char c;
+
+	do {
+		if (!uart_pio_rx_wait_until(&cfg->uart_cfg, 1, deadline) ||
+		    !uart_pio_try_getc(&cfg->uart_cfg, &c)) {
+			return -1;
 		}
 
-		if (!_esp_check_at_end_sequence(rsp))
-			continue;
+		_esp_cmd_feed(cfg, c, ev);
+	} while (*ev == AT_FRAME_NONE);
 
-		DEBUGMSG("Found AT end sequence");
-		DEBUGDATA("AT Response so far", rsp, "%s");
+	return 0;
+}
 
-		/* rslt = 1 for OK, -1 for ERROR, and 0 if no match */
-		if ((rslt = _esp_check_rsp_success(rsp)))
-			break;
+bool _esp_send_pending(esp_at_cfg *cfg, int link)
+{
+	for (unsigned int i = 0; i < cfg->nacks; ++i) {
+		unsigned int ai = (cfg->ack_head + i) % ESP_AT_MAX_CONN;
 
-		/* DEBUGDATA("AT Response so far", rsp, "%s"); */
+		if (cfg->acks[ai].link == link) {
+			return true;
+		}
 	}
 
-	switch (rslt) {
-	case 1:
-		/* Return number of characters read if successful */
-		DEBUGMSG("Received AT response OK for command");
-		return strlen(rsp);
-	case 0:
-		DEBUGMSG("Received no AT response before buffer filled command");
-		break;
-	default:
-		/* Ran out of buffer before received OK or ERROR */
-		DEBUGMSG("Received AT response ERROR for command");
-		break;
-	}
+	return false;
+}
 
-	return -1;
+void _esp_send_queue(esp_at_cfg *cfg, int link)
+{
+	unsigned int ai = (cfg->ack_head + cfg->nacks) % ESP_AT_MAX_CONN;
+
+	/* Callers make sure there is room, the fan-out by skipping
+	 * links with a pending send */
+	cfg->acks[ai].link = link;
+	cfg->acks[ai].deadline = make_timeout_time_ms(ESP_AT_SEND_ACK_MS);
+	++cfg->nacks;
 }
 
-bool _esp_check_at_end_sequence(const char *rsp)
+void _esp_send_done(esp_at_cfg *cfg, bool ok)
 {
-	const char *endseq = "\r\n";
-	unsigned int len = strlen(rsp);
+	esp_at_link_stats *st = &cfg->links[cfg->acks[cfg->ack_head].link];
 
-	if (len < 2)
-		return false;
+	if (ok) {
+		++st->acked;
+	} else {
+		++st->failed;
+		esp_at_status_invalidate(cfg, ESP_AT_FIELD_CLIENTS);
+	}
 
-	return !strncmp(&rsp[len - 2], endseq,
-			strlen(endseq) * sizeof(char));
+	cfg->ack_head = (cfg->ack_head + 1) % ESP_AT_MAX_CONN;
+	--cfg->nacks;
 }
 
-int _esp_check_rsp_success(const char *rsp)
+void _esp_send_expire(esp_at_cfg *cfg)
 {
-	const char *okptrn = "OK\r\n";
-	const char *errptrn = "ERROR\r\n";
+	while (cfg->nacks &&
+	       time_reached(cfg->acks[cfg->ack_head].deadline)) {
+		_esp_send_done(cfg, false);
+	}
+}
 
-	const int len = strlen(rsp);
-	const int okpos = len - (int) strlen(okptrn);
-	const int errpos = len - (int) strlen(errptrn);
+void _esp_throughput_report(esp_at_cfg *cfg)
+{
+	const uint baud = cfg->uart_cfg.baud;
 
-	if (okpos >= 0 && !strcmp(&rsp[okpos], okptrn)) {
-		DEBUGMSG("Received AT response OK for command");
+	printf("Sending %u bytes to link 0 at each rate\n",
+	       _ESP_THROUGHPUT_LEN);
 
-		return 1;
-	}
+	for (unsigned int i = ARRAY_LEN(_esp_bauds); i-- > 0;) {
+		int32_t bps;
 
-	if (errpos >= 0 && !strcmp(&rsp[errpos], errptrn)) {
-		DEBUGMSG("Received AT response ERROR for command");
+		if (esp_at_set_baud(cfg, _esp_bauds[i]) < 0) {
+			printf("%7u baud: not supported\n", _esp_bauds[i]);
+			continue;
+		}
 
-		return -1;
+		bps = esp_at_measure_throughput(cfg, 0, _ESP_THROUGHPUT_LEN);
+
+		if (bps < 0) {
+			printf("%7u baud: send failed\n", _esp_bauds[i]);
+		} else {
+			printf("%7u baud: %ld bytes/s\n", _esp_bauds[i],
+			       (long) bps);
+		}
 	}
 
-	return 0;
+	esp_at_set_baud(cfg, baud);
 }
@@ -0,0 +1,348 @@
+/*
+* Copyright (c) 2022 Tyler J. Anderson.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions
+* are met:
+*
+* 1. Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+*
+* 2. Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in
+*    the documentation and/or other materials provided with the
+*    distribution.
+*
+* 3. Neither the name of the copyright holder nor the names of its
+*    contributors may be used to endorse or promote products derived
+*    from this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+* "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+* LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+* FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+* COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+* INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+* BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+* CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+* LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+* ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+/**
+ * @file esp-at-replay.c
+ *
+ * @brief Window of recent frames in RAM, for clients to catch up
+ */
+
+#include "esp-at-replay.h"
+#include "debugmsg.h"
+
+#include <string.h>
+
+#include "pico/stdlib.h"
+
+#ifdef ESP_AT_DMA_CRC_ENABLED
+#include "hardware/dma.h"
+#endif /* #ifdef ESP_AT_DMA_CRC_ENABLED */
+
+/* CRC32 of each nibble, for the reflected polynomial 0xedb88320 */
+static const uint32_t _esp_crc_nibble[16] = {
+	0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac,
+	0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+	0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c,
+	0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c
+};
+
+static uint32_t _esp_crc32_table(const uint8_t *data, size_t len);
+#ifdef ESP_AT_DMA_CRC_ENABLED
+static uint32_t _esp_crc32_dma(const uint8_t *data, size_t len);
+#endif /* #ifdef ESP_AT_DMA_CRC_ENABLED */
+static bool _esp_replay_place(esp_at_replay *rp, size_t len, size_t *off);
+static void _esp_replay_evict(esp_at_replay *rp);
+static void _esp_replay_lock(esp_at_replay *rp);
+static void _esp_replay_unlock(esp_at_replay *rp);
+
+uint32_t esp_at_crc32(const void *data, size_t len)
+{
+#ifdef ESP_AT_DMA_CRC_ENABLED
+	return _esp_crc32_dma(data, len);
+#else
+	return _esp_crc32_table(data, len);
+#endif /* #ifdef ESP_AT_DMA_CRC_ENABLED */
+}
+
+void esp_at_replay_init(esp_at_replay *rp, char *store, size_t size,
+			uint32_t seq)
+{
+	memset(rp, 0, sizeof(*rp));
+	rp->store = store;
+	rp->size = size > UINT16_MAX ? UINT16_MAX : size;
+	rp->seq = seq;
+	rp->next = seq;
+
+#ifdef ESP_AT_MULTICORE_ENABLED
+	critical_section_init(&rp->cs);
+#endif /* #ifdef ESP_AT_MULTICORE_ENABLED */
+}
+
+uint32_t esp_at_replay_add(esp_at_replay *rp, const void *data,
+			   size_t len)
+{
+	esp_at_replay_frame *f;
+	uint32_t seq;
+	size_t off;
+
+	/* The CRC is taken under the lock too, so the cores never
+	 * share the DMA sniffer */
+	_esp_replay_lock(rp);
+	seq = rp->next++;
+
+	if (!data || len > rp->size) {
+		DEBUGDATA("Frame not kept, length", len, "%zu");
+		rp->evicted += rp->count;
+		rp->dropped++;
+		rp->count = 0;
+		rp->seq = rp->next;
+		_esp_replay_unlock(rp);
+
+		return seq;
+	}
+
+	while (!_esp_replay_place(rp, len, &off)) {
+		_esp_replay_evict(rp);
+	}
+
+	if (rp->count == 0) {
+		rp->seq = seq;
+	}
+
+	f = &rp->frames[(rp->first + rp->count) % ESP_AT_REPLAY_FRAMES];
+	f->off = off;
+	f->len = len;
+	f->crc = esp_at_crc32(data, len);
+	memcpy(&rp->store[off], data, len);
+	rp->count++;
+
+	_esp_replay_unlock(rp);
+
+	return seq;
+}
+
+uint32_t esp_at_replay_next(esp_at_replay *rp)
+{
+	uint32_t next;
+
+	_esp_replay_lock(rp);
+	next = rp->next;
+	_esp_replay_unlock(rp);
+
+	return next;
+}
+
+int esp_at_replay_get(esp_at_replay *rp, uint32_t seq, void *buf,
+		      size_t size, size_t *len)
+{
+	const esp_at_replay_frame *f;
+	int ret = 0;
+
+	_esp_replay_lock(rp);
+
+	/* Wraps around along with the sequence numbers */
+	if (seq - rp->seq >= rp->count) {
+		ret = -1;
+	} else {
+		f = &rp->frames[(rp->first + (seq - rp->seq)) %
+				ESP_AT_REPLAY_FRAMES];
+
+		if (f->len > size) {
+			ret = -2;
+		} else {
+			memcpy(buf, &rp->store[f->off], f->len);
+			*len = f->len;
+
+			if (esp_at_crc32(buf, f->len) != f->crc) {
+				rp->corrupt++;
+				ret = -3;
+			}
+		}
+	}
+
+	_esp_replay_unlock(rp);
+
+	return ret;
+}
+
+int esp_at_replay_send(esp_at_replay *rp, esp_at_cfg *cfg, int link,
+		       uint32_t seq, void *buf, size_t size,
+		       uint32_t *lost)
+{
+	uint32_t oldest;
+	uint32_t end;
+	int sent = 0;
+
+	_esp_replay_lock(rp);
+	oldest = rp->seq;
+	end = rp->next;
+	_esp_replay_unlock(rp);
+
+	*lost = 0;
+
+	/* Ahead of the window, the client saw everything there is */
+	if ((int32_t) (seq - end) > 0) {
+		return 0;
+	}
+
+	if ((int32_t) (oldest - seq) > 0) {
+		*lost = oldest - seq;
+		seq = oldest;
+	}
+
+	for (; seq != end; ++seq) {
+		size_t len;
+
+		/* Evicted meanwhile, or corrupt */
+		if (esp_at_replay_get(rp, seq, buf, size, &len) < 0) {
+			++*lost;
+			continue;
+		}
+
+		if (esp_at_cipsend_data(cfg, link, buf, len) < 0) {
+			return -1;
+		}
+
+		++sent;
+	}
+
+	return sent;
+}
+
+/*
+**********************************************************************
+************************ INTERNAL FUNCTIONS **************************
+**********************************************************************
+*/
+
+uint32_t _esp_crc32_table(const uint8_t *data, size_t len)
+{
+	uint32_t crc = 0xffffffff;
+
+	for (size_t i = 0; i < len; ++i) {
+		crc = _esp_crc_nibble[(crc ^ data[i]) & 0xf] ^ (crc >> 4);
+		crc = _esp_crc_nibble[(crc ^ (data[i] >> 4)) & 0xf] ^
+			(crc >> 4);
+	}
+
+	return ~crc;
+}
+
+#ifdef ESP_AT_DMA_CRC_ENABLED
+uint32_t _esp_crc32_dma(const uint8_t *data, size_t len)
+{
+	static int ch = -1;
+	static uint8_t sink;
+	dma_channel_config c;
+	uint32_t crc;
+
+	if (ch < 0) {
+		ch = dma_claim_unused_channel(false);
+	}
+
+	/* The UART may have taken every channel */
+	if (ch < 0 || len == 0) {
+		return _esp_crc32_table(data, len);
+	}
+
+	c = dma_channel_get_default_config(ch);
+	channel_config_set_transfer_data_size(&c, DMA_SIZE_8);
+	channel_config_set_read_increment(&c, true);
+	channel_config_set_write_increment(&c, false);
+	channel_config_set_sniff_enable(&c, true);
+
+	/* Bit-reversed data, and the result reversed and inverted when
+	 * read, gives the CRC32 of the table */
+	dma_sniffer_enable(ch, DMA_SNIFF_CTRL_CALC_VALUE_CRC32R, true);
+	dma_sniffer_set_output_reverse_enabled(true);
+	dma_sniffer_set_output_invert_enabled(true);
+	dma_sniffer_set_data_accumulator(0xffffffff);
+
+	dma_channel_configure(ch, &c, &sink, data, len, true);
+	dma_channel_wait_for_finish_blocking(ch);
+
+	crc = dma_sniffer_get_data_accumulator();
+	dma_sniffer_disable();
+
+	return crc;
+}
+#endif /* #ifdef ESP_AT_DMA_CRC_ENABLED */
+
+bool _esp_replay_place(esp_at_replay *rp, size_t len, size_t *off)
+{
+	const esp_at_replay_frame *oldest;
+	const esp_at_replay_frame *newest;
+	size_t head;
+	size_t tail;
+
+	if (rp->count == 0) {
+		*off = 0;
+		return len <= rp->size;
+	}
+
+	if (rp->count == ESP_AT_REPLAY_FRAMES) {
+		return false;
+	}
+
+	oldest = &rp->frames[rp->first];
+	newest = &rp->frames[(rp->first + rp->count - 1) %
+			     ESP_AT_REPLAY_FRAMES];
+	head = oldest->off;
+	tail = newest->off + newest->len;
+
+	/* Frames in one piece, room after them or in front of them */
+	if (tail > head) {
+		if (rp->size - tail >= len) {
+			*off = tail;
+			return true;
+		}
+
+		if (head >= len) {
+			*off = 0;
+			return true;
+		}
+
+		return false;
+	}
+
+	/* Frames wrapped around, room between the newest and oldest */
+	if (head - tail >= len) {
+		*off = tail;
+		return true;
+	}
+
+	return false;
+}
+
+void _esp_replay_evict(esp_at_replay *rp)
+{
+	rp->first = (rp->first + 1) % ESP_AT_REPLAY_FRAMES;
+	rp->count--;
+	rp->seq++;
+	rp->evicted++;
+}
+
+void _esp_replay_lock(esp_at_replay *rp)
+{
+#ifdef ESP_AT_MULTICORE_ENABLED
+	critical_section_enter_blocking(&rp->cs);
+#endif /* #ifdef ESP_AT_MULTICORE_ENABLED */
+}
+
+void _esp_replay_unlock(esp_at_replay *rp)
+{
+#ifdef ESP_AT_MULTICORE_ENABLED
+	critical_section_exit(&rp->cs);
+#endif /* #ifdef ESP_AT_MULTICORE_ENABLED */
+}
@@ -0,0 +1,215 @@
+/**
+ * @file bench.c
+ * @brief Host benchmark of sending to clients
+ *
+ * Measures on the simulated module how long it takes until every
+ * client confirmed a message, once sending to one client after the
+ * other and waiting for each SEND OK as done before, and once with
+ * the pipelined fan-out of esp_at_cipsend_string. Then measures the
+ * throughput to a single client at each UART rate, with a CIPSEND
+ * per piece and in transparent transmission.
+ */
+
+#include "esp-at-modem.h"
+#include "esp-sim.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BENCH_BAUD 115200
+#define BENCH_MAX_CLIENTS 5
+#define BENCH_MSG_LEN 64
+#define BENCH_THROUGHPUT_LEN 32768
+#define BENCH_STREAM_CHUNK 1024
+
+static esp_at_cfg cfg;
+static char msg[BENCH_MSG_LEN + 1];
+
+static void _bench_setup(unsigned int nclients, esp_at_status *status)
+{
+	esp_sim *esp = esp_sim_reset();
+
+	for (unsigned int i = 0; i < nclients; ++i) {
+		esp->links[i].connected = true;
+	}
+
+	esp_at_init_module(&cfg, pio0, 0, 1, 0, 1, BENCH_BAUD, 2, 3);
+	esp_at_set_baud(&cfg, BENCH_BAUD);
+	esp_at_cipserver_init(&cfg);
+	esp_at_status_update(&cfg);
+	esp_at_status_snapshot(&cfg, status);
+}
+
+/* Done once the last result came in */
+static void _bench_wait_acks(void)
+{
+	while (cfg.nacks) {
+		sleep_us(100);
+		esp_at_poll(&cfg);
+	}
+}
+
+/* CIPSEND, data and SEND OK for each client in turn */
+static int _bench_sequential(esp_at_status *status)
+{
+	esp_at_status one = *status;
+
+	one.ncli = 1;
+
+	for (unsigned int i = 0; i < status->ncli; ++i) {
+		one.cli[0] = status->cli[i];
+
+		if (esp_at_cipsend_string(&cfg, msg, strlen(msg), &one) < 0) {
+			return -1;
+		}
+
+		_bench_wait_acks();
+	}
+
+	return 0;
+}
+
+static int _bench_pipelined(esp_at_status *status)
+{
+	int ret = esp_at_cipsend_string(&cfg, msg, strlen(msg), status);
+
+	_bench_wait_acks();
+
+	return ret;
+}
+
+static double _bench_run(int (*fn)(esp_at_status*), unsigned int nclients)
+{
+	esp_at_status status;
+	uint64_t start;
+
+	_bench_setup(nclients, &status);
+	start = esp_sim_now_us();
+
+	if (fn(&status) < 0) {
+		return -1;
+	}
+
+	return (esp_sim_now_us() - start) / 1000.0;
+}
+
+/* The same data written in transparent transmission */
+static int32_t _bench_stream(uint baud)
+{
+	static char chunk[BENCH_STREAM_CHUNK];
+	uint64_t start;
+	size_t sent = 0;
+
+	esp_sim_reset();
+	esp_at_init_module(&cfg, pio0, 0, 1, 0, 1, BENCH_BAUD, 2, 3);
+
+	if (esp_at_set_baud(&cfg, baud) < 0 ||
+	    esp_at_transparent_enter(&cfg, ESP_AT_CIP_PROTO_TCP,
+				     "192.168.5.2", 5000) < 0) {
+		return -1;
+	}
+
+	memset(chunk, 'x', sizeof(chunk));
+	start = esp_sim_now_us();
+
+	while (sent < BENCH_THROUGHPUT_LEN) {
+		if (esp_at_transparent_write(&cfg, chunk, sizeof(chunk)) < 0) {
+			return -1;
+		}
+
+		sent += sizeof(chunk);
+	}
+
+	start = esp_sim_now_us() - start;
+	esp_at_transparent_exit(&cfg);
+
+	return (int32_t) ((uint64_t) sent * 1000000 / start);
+}
+
+static int _bench_throughput(void)
+{
+	static const uint bauds[] = {115200, 230400, 460800, 921600};
+	esp_at_status status;
+	int rslt = EXIT_SUCCESS;
+	int32_t last = 0;
+
+	printf("\n%u bytes to one client\n", BENCH_THROUGHPUT_LEN);
+	printf("%-8s %14s %10s %14s %10s\n", "baud", "bytes/s", "of line",
+	       "transparent", "of line");
+
+	for (unsigned int i = 0; i < sizeof(bauds) / sizeof(bauds[0]);
+	     ++i) {
+		int32_t bps, stream;
+
+		_bench_setup(1, &status);
+
+		if (esp_at_set_baud(&cfg, bauds[i]) < 0) {
+			printf("%-8u failed to switch\n", bauds[i]);
+			rslt = EXIT_FAILURE;
+			continue;
+		}
+
+		bps = esp_at_measure_throughput(&cfg, 0,
+						BENCH_THROUGHPUT_LEN);
+
+		stream = _bench_stream(bauds[i]);
+
+		/* Without a command per piece only the line is left */
+		if (bps <= last || stream < bps ||
+		    stream < 0.95 * (bauds[i] / 10)) {
+			rslt = EXIT_FAILURE;
+		}
+
+		printf("%-8u %14d %9.0f%% %14d %9.0f%%\n", bauds[i],
+		       (int) bps, 100.0 * bps / (bauds[i] / 10),
+		       (int) stream, 100.0 * stream / (bauds[i] / 10));
+		last = bps;
+	}
+
+	return rslt;
+}
+
+int main(int argc, char *argv[])
+{
+	int rslt = EXIT_SUCCESS;
+	double seq[BENCH_MAX_CLIENTS + 1];
+	double pipe[BENCH_MAX_CLIENTS + 1];
+
+	memset(msg, 'x', BENCH_MSG_LEN);
+
+	printf("%u byte message at %u baud, %u ms until SEND OK\n",
+	       BENCH_MSG_LEN, BENCH_BAUD, ESP_SIM_ACK_US / 1000);
+	printf("%-8s %14s %14s %10s %10s\n", "clients", "sequential ms",
+	       "pipelined ms", "+seq ms", "+pipe ms");
+
+	for (unsigned int n = 1; n <= BENCH_MAX_CLIENTS; ++n) {
+		seq[n] = _bench_run(_bench_sequential, n);
+		pipe[n] = _bench_run(_bench_pipelined, n);
+
+		if (seq[n] <= 0 || pipe[n] <= 0) {
+			printf("%u clients: send failed\n", n);
+			rslt = EXIT_FAILURE;
+			continue;
+		}
+
+		printf("%-8u %14.1f %14.1f %10.1f %10.1f\n", n, seq[n],
+		       pipe[n], n > 1 ? seq[n] - seq[n - 1] : 0.0,
+		       n > 1 ? pipe[n] - pipe[n - 1] : 0.0);
+	}
+
+	/* Each added client should cost its serial line time, not
+	 * another round trip */
+	if (rslt == EXIT_SUCCESS &&
+	    pipe[BENCH_MAX_CLIENTS] - pipe[1] >=
+	    (seq[BENCH_MAX_CLIENTS] - seq[1]) / 2) {
+		printf("pipelined fan-out does not scale\n");
+		rslt = EXIT_FAILURE;
+	}
+
+	if (_bench_throughput() != EXIT_SUCCESS) {
+		rslt = EXIT_FAILURE;
+	}
+
+	return rslt;
+}
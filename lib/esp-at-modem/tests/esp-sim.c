@@ -0,0 +1,826 @@
+/**
+ * @file esp-sim.c
+ * @author Tyler J. Anderson
+ * @brief Simulated ESP-AT module for host tests
+ */
+
+#include "esp-sim.h"
+#include "uart_pio.h"
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#define SIM_MAX_EVENTS 64
+#define SIM_EVENT_LEN 512
+#define SIM_RX_LEN 8192
+#define SIM_LINE_LEN 256
+#define SIM_RECV_US 200
+#define SIM_NEVER UINT64_MAX
+
+#define ARRAY_LEN(array) sizeof(array)/sizeof(array[0])
+
+/* Output of the module, sent once the clock reaches its time */
+typedef struct {
+	uint64_t t;
+	uint baud; /* Rate the module changes to, if not 0 */
+	size_t len;
+	char data[SIM_EVENT_LEN];
+} sim_event;
+
+static struct {
+	uint64_t now; /* ns */
+	uint host_baud; /* Rate of the PIO */
+
+	/* Module to MCU: pending output, then characters on the line
+	 * with the time each finished arriving */
+	sim_event ev[SIM_MAX_EVENTS];
+	unsigned int nev;
+	struct {
+		char c;
+		uint64_t t;
+	} rx[SIM_RX_LEN];
+	unsigned int rx_head;
+	unsigned int rx_len;
+	uint64_t line_free;
+
+	/* Command being received, or data of a send */
+	char line[SIM_LINE_LEN];
+	size_t line_len;
+	int data_link;
+	size_t data_len;
+	size_t data_left;
+	bool data_long; /* Data of a CIPSENDL */
+	uint64_t last_ack;
+
+	/* Transparent transmission: end of the last byte, and how many
+	 * + after a pause are held back as a possible +++ */
+	uint64_t stream_last;
+	unsigned int plus;
+
+	esp_sim esp;
+} sim = {.host_baud = 115200};
+
+static void _sim_advance(uint64_t t);
+static void _sim_output(uint64_t t);
+static uint64_t _sim_next_rx(void);
+static size_t _sim_arrived(void);
+static sim_event *_sim_schedule(const char *s, uint64_t t);
+static uint64_t _sim_after(uint64_t us);
+static uint64_t _sim_byte_ns(uint baud);
+static bool _sim_garbled(void);
+static void _sim_rx_byte(char c);
+static void _sim_stream_byte(char c);
+static void _sim_command(const char *cmd);
+static bool _sim_command_esp32(const char *cmd);
+static void _sim_cipsend(const char *args, bool sendl);
+static void _sim_cipstatus(void);
+static void _sim_cipstate(void);
+static void _sim_cipstart(const char *args);
+static void _sim_cipsend_bare(void);
+static void _sim_cipclose(const char *args);
+static void _sim_udp_forward(const esp_sim_link *link);
+void _sim_uart_cur(const char *args);
+static void _sim_send_done(void);
+
+esp_sim *esp_sim_reset(void)
+{
+	sim.nev = 0;
+	sim.rx_head = 0;
+	sim.rx_len = 0;
+	sim.line_free = sim.now;
+	sim.line_len = 0;
+	sim.data_left = 0;
+	sim.last_ack = sim.now;
+	sim.plus = 0;
+
+	memset(&sim.esp, 0, sizeof(sim.esp));
+	sim.esp.cmd_us = ESP_SIM_CMD_US;
+	sim.esp.baud = 115200;
+
+	for (unsigned int i = 0; i < ARRAY_LEN(sim.esp.links); ++i) {
+		sim.esp.links[i].ack_us = ESP_SIM_ACK_US;
+	}
+
+	return &sim.esp;
+}
+
+void esp_sim_emit(const char *s, uint64_t delay_us)
+{
+	_sim_schedule(s, _sim_after(delay_us));
+}
+
+uint64_t esp_sim_now_us(void)
+{
+	return sim.now / 1000;
+}
+
+absolute_time_t get_absolute_time(void)
+{
+	return sim.now / 1000;
+}
+
+void sleep_us(uint64_t us)
+{
+	_sim_advance(sim.now + us * 1000);
+}
+
+/*
+**********************************************************************
+************************** UART PIO API ******************************
+**********************************************************************
+*/
+
+uint uart_pio_init(uart_pio_cfg *cfg)
+{
+	if (!cfg->baud) {
+		return UART_PIO_E_HARDWARE_FAIL;
+	}
+
+	sim.host_baud = cfg->baud;
+	memset(&cfg->rx_stats, 0, sizeof(cfg->rx_stats));
+
+	return UART_PIO_OK;
+}
+
+bool uart_pio_is_writable(uart_pio_cfg *cfg)
+{
+	return true;
+}
+
+bool uart_pio_is_readable(uart_pio_cfg *cfg)
+{
+	return uart_pio_rx_available(cfg) > 0;
+}
+
+void uart_pio_putc_blocking(uart_pio_cfg *cfg, char c)
+{
+	uart_pio_write_timeout(cfg, &c, 1, SIM_NEVER / 2000);
+}
+
+void uart_pio_puts_blocking(uart_pio_cfg *cfg, const char *s)
+{
+	uart_pio_write_timeout(cfg, s, strlen(s), SIM_NEVER / 2000);
+}
+
+bool uart_pio_putc_timeout(uart_pio_cfg *cfg, char c, uint64_t us)
+{
+	return uart_pio_write_timeout(cfg, &c, 1, us);
+}
+
+bool uart_pio_puts_timeout(uart_pio_cfg *cfg, const char *s,
+			   uint64_t us)
+{
+	return uart_pio_write_timeout(cfg, s, strlen(s), us);
+}
+
+bool uart_pio_write_async(uart_pio_cfg *cfg, const void *buf,
+			  size_t len)
+{
+	/* Nothing else runs meanwhile, so sending it right away looks
+	 * the same to the caller */
+	return uart_pio_write_timeout(cfg, buf, len, SIM_NEVER / 2000);
+}
+
+bool uart_pio_write_busy(uart_pio_cfg *cfg)
+{
+	return false;
+}
+
+bool uart_pio_write_wait(uart_pio_cfg *cfg, absolute_time_t deadline)
+{
+	return true;
+}
+
+size_t uart_pio_write_abort(uart_pio_cfg *cfg)
+{
+	return 0;
+}
+
+bool uart_pio_write_timeout(uart_pio_cfg *cfg, const void *buf,
+			    size_t len, uint64_t us)
+{
+	const char *s = buf;
+	const uint64_t deadline = sim.now + us * 1000;
+
+	for (size_t i = 0; i < len; ++i) {
+		const uint64_t t = sim.now + _sim_byte_ns(sim.host_baud);
+
+		if (t > deadline) {
+			return false;
+		}
+
+		_sim_advance(t);
+		_sim_rx_byte(s[i]);
+	}
+
+	return true;
+}
+
+char uart_pio_getc_blocking(uart_pio_cfg *cfg)
+{
+	char c = '\0';
+
+	uart_pio_rx_wait_until(cfg, 1, SIM_NEVER / 1000);
+	uart_pio_try_getc(cfg, &c);
+
+	return c;
+}
+
+bool uart_pio_getc_timeout(uart_pio_cfg *cfg, char *c, uint64_t us)
+{
+	*c = '\0';
+
+	return uart_pio_rx_wait_until(cfg, 1, make_timeout_time_us(us)) &&
+		uart_pio_try_getc(cfg, c);
+}
+
+size_t uart_pio_rx_available(uart_pio_cfg *cfg)
+{
+	_sim_output(sim.now);
+
+	return _sim_arrived();
+}
+
+bool uart_pio_try_getc(uart_pio_cfg *cfg, char *c)
+{
+	if (!uart_pio_rx_available(cfg)) {
+		return false;
+	}
+
+	*c = sim.rx[sim.rx_head].c;
+	sim.rx_head = (sim.rx_head + 1) % SIM_RX_LEN;
+	--sim.rx_len;
+	++cfg->rx_stats.received;
+
+	return true;
+}
+
+size_t uart_pio_read(uart_pio_cfg *cfg, uint8_t *buf, size_t len)
+{
+	size_t n = 0;
+
+	while (n < len && uart_pio_try_getc(cfg, (char *) &buf[n])) {
+		++n;
+	}
+
+	return n;
+}
+
+bool uart_pio_rx_wait_until(uart_pio_cfg *cfg, size_t n,
+			    absolute_time_t deadline)
+{
+	/* Jump from one arrival to the next instead of ticking */
+	while (uart_pio_rx_available(cfg) < n) {
+		uint64_t next = _sim_next_rx();
+
+		if (next == SIM_NEVER || next > deadline * 1000) {
+			if (deadline != SIM_NEVER / 1000) {
+				_sim_advance(deadline * 1000);
+			}
+
+			return false;
+		}
+
+		_sim_advance(next);
+	}
+
+	return true;
+}
+
+void uart_pio_get_rx_stats(uart_pio_cfg *cfg, uart_pio_rx_stats *s)
+{
+	*s = cfg->rx_stats;
+}
+
+bool uart_pio_set_baud(uart_pio_cfg *cfg, uint baud, uint64_t us)
+{
+	sim.host_baud = baud;
+	cfg->baud = baud;
+
+	return true;
+}
+
+void uart_pio_flush_tx(uart_pio_cfg *cfg)
+{
+}
+
+void uart_pio_flush_rx(uart_pio_cfg *cfg)
+{
+	char c;
+
+	while (uart_pio_try_getc(cfg, &c)) {
+	}
+}
+
+/*
+**********************************************************************
+*********************** INTERNAL FUNCTIONS ***************************
+**********************************************************************
+*/
+
+void _sim_advance(uint64_t t)
+{
+	if (t > sim.now) {
+		sim.now = t;
+	}
+
+	/* Silence after the +++ ends the transmission */
+	if (sim.esp.transparent && sim.plus == 3 &&
+	    sim.now >= sim.stream_last + ESP_SIM_GUARD_US * 1000ull) {
+		sim.esp.transparent = false;
+		sim.plus = 0;
+	}
+
+	_sim_output(sim.now);
+}
+
+void _sim_output(uint64_t t)
+{
+	/* Output due by now goes on the line in order, each character
+	 * after the one before it */
+	while (sim.nev && sim.ev[0].t <= t) {
+		sim_event *e = &sim.ev[0];
+		const uint64_t byte_ns = _sim_byte_ns(sim.esp.baud);
+		const bool garbled = _sim_garbled() ||
+			(sim.esp.max_baud && sim.esp.baud > sim.esp.max_baud);
+
+		if (e->baud) {
+			sim.esp.baud = e->baud;
+		}
+
+		for (size_t i = 0; i < e->len; ++i) {
+			unsigned int ri = (sim.rx_head + sim.rx_len) %
+				SIM_RX_LEN;
+
+			if (sim.rx_len == ARRAY_LEN(sim.rx)) {
+				fprintf(stderr, "esp-sim: RX overrun\n");
+				abort();
+			}
+
+			if (sim.line_free < e->t) {
+				sim.line_free = e->t;
+			}
+
+			sim.line_free += byte_ns;
+			sim.rx[ri].c = garbled ? '\xfe' : e->data[i];
+			sim.rx[ri].t = sim.line_free;
+			++sim.rx_len;
+		}
+
+		--sim.nev;
+		memmove(&sim.ev[0], &sim.ev[1], sim.nev * sizeof(sim.ev[0]));
+	}
+}
+
+uint64_t _sim_next_rx(void)
+{
+	size_t n = _sim_arrived();
+
+	if (n < sim.rx_len) {
+		return sim.rx[(sim.rx_head + n) % SIM_RX_LEN].t;
+	}
+
+	if (sim.nev) {
+		return (sim.line_free > sim.ev[0].t ?
+			sim.line_free : sim.ev[0].t) +
+			_sim_byte_ns(sim.esp.baud);
+	}
+
+	return SIM_NEVER;
+}
+
+size_t _sim_arrived(void)
+{
+	size_t n = 0;
+
+	while (n < sim.rx_len &&
+	       sim.rx[(sim.rx_head + n) % SIM_RX_LEN].t <= sim.now) {
+		++n;
+	}
+
+	return n;
+}
+
+uint64_t _sim_after(uint64_t us)
+{
+	return sim.now + us * 1000;
+}
+
+uint64_t _sim_byte_ns(uint baud)
+{
+	/* Start bit, 8 data bits and stop bit */
+	return 10000000000ull / baud;
+}
+
+bool _sim_garbled(void)
+{
+	return sim.host_baud != sim.esp.baud;
+}
+
+sim_event *_sim_schedule(const char *s, uint64_t t)
+{
+	unsigned int i = sim.nev;
+
+	if (sim.nev == ARRAY_LEN(sim.ev) || strlen(s) > SIM_EVENT_LEN) {
+		fprintf(stderr, "esp-sim: too much output pending\n");
+		abort();
+	}
+
+	/* Keep the events in time order, and in the order they were
+	 * made when due at the same time */
+	while (i > 0 && sim.ev[i - 1].t > t) {
+		--i;
+	}
+
+	memmove(&sim.ev[i + 1], &sim.ev[i],
+		(sim.nev - i) * sizeof(sim.ev[0]));
+	sim.ev[i].t = t;
+	sim.ev[i].baud = 0;
+	sim.ev[i].len = strlen(s);
+	memcpy(sim.ev[i].data, s, sim.ev[i].len);
+	++sim.nev;
+
+	return &sim.ev[i];
+}
+
+void _sim_rx_byte(char c)
+{
+	/* Characters sent at the wrong rate end in framing errors */
+	if (_sim_garbled()) {
+		return;
+	}
+
+	if (sim.esp.transparent) {
+		_sim_stream_byte(c);
+		return;
+	}
+
+	if (sim.data_left) {
+		esp_sim_link *link = &sim.esp.links[sim.data_link];
+		const size_t i = sim.data_len - sim.data_left;
+
+		if (link->udp && i < ARRAY_LEN(link->dgram)) {
+			link->dgram[i] = c;
+		}
+
+		if (link->sent_len < ARRAY_LEN(link->sent)) {
+			link->sent[link->sent_len++] = c;
+		}
+
+		if (--sim.data_left == 0) {
+			_sim_send_done();
+		}
+
+		return;
+	}
+
+	if (c == '\r') {
+		return;
+	}
+
+	if (c != '\n') {
+		if (sim.line_len < ARRAY_LEN(sim.line) - 1) {
+			sim.line[sim.line_len++] = c;
+		}
+
+		return;
+	}
+
+	sim.line[sim.line_len] = '\0';
+	sim.line_len = 0;
+
+	/* Stray line ends are ignored, and not echoed */
+	if (sim.line[0] == '\0') {
+		return;
+	}
+
+	_sim_command(sim.line);
+}
+
+void _sim_stream_byte(char c)
+{
+	const uint64_t guard = ESP_SIM_GUARD_US * 1000ull;
+
+	/* A + after a pause may start the +++, held back until it
+	 * turns out to be data */
+	if (c == '+' && sim.plus < 3 &&
+	    (sim.plus || sim.now >= sim.stream_last + guard)) {
+		++sim.plus;
+		sim.stream_last = sim.now;
+		return;
+	}
+
+	sim.esp.stream_bytes += sim.plus + 1;
+	sim.plus = 0;
+	sim.stream_last = sim.now;
+}
+
+void _sim_command(const char *cmd)
+{
+	char echo[SIM_LINE_LEN + 2];
+
+	++sim.esp.ncmd;
+
+	snprintf(echo, ARRAY_LEN(echo), "%s\r\n", cmd);
+	_sim_schedule(echo, sim.now);
+
+	if (sim.esp.busy_while_sending && sim.now < sim.last_ack) {
+		++sim.esp.nbusy;
+		_sim_schedule("busy s...\r\n", _sim_after(sim.esp.cmd_us));
+		return;
+	}
+
+	if (sim.esp.profile == ESP_SIM_ESP32 && _sim_command_esp32(cmd)) {
+		return;
+	}
+
+	if (strcmp(cmd, "AT") == 0) {
+		_sim_schedule("\r\nOK\r\n", _sim_after(sim.esp.cmd_us));
+	} else if (strcmp(cmd, "AT+CIPSERVER=1") == 0) {
+		sim.esp.server = true;
+		_sim_schedule("\r\nOK\r\n", _sim_after(sim.esp.cmd_us));
+	} else if (strcmp(cmd, "AT+CIPMUX=1") == 0) {
+		sim.esp.mux = true;
+		_sim_schedule("\r\nOK\r\n", _sim_after(sim.esp.cmd_us));
+	} else if (strcmp(cmd, "AT+CIPMUX=0") == 0 && !sim.esp.server) {
+		/* Not while the server runs */
+		sim.esp.mux = false;
+		_sim_schedule("\r\nOK\r\n", _sim_after(sim.esp.cmd_us));
+	} else if (strcmp(cmd, "AT+CIPMODE=0") == 0 ||
+		   strcmp(cmd, "AT+CIPMODE=1") == 0) {
+		sim.esp.cipmode = cmd[11] == '1';
+		_sim_schedule("\r\nOK\r\n", _sim_after(sim.esp.cmd_us));
+	} else if (strncmp(cmd, "AT+CIPSTART=", 12) == 0) {
+		_sim_cipstart(&cmd[12]);
+	} else if (strncmp(cmd, "AT+CIPCLOSE=", 12) == 0) {
+		_sim_cipclose(&cmd[12]);
+	} else if (strcmp(cmd, "AT+CIPSEND") == 0) {
+		_sim_cipsend_bare();
+	} else if (strcmp(cmd, "AT+CIPMUX?") == 0) {
+		_sim_schedule(sim.esp.mux ? "+CIPMUX:1\r\n\r\nOK\r\n" :
+			      "+CIPMUX:0\r\n\r\nOK\r\n",
+			      _sim_after(sim.esp.cmd_us));
+	} else if (strcmp(cmd, "AT+CIPSTA?") == 0) {
+		_sim_schedule("+CIPSTA:ip:\"192.168.5.105\"\r\n"
+			      "+CIPSTA:gateway:\"192.168.5.1\"\r\n"
+			      "+CIPSTA:netmask:\"255.255.255.0\"\r\n"
+			      "\r\nOK\r\n", _sim_after(sim.esp.cmd_us));
+	} else if (strcmp(cmd, "AT+CIPSTATUS") == 0) {
+		_sim_cipstatus();
+	} else if (strcmp(cmd, "AT+GMR") == 0) {
+		_sim_schedule("AT version:1.7.4.0(May 11 2020 19:13:04)\r\n"
+			      "SDK version:3.0.4(9532ceb)\r\n"
+			      "compile time:May 27 2020 10:12:17\r\n"
+			      "Bin version(Wroom 02):1.7.4\r\n"
+			      "\r\nOK\r\n", _sim_after(sim.esp.cmd_us));
+	} else if (strncmp(cmd, "AT+CIPSEND=", 11) == 0) {
+		_sim_cipsend(&cmd[11], false);
+	} else if (strncmp(cmd, "AT+UART_CUR=", 12) == 0) {
+		_sim_uart_cur(&cmd[12]);
+	} else {
+		_sim_schedule("\r\nERROR\r\n", _sim_after(sim.esp.cmd_us));
+	}
+}
+
+bool _sim_command_esp32(const char *cmd)
+{
+	if (strcmp(cmd, "AT+GMR") == 0) {
+		_sim_schedule("AT version:2.4.0.0(s-4c6eb65 - ESP32 - "
+			      "May 20 2022 03:12:58)\r\n"
+			      "SDK version:v4.2.2-76-gefa6eca\r\n"
+			      "compile time(3a696ba):May 20 2022 03:11:01\r\n"
+			      "Bin version:2.4.0(WROOM-32)\r\n"
+			      "\r\nOK\r\n", _sim_after(sim.esp.cmd_us));
+	} else if (strcmp(cmd, "AT+CIPSTATE=?") == 0) {
+		_sim_schedule("\r\nOK\r\n", _sim_after(sim.esp.cmd_us));
+	} else if (strcmp(cmd, "AT+CIPSTATE?") == 0) {
+		_sim_cipstate();
+	} else if (strncmp(cmd, "AT+CIPSENDL=", 12) == 0) {
+		_sim_cipsend(&cmd[12], true);
+	} else {
+		return false;
+	}
+
+	return true;
+}
+
+void _sim_cipsend(const char *args, bool sendl)
+{
+	char *end;
+	long link = strtol(args, &end, 10);
+	long len = *end == ',' ? strtol(&end[1], NULL, 10) : 0;
+
+	if (*end != ',' || link < 0 || link >= ESP_SIM_MAX_LINKS ||
+	    !sim.esp.links[link].connected) {
+		_sim_schedule("link is not valid\r\n\r\nERROR\r\n",
+			      _sim_after(sim.esp.cmd_us));
+		return;
+	}
+
+	if (len <= 0 || (!sendl && len > 2048)) {
+		_sim_schedule("\r\nERROR\r\n", _sim_after(sim.esp.cmd_us));
+		return;
+	}
+
+	sim.data_link = link;
+	sim.data_len = len;
+	sim.data_left = len;
+	sim.data_long = sendl;
+	_sim_schedule("\r\nOK\r\n> ", _sim_after(sim.esp.cmd_us));
+}
+
+void _sim_cipstart(const char *args)
+{
+	char rsp[32];
+	long link = 0;
+
+	/* Connects to anywhere, on the link given first if muxing */
+	if (sim.esp.mux) {
+		char *end;
+
+		link = strtol(args, &end, 10);
+		args = *end == ',' ? &end[1] : "";
+	}
+
+	if (link < 0 || link >= ESP_SIM_MAX_LINKS ||
+	    (strncmp(args, "\"TCP\",", 6) != 0 &&
+	     strncmp(args, "\"UDP\",", 6) != 0)) {
+		_sim_schedule("\r\nERROR\r\n", _sim_after(sim.esp.cmd_us));
+	} else if (sim.esp.links[link].connected) {
+		_sim_schedule("ALREADY CONNECTED\r\n\r\nERROR\r\n",
+			      _sim_after(sim.esp.cmd_us));
+	} else {
+		sim.esp.links[link].connected = true;
+		sim.esp.links[link].udp = args[1] == 'U';
+
+		if (sim.esp.mux) {
+			snprintf(rsp, ARRAY_LEN(rsp),
+				 "%ld,CONNECT\r\n\r\nOK\r\n", link);
+		} else {
+			snprintf(rsp, ARRAY_LEN(rsp), "CONNECT\r\n\r\nOK\r\n");
+		}
+
+		_sim_schedule(rsp, _sim_after(sim.esp.cmd_us));
+	}
+}
+
+void _sim_cipclose(const char *args)
+{
+	char rsp[32];
+	long link = strtol(args, NULL, 10);
+
+	if (!sim.esp.mux || link < 0 || link >= ESP_SIM_MAX_LINKS ||
+	    !sim.esp.links[link].connected) {
+		_sim_schedule("\r\nERROR\r\n", _sim_after(sim.esp.cmd_us));
+		return;
+	}
+
+	sim.esp.links[link].connected = false;
+	sim.esp.links[link].udp = false;
+	snprintf(rsp, ARRAY_LEN(rsp), "%ld,CLOSED\r\n\r\nOK\r\n", link);
+	_sim_schedule(rsp, _sim_after(sim.esp.cmd_us));
+}
+
+void _sim_cipsend_bare(void)
+{
+	if (sim.esp.mux || !sim.esp.cipmode ||
+	    !sim.esp.links[0].connected) {
+		_sim_schedule("\r\nERROR\r\n", _sim_after(sim.esp.cmd_us));
+		return;
+	}
+
+	/* Everything after this is data, until +++ */
+	sim.esp.transparent = true;
+	sim.plus = 0;
+	sim.stream_last = _sim_after(sim.esp.cmd_us);
+	_sim_schedule("\r\nOK\r\n\r\n>", _sim_after(sim.esp.cmd_us));
+}
+
+void _sim_cipstate(void)
+{
+	char rsp[SIM_EVENT_LEN];
+	size_t n = 0;
+
+	for (int i = 0; i < ESP_SIM_MAX_LINKS; ++i) {
+		if (!sim.esp.links[i].connected) {
+			continue;
+		}
+
+		n += snprintf(&rsp[n], ARRAY_LEN(rsp) - n,
+			      "+CIPSTATE:%d,\"%s\",\"192.168.5.%d\","
+			      "%d,333,%d\r\n", i,
+			      sim.esp.links[i].udp ? "UDP" : "TCP", 110 + i,
+			      48700 + i, !sim.esp.links[i].udp);
+	}
+
+	snprintf(&rsp[n], ARRAY_LEN(rsp) - n, "\r\nOK\r\n");
+	_sim_schedule(rsp, _sim_after(sim.esp.cmd_us));
+}
+
+void _sim_cipstatus(void)
+{
+	char rsp[SIM_EVENT_LEN];
+	size_t n;
+
+	n = snprintf(rsp, ARRAY_LEN(rsp), "STATUS:3\r\n");
+
+	for (int i = 0; i < ESP_SIM_MAX_LINKS; ++i) {
+		if (!sim.esp.links[i].connected) {
+			continue;
+		}
+
+		n += snprintf(&rsp[n], ARRAY_LEN(rsp) - n,
+			      "+CIPSTATUS:%d,\"%s\",\"192.168.5.%d\","
+			      "%d,333,%d\r\n", i,
+			      sim.esp.links[i].udp ? "UDP" : "TCP", 110 + i,
+			      48700 + i, !sim.esp.links[i].udp);
+	}
+
+	snprintf(&rsp[n], ARRAY_LEN(rsp) - n, "\r\nOK\r\n");
+	_sim_schedule(rsp, _sim_after(sim.esp.cmd_us));
+}
+
+void _sim_uart_cur(const char *args)
+{
+	long baud = 0;
+	int flow = 0;
+
+	sscanf(args, "%ld,%*d,%*d,%*d,%d", &baud, &flow);
+
+	if (baud < 80 || baud > 5000000 || flow < 0 || flow > 3) {
+		_sim_schedule("\r\nERROR\r\n", _sim_after(sim.esp.cmd_us));
+		return;
+	}
+
+	/* The answer still goes out at the old rate */
+	_sim_schedule("\r\nOK\r\n", _sim_after(sim.esp.cmd_us));
+	_sim_schedule("", _sim_after(sim.esp.cmd_us))->baud = baud;
+	sim.esp.flow = flow == 3;
+}
+
+void _sim_send_done(void)
+{
+	esp_sim_link *link = &sim.esp.links[sim.data_link];
+	uint64_t ack = _sim_after(link->ack_us);
+	char recv[48];
+
+	++link->received;
+	link->bytes += sim.data_len;
+
+	/* A datagram that fails never reaches the network */
+	if (link->udp) {
+		link->dgram_len = sim.data_len < ARRAY_LEN(link->dgram) ?
+			sim.data_len : ARRAY_LEN(link->dgram);
+
+		if (!link->fail) {
+			_sim_udp_forward(link);
+		}
+	}
+
+	if (sim.data_long) {
+		snprintf(recv, ARRAY_LEN(recv), "\r\n+CIPSENDL:%u,%u\r\n",
+			 (unsigned int) sim.data_len,
+			 (unsigned int) sim.data_len);
+	} else {
+		snprintf(recv, ARRAY_LEN(recv), "\r\nRecv %u bytes\r\n",
+			 (unsigned int) sim.data_len);
+	}
+
+	_sim_schedule(recv, _sim_after(SIM_RECV_US));
+
+	/* The module reports the results of sends in order */
+	if (ack <= sim.last_ack) {
+		ack = sim.last_ack + 1;
+	}
+
+	sim.last_ack = ack;
+	_sim_schedule(link->fail || !link->connected ?
+		      "\r\nSEND FAIL\r\n" : "\r\nSEND OK\r\n", ack);
+}
+
+void _sim_udp_forward(const esp_sim_link *link)
+{
+	struct sockaddr_in to = {0};
+	int fd;
+
+	if (!sim.esp.udp_forward) {
+		return;
+	}
+
+	fd = socket(AF_INET, SOCK_DGRAM, 0);
+
+	if (fd < 0) {
+		return;
+	}
+
+	to.sin_family = AF_INET;
+	to.sin_port = htons(sim.esp.udp_forward);
+	to.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	sendto(fd, link->dgram, link->dgram_len, 0,
+	       (const struct sockaddr *) &to, sizeof(to));
+	close(fd);
+}
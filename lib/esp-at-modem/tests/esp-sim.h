@@ -0,0 +1,102 @@
+/**
+ * @file esp-sim.h
+ * @author Tyler J. Anderson
+ * @brief Simulated ESP-AT module for host tests
+ *
+ * Implements the uart_pio API against a model of the module instead
+ * of the PIO. Both directions of the serial line take as long as the
+ * baud rate says, and the module answers after a configurable delay,
+ * all on a virtual clock that only moves while the library waits.
+ */
+
+#ifndef ESP_SIM_H
+#define ESP_SIM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "pico/stdlib.h"
+
+/** @brief Links the module supports with CIPMUX=1 */
+#define ESP_SIM_MAX_LINKS 5
+
+/** @brief Default time the module takes to answer a command */
+#define ESP_SIM_CMD_US 1000
+
+/** @brief Default time from the data of a send to its SEND OK */
+#define ESP_SIM_ACK_US 50000
+
+/** @brief Firmware the simulated module answers like */
+typedef enum {
+	ESP_SIM_ESP8266, /**< ESP8266 with AT 1.7, no CIPSTATE or CIPSENDL */
+	ESP_SIM_ESP32 /**< ESP32 with AT 2.4 */
+} esp_sim_profile;
+
+/** @brief Silence the module needs around +++ to end transparent
+ * transmission */
+#define ESP_SIM_GUARD_US 20000
+
+/** @brief Data of a UDP send kept by the simulated module */
+#define ESP_SIM_DGRAM_LEN 2048
+
+/** @brief Data of all sends to a link kept by the simulated module */
+#define ESP_SIM_SENT_LEN 4096
+
+/** @brief A link of the simulated module */
+typedef struct {
+	bool connected;
+	bool udp; /**< Opened with AT+CIPSTART as UDP */
+	bool fail; /**< Answer sends with SEND FAIL */
+	uint32_t ack_us; /**< Time from the data to SEND OK */
+	unsigned int received; /**< Sends with all their data received */
+	size_t bytes; /**< Data received in all sends */
+	char dgram[ESP_SIM_DGRAM_LEN]; /**< Data of the last UDP send */
+	size_t dgram_len; /**< Length of dgram */
+	char sent[ESP_SIM_SENT_LEN]; /**< Start of the data of all sends */
+	size_t sent_len; /**< Length of sent */
+} esp_sim_link;
+
+/** @brief State and settings of the simulated module */
+typedef struct {
+	esp_sim_profile profile; /**< Set before esp_at_init_module */
+	uint32_t cmd_us; /**< Time to answer a command */
+	uint baud; /**< Rate of the UART of the module */
+	bool flow; /**< RTS/CTS flow control set with AT+UART_CUR */
+
+	/** @brief Fastest rate the line to the MCU carries, 0 for any */
+	uint max_baud;
+
+	/** @brief Refuse commands with busy s... until the result of
+	 * the last send went out */
+	bool busy_while_sending;
+	bool mux;
+	bool server; /**< AT+CIPSERVER=1 was sent */
+	bool cipmode; /**< AT+CIPMODE=1 was sent */
+
+	/** @brief In transparent transmission after a bare CIPSEND,
+	 * until +++ */
+	bool transparent;
+	size_t stream_bytes; /**< Data received in transparent transmission */
+	esp_sim_link links[ESP_SIM_MAX_LINKS];
+
+	/** @brief Port on the host loopback each UDP datagram is sent
+	 * to once it went out, 0 for none */
+	uint16_t udp_forward;
+	unsigned int ncmd; /**< Commands received */
+	unsigned int nbusy; /**< Commands refused as busy */
+} esp_sim;
+
+/** @brief Reset the module and the line, the clock keeps running
+ *
+ * @return The module, to change its settings
+ */
+esp_sim *esp_sim_reset(void);
+
+/** @brief Have the module send @p s after @p delay_us, like a URC */
+void esp_sim_emit(const char *s, uint64_t delay_us);
+
+/** @brief Virtual time in us */
+uint64_t esp_sim_now_us(void);
+
+#endif /* #ifndef ESP_SIM_H */
@@ -0,0 +1,16 @@
+/**
+ * @file pio.h
+ * @author Tyler J. Anderson
+ * @brief Host stand-in for hardware/pio.h, the simulator has no PIO
+ */
+
+#ifndef ESP_SIM_HARDWARE_PIO_H
+#define ESP_SIM_HARDWARE_PIO_H
+
+typedef struct pio_hw pio_hw_t;
+typedef pio_hw_t *PIO;
+
+#define pio0 ((PIO) 0)
+#define pio1 ((PIO) 0)
+
+#endif /* #ifndef ESP_SIM_HARDWARE_PIO_H */
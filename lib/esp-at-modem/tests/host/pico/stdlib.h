@@ -0,0 +1,88 @@
+/**
+ * @file stdlib.h
+ * @author Tyler J. Anderson
+ * @brief Host stand-in for the parts of pico/stdlib.h the library uses
+ *
+ * Time is the virtual clock of the ESP simulator, so waiting for the
+ * module costs no real time in the tests.
+ */
+
+#ifndef ESP_SIM_PICO_STDLIB_H
+#define ESP_SIM_PICO_STDLIB_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+typedef unsigned int uint;
+typedef uint64_t absolute_time_t;
+
+#define PICO_ERROR_TIMEOUT -1
+
+absolute_time_t get_absolute_time(void);
+void sleep_us(uint64_t us);
+
+static inline void sleep_ms(uint32_t ms)
+{
+	sleep_us((uint64_t) ms * 1000);
+}
+
+static inline absolute_time_t make_timeout_time_us(uint64_t us)
+{
+	return get_absolute_time() + us;
+}
+
+static inline absolute_time_t make_timeout_time_ms(uint32_t ms)
+{
+	return make_timeout_time_us((uint64_t) ms * 1000);
+}
+
+static inline bool time_reached(absolute_time_t t)
+{
+	return get_absolute_time() >= t;
+}
+
+static inline int64_t absolute_time_diff_us(absolute_time_t from,
+					    absolute_time_t to)
+{
+	return (int64_t) (to - from);
+}
+
+static inline absolute_time_t delayed_by_ms(absolute_time_t t,
+					    uint32_t ms)
+{
+	return t + (uint64_t) ms * 1000;
+}
+
+static inline void sleep_until(absolute_time_t t)
+{
+	if (!time_reached(t)) {
+		sleep_us(absolute_time_diff_us(get_absolute_time(), t));
+	}
+}
+
+static inline uint64_t to_us_since_boot(absolute_time_t t)
+{
+	return t;
+}
+
+static inline int getchar_timeout_us(uint32_t us)
+{
+	sleep_us(us);
+	return PICO_ERROR_TIMEOUT;
+}
+
+static inline void gpio_init(uint gpio) {(void) gpio;}
+static inline void gpio_set_dir(uint gpio, bool out)
+{
+	(void) gpio;
+	(void) out;
+}
+static inline void gpio_disable_pulls(uint gpio) {(void) gpio;}
+static inline void gpio_put(uint gpio, bool value)
+{
+	(void) gpio;
+	(void) value;
+}
+
+#endif /* #ifndef ESP_SIM_PICO_STDLIB_H */
@@ -0,0 +1,1306 @@
+#include "esp-at-modem.h"
+#include "esp-at-http.h"
+#include "esp-at-replay.h"
+#include "esp-sim.h"
+
+#include "munit.h"
+
+#include "string.h"
+
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#define TEST_BAUD 115200
+#define TEST_MSG "{\"co2\":612,\"pm2_5\":3.1,\"temp\":21.4}\n"
+
+#define ARRAY_LEN(array) sizeof(array)/sizeof(array[0])
+
+typedef struct {
+	esp_sim *esp;
+	esp_at_cfg cfg;
+	esp_at_status status;
+} test_fixture;
+
+static void *test_setup(const MunitParameter params[], void *user_data)
+{
+	test_fixture *f = munit_new(test_fixture);
+
+	memset(f, 0, sizeof(*f));
+
+	f->esp = esp_sim_reset();
+
+	munit_assert_int(esp_at_init_module(&f->cfg, pio0, 0, 1, 0, 1,
+					    TEST_BAUD, 2, 3), >, 0);
+	munit_assert_int(esp_at_cipserver_init(&f->cfg), ==, 0);
+
+	return f;
+}
+
+static void test_tear_down(void *fixture)
+{
+	free(fixture);
+}
+
+/* Connect clients and get them into the cached client list */
+static void test_connect(test_fixture *f, const int *links, size_t n)
+{
+	for (size_t i = 0; i < n; ++i) {
+		f->esp->links[links[i]].connected = true;
+	}
+
+	esp_at_status_invalidate(&f->cfg, ESP_AT_FIELD_CLIENTS);
+	munit_assert_int(esp_at_status_update(&f->cfg), ==, 0);
+	esp_at_status_snapshot(&f->cfg, &f->status);
+	munit_assert_uint(f->status.ncli, ==, n);
+}
+
+/* Let the outstanding results arrive and collect them */
+static void test_settle(test_fixture *f, uint32_t ms)
+{
+	sleep_ms(ms);
+	esp_at_poll(&f->cfg);
+}
+
+static MunitResult test_fanout(const MunitParameter params[],
+			       void *fixture)
+{
+	const int links[] = {0, 1, 3};
+	test_fixture *f = fixture;
+	uint64_t start;
+
+	test_connect(f, links, ARRAY_LEN(links));
+
+	start = esp_sim_now_us();
+
+	munit_assert_int(esp_at_cipsend_string(&f->cfg, TEST_MSG,
+					       strlen(TEST_MSG),
+					       &f->status), ==, 0);
+
+	/* Nothing waited for a SEND OK, so all clients got their
+	 * data before the first one could have been answered */
+	munit_assert_uint64(esp_sim_now_us() - start, <,
+			    f->esp->links[0].ack_us);
+
+	for (size_t i = 0; i < ARRAY_LEN(links); ++i) {
+		esp_at_link_stats st;
+
+		munit_assert_uint(f->esp->links[links[i]].received, ==, 1);
+		munit_assert_int(esp_at_link_get_stats(&f->cfg, links[i],
+						       &st), ==, 0);
+		munit_assert_uint32(st.sent, ==, 1);
+		munit_assert_uint32(st.acked, ==, 0);
+	}
+
+	munit_assert_uint(f->cfg.nacks, ==, ARRAY_LEN(links));
+
+	test_settle(f, 200);
+
+	munit_assert_uint(f->cfg.nacks, ==, 0);
+
+	for (size_t i = 0; i < ARRAY_LEN(links); ++i) {
+		esp_at_link_stats st;
+
+		esp_at_link_get_stats(&f->cfg, links[i], &st);
+		munit_assert_uint32(st.acked, ==, 1);
+		munit_assert_uint32(st.failed, ==, 0);
+	}
+
+	return MUNIT_OK;
+}
+
+static MunitResult test_fanout_fail(const MunitParameter params[],
+				    void *fixture)
+{
+	const int links[] = {0, 1, 2};
+	test_fixture *f = fixture;
+	esp_at_link_stats st;
+
+	test_connect(f, links, ARRAY_LEN(links));
+
+	/* Link 1 fails late, link 2 is gone before its CIPSEND */
+	f->esp->links[1].fail = true;
+	f->esp->links[2].connected = false;
+
+	munit_assert_int(esp_at_cipsend_string(&f->cfg, TEST_MSG,
+					       strlen(TEST_MSG),
+					       &f->status), <, 0);
+	munit_assert_uint(f->esp->links[0].received, ==, 1);
+	munit_assert_uint(f->esp->links[1].received, ==, 1);
+
+	esp_at_link_get_stats(&f->cfg, 2, &st);
+	munit_assert_uint32(st.sent, ==, 0);
+	munit_assert_uint32(st.failed, ==, 1);
+
+	test_settle(f, 200);
+
+	esp_at_link_get_stats(&f->cfg, 0, &st);
+	munit_assert_uint32(st.acked, ==, 1);
+	esp_at_link_get_stats(&f->cfg, 1, &st);
+	munit_assert_uint32(st.acked, ==, 0);
+	munit_assert_uint32(st.failed, ==, 1);
+
+	/* The client list is queried again after a failure */
+	munit_assert_uint(f->cfg.stale & ESP_AT_FIELD_CLIENTS, !=, 0);
+
+	return MUNIT_OK;
+}
+
+static MunitResult test_fanout_busy(const MunitParameter params[],
+				    void *fixture)
+{
+	const int links[] = {0, 1, 2, 3};
+	test_fixture *f = fixture;
+
+	test_connect(f, links, ARRAY_LEN(links));
+	f->esp->busy_while_sending = true;
+
+	/* The module refuses the next CIPSEND until the last send is
+	 * answered, so every link after the first has to retry */
+	munit_assert_int(esp_at_cipsend_string(&f->cfg, TEST_MSG,
+					       strlen(TEST_MSG),
+					       &f->status), ==, 0);
+	munit_assert_uint(f->esp->nbusy, >=, ARRAY_LEN(links) - 1);
+
+	test_settle(f, 200);
+
+	for (size_t i = 0; i < ARRAY_LEN(links); ++i) {
+		esp_at_link_stats st;
+
+		munit_assert_uint(f->esp->links[links[i]].received, ==, 1);
+		esp_at_link_get_stats(&f->cfg, links[i], &st);
+		munit_assert_uint32(st.sent, ==, 1);
+		munit_assert_uint32(st.acked, ==, 1);
+	}
+
+	return MUNIT_OK;
+}
+
+static MunitResult test_fanout_backlog(const MunitParameter params[],
+				       void *fixture)
+{
+	const int links[] = {0, 1, 2};
+	test_fixture *f = fixture;
+	esp_at_link_stats st;
+
+	test_connect(f, links, ARRAY_LEN(links));
+
+	/* Link 2 is slow to acknowledge its data */
+	f->esp->links[2].ack_us = 2000000;
+
+	munit_assert_int(esp_at_cipsend_string(&f->cfg, TEST_MSG,
+					       strlen(TEST_MSG),
+					       &f->status), ==, 0);
+	sleep_ms(200);
+	munit_assert_int(esp_at_cipsend_string(&f->cfg, TEST_MSG,
+					       strlen(TEST_MSG),
+					       &f->status), ==, 0);
+
+	munit_assert_uint(f->esp->links[0].received, ==, 2);
+	munit_assert_uint(f->esp->links[1].received, ==, 2);
+	munit_assert_uint(f->esp->links[2].received, ==, 1);
+
+	esp_at_link_get_stats(&f->cfg, 2, &st);
+	munit_assert_uint32(st.skipped, ==, 1);
+
+	/* Once it caught up the link is served again */
+	test_settle(f, 3000);
+	munit_assert_int(esp_at_cipsend_string(&f->cfg, TEST_MSG,
+					       strlen(TEST_MSG),
+					       &f->status), ==, 0);
+	munit_assert_uint(f->esp->links[2].received, ==, 2);
+
+	esp_at_link_get_stats(&f->cfg, 2, &st);
+	munit_assert_uint32(st.acked, ==, 1);
+	munit_assert_uint32(st.skipped, ==, 1);
+
+	return MUNIT_OK;
+}
+
+static MunitResult test_cipsend_data(const MunitParameter params[],
+				     void *fixture)
+{
+	const int links[] = {0, 1};
+	test_fixture *f = fixture;
+	esp_at_link_stats st;
+	static char data[5000];
+
+	test_connect(f, links, ARRAY_LEN(links));
+
+	for (size_t i = 0; i < sizeof(data); ++i) {
+		data[i] = 'a' + i % 26;
+	}
+
+	/* More than a single CIPSEND takes, and not a C-string */
+	munit_assert_int(esp_at_cipsend_data(&f->cfg, 0, data,
+					     sizeof(data)), ==, sizeof(data));
+	munit_assert_uint(f->cfg.nacks, ==, 0);
+	munit_assert_uint(f->esp->links[0].received, ==, 3);
+	munit_assert_size(f->esp->links[0].bytes, ==, sizeof(data));
+
+	esp_at_link_get_stats(&f->cfg, 0, &st);
+	munit_assert_uint32(st.sent, ==, 3);
+	munit_assert_uint32(st.acked, ==, 3);
+
+	f->esp->links[1].fail = true;
+	munit_assert_int(esp_at_cipsend_data(&f->cfg, 1, data, 100), <, 0);
+
+	esp_at_link_get_stats(&f->cfg, 1, &st);
+	munit_assert_uint32(st.failed, ==, 1);
+
+	return MUNIT_OK;
+}
+
+static MunitResult test_baud(const MunitParameter params[],
+			     void *fixture)
+{
+	test_fixture *f = fixture;
+	char rsp[64];
+
+	/* Initialization went up to the fastest rate */
+	munit_assert_uint(f->cfg.uart_cfg.baud, ==, ESP_AT_BAUD_MAX);
+	munit_assert_uint(f->esp->baud, ==, ESP_AT_BAUD_MAX);
+
+	munit_assert_int(esp_at_set_baud(&f->cfg, 115200), ==, 0);
+	munit_assert_uint(f->esp->baud, ==, 115200);
+
+	/* The line to the MCU can't take the fastest rate, the module
+	 * is sent back and the next one down is tried */
+	f->esp->max_baud = 460800;
+
+	munit_assert_uint(esp_at_negotiate_baud(&f->cfg, 921600), ==,
+			  460800);
+	munit_assert_uint(f->esp->baud, ==, 460800);
+	munit_assert_int(esp_at_send_cmd(&f->cfg, "AT", rsp, sizeof(rsp)),
+			 >, 0);
+
+	/* A rate the module refuses leaves everything as it was */
+	munit_assert_int(esp_at_set_baud(&f->cfg, 10000000), <, 0);
+	munit_assert_uint(f->cfg.uart_cfg.baud, ==, 460800);
+	munit_assert_int(esp_at_send_cmd(&f->cfg, "AT", rsp, sizeof(rsp)),
+			 >, 0);
+
+	return MUNIT_OK;
+}
+
+static MunitResult test_flow(const MunitParameter params[],
+			     void *fixture)
+{
+	esp_sim *esp = esp_sim_reset();
+	esp_at_cfg cfg;
+	char rsp[64];
+
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.uart_cfg.flow = true;
+	cfg.uart_cfg.pin_cts = 4;
+	cfg.uart_cfg.pin_rts = 5;
+
+	/* The module gets flow control along with the first rate */
+	munit_assert_int(esp_at_init_module(&cfg, pio0, 0, 1, 0, 1,
+					    TEST_BAUD, 2, 3), >, 0);
+	munit_assert_true(esp->flow);
+	munit_assert_uint(cfg.uart_cfg.baud, ==, ESP_AT_BAUD_MAX_FLOW);
+	munit_assert_uint(esp->baud, ==, ESP_AT_BAUD_MAX_FLOW);
+
+	/* And keeps it when the rate changes */
+	munit_assert_int(esp_at_set_baud(&cfg, 1000000), ==, 0);
+	munit_assert_true(esp->flow);
+	munit_assert_int(esp_at_send_cmd(&cfg, "AT", rsp, sizeof(rsp)),
+			 >, 0);
+
+	/* Without flow control the module doesn't get it either */
+	esp = esp_sim_reset();
+	memset(&cfg, 0, sizeof(cfg));
+	munit_assert_int(esp_at_init_module(&cfg, pio0, 0, 1, 0, 1,
+					    TEST_BAUD, 2, 3), >, 0);
+	munit_assert_false(esp->flow);
+	munit_assert_uint(esp->baud, ==, ESP_AT_BAUD_MAX);
+
+	return MUNIT_OK;
+}
+
+/* Records the order commands finished in */
+static void test_cmd_cb(esp_at_cmd *cmd, void *ctx)
+{
+	esp_at_cmd **done = ctx;
+
+	while (*done) {
+		++done;
+	}
+
+	*done = cmd;
+}
+
+static MunitResult test_cmd_queue(const MunitParameter params[],
+				  void *fixture)
+{
+	test_fixture *f = fixture;
+	esp_at_cmd cmds[ESP_AT_CMD_QUEUE_LEN];
+	esp_at_cmd late;
+	char rsp[ESP_AT_CMD_QUEUE_LEN][128];
+	const char *text[] = {"AT", "AT+CIPMUX?", "AT+BOGUS", "AT"};
+	esp_at_cmd *done[ESP_AT_CMD_QUEUE_LEN + 1] = {NULL};
+	unsigned int ncmd = f->esp->ncmd;
+	uint64_t start = esp_sim_now_us();
+
+	for (unsigned int i = 0; i < ESP_AT_CMD_QUEUE_LEN; ++i) {
+		esp_at_cmd_init(&cmds[i], text[i % 4], rsp[i],
+				sizeof(rsp[i]));
+		cmds[i].cb = test_cmd_cb;
+		cmds[i].ctx = done;
+		munit_assert_int(esp_at_cmd_submit(&f->cfg, &cmds[i]), ==, 0);
+	}
+
+	/* Submitting neither talks to the module nor waits */
+	esp_at_cmd_init(&late, "AT", NULL, 0);
+	munit_assert_int(esp_at_cmd_submit(&f->cfg, &late), <, 0);
+	munit_assert_uint(f->esp->ncmd, ==, ncmd);
+	munit_assert_uint64(esp_sim_now_us(), ==, start);
+
+	/* Polling sends one command at a time and never waits */
+	esp_at_poll(&f->cfg);
+	munit_assert_uint(f->esp->ncmd, ==, ncmd + 1);
+	munit_assert_int(cmds[0].state, ==, ESP_AT_CMD_RUNNING);
+
+	while (!esp_at_cmd_done(&cmds[ESP_AT_CMD_QUEUE_LEN - 1])) {
+		sleep_us(500);
+		esp_at_poll(&f->cfg);
+	}
+
+	for (unsigned int i = 0; i < ESP_AT_CMD_QUEUE_LEN; ++i) {
+		munit_assert_ptr(done[i], ==, &cmds[i]);
+	}
+
+	munit_assert_int(cmds[0].state, ==, ESP_AT_CMD_OK);
+	munit_assert_int(cmds[1].state, ==, ESP_AT_CMD_OK);
+	munit_assert_not_null(strstr(rsp[1], "+CIPMUX:1"));
+	munit_assert_int(cmds[1].result, ==, strlen(rsp[1]));
+	munit_assert_int(cmds[2].state, ==, ESP_AT_CMD_ERROR);
+	munit_assert_int(cmds[2].result, <, 0);
+
+	/* A command whose deadline passes in the queue is never sent */
+	ncmd = f->esp->ncmd;
+	esp_at_cmd_init(&late, "AT", NULL, 0);
+	late.deadline = make_timeout_time_us(100);
+	f->esp->cmd_us = 2000;
+	cmds[0].cb = NULL;
+	munit_assert_int(esp_at_cmd_submit(&f->cfg, &cmds[0]), ==, 0);
+	munit_assert_int(esp_at_cmd_submit(&f->cfg, &late), ==, 0);
+	munit_assert_int(esp_at_cmd_wait(&f->cfg, &late), <, 0);
+	munit_assert_int(late.state, ==, ESP_AT_CMD_TIMEOUT);
+	munit_assert_int(cmds[0].state, ==, ESP_AT_CMD_OK);
+	munit_assert_uint(f->esp->ncmd, ==, ncmd + 1);
+
+	return MUNIT_OK;
+}
+
+static MunitResult test_cmd_busy(const MunitParameter params[],
+				 void *fixture)
+{
+	const int links[] = {0};
+	test_fixture *f = fixture;
+	esp_at_cmd cmd;
+	char rsp[64];
+
+	test_connect(f, links, ARRAY_LEN(links));
+	f->esp->busy_while_sending = true;
+
+	munit_assert_int(esp_at_cipsend_string(&f->cfg, TEST_MSG,
+					       strlen(TEST_MSG),
+					       &f->status), ==, 0);
+
+	/* Refused while the send is going on, and sent again */
+	esp_at_cmd_init(&cmd, "AT", rsp, sizeof(rsp));
+	munit_assert_int(esp_at_cmd_submit(&f->cfg, &cmd), ==, 0);
+	munit_assert_int(esp_at_cmd_wait(&f->cfg, &cmd), >, 0);
+	munit_assert_uint(f->esp->nbusy, >, 0);
+	munit_assert_uint(f->cfg.nacks, ==, 0);
+
+	return MUNIT_OK;
+}
+
+static MunitResult test_cmd_deadline(const MunitParameter params[],
+				     void *fixture)
+{
+	test_fixture *f = fixture;
+	esp_at_cmd_stats before, after;
+	char rsp[256];
+	uint64_t start;
+
+	munit_assert_uint32(esp_at_cmd_timeout_ms("AT"), ==, 200);
+	munit_assert_uint32(esp_at_cmd_timeout_ms("AT+CIPSTA?"), ==, 500);
+	munit_assert_uint32(esp_at_cmd_timeout_ms("AT+CWJAP=\"a\",\"b\""),
+			    ==, 20000);
+	munit_assert_uint32(esp_at_cmd_timeout_ms("AT+BOGUS"), ==,
+			    ESP_AT_CMD_TIMEOUT_MS);
+
+	/* A module that keeps chattering without ever answering can't
+	 * hold the command past its limit */
+	f->esp->cmd_us = 3000000;
+
+	for (unsigned int i = 0; i < 40; ++i) {
+		esp_sim_emit("WIFI GOT IP\r\n", 20000 * i);
+	}
+
+	esp_at_cmd_get_stats(&f->cfg, "AT", &before);
+	start = esp_sim_now_us();
+	munit_assert_int(esp_at_send_cmd(&f->cfg, "AT", rsp, sizeof(rsp)),
+			 <, 0);
+	munit_assert_uint64(esp_sim_now_us() - start, <=,
+			    esp_at_cmd_timeout_ms("AT") * 1000 + 1000);
+
+	esp_at_cmd_get_stats(&f->cfg, "AT", &after);
+	munit_assert_uint32(after.count, ==, before.count + 1);
+	munit_assert_uint32(after.timeouts, ==, before.timeouts + 1);
+	munit_assert_uint32(after.max_us, <=,
+			    esp_at_cmd_timeout_ms("AT") * 1000);
+
+	/* Other commands keep their own counters */
+	esp_at_cmd_get_stats(&f->cfg, "AT+CIPSTATUS", &after);
+	munit_assert_uint32(after.timeouts, ==, 0);
+
+	return MUNIT_OK;
+}
+
+static MunitResult test_status_refresh(const MunitParameter params[],
+				       void *fixture)
+{
+	test_fixture *f = fixture;
+	uint64_t start = esp_sim_now_us();
+	unsigned int ncmd = f->esp->ncmd;
+
+	f->esp->links[0].connected = true;
+	f->esp->links[2].connected = true;
+
+	/* Only queues the first query */
+	munit_assert_int(esp_at_status_refresh(&f->cfg, &f->status), ==, 0);
+	munit_assert_uint64(esp_sim_now_us(), ==, start);
+	munit_assert_uint(f->esp->ncmd, ==, ncmd);
+	munit_assert_uint(f->status.ncli, ==, 0);
+
+	/* Whoever owns the module keeps polling it */
+	for (unsigned int i = 0; i < 100 && f->cfg.stale; ++i) {
+		sleep_ms(1);
+		esp_at_poll(&f->cfg);
+		munit_assert_int(esp_at_status_refresh(&f->cfg, &f->status),
+				 ==, 0);
+	}
+
+	munit_assert_uint(f->cfg.stale, ==, 0);
+	munit_assert_uint(f->esp->ncmd, ==, ncmd + ESP_AT_FIELD_COUNT);
+	munit_assert_uint(f->status.ncli, ==, 2);
+	munit_assert_true(f->status.status & ESP_AT_STATUS_CIPMUX_ON);
+	munit_assert_string_equal(f->status.ipv4, "192.168.5.105");
+
+	return MUNIT_OK;
+}
+
+static MunitResult test_caps(const MunitParameter params[],
+			     void *fixture)
+{
+	/* What each firmware has, and the commands it gets */
+	static const struct {
+		esp_sim_profile profile;
+		unsigned int caps;
+		unsigned int version;
+		const char *clients;
+		unsigned int sends;
+	} profiles[] = {
+		{ESP_SIM_ESP8266, 0, ESP_AT_VERSION(1, 7), "AT+CIPSTATUS", 3},
+		{ESP_SIM_ESP32, ESP_AT_CAP_CIPSTATE | ESP_AT_CAP_CIPSENDL,
+		 ESP_AT_VERSION(2, 4), "AT+CIPSTATE", 1}
+	};
+
+	static char data[5000];
+
+	for (unsigned int i = 0; i < ARRAY_LEN(profiles); ++i) {
+		esp_sim *esp = esp_sim_reset();
+		esp_at_cfg cfg;
+		esp_at_status status;
+		esp_at_cmd_stats before, after;
+
+		esp->profile = profiles[i].profile;
+		memset(&cfg, 0, sizeof(cfg));
+
+		munit_assert_int(esp_at_init_module(&cfg, pio0, 0, 1, 0, 1,
+						    TEST_BAUD, 2, 3), >, 0);
+		munit_assert_int(esp_at_cipserver_init(&cfg), ==, 0);
+		munit_assert_uint(cfg.caps, ==, profiles[i].caps);
+		munit_assert_uint(cfg.at_version, ==, profiles[i].version);
+
+		/* The same client list from either query */
+		esp_at_cmd_get_stats(&cfg, profiles[i].clients, &before);
+		esp->links[1].connected = true;
+		munit_assert_int(esp_at_cipstatus(&cfg, &status), ==, 0);
+		munit_assert_uint(status.ncli, ==, 1);
+		munit_assert_int(status.cli[0].index, ==, 1);
+		munit_assert_int(status.cli[0].r_port, ==, 48701);
+		munit_assert_true(status.status & ESP_AT_STATUS_SERVER_ON);
+		munit_assert_true(status.status &
+				  ESP_AT_STATUS_CLIENT_CONNECTED);
+
+		esp_at_cmd_get_stats(&cfg, profiles[i].clients, &after);
+		munit_assert_uint32(after.count, ==, before.count + 1);
+		munit_assert_uint32(after.errors, ==, before.errors);
+
+		/* More than one CIPSEND takes, in one CIPSENDL if the
+		 * module has it */
+		munit_assert_int(esp_at_cipsend_data(&cfg, 1, data,
+						     sizeof(data)),
+				 ==, sizeof(data));
+		munit_assert_uint(esp->links[1].received, ==,
+				  profiles[i].sends);
+		munit_assert_size(esp->links[1].bytes, ==, sizeof(data));
+	}
+
+	return MUNIT_OK;
+}
+
+/* Collects received data of link 0 */
+static void test_ipd_cb(const esp_at_urc *urc, void *ctx)
+{
+	char *rx = ctx;
+
+	if (urc->type == ESP_AT_URC_IPD && urc->link == 0) {
+		strncat(rx, urc->data, urc->len);
+	}
+}
+
+static MunitResult test_transparent(const MunitParameter params[],
+				    void *fixture)
+{
+	esp_sim *esp = esp_sim_reset();
+	esp_at_cfg cfg;
+	static char data[4096];
+	char rx[64] = "";
+	char rsp[64];
+	uint64_t start;
+	unsigned int ncmd;
+
+	memset(&cfg, 0, sizeof(cfg));
+	memset(data, 'x', sizeof(data));
+
+	munit_assert_int(esp_at_init_module(&cfg, pio0, 0, 1, 0, 1,
+					    TEST_BAUD, 2, 3), >, 0);
+	munit_assert_int(esp_at_urc_register(&cfg, test_ipd_cb, rx), ==, 0);
+
+	munit_assert_int(esp_at_transparent_enter(&cfg, ESP_AT_CIP_PROTO_TCP,
+						  "192.168.5.2", 5000),
+			 ==, 0);
+	munit_assert_true(cfg.transparent);
+	munit_assert_true(esp->transparent);
+
+	/* Data goes out at the rate of the line, with no command per
+	 * write */
+	ncmd = esp->ncmd;
+	start = esp_sim_now_us();
+
+	for (unsigned int i = 0; i < 4; ++i) {
+		munit_assert_int(esp_at_transparent_write(&cfg, data,
+							  sizeof(data)),
+				 ==, sizeof(data));
+	}
+
+	munit_assert_uint64(esp_sim_now_us() - start, <=,
+			    4 * sizeof(data) * 10000000ull /
+			    cfg.uart_cfg.baud + 1000);
+	munit_assert_size(esp->stream_bytes, ==, 4 * sizeof(data));
+
+	/* A + in the data is data */
+	sleep_ms(50);
+	munit_assert_int(esp_at_transparent_write(&cfg, "a+++b", 5), ==, 5);
+	munit_assert_size(esp->stream_bytes, ==, 4 * sizeof(data) + 5);
+
+	/* Commands would be data, they fail without being sent */
+	munit_assert_int(esp_at_send_cmd(&cfg, "AT", rsp, sizeof(rsp)),
+			 <, 0);
+	munit_assert_int(esp_at_cipsend_data(&cfg, 0, data, 10), <, 0);
+	munit_assert_uint(esp->ncmd, ==, ncmd);
+
+	/* Data from the remote end is passed on as it comes */
+	esp_sim_emit("pong", 0);
+	sleep_ms(1);
+	esp_at_poll(&cfg);
+	munit_assert_string_equal(rx, "pong");
+
+	munit_assert_int(esp_at_transparent_exit(&cfg), ==, 0);
+	munit_assert_false(cfg.transparent);
+	munit_assert_false(esp->transparent);
+	munit_assert_false(esp->cipmode);
+	munit_assert_size(esp->stream_bytes, ==, 4 * sizeof(data) + 5);
+	munit_assert_int(esp_at_send_cmd(&cfg, "AT", rsp, sizeof(rsp)),
+			 >, 0);
+
+	/* The link is still open to enter again */
+	munit_assert_int(esp_at_transparent_enter(&cfg, ESP_AT_CIP_PROTO_TCP,
+						  "192.168.5.2", 5000),
+			 ==, 0);
+	munit_assert_int(esp_at_transparent_exit(&cfg), ==, 0);
+
+	/* Not with the server running */
+	esp = esp_sim_reset();
+	memset(&cfg, 0, sizeof(cfg));
+	munit_assert_int(esp_at_init_module(&cfg, pio0, 0, 1, 0, 1,
+					    TEST_BAUD, 2, 3), >, 0);
+	munit_assert_int(esp_at_cipserver_init(&cfg), ==, 0);
+	munit_assert_int(esp_at_transparent_enter(&cfg, ESP_AT_CIP_PROTO_TCP,
+						  "192.168.5.2", 5000),
+			 <, 0);
+	munit_assert_false(cfg.transparent);
+
+	return MUNIT_OK;
+}
+
+/* Take the next datagram the module sent to the loopback, return its
+ * sequence number */
+static uint32_t test_udp_recv(int fd, char *payload, size_t len)
+{
+	uint8_t buf[ESP_SIM_DGRAM_LEN];
+	ssize_t n = recv(fd, buf, sizeof(buf), MSG_DONTWAIT);
+
+	munit_assert_long(n, >=, ESP_AT_UDP_SEQ_LEN);
+	munit_assert_size(n - ESP_AT_UDP_SEQ_LEN, <, len);
+	memcpy(payload, &buf[ESP_AT_UDP_SEQ_LEN], n - ESP_AT_UDP_SEQ_LEN);
+	payload[n - ESP_AT_UDP_SEQ_LEN] = '\0';
+
+	return (uint32_t) buf[0] << 24 | (uint32_t) buf[1] << 16 |
+		(uint32_t) buf[2] << 8 | buf[3];
+}
+
+static MunitResult test_udp(const MunitParameter params[], void *fixture)
+{
+	test_fixture *f = fixture;
+	const int links[] = {0, 1};
+	struct sockaddr_in addr = {0};
+	socklen_t alen = sizeof(addr);
+	esp_at_status other = {0};
+	esp_at_link_stats st;
+	char bcast[16];
+	char payload[128];
+	unsigned int received;
+	int fd;
+
+	test_connect(f, links, ARRAY_LEN(links));
+
+	/* The collector, on a port of the host loopback */
+	fd = socket(AF_INET, SOCK_DGRAM, 0);
+	munit_assert_int(fd, >=, 0);
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	munit_assert_int(bind(fd, (struct sockaddr *) &addr, sizeof(addr)),
+			 ==, 0);
+	munit_assert_int(getsockname(fd, (struct sockaddr *) &addr, &alen),
+			 ==, 0);
+	f->esp->udp_forward = ntohs(addr.sin_port);
+
+	/* The broadcast address of the network of the module */
+	munit_assert_int(esp_at_status_update(&f->cfg), ==, 0);
+	esp_at_status_snapshot(&f->cfg, &f->status);
+	munit_assert_int(esp_at_broadcast_addr(&f->status, bcast,
+					       sizeof(bcast)), ==, 0);
+	munit_assert_string_equal(bcast, "192.168.5.255");
+
+	strcpy(other.ipv4, "10.1.2.3");
+	other.ipv4_prefix = 20;
+	munit_assert_int(esp_at_broadcast_addr(&other, bcast, sizeof(bcast)),
+			 ==, 0);
+	munit_assert_string_equal(bcast, "10.1.15.255");
+	other.ipv4_prefix = 0;
+	munit_assert_int(esp_at_broadcast_addr(&other, bcast, sizeof(bcast)),
+			 <, 0);
+
+	/* Opened next to the server, and not taken for a client */
+	munit_assert_int(esp_at_udp_open(&f->cfg, 4, "192.168.5.255", 5010),
+			 ==, 0);
+	munit_assert_true(f->esp->links[4].udp);
+	esp_at_status_snapshot(&f->cfg, &f->status);
+	munit_assert_uint(f->status.ncli, ==, 3);
+	munit_assert_int(f->status.cli[2].index, ==, 4);
+	munit_assert_int(f->status.cli[2].proto, ==, ESP_AT_CIP_PROTO_UDP);
+	munit_assert_uint(f->status.cli[2].passive, ==, 0);
+	munit_assert_true(f->status.status & ESP_AT_STATUS_AS_CLIENT);
+
+	/* One send per frame, numbered from 0 */
+	for (uint32_t i = 0; i < 3; ++i) {
+		munit_assert_int(esp_at_udp_send(&f->cfg, 4, TEST_MSG,
+						 strlen(TEST_MSG)), ==, 0);
+		munit_assert_uint32(test_udp_recv(fd, payload,
+						  sizeof(payload)), ==, i);
+		munit_assert_string_equal(payload, TEST_MSG);
+		test_settle(f, 100);
+	}
+
+	munit_assert_uint(f->esp->links[4].received, ==, 3);
+
+	/* Back to back, the second waits for the SEND OK of the first */
+	munit_assert_int(esp_at_udp_send(&f->cfg, 4, "a", 1), ==, 0);
+	munit_assert_int(esp_at_udp_send(&f->cfg, 4, "b", 1), ==, 0);
+	munit_assert_uint32(test_udp_recv(fd, payload, sizeof(payload)),
+			    ==, 3);
+	munit_assert_string_equal(payload, "a");
+	munit_assert_uint32(test_udp_recv(fd, payload, sizeof(payload)),
+			    ==, 4);
+	munit_assert_string_equal(payload, "b");
+	test_settle(f, 100);
+
+	/* Failed datagrams leave a gap */
+	f->esp->links[4].fail = true;
+	munit_assert_int(esp_at_udp_send(&f->cfg, 4, "c", 1), ==, 0);
+	munit_assert_int(esp_at_udp_send(&f->cfg, 4, "d", 1), ==, 0);
+	test_settle(f, 100);
+	f->esp->links[4].fail = false;
+	munit_assert_int(esp_at_udp_send(&f->cfg, 4, "e", 1), ==, 0);
+	munit_assert_uint32(test_udp_recv(fd, payload, sizeof(payload)),
+			    ==, 7);
+	munit_assert_string_equal(payload, "e");
+	test_settle(f, 100);
+	munit_assert_int(esp_at_link_get_stats(&f->cfg, 4, &st), ==, 0);
+	munit_assert_uint32(st.failed, ==, 2);
+	munit_assert_uint32(st.acked, ==, 6);
+
+	/* The fan-out to the clients leaves it out */
+	received = f->esp->links[4].received;
+	munit_assert_int(esp_at_cipsend_string(&f->cfg, TEST_MSG,
+					       strlen(TEST_MSG), &f->status),
+			 ==, 0);
+	munit_assert_uint(f->esp->links[4].received, ==, received);
+	munit_assert_uint(f->esp->links[0].received, ==, 1);
+
+	munit_assert_int(esp_at_udp_close(&f->cfg, 4), ==, 0);
+	munit_assert_false(f->esp->links[4].connected);
+	munit_assert_int(esp_at_udp_send(&f->cfg, 4, "d", 1), <, 0);
+	esp_at_status_snapshot(&f->cfg, &f->status);
+	munit_assert_uint(f->status.ncli, ==, 2);
+
+	/* Garbled links are not taken for clients */
+	esp_sim_emit("40,CONNECT\r\n", 0);
+	test_settle(f, 10);
+	esp_at_status_snapshot(&f->cfg, &f->status);
+	munit_assert_uint(f->status.ncli, ==, 2);
+
+	close(fd);
+
+	return MUNIT_OK;
+}
+
+/* Connect a client on link and have it send req, in two pieces so it
+ * has to be put together */
+static void test_http_request(test_fixture *f, int link, const char *req)
+{
+	const size_t half = strlen(req) / 2;
+	char ipd[256];
+
+	f->esp->links[link].connected = true;
+	f->esp->links[link].sent_len = 0;
+	memset(f->esp->links[link].sent, 0, ESP_SIM_SENT_LEN);
+	snprintf(ipd, sizeof(ipd), "%d,CONNECT\r\n", link);
+	esp_sim_emit(ipd, 0);
+	snprintf(ipd, sizeof(ipd), "\r\n+IPD,%d,%u:%.*s", link,
+		 (unsigned int) half, (int) half, req);
+	esp_sim_emit(ipd, 100);
+	snprintf(ipd, sizeof(ipd), "\r\n+IPD,%d,%u:%s", link,
+		 (unsigned int) (strlen(req) - half), &req[half]);
+	esp_sim_emit(ipd, 200);
+	test_settle(f, 10);
+}
+
+static MunitResult test_http(const MunitParameter params[], void *fixture)
+{
+	test_fixture *f = fixture;
+	static esp_at_http srv;
+	static char latest[2 * 256];
+	static char metrics[2 * 256];
+	const char *get = "GET /latest HTTP/1.1\r\nHost: aq\r\n\r\n";
+	const char *sent;
+	char *buf;
+	char *spare;
+	size_t size;
+	int rl;
+	int rm;
+
+	munit_assert_int(esp_at_http_init(&srv, &f->cfg), ==, 0);
+	rl = esp_at_http_route_add(&srv, "/latest", "application/json",
+				   latest, sizeof(latest) / 2);
+	rm = esp_at_http_route_add(&srv, "/metrics",
+				   "application/openmetrics-text; "
+				   "version=1.0.0; charset=utf-8",
+				   metrics, sizeof(metrics) / 2);
+	munit_assert_int(rl, >=, 0);
+	munit_assert_int(rm, >=, 0);
+
+	/* Nothing to serve yet */
+	test_http_request(f, 0, get);
+	munit_assert_true(f->cfg.http_links & 1u);
+	munit_assert_int(esp_at_http_process(&srv), ==, 1);
+	munit_assert_memory_equal(20, f->esp->links[0].sent,
+				  "HTTP/1.1 503 Service");
+	munit_assert_false(f->esp->links[0].connected);
+	munit_assert_false(f->cfg.http_links & 1u);
+
+	/* Rendered once into the spare buffer */
+	buf = esp_at_http_render(&srv, rl, &size);
+	munit_assert_not_null(buf);
+	munit_assert_size(size, ==, 256);
+	strcpy(buf, TEST_MSG);
+	esp_at_http_publish(&srv, rl, strlen(TEST_MSG));
+	spare = esp_at_http_render(&srv, rl, &size);
+	munit_assert_ptr_not_equal(spare, buf);
+
+	/* Then served to every request in a single send each */
+	for (int link = 1; link < 3; ++link) {
+		test_http_request(f, link, get);
+		munit_assert_int(esp_at_http_process(&srv), ==, 1);
+		munit_assert_uint(f->esp->links[link].received, ==, 1);
+
+		sent = f->esp->links[link].sent;
+		munit_assert_memory_equal(15, sent, "HTTP/1.1 200 OK");
+		munit_assert_not_null(strstr(sent, "Content-Length: 36\r\n"));
+		munit_assert_string_equal(strstr(sent, "\r\n\r\n") + 4,
+					  TEST_MSG);
+	}
+
+	munit_assert_uint32(srv.routes[rl].requests, ==, 2);
+
+	/* A HEAD gets the header alone, unknown paths a 404 */
+	test_http_request(f, 3, "HEAD /latest?x=1 HTTP/1.0\r\n\r\n");
+	esp_at_http_process(&srv);
+	munit_assert_size(f->esp->links[3].sent_len, ==,
+			  strstr(f->esp->links[3].sent, "\r\n\r\n") + 4 -
+			  f->esp->links[3].sent);
+
+	test_http_request(f, 4, "GET /nope HTTP/1.1\r\n\r\n");
+	esp_at_http_process(&srv);
+	munit_assert_memory_equal(12, f->esp->links[4].sent, "HTTP/1.1 404");
+	munit_assert_uint32(srv.errors, ==, 2);
+
+	/* Other data comes from a client of the stream, which gets
+	 * the stream right away */
+	test_http_request(f, 0, "stats\n");
+	munit_assert_false(f->cfg.http_links & 1u);
+
+	/* As does a client that sends nothing for a while */
+	f->esp->links[1].connected = true;
+	esp_sim_emit("1,CONNECT\r\n", 0);
+	test_settle(f, 10);
+	munit_assert_true(f->cfg.http_links & 2u);
+	esp_at_status_snapshot(&f->cfg, &f->status);
+	f->esp->links[1].sent_len = 0;
+	munit_assert_int(esp_at_cipsend_string(&f->cfg, TEST_MSG,
+					       strlen(TEST_MSG), &f->status),
+			 ==, 0);
+	munit_assert_size(f->esp->links[1].sent_len, ==, 0);
+	munit_assert_size(f->esp->links[0].sent_len, ==, strlen(TEST_MSG));
+
+	test_settle(f, ESP_AT_HTTP_HOLD_MS);
+	munit_assert_int(esp_at_http_process(&srv), ==, 0);
+	munit_assert_false(f->cfg.http_links & 2u);
+	munit_assert_int(esp_at_cipsend_string(&f->cfg, TEST_MSG,
+					       strlen(TEST_MSG), &f->status),
+			 ==, 0);
+	munit_assert_size(f->esp->links[1].sent_len, ==, strlen(TEST_MSG));
+
+	return MUNIT_OK;
+}
+
+/* Takes commands like the program does, from links the HTTP endpoint
+ * doesn't hold, and subscribes a link by leaving it out of the
+ * stream */
+typedef struct {
+	esp_at_cfg *cfg;
+	char line[ESP_AT_MAX_CONN][32];
+	unsigned int cmds;
+} test_command_ctx;
+
+static void test_command_cb(const esp_at_urc *urc, void *ctx)
+{
+	test_command_ctx *c = ctx;
+	char *line;
+
+	if (urc->type != ESP_AT_URC_IPD ||
+	    (c->cfg->http_links & (1u << urc->link))) {
+		return;
+	}
+
+	line = c->line[urc->link];
+	strncat(line, urc->data, urc->len);
+
+	if (!strchr(line, '\n')) {
+		return;
+	}
+
+	if (strcmp(line, "subscribe co2\n") == 0) {
+		c->cfg->quiet_links |= 1u << urc->link;
+	} else if (strcmp(line, "unsubscribe\n") == 0) {
+		c->cfg->quiet_links &= ~(1u << urc->link);
+	}
+
+	line[0] = '\0';
+	++c->cmds;
+}
+
+static MunitResult test_http_subscribe(const MunitParameter params[],
+				       void *fixture)
+{
+	test_fixture *f = fixture;
+	static esp_at_http srv;
+	static test_command_ctx c;
+	const char *unsub = "\r\n+IPD,1,12:unsubscribe\n";
+
+	memset(&c, 0, sizeof(c));
+	c.cfg = &f->cfg;
+
+	munit_assert_int(esp_at_http_init(&srv, &f->cfg), ==, 0);
+	munit_assert_int(esp_at_urc_register(&f->cfg, test_command_cb, &c),
+			 ==, 0);
+
+	/* A client of the stream subscribes and leaves the stream */
+	test_http_request(f, 1, "subscribe co2\n");
+	munit_assert_uint(c.cmds, ==, 1);
+	munit_assert_false(f->cfg.http_links & 2u);
+	munit_assert_true(f->cfg.quiet_links & 2u);
+
+	esp_at_status_snapshot(&f->cfg, &f->status);
+	munit_assert_int(esp_at_cipsend_string(&f->cfg, TEST_MSG,
+					       strlen(TEST_MSG), &f->status),
+			 ==, 0);
+	munit_assert_size(f->esp->links[1].sent_len, ==, 0);
+
+	/* While subscribed it still takes commands */
+	esp_sim_emit(unsub, 0);
+	test_settle(f, 10);
+	munit_assert_uint(c.cmds, ==, 2);
+	munit_assert_false(f->cfg.quiet_links & 2u);
+
+	munit_assert_int(esp_at_cipsend_string(&f->cfg, TEST_MSG,
+					       strlen(TEST_MSG), &f->status),
+			 ==, 0);
+	munit_assert_size(f->esp->links[1].sent_len, ==, strlen(TEST_MSG));
+
+	return MUNIT_OK;
+}
+
+static MunitResult test_replay(const MunitParameter params[], void *fixture)
+{
+	static esp_at_replay rp;
+	static char store[64];
+	static char big[1024];
+	char frame[24];
+	char buf[32];
+	size_t len;
+
+	/* The check value of CRC-32 */
+	munit_assert_uint32(esp_at_crc32("123456789", 9), ==, 0xcbf43926);
+	munit_assert_uint32(esp_at_crc32("", 0), ==, 0);
+
+	/* Frames of 20 bytes, three fit */
+	esp_at_replay_init(&rp, store, sizeof(store), 0);
+
+	for (uint32_t seq = 0; seq < 5; ++seq) {
+		snprintf(frame, sizeof(frame), "frame %02u ..........\n",
+			 (unsigned int) seq);
+		munit_assert_uint32(esp_at_replay_add(&rp, frame, 20), ==, seq);
+	}
+
+	/* The oldest two were evicted, the newest two went in front */
+	munit_assert_uint(rp.count, ==, 3);
+	munit_assert_uint32(rp.seq, ==, 2);
+	munit_assert_uint32(rp.evicted, ==, 2);
+	munit_assert_uint32(esp_at_replay_next(&rp), ==, 5);
+	munit_assert_int(esp_at_replay_get(&rp, 0, buf, sizeof(buf), &len),
+			 ==, -1);
+	munit_assert_int(esp_at_replay_get(&rp, 1, buf, sizeof(buf), &len),
+			 ==, -1);
+	munit_assert_int(esp_at_replay_get(&rp, 5, buf, sizeof(buf), &len),
+			 ==, -1);
+	munit_assert_int(esp_at_replay_get(&rp, 2, buf, 10, &len), ==, -2);
+
+	for (uint32_t seq = 2; seq < 5; ++seq) {
+		snprintf(frame, sizeof(frame), "frame %02u ..........\n",
+			 (unsigned int) seq);
+		munit_assert_int(esp_at_replay_get(&rp, seq, buf, sizeof(buf),
+						   &len), ==, 0);
+		munit_assert_size(len, ==, 20);
+		munit_assert_memory_equal(len, buf, frame);
+	}
+
+	/* A frame longer than the ring empties the window, and the
+	 * window goes on after it */
+	munit_assert_uint32(esp_at_replay_add(&rp, big, sizeof(store) + 1),
+			    ==, 5);
+	munit_assert_uint(rp.count, ==, 0);
+	munit_assert_uint32(rp.dropped, ==, 1);
+	munit_assert_int(esp_at_replay_get(&rp, 4, buf, sizeof(buf), &len),
+			 ==, -1);
+	munit_assert_uint32(esp_at_replay_add(&rp, "frame 06\n", 9), ==, 6);
+	munit_assert_uint32(rp.seq, ==, 6);
+	munit_assert_int(esp_at_replay_get(&rp, 6, buf, sizeof(buf), &len),
+			 ==, 0);
+	munit_assert_memory_equal(9, buf, "frame 06\n");
+	munit_assert_uint32(esp_at_replay_add(&rp, NULL, 0), ==, 7);
+	munit_assert_uint(rp.count, ==, 0);
+	munit_assert_uint32(rp.dropped, ==, 2);
+	munit_assert_uint32(esp_at_replay_add(&rp, "frame 08\n", 9), ==, 8);
+	munit_assert_uint32(rp.seq, ==, 8);
+	munit_assert_int(esp_at_replay_get(&rp, 8, buf, sizeof(buf), &len),
+			 ==, 0);
+
+	/* A damaged frame fails its CRC */
+	store[rp.frames[rp.first].off] ^= 1;
+	munit_assert_int(esp_at_replay_get(&rp, 8, buf, sizeof(buf), &len),
+			 ==, -3);
+	munit_assert_uint32(rp.corrupt, ==, 1);
+
+	/* Short frames are limited by their number instead */
+	esp_at_replay_init(&rp, big, sizeof(big), 0);
+
+	for (unsigned int i = 0; i <= ESP_AT_REPLAY_FRAMES; ++i) {
+		esp_at_replay_add(&rp, "x", 1);
+	}
+
+	munit_assert_uint(rp.count, ==, ESP_AT_REPLAY_FRAMES);
+	munit_assert_uint32(rp.seq, ==, 1);
+	munit_assert_uint32(rp.evicted, ==, 1);
+
+	return MUNIT_OK;
+}
+
+static MunitResult test_replay_wrap(const MunitParameter params[],
+				    void *fixture)
+{
+	const int links[] = {0};
+	test_fixture *f = fixture;
+	static esp_at_replay rp;
+	static char store[32];
+	const char *sent = f->esp->links[0].sent;
+	char frame[16];
+	char buf[16];
+	uint32_t lost;
+	uint32_t seq = 0xfffffffe;
+	size_t len;
+
+	test_connect(f, links, ARRAY_LEN(links));
+
+	/* Five frames of 8 bytes around the wrap, four fit */
+	esp_at_replay_init(&rp, store, sizeof(store), seq);
+
+	for (int i = 0; i < 5; ++i) {
+		snprintf(frame, sizeof(frame), "frame %d\n", i);
+		munit_assert_uint32(esp_at_replay_add(&rp, frame, 8), ==, seq);
+		++seq;
+	}
+
+	munit_assert_uint32(seq, ==, 3);
+	munit_assert_uint32(esp_at_replay_next(&rp), ==, 3);
+	munit_assert_uint32(rp.seq, ==, 0xffffffff);
+	munit_assert_int(esp_at_replay_get(&rp, 0xfffffffe, buf, sizeof(buf),
+					   &len), ==, -1);
+	munit_assert_int(esp_at_replay_get(&rp, 0, buf, sizeof(buf), &len),
+			 ==, 0);
+	munit_assert_memory_equal(8, buf, "frame 2\n");
+
+	/* Resumed across the wrap, one frame short */
+	f->esp->links[0].sent_len = 0;
+	munit_assert_int(esp_at_replay_send(&rp, &f->cfg, 0, 0xfffffffe, buf,
+					    sizeof(buf), &lost), ==, 4);
+	munit_assert_uint32(lost, ==, 1);
+	munit_assert_size(f->esp->links[0].sent_len, ==, 32);
+	munit_assert_memory_equal(32, sent,
+				  "frame 1\nframe 2\nframe 3\nframe 4\n");
+
+	/* From within the window */
+	f->esp->links[0].sent_len = 0;
+	munit_assert_int(esp_at_replay_send(&rp, &f->cfg, 0, 2, buf,
+					    sizeof(buf), &lost), ==, 1);
+	munit_assert_uint32(lost, ==, 0);
+	munit_assert_memory_equal(8, sent, "frame 4\n");
+
+	/* Caught up, or ahead like from before a restart */
+	munit_assert_int(esp_at_replay_send(&rp, &f->cfg, 0, 3, buf,
+					    sizeof(buf), &lost), ==, 0);
+	munit_assert_int(esp_at_replay_send(&rp, &f->cfg, 0, 100, buf,
+					    sizeof(buf), &lost), ==, 0);
+	munit_assert_uint32(lost, ==, 0);
+
+	/* A damaged frame is skipped and counted */
+	store[rp.frames[rp.first].off] ^= 1;
+	f->esp->links[0].sent_len = 0;
+	munit_assert_int(esp_at_replay_send(&rp, &f->cfg, 0, 0xffffffff, buf,
+					    sizeof(buf), &lost), ==, 3);
+	munit_assert_uint32(lost, ==, 1);
+	munit_assert_memory_equal(8, sent, "frame 2\n");
+
+	/* A failed send stops the replay */
+	f->esp->links[0].fail = true;
+	munit_assert_int(esp_at_replay_send(&rp, &f->cfg, 0, 0, buf,
+					    sizeof(buf), &lost), <, 0);
+
+	return MUNIT_OK;
+}
+
+static MunitTest esp_at_tests[] = {
+	{
+		.name = "/fanout-test",
+		.test = test_fanout,
+		.setup = test_setup,
+		.tear_down = test_tear_down,
+		.options = MUNIT_TEST_OPTION_NONE,
+		.parameters = NULL
+	},
+	{
+		.name = "/fanout-fail-test",
+		.test = test_fanout_fail,
+		.setup = test_setup,
+		.tear_down = test_tear_down,
+		.options = MUNIT_TEST_OPTION_NONE,
+		.parameters = NULL
+	},
+	{
+		.name = "/fanout-busy-test",
+		.test = test_fanout_busy,
+		.setup = test_setup,
+		.tear_down = test_tear_down,
+		.options = MUNIT_TEST_OPTION_NONE,
+		.parameters = NULL
+	},
+	{
+		.name = "/fanout-backlog-test",
+		.test = test_fanout_backlog,
+		.setup = test_setup,
+		.tear_down = test_tear_down,
+		.options = MUNIT_TEST_OPTION_NONE,
+		.parameters = NULL
+	},
+	{
+		.name = "/cipsend-data-test",
+		.test = test_cipsend_data,
+		.setup = test_setup,
+		.tear_down = test_tear_down,
+		.options = MUNIT_TEST_OPTION_NONE,
+		.parameters = NULL
+	},
+	{
+		.name = "/baud-test",
+		.test = test_baud,
+		.setup = test_setup,
+		.tear_down = test_tear_down,
+		.options = MUNIT_TEST_OPTION_NONE,
+		.parameters = NULL
+	},
+	{
+		.name = "/flow-test",
+		.test = test_flow,
+		.setup = NULL,
+		.tear_down = NULL,
+		.options = MUNIT_TEST_OPTION_NONE,
+		.parameters = NULL
+	},
+	{
+		.name = "/caps-test",
+		.test = test_caps,
+		.setup = NULL,
+		.tear_down = NULL,
+		.options = MUNIT_TEST_OPTION_NONE,
+		.parameters = NULL
+	},
+	{
+		.name = "/transparent-test",
+		.test = test_transparent,
+		.setup = NULL,
+		.tear_down = NULL,
+		.options = MUNIT_TEST_OPTION_NONE,
+		.parameters = NULL
+	},
+	{
+		.name = "/udp-test",
+		.test = test_udp,
+		.setup = test_setup,
+		.tear_down = test_tear_down,
+		.options = MUNIT_TEST_OPTION_NONE,
+		.parameters = NULL
+	},
+	{
+		.name = "/http-test",
+		.test = test_http,
+		.setup = test_setup,
+		.tear_down = test_tear_down,
+		.options = MUNIT_TEST_OPTION_NONE,
+		.parameters = NULL
+	},
+	{
+		.name = "/http-subscribe-test",
+		.test = test_http_subscribe,
+		.setup = test_setup,
+		.tear_down = test_tear_down,
+		.options = MUNIT_TEST_OPTION_NONE,
+		.parameters = NULL
+	},
+	{
+		.name = "/replay-test",
+		.test = test_replay,
+		.setup = NULL,
+		.tear_down = NULL,
+		.options = MUNIT_TEST_OPTION_NONE,
+		.parameters = NULL
+	},
+	{
+		.name = "/replay-wrap-test",
+		.test = test_replay_wrap,
+		.setup = test_setup,
+		.tear_down = test_tear_down,
+		.options = MUNIT_TEST_OPTION_NONE,
+		.parameters = NULL
+	},
+	{
+		.name = "/cmd-queue-test",
+		.test = test_cmd_queue,
+		.setup = test_setup,
+		.tear_down = test_tear_down,
+		.options = MUNIT_TEST_OPTION_NONE,
+		.parameters = NULL
+	},
+	{
+		.name = "/cmd-busy-test",
+		.test = test_cmd_busy,
+		.setup = test_setup,
+		.tear_down = test_tear_down,
+		.options = MUNIT_TEST_OPTION_NONE,
+		.parameters = NULL
+	},
+	{
+		.name = "/cmd-deadline-test",
+		.test = test_cmd_deadline,
+		.setup = test_setup,
+		.tear_down = test_tear_down,
+		.options = MUNIT_TEST_OPTION_NONE,
+		.parameters = NULL
+	},
+	{
+		.name = "/status-refresh-test",
+		.test = test_status_refresh,
+		.setup = test_setup,
+		.tear_down = test_tear_down,
+		.options = MUNIT_TEST_OPTION_NONE,
+		.parameters = NULL
+	},
+	{
+		.name = NULL,
+		.test = NULL,
+		.setup = NULL,
+		.tear_down = NULL,
+		.options = MUNIT_TEST_OPTION_NONE,
+		.parameters = NULL
+	}
+};
+
+static const MunitSuite esp_at_test_suite = {
+	"/esp-at-modem-suite",
+	esp_at_tests,
+	NULL,
+	1,
+	MUNIT_SUITE_OPTION_NONE
+};
+
+int main(int argc, char *const argv[])
+{
+	return munit_suite_main(&esp_at_test_suite, NULL, argc, argv);
+}
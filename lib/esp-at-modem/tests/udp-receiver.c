@@ -0,0 +1,120 @@
+/**
+ * @file udp-receiver.c
+ * @author Tyler J. Anderson
+ * @brief Collector for the datagrams of esp_at_udp_send
+ *
+ * Listens on a UDP port, on all addresses so broadcasts arrive too,
+ * and optionally in a multicast group. Prints the payload of each
+ * datagram and counts the ones lost or out of order by their
+ * sequence numbers.
+ *
+ * Usage: esp-at-udp-receiver <port> [group] [count]
+ */
+
+#include "esp-at-modem.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+int main(int argc, char *argv[])
+{
+	struct sockaddr_in addr = {0};
+	const int on = 1;
+	unsigned long count;
+	unsigned long frames = 0;
+	unsigned long lost = 0;
+	unsigned long late = 0;
+	uint32_t next = 0;
+	int fd;
+
+	if (argc < 2) {
+		fprintf(stderr, "Usage: %s <port> [group] [count]\n", argv[0]);
+		return 2;
+	}
+
+	count = argc > 3 ? strtoul(argv[3], NULL, 10) : 0;
+
+	fd = socket(AF_INET, SOCK_DGRAM, 0);
+
+	if (fd < 0) {
+		perror("socket");
+		return 1;
+	}
+
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(strtoul(argv[1], NULL, 10));
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+
+	if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+		perror("bind");
+		return 1;
+	}
+
+	if (argc > 2 && argv[2][0] != '\0') {
+		struct ip_mreq mreq = {0};
+
+		if (inet_pton(AF_INET, argv[2], &mreq.imr_multiaddr) != 1 ||
+		    setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq,
+			       sizeof(mreq)) < 0) {
+			perror("multicast group");
+			return 1;
+		}
+	}
+
+	while (!count || frames < count) {
+		uint8_t buf[ESP_AT_CIPSEND_MAX_LEN + 1];
+		ssize_t n = recv(fd, buf, sizeof(buf) - 1, 0);
+		uint32_t seq;
+
+		if (n < 0) {
+			perror("recv");
+			return 1;
+		}
+
+		if (n < ESP_AT_UDP_SEQ_LEN) {
+			fprintf(stderr, "Short datagram of %zd bytes\n", n);
+			continue;
+		}
+
+		seq = (uint32_t) buf[0] << 24 | (uint32_t) buf[1] << 16 |
+			(uint32_t) buf[2] << 8 | buf[3];
+		buf[n] = '\0';
+
+		/* A new sender starts from 0 again */
+		if (frames && seq == 0) {
+			next = 0;
+		}
+
+		if (seq >= next) {
+			lost += seq - next;
+			next = seq + 1;
+		} else {
+			++late;
+
+			if (lost) {
+				--lost;
+			}
+		}
+
+		++frames;
+		printf("%lu %s", (unsigned long) seq,
+		       (char *) &buf[ESP_AT_UDP_SEQ_LEN]);
+
+		if (n == ESP_AT_UDP_SEQ_LEN || buf[n - 1] != '\n') {
+			printf("\n");
+		}
+
+		fflush(stdout);
+	}
+
+	fprintf(stderr, "%lu frames, %lu lost, %lu out of order\n", frames,
+		lost, late);
+	close(fd);
+
+	return lost ? 1 : 0;
+}
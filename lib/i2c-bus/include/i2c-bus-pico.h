@@ -0,0 +1,87 @@
+/**
+ * @file i2c-bus-pico.h
+ * @author Tyler J. Anderson
+ * @brief DMA driven Pico SDK backend of the shared I2C bus scheduler
+ */
+
+#ifndef I2C_BUS_PICO_H
+#define I2C_BUS_PICO_H
+
+#include "i2c-bus.h"
+
+#include "hardware/i2c.h"
+
+/**
+ * @addtogroup i2c-bus
+ * @{
+ */
+
+/* GPIO pins of each I2C block, the board default pins are used for
+ * the default block */
+#if defined(PICO_DEFAULT_I2C) && PICO_DEFAULT_I2C == 1
+
+#ifndef I2C_BUS_PICO_I2C0_SDA_PIN
+#define I2C_BUS_PICO_I2C0_SDA_PIN 4
+#endif
+
+#ifndef I2C_BUS_PICO_I2C0_SCL_PIN
+#define I2C_BUS_PICO_I2C0_SCL_PIN 5
+#endif
+
+#ifndef I2C_BUS_PICO_I2C1_SDA_PIN
+#define I2C_BUS_PICO_I2C1_SDA_PIN PICO_DEFAULT_I2C_SDA_PIN
+#endif
+
+#ifndef I2C_BUS_PICO_I2C1_SCL_PIN
+#define I2C_BUS_PICO_I2C1_SCL_PIN PICO_DEFAULT_I2C_SCL_PIN
+#endif
+
+#else
+
+#ifndef I2C_BUS_PICO_I2C0_SDA_PIN
+#define I2C_BUS_PICO_I2C0_SDA_PIN PICO_DEFAULT_I2C_SDA_PIN
+#endif
+
+#ifndef I2C_BUS_PICO_I2C0_SCL_PIN
+#define I2C_BUS_PICO_I2C0_SCL_PIN PICO_DEFAULT_I2C_SCL_PIN
+#endif
+
+#ifndef I2C_BUS_PICO_I2C1_SDA_PIN
+#define I2C_BUS_PICO_I2C1_SDA_PIN 2
+#endif
+
+#ifndef I2C_BUS_PICO_I2C1_SCL_PIN
+#define I2C_BUS_PICO_I2C1_SCL_PIN 3
+#endif
+
+#endif /* #if defined(PICO_DEFAULT_I2C) && PICO_DEFAULT_I2C == 1 */
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* #ifdef __cplusplus */
+
+/** @brief Get the bus of an I2C block, setting it up on first use
+ *
+ * Each call adds a user of the block. The block runs at the lowest
+ * @p baudrate asked for by any of its users, so a slow device can
+ * share the bus with fast ones. NULL @p i2c selects the default
+ * block.
+ *
+ * @return The bus, shared by all users of @p i2c
+ */
+i2c_bus *i2c_bus_pico_init(i2c_inst_t *i2c, uint baudrate);
+
+/** @brief Drop a user of the block, which is shut down with the last
+ * user
+ */
+void i2c_bus_pico_deinit(i2c_inst_t *i2c);
+
+#ifdef __cplusplus
+}
+#endif /* #ifdef __cplusplus */
+
+/**
+ * @}
+ */
+
+#endif /* #ifndef I2C_BUS_PICO_H */
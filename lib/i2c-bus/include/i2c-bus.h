@@ -0,0 +1,246 @@
+/**
+ * @file i2c-bus.h
+ * @author Tyler J. Anderson
+ * @brief Shared I2C bus transaction scheduler
+ *
+ * Several device drivers can queue transactions on the same bus
+ * without blocking each other. Each device has its own queue, which
+ * is always served in order, and the bus picks the next device by
+ * priority. A transaction can have a delay between its write and
+ * read phases, such as the command execution time of a Sensirion
+ * sensor, during which the bus is released to other devices.
+ *
+ * The scheduler itself knows nothing of the hardware. A backend
+ * provides the @ref i2c_bus_ops, starts the phases it is given and
+ * calls @ref i2c_bus_complete when each one finishes.
+ */
+
+#ifndef I2C_BUS_H
+#define I2C_BUS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * @defgroup i2c-bus Shared I2C Bus Scheduler
+ * @{
+ */
+
+/** @brief Max bytes in each phase of a transaction */
+#ifndef I2C_BUS_XFER_MAX_LEN
+#define I2C_BUS_XFER_MAX_LEN 65
+#endif /* #ifndef I2C_BUS_XFER_MAX_LEN */
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* #ifdef __cplusplus */
+
+/** @brief Return codes of the scheduler */
+typedef enum {
+	I2C_BUS_OK		= 0,
+	I2C_BUS_E_NULL_PTR	= -1, /**< Required argument was NULL */
+	I2C_BUS_E_INVALID_LEN	= -2, /**< Phase longer than max len */
+	I2C_BUS_E_BUSY		= -3, /**< Transaction already in use */
+	I2C_BUS_E_COMM		= -4, /**< NACK or bus error */
+	I2C_BUS_E_TIMEOUT	= -5  /**< Cancelled after timeout */
+} i2c_bus_err;
+
+/** @brief Life cycle of a transaction */
+typedef enum {
+	I2C_BUS_XFER_FREE,	/**< Not in use */
+	I2C_BUS_XFER_CLAIMED,	/**< Reserved, being filled out */
+	I2C_BUS_XFER_QUEUED,	/**< Waiting for the bus */
+	I2C_BUS_XFER_ACTIVE,	/**< A phase is on the bus */
+	I2C_BUS_XFER_WAIT,	/**< Between write and read phases */
+	I2C_BUS_XFER_DONE	/**< Finished, result not collected */
+} i2c_bus_xfer_state;
+
+/** @brief Bus operation handed to the backend */
+typedef enum {
+	I2C_BUS_OP_WRITE,	/**< Write then stop */
+	I2C_BUS_OP_READ,	/**< Read then stop */
+	I2C_BUS_OP_WRITE_READ	/**< Write, restart, read then stop */
+} i2c_bus_op;
+
+struct i2c_bus_node;
+struct i2c_bus_dev_node;
+struct i2c_bus_xfer_node;
+
+/** @brief Completion callback of a transaction
+ *
+ * Called once the transaction is finished, possibly from interrupt
+ * context, without the bus lock held. The transaction is already
+ * free, so the callback may fill it out and submit it again.
+ */
+typedef void (*i2c_bus_xfer_cb)(struct i2c_bus_xfer_node *x, int rslt,
+				void *ctx);
+
+/** @brief Bus time accounting
+ *
+ * @p busy_us is the time a phase was on the bus and @p elapsed_us
+ * the time since the counters were reset, so their ratio is the bus
+ * utilization. @p queue_us is the time transactions waited for the
+ * bus after being submitted.
+ */
+typedef struct {
+	uint64_t elapsed_us; /**< @brief Time since last reset */
+	uint64_t busy_us; /**< @brief Time phases were on the bus */
+	uint64_t queue_us; /**< @brief Time spent waiting for the bus */
+	uint32_t queue_max_us; /**< @brief Longest wait for the bus */
+	uint32_t xfers; /**< @brief Finished transactions */
+	uint32_t errors; /**< @brief Failed transactions */
+} i2c_bus_stats;
+
+/** @brief A transaction: an optional write, delay, and optional read
+ *
+ * Without a delay a write and read are done as one transfer with a
+ * repeated start. With a delay the write is ended with a stop and
+ * the read is started once the delay has passed.
+ */
+typedef struct i2c_bus_xfer_node {
+	struct i2c_bus_dev_node *dev;
+	struct i2c_bus_xfer_node *next;
+	uint8_t wbuf[I2C_BUS_XFER_MAX_LEN]; /**< @brief Bytes to write */
+	size_t wlen;
+	uint8_t *rbuf; /**< @brief Destination of the read phase */
+	size_t rlen;
+	uint32_t delay_us; /**< @brief Delay between write and read */
+	volatile i2c_bus_xfer_state state;
+	volatile int rslt;
+	i2c_bus_xfer_cb cb;
+	void *ctx;
+	uint64_t t_queued; /**< @brief When the transaction was queued */
+	uint64_t t_ready; /**< @brief When a delay ends */
+} i2c_bus_xfer;
+
+/** @brief A device on the bus with its own transaction queue */
+typedef struct i2c_bus_dev_node {
+	struct i2c_bus_node *bus;
+	struct i2c_bus_dev_node *next;
+	uint8_t addr; /**< @brief 7-bit I2C address */
+	uint8_t prio; /**< @brief Higher values are served first */
+	i2c_bus_xfer *head;
+	i2c_bus_xfer *tail;
+	i2c_bus_stats stats; /**< @brief Time used by this device */
+} i2c_bus_dev;
+
+/** @brief Hardware backend of a bus
+ *
+ * @p start and @p now_us are required, the rest are optional.
+ * @p start is called with the bus locked and must only begin the
+ * operation; the backend calls @ref i2c_bus_complete once it is
+ * finished. Without @p alarm the owner of the bus must call
+ * @ref i2c_bus_poll for delayed read phases to be started.
+ */
+typedef struct {
+	int (*start)(struct i2c_bus_node *bus, i2c_bus_xfer *x,
+		     i2c_bus_op op);
+	void (*cancel)(struct i2c_bus_node *bus);
+	uint64_t (*now_us)(struct i2c_bus_node *bus);
+	void (*alarm)(struct i2c_bus_node *bus, uint64_t at_us);
+	void (*lock)(struct i2c_bus_node *bus);
+	void (*unlock)(struct i2c_bus_node *bus);
+} i2c_bus_ops;
+
+/** @brief Scheduler state of one bus */
+typedef struct i2c_bus_node {
+	const i2c_bus_ops *ops;
+	void *ctx; /**< @brief Backend data */
+	i2c_bus_dev *devs;
+	i2c_bus_dev *last; /**< @brief Last device served */
+	i2c_bus_xfer *active;
+	i2c_bus_op op; /**< @brief Operation of the active phase */
+	uint64_t t_start; /**< @brief When the active phase started */
+	uint64_t t_reset; /**< @brief When the stats were reset */
+	i2c_bus_stats stats;
+} i2c_bus;
+
+/** @brief Set up a bus with a backend
+ *
+ * @return I2C_BUS_OK or I2C_BUS_E_NULL_PTR
+ */
+int i2c_bus_init(i2c_bus *bus, const i2c_bus_ops *ops, void *ctx);
+
+/** @brief Add a device to a bus
+ *
+ * Adding a device that is already on the bus only updates its
+ * address and priority.
+ */
+int i2c_bus_dev_add(i2c_bus *bus, i2c_bus_dev *dev, uint8_t addr,
+		    uint8_t prio);
+
+/** @brief Remove a device from its bus, cancelling its transactions */
+void i2c_bus_dev_remove(i2c_bus_dev *dev);
+
+/** @brief Reserve a free transaction
+ *
+ * Needed only when a transaction may be submitted from both thread
+ * and interrupt context.
+ *
+ * @return true if @p x was free and is now reserved
+ */
+bool i2c_bus_xfer_claim(i2c_bus_dev *dev, i2c_bus_xfer *x);
+
+/** @brief Fill out a free or claimed transaction
+ *
+ * @p wbuf is copied, @p rbuf must stay valid until the transaction
+ * has finished.
+ *
+ * @return I2C_BUS_OK, or I2C_BUS_E_INVALID_LEN if either phase is
+ * longer than @ref I2C_BUS_XFER_MAX_LEN
+ */
+int i2c_bus_xfer_set(i2c_bus_xfer *x, const uint8_t *wbuf, size_t wlen,
+		     uint8_t *rbuf, size_t rlen, uint32_t delay_us,
+		     i2c_bus_xfer_cb cb, void *ctx);
+
+/** @brief Queue a transaction on a device
+ *
+ * @return I2C_BUS_OK, or I2C_BUS_E_BUSY if @p x is already queued
+ */
+int i2c_bus_submit(i2c_bus_dev *dev, i2c_bus_xfer *x);
+
+/** @brief Check if a transaction has not finished yet */
+bool i2c_bus_xfer_busy(const i2c_bus_xfer *x);
+
+/** @brief Wait for a transaction without a callback to finish
+ *
+ * The transaction is cancelled if it did not finish within
+ * @p timeout_us, or never if @p timeout_us is 0. The transaction is
+ * free again when this returns.
+ *
+ * @return Result of the transaction
+ */
+int i2c_bus_xfer_wait(i2c_bus_xfer *x, uint64_t timeout_us);
+
+/** @brief Cancel a queued or active transaction
+ *
+ * A cancelled transaction finishes with I2C_BUS_E_TIMEOUT. Its
+ * callback is not called.
+ */
+void i2c_bus_cancel(i2c_bus_xfer *x);
+
+/** @brief Report the end of the active phase, for backends */
+void i2c_bus_complete(i2c_bus *bus, int rslt);
+
+/** @brief Start delayed read phases that are due */
+void i2c_bus_poll(i2c_bus *bus);
+
+/** @brief Get the bus time accounting of the whole bus */
+void i2c_bus_get_stats(i2c_bus *bus, i2c_bus_stats *s);
+
+/** @brief Get the bus time accounting of a single device */
+void i2c_bus_dev_get_stats(i2c_bus_dev *dev, i2c_bus_stats *s);
+
+/** @brief Reset bus time accounting of the bus and its devices */
+void i2c_bus_reset_stats(i2c_bus *bus);
+
+#ifdef __cplusplus
+}
+#endif /* #ifdef __cplusplus */
+
+/**
+ * @}
+ */
+
+#endif /* #ifndef I2C_BUS_H */
@@ -0,0 +1,336 @@
+/**
+ * @file i2c-bus-pico.c
+ * @author Tyler J. Anderson
+ * @brief DMA driven Pico SDK backend of the shared I2C bus scheduler
+ *
+ * Each phase is encoded as IC_DATA_CMD words and fed to the I2C
+ * block by one DMA channel while a second one drains the received
+ * bytes, so the CPU is only involved at the start of a phase and at
+ * the STOP_DET or TX_ABRT interrupt that ends it.
+ */
+
+#include "i2c-bus-pico.h"
+
+#include "pico/stdlib.h"
+#include "pico/critical_section.h"
+#include "hardware/dma.h"
+#include "hardware/irq.h"
+
+/** @brief Backend state, one per I2C block */
+typedef struct {
+	i2c_inst_t *i2c;
+	i2c_bus bus;
+	unsigned int users;
+	uint baudrate;
+	int dma_tx;
+	int dma_rx;
+	dma_channel_config tx_cfg;
+	dma_channel_config rx_cfg;
+	critical_section_t cs;
+	alarm_id_t alarm;
+	bool reading; /* Active phase has a read */
+	int rslt; /* Result of the active phase so far */
+	uint32_t cmd[2 * I2C_BUS_XFER_MAX_LEN];
+} _i2c_bus_pico;
+
+static _i2c_bus_pico _buses[NUM_I2CS];
+
+static int _i2c_bus_pico_start(i2c_bus *bus, i2c_bus_xfer *x,
+			       i2c_bus_op op);
+static void _i2c_bus_pico_cancel(i2c_bus *bus);
+static uint64_t _i2c_bus_pico_now_us(i2c_bus *bus);
+static void _i2c_bus_pico_alarm(i2c_bus *bus, uint64_t at_us);
+static void _i2c_bus_pico_lock(i2c_bus *bus);
+static void _i2c_bus_pico_unlock(i2c_bus *bus);
+static int64_t _i2c_bus_pico_alarm_cb(alarm_id_t id, void *user_data);
+static void _i2c_bus_pico_irq(_i2c_bus_pico *p);
+static void _i2c_bus_pico_i2c0_irq();
+static void _i2c_bus_pico_i2c1_irq();
+
+static const i2c_bus_ops _i2c_bus_pico_ops = {
+	.start = _i2c_bus_pico_start,
+	.cancel = _i2c_bus_pico_cancel,
+	.now_us = _i2c_bus_pico_now_us,
+	.alarm = _i2c_bus_pico_alarm,
+	.lock = _i2c_bus_pico_lock,
+	.unlock = _i2c_bus_pico_unlock
+};
+
+i2c_bus *i2c_bus_pico_init(i2c_inst_t *i2c, uint baudrate)
+{
+	_i2c_bus_pico *p;
+	i2c_hw_t *hw;
+	uint irq;
+
+	if (!i2c) {
+		i2c = i2c_default;
+	}
+
+	p = &_buses[i2c_hw_index(i2c)];
+
+	/* Already in use, only slow it down if needed */
+	if (p->users > 0) {
+		if (baudrate < p->baudrate) {
+			p->baudrate = baudrate;
+			i2c_set_baudrate(i2c, baudrate);
+		}
+
+		++p->users;
+
+		return &p->bus;
+	}
+
+	hw = i2c_get_hw(i2c);
+	irq = I2C0_IRQ + i2c_hw_index(i2c);
+
+	/* note: given baudrate may not match actual */
+	i2c_init(i2c, baudrate);
+
+	if (i2c_hw_index(i2c)) {
+		gpio_set_function(I2C_BUS_PICO_I2C1_SDA_PIN, GPIO_FUNC_I2C);
+		gpio_set_function(I2C_BUS_PICO_I2C1_SCL_PIN, GPIO_FUNC_I2C);
+		gpio_pull_up(I2C_BUS_PICO_I2C1_SDA_PIN);
+		gpio_pull_up(I2C_BUS_PICO_I2C1_SCL_PIN);
+	} else {
+		gpio_set_function(I2C_BUS_PICO_I2C0_SDA_PIN, GPIO_FUNC_I2C);
+		gpio_set_function(I2C_BUS_PICO_I2C0_SCL_PIN, GPIO_FUNC_I2C);
+		gpio_pull_up(I2C_BUS_PICO_I2C0_SDA_PIN);
+		gpio_pull_up(I2C_BUS_PICO_I2C0_SCL_PIN);
+	}
+
+	p->i2c = i2c;
+	p->users = 1;
+	p->baudrate = baudrate;
+	p->alarm = 0;
+	p->dma_tx = dma_claim_unused_channel(true);
+	p->dma_rx = dma_claim_unused_channel(true);
+	critical_section_init(&p->cs);
+
+	/* Command words go from memory to IC_DATA_CMD */
+	p->tx_cfg = dma_channel_get_default_config(p->dma_tx);
+	channel_config_set_transfer_data_size(&p->tx_cfg, DMA_SIZE_32);
+	channel_config_set_read_increment(&p->tx_cfg, true);
+	channel_config_set_write_increment(&p->tx_cfg, false);
+	channel_config_set_dreq(&p->tx_cfg, i2c_get_dreq(i2c, true));
+
+	/* Received bytes go from IC_DATA_CMD to memory */
+	p->rx_cfg = dma_channel_get_default_config(p->dma_rx);
+	channel_config_set_transfer_data_size(&p->rx_cfg, DMA_SIZE_8);
+	channel_config_set_read_increment(&p->rx_cfg, false);
+	channel_config_set_write_increment(&p->rx_cfg, true);
+	channel_config_set_dreq(&p->rx_cfg, i2c_get_dreq(i2c, false));
+
+	i2c_bus_init(&p->bus, &_i2c_bus_pico_ops, p);
+
+	/* DMA handshake and completion interrupts */
+	hw->dma_cr = I2C_IC_DMA_CR_TDMAE_BITS | I2C_IC_DMA_CR_RDMAE_BITS;
+	hw->dma_tdlr = 4;
+	hw->dma_rdlr = 0;
+	hw->intr_mask = I2C_IC_INTR_MASK_M_STOP_DET_BITS |
+		I2C_IC_INTR_MASK_M_TX_ABRT_BITS;
+
+	irq_set_exclusive_handler(irq, i2c_hw_index(i2c) ?
+				  _i2c_bus_pico_i2c1_irq :
+				  _i2c_bus_pico_i2c0_irq);
+	irq_set_enabled(irq, true);
+
+	return &p->bus;
+}
+
+void i2c_bus_pico_deinit(i2c_inst_t *i2c)
+{
+	_i2c_bus_pico *p;
+	uint irq;
+
+	if (!i2c) {
+		i2c = i2c_default;
+	}
+
+	p = &_buses[i2c_hw_index(i2c)];
+
+	if (p->users == 0 || --p->users > 0) {
+		return;
+	}
+
+	irq = I2C0_IRQ + i2c_hw_index(i2c);
+	irq_set_enabled(irq, false);
+	irq_remove_handler(irq, i2c_hw_index(i2c) ?
+			   _i2c_bus_pico_i2c1_irq :
+			   _i2c_bus_pico_i2c0_irq);
+
+	if (p->alarm > 0) {
+		cancel_alarm(p->alarm);
+		p->alarm = 0;
+	}
+
+	dma_channel_abort(p->dma_tx);
+	dma_channel_abort(p->dma_rx);
+	dma_channel_unclaim(p->dma_tx);
+	dma_channel_unclaim(p->dma_rx);
+
+	i2c_deinit(i2c);
+	critical_section_deinit(&p->cs);
+}
+
+/*
+**********************************************************************
+*********************** BACKEND OPERATIONS ***************************
+**********************************************************************
+*/
+
+int _i2c_bus_pico_start(i2c_bus *bus, i2c_bus_xfer *x, i2c_bus_op op)
+{
+	_i2c_bus_pico *p = (_i2c_bus_pico*) bus->ctx;
+	i2c_hw_t *hw = i2c_get_hw(p->i2c);
+	uint32_t n = 0;
+
+	if (op != I2C_BUS_OP_READ) {
+		for (size_t i = 0; i < x->wlen; ++i) {
+			p->cmd[n++] = x->wbuf[i];
+		}
+	}
+
+	/* One read command per byte, the first of which restarts
+	 * after a write */
+	if (op != I2C_BUS_OP_WRITE) {
+		for (size_t i = 0; i < x->rlen; ++i) {
+			p->cmd[n++] = I2C_IC_DATA_CMD_CMD_BITS;
+		}
+
+		if (op == I2C_BUS_OP_WRITE_READ) {
+			p->cmd[x->wlen] |= I2C_IC_DATA_CMD_RESTART_BITS;
+		}
+	}
+
+	if (n == 0) {
+		return I2C_BUS_E_INVALID_LEN;
+	}
+
+	p->cmd[n - 1] |= I2C_IC_DATA_CMD_STOP_BITS;
+	p->reading = op != I2C_BUS_OP_WRITE;
+	p->rslt = I2C_BUS_OK;
+
+	/* Target address can only be changed while disabled */
+	hw->enable = 0;
+	hw->tar = x->dev->addr;
+	hw->enable = 1;
+
+	/* Arm the receiver before any read command goes out */
+	if (p->reading) {
+		dma_channel_configure(p->dma_rx, &p->rx_cfg, x->rbuf,
+				      &hw->data_cmd, x->rlen, true);
+	}
+
+	dma_channel_configure(p->dma_tx, &p->tx_cfg, &hw->data_cmd,
+			      p->cmd, n, true);
+
+	return I2C_BUS_OK;
+}
+
+void _i2c_bus_pico_cancel(i2c_bus *bus)
+{
+	_i2c_bus_pico *p = (_i2c_bus_pico*) bus->ctx;
+
+	dma_channel_abort(p->dma_tx);
+	dma_channel_abort(p->dma_rx);
+
+	/* Disabling the block flushes both FIFOs */
+	i2c_get_hw(p->i2c)->enable = 0;
+}
+
+uint64_t _i2c_bus_pico_now_us(i2c_bus *bus)
+{
+	return time_us_64();
+}
+
+void _i2c_bus_pico_alarm(i2c_bus *bus, uint64_t at_us)
+{
+	_i2c_bus_pico *p = (_i2c_bus_pico*) bus->ctx;
+
+	if (p->alarm > 0) {
+		cancel_alarm(p->alarm);
+	}
+
+	p->alarm = add_alarm_at(from_us_since_boot(at_us),
+				_i2c_bus_pico_alarm_cb, p, false);
+
+	/* Without a free alarm slot keep trying until one frees up or
+	 * the delay has passed, so the read is never left waiting */
+	while (p->alarm < 0) {
+		if (time_us_64() >= at_us) {
+			p->alarm = 0;
+			break;
+		}
+
+		tight_loop_contents();
+		p->alarm = add_alarm_at(from_us_since_boot(at_us),
+					_i2c_bus_pico_alarm_cb, p, false);
+	}
+
+	/* Already due by the time it was set */
+	if (p->alarm == 0) {
+		i2c_bus_poll(bus);
+	}
+}
+
+void _i2c_bus_pico_lock(i2c_bus *bus)
+{
+	critical_section_enter_blocking(&((_i2c_bus_pico*) bus->ctx)->cs);
+}
+
+void _i2c_bus_pico_unlock(i2c_bus *bus)
+{
+	critical_section_exit(&((_i2c_bus_pico*) bus->ctx)->cs);
+}
+
+int64_t _i2c_bus_pico_alarm_cb(alarm_id_t id, void *user_data)
+{
+	_i2c_bus_pico *p = (_i2c_bus_pico*) user_data;
+
+	p->alarm = 0;
+	i2c_bus_poll(&p->bus);
+
+	return 0;
+}
+
+void _i2c_bus_pico_irq(_i2c_bus_pico *p)
+{
+	i2c_hw_t *hw = i2c_get_hw(p->i2c);
+	const uint32_t stat = hw->intr_stat;
+
+	/* A NACK or lost arbitration flushes the TX FIFO, so stop
+	 * the DMA from refilling it. The controller still issues a
+	 * stop, which completes the phase below. */
+	if (stat & I2C_IC_INTR_STAT_R_TX_ABRT_BITS) {
+		dma_channel_abort(p->dma_tx);
+		dma_channel_abort(p->dma_rx);
+		(void) hw->clr_tx_abrt;
+		p->rslt = I2C_BUS_E_COMM;
+	}
+
+	if (!(stat & I2C_IC_INTR_STAT_R_STOP_DET_BITS)) {
+		return;
+	}
+
+	(void) hw->clr_stop_det;
+
+	/* All data is in the RX FIFO by the time the stop is seen,
+	 * but the DMA may still be moving the last bytes */
+	if (p->reading && p->rslt == I2C_BUS_OK) {
+		while (dma_channel_is_busy(p->dma_rx)) {
+			tight_loop_contents();
+		}
+	}
+
+	i2c_bus_complete(&p->bus, p->rslt);
+}
+
+void _i2c_bus_pico_i2c0_irq()
+{
+	_i2c_bus_pico_irq(&_buses[0]);
+}
+
+void _i2c_bus_pico_i2c1_irq()
+{
+	_i2c_bus_pico_irq(&_buses[1]);
+}
@@ -0,0 +1,548 @@
+/**
+ * @file i2c-bus.c
+ * @author Tyler J. Anderson
+ * @brief Shared I2C bus transaction scheduler implementation
+ */
+
+#include "i2c-bus.h"
+
+#include <string.h>
+
+#define I2C_BUS_NEVER UINT64_MAX
+
+static void _i2c_bus_lock(i2c_bus *bus);
+static void _i2c_bus_unlock(i2c_bus *bus);
+static uint64_t _i2c_bus_now(i2c_bus *bus);
+static void _i2c_bus_unlink(i2c_bus_xfer *x);
+static void _i2c_bus_finish(i2c_bus *bus, i2c_bus_xfer *x, int rslt,
+			    i2c_bus_xfer **done);
+static uint64_t _i2c_bus_schedule(i2c_bus *bus, uint64_t now,
+				  i2c_bus_xfer **done);
+static void _i2c_bus_post(i2c_bus *bus, i2c_bus_xfer *done,
+			  uint64_t next);
+
+int i2c_bus_init(i2c_bus *bus, const i2c_bus_ops *ops, void *ctx)
+{
+	if (!bus || !ops || !ops->start || !ops->now_us) {
+		return I2C_BUS_E_NULL_PTR;
+	}
+
+	memset(bus, 0, sizeof(*bus));
+
+	bus->ops = ops;
+	bus->ctx = ctx;
+	bus->t_reset = _i2c_bus_now(bus);
+
+	return I2C_BUS_OK;
+}
+
+int i2c_bus_dev_add(i2c_bus *bus, i2c_bus_dev *dev, uint8_t addr,
+		    uint8_t prio)
+{
+	i2c_bus_dev *d;
+
+	if (!bus || !dev) {
+		return I2C_BUS_E_NULL_PTR;
+	}
+
+	_i2c_bus_lock(bus);
+
+	for (d = bus->devs; d; d = d->next) {
+		if (d == dev) {
+			break;
+		}
+	}
+
+	if (!d) {
+		memset(dev, 0, sizeof(*dev));
+		dev->bus = bus;
+		dev->next = bus->devs;
+		bus->devs = dev;
+	}
+
+	dev->addr = addr;
+	dev->prio = prio;
+
+	_i2c_bus_unlock(bus);
+
+	return I2C_BUS_OK;
+}
+
+void i2c_bus_dev_remove(i2c_bus_dev *dev)
+{
+	i2c_bus *bus;
+	i2c_bus_dev **d;
+
+	if (!dev || !dev->bus) {
+		return;
+	}
+
+	bus = dev->bus;
+
+	while (dev->head) {
+		i2c_bus_cancel(dev->head);
+	}
+
+	_i2c_bus_lock(bus);
+
+	for (d = &bus->devs; *d; d = &(*d)->next) {
+		if (*d == dev) {
+			*d = dev->next;
+			break;
+		}
+	}
+
+	if (bus->last == dev) {
+		bus->last = NULL;
+	}
+
+	dev->bus = NULL;
+	dev->next = NULL;
+
+	_i2c_bus_unlock(bus);
+}
+
+bool i2c_bus_xfer_claim(i2c_bus_dev *dev, i2c_bus_xfer *x)
+{
+	bool claimed = false;
+
+	if (!dev || !dev->bus || !x) {
+		return false;
+	}
+
+	_i2c_bus_lock(dev->bus);
+
+	if (x->state == I2C_BUS_XFER_FREE) {
+		x->state = I2C_BUS_XFER_CLAIMED;
+		claimed = true;
+	}
+
+	_i2c_bus_unlock(dev->bus);
+
+	return claimed;
+}
+
+int i2c_bus_xfer_set(i2c_bus_xfer *x, const uint8_t *wbuf, size_t wlen,
+		     uint8_t *rbuf, size_t rlen, uint32_t delay_us,
+		     i2c_bus_xfer_cb cb, void *ctx)
+{
+	if (!x || (wlen && !wbuf) || (rlen && !rbuf)) {
+		return I2C_BUS_E_NULL_PTR;
+	}
+
+	if (x->state != I2C_BUS_XFER_FREE &&
+	    x->state != I2C_BUS_XFER_CLAIMED) {
+		return I2C_BUS_E_BUSY;
+	}
+
+	if (wlen > I2C_BUS_XFER_MAX_LEN || rlen > I2C_BUS_XFER_MAX_LEN ||
+	    (wlen == 0 && rlen == 0)) {
+		return I2C_BUS_E_INVALID_LEN;
+	}
+
+	if (wlen) {
+		memcpy(x->wbuf, wbuf, wlen);
+	}
+
+	x->wlen = wlen;
+	x->rbuf = rbuf;
+	x->rlen = rlen;
+	x->delay_us = delay_us;
+	x->cb = cb;
+	x->ctx = ctx;
+
+	return I2C_BUS_OK;
+}
+
+int i2c_bus_submit(i2c_bus_dev *dev, i2c_bus_xfer *x)
+{
+	i2c_bus *bus;
+	i2c_bus_xfer *done = NULL;
+	uint64_t next;
+
+	if (!dev || !dev->bus || !x) {
+		return I2C_BUS_E_NULL_PTR;
+	}
+
+	bus = dev->bus;
+
+	_i2c_bus_lock(bus);
+
+	if (x->state != I2C_BUS_XFER_FREE &&
+	    x->state != I2C_BUS_XFER_CLAIMED) {
+		_i2c_bus_unlock(bus);
+		return I2C_BUS_E_BUSY;
+	}
+
+	x->dev = dev;
+	x->next = NULL;
+	x->rslt = I2C_BUS_OK;
+	x->state = I2C_BUS_XFER_QUEUED;
+	x->t_queued = _i2c_bus_now(bus);
+
+	if (dev->tail) {
+		dev->tail->next = x;
+	} else {
+		dev->head = x;
+	}
+
+	dev->tail = x;
+
+	next = _i2c_bus_schedule(bus, x->t_queued, &done);
+
+	_i2c_bus_unlock(bus);
+
+	_i2c_bus_post(bus, done, next);
+
+	return I2C_BUS_OK;
+}
+
+bool i2c_bus_xfer_busy(const i2c_bus_xfer *x)
+{
+	switch (x->state) {
+	case I2C_BUS_XFER_QUEUED:
+	case I2C_BUS_XFER_ACTIVE:
+	case I2C_BUS_XFER_WAIT:
+		return true;
+	default:
+		return false;
+	}
+}
+
+int i2c_bus_xfer_wait(i2c_bus_xfer *x, uint64_t timeout_us)
+{
+	i2c_bus *bus;
+	uint64_t start;
+	int rslt;
+
+	if (!x || !x->dev || !x->dev->bus) {
+		return I2C_BUS_E_NULL_PTR;
+	}
+
+	bus = x->dev->bus;
+	start = _i2c_bus_now(bus);
+
+	while (i2c_bus_xfer_busy(x)) {
+		/* Nothing else will start a delayed read phase */
+		if (!bus->ops->alarm) {
+			i2c_bus_poll(bus);
+		}
+
+		if (timeout_us &&
+		    _i2c_bus_now(bus) - start >= timeout_us) {
+			i2c_bus_cancel(x);
+		}
+	}
+
+	rslt = x->rslt;
+	x->state = I2C_BUS_XFER_FREE;
+
+	return rslt;
+}
+
+void i2c_bus_cancel(i2c_bus_xfer *x)
+{
+	i2c_bus *bus;
+	i2c_bus_xfer *done = NULL;
+	uint64_t now, next;
+
+	if (!x || !x->dev || !x->dev->bus) {
+		return;
+	}
+
+	bus = x->dev->bus;
+
+	_i2c_bus_lock(bus);
+
+	if (!i2c_bus_xfer_busy(x)) {
+		_i2c_bus_unlock(bus);
+		return;
+	}
+
+	now = _i2c_bus_now(bus);
+
+	if (bus->active == x) {
+		if (bus->ops->cancel) {
+			bus->ops->cancel(bus);
+		}
+
+		bus->stats.busy_us += now - bus->t_start;
+		x->dev->stats.busy_us += now - bus->t_start;
+		bus->active = NULL;
+	}
+
+	/* A cancelled transaction never calls back, so whoever
+	 * cancelled it is left to collect the result */
+	_i2c_bus_unlink(x);
+	++bus->stats.xfers;
+	++bus->stats.errors;
+	++x->dev->stats.xfers;
+	++x->dev->stats.errors;
+	x->rslt = I2C_BUS_E_TIMEOUT;
+	x->state = x->cb ? I2C_BUS_XFER_FREE : I2C_BUS_XFER_DONE;
+
+	next = _i2c_bus_schedule(bus, now, &done);
+
+	_i2c_bus_unlock(bus);
+
+	_i2c_bus_post(bus, done, next);
+}
+
+void i2c_bus_complete(i2c_bus *bus, int rslt)
+{
+	i2c_bus_xfer *x;
+	i2c_bus_xfer *done = NULL;
+	uint64_t now, next;
+
+	_i2c_bus_lock(bus);
+
+	x = bus->active;
+
+	if (!x) {
+		_i2c_bus_unlock(bus);
+		return;
+	}
+
+	now = _i2c_bus_now(bus);
+	bus->stats.busy_us += now - bus->t_start;
+	x->dev->stats.busy_us += now - bus->t_start;
+	bus->active = NULL;
+
+	/* A write followed by a delay releases the bus until the
+	 * read phase is due */
+	if (rslt == I2C_BUS_OK && bus->op == I2C_BUS_OP_WRITE &&
+	    x->rlen > 0) {
+		x->state = I2C_BUS_XFER_WAIT;
+		x->t_ready = now + x->delay_us;
+	} else {
+		_i2c_bus_finish(bus, x, rslt, &done);
+	}
+
+	next = _i2c_bus_schedule(bus, now, &done);
+
+	_i2c_bus_unlock(bus);
+
+	_i2c_bus_post(bus, done, next);
+}
+
+void i2c_bus_poll(i2c_bus *bus)
+{
+	i2c_bus_xfer *done = NULL;
+	uint64_t next;
+
+	_i2c_bus_lock(bus);
+	next = _i2c_bus_schedule(bus, _i2c_bus_now(bus), &done);
+	_i2c_bus_unlock(bus);
+
+	_i2c_bus_post(bus, done, next);
+}
+
+void i2c_bus_get_stats(i2c_bus *bus, i2c_bus_stats *s)
+{
+	_i2c_bus_lock(bus);
+	*s = bus->stats;
+	s->elapsed_us = _i2c_bus_now(bus) - bus->t_reset;
+	_i2c_bus_unlock(bus);
+}
+
+void i2c_bus_dev_get_stats(i2c_bus_dev *dev, i2c_bus_stats *s)
+{
+	_i2c_bus_lock(dev->bus);
+	*s = dev->stats;
+	s->elapsed_us = _i2c_bus_now(dev->bus) - dev->bus->t_reset;
+	_i2c_bus_unlock(dev->bus);
+}
+
+void i2c_bus_reset_stats(i2c_bus *bus)
+{
+	_i2c_bus_lock(bus);
+
+	memset(&bus->stats, 0, sizeof(bus->stats));
+
+	for (i2c_bus_dev *d = bus->devs; d; d = d->next) {
+		memset(&d->stats, 0, sizeof(d->stats));
+	}
+
+	/* Only count the rest of a phase already on the bus */
+	bus->t_reset = _i2c_bus_now(bus);
+	bus->t_start = bus->t_reset;
+
+	_i2c_bus_unlock(bus);
+}
+
+/*
+**********************************************************************
+*********************** INTERNAL FUNCTIONS ***************************
+**********************************************************************
+*/
+
+void _i2c_bus_lock(i2c_bus *bus)
+{
+	if (bus->ops->lock) {
+		bus->ops->lock(bus);
+	}
+}
+
+void _i2c_bus_unlock(i2c_bus *bus)
+{
+	if (bus->ops->unlock) {
+		bus->ops->unlock(bus);
+	}
+}
+
+uint64_t _i2c_bus_now(i2c_bus *bus)
+{
+	return bus->ops->now_us(bus);
+}
+
+void _i2c_bus_unlink(i2c_bus_xfer *x)
+{
+	i2c_bus_dev *dev = x->dev;
+	i2c_bus_xfer *prev = NULL;
+
+	for (i2c_bus_xfer *i = dev->head; i; i = i->next) {
+		if (i != x) {
+			prev = i;
+			continue;
+		}
+
+		if (prev) {
+			prev->next = x->next;
+		} else {
+			dev->head = x->next;
+		}
+
+		if (dev->tail == x) {
+			dev->tail = prev;
+		}
+
+		break;
+	}
+
+	x->next = NULL;
+}
+
+void _i2c_bus_finish(i2c_bus *bus, i2c_bus_xfer *x, int rslt,
+		     i2c_bus_xfer **done)
+{
+	_i2c_bus_unlink(x);
+
+	++bus->stats.xfers;
+	++x->dev->stats.xfers;
+
+	if (rslt != I2C_BUS_OK) {
+		++bus->stats.errors;
+		++x->dev->stats.errors;
+	}
+
+	x->rslt = rslt;
+
+	/* Without a callback the submitter owns the transaction until
+	 * it has collected the result. Callbacks are run once the bus
+	 * is unlocked, since they may submit more transactions. */
+	if (!x->cb) {
+		x->state = I2C_BUS_XFER_DONE;
+		return;
+	}
+
+	x->next = *done;
+	*done = x;
+}
+
+uint64_t _i2c_bus_schedule(i2c_bus *bus, uint64_t now,
+			   i2c_bus_xfer **done)
+{
+	for (;;) {
+		i2c_bus_dev *first, *d;
+		i2c_bus_xfer *best = NULL;
+		uint64_t next = I2C_BUS_NEVER;
+		i2c_bus_op op;
+
+		if (bus->active || !bus->devs) {
+			return I2C_BUS_NEVER;
+		}
+
+		/* Go around the devices starting after the last one
+		 * served, so devices of equal priority take turns */
+		first = bus->last && bus->last->next ?
+			bus->last->next : bus->devs;
+		d = first;
+
+		do {
+			i2c_bus_xfer *x = d->head;
+
+			if (x && x->state == I2C_BUS_XFER_WAIT &&
+			    x->t_ready > now) {
+				if (x->t_ready < next) {
+					next = x->t_ready;
+				}
+			} else if (x && (!best ||
+					 d->prio > best->dev->prio)) {
+				best = x;
+			}
+
+			d = d->next ? d->next : bus->devs;
+		} while (d != first);
+
+		if (!best) {
+			return next;
+		}
+
+		if (best->state == I2C_BUS_XFER_WAIT || best->wlen == 0) {
+			op = I2C_BUS_OP_READ;
+		} else if (best->rlen > 0 && best->delay_us == 0) {
+			op = I2C_BUS_OP_WRITE_READ;
+		} else {
+			op = I2C_BUS_OP_WRITE;
+		}
+
+		if (best->state == I2C_BUS_XFER_QUEUED) {
+			uint64_t q = now - best->t_queued;
+
+			bus->stats.queue_us += q;
+			best->dev->stats.queue_us += q;
+
+			if (q > bus->stats.queue_max_us) {
+				bus->stats.queue_max_us = q;
+			}
+
+			if (q > best->dev->stats.queue_max_us) {
+				best->dev->stats.queue_max_us = q;
+			}
+		}
+
+		bus->last = best->dev;
+		bus->active = best;
+		bus->op = op;
+		bus->t_start = now;
+		best->state = I2C_BUS_XFER_ACTIVE;
+
+		if (bus->ops->start(bus, best, op) == I2C_BUS_OK) {
+			return I2C_BUS_NEVER;
+		}
+
+		/* Backend refused, fail it and try the next one */
+		bus->active = NULL;
+		_i2c_bus_finish(bus, best, I2C_BUS_E_COMM, done);
+	}
+}
+
+void _i2c_bus_post(i2c_bus *bus, i2c_bus_xfer *done, uint64_t next)
+{
+	while (done) {
+		i2c_bus_xfer *x = done;
+		i2c_bus_xfer_cb cb = x->cb;
+		void *ctx = x->ctx;
+		int rslt = x->rslt;
+
+		done = x->next;
+		x->next = NULL;
+		x->state = I2C_BUS_XFER_FREE;
+
+		cb(x, rslt, ctx);
+	}
+
+	if (next != I2C_BUS_NEVER && bus->ops->alarm) {
+		bus->ops->alarm(bus, next);
+	}
+}
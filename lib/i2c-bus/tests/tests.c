@@ -0,0 +1,536 @@
+#include "i2c-bus.h"
+
+#include "munit.h"
+
+#include "string.h"
+
+/* 100 kHz bus, 9 clocks for each byte and its ACK */
+#define SIM_BIT_US	10
+#define SIM_BYTE_US	(9 * SIM_BIT_US)
+#define SIM_NEVER	UINT64_MAX
+#define SIM_LOG_LEN	64
+
+#define ARRAY_LEN(array) sizeof(array)/sizeof(array[0])
+
+/* Simulated bus with a virtual clock. Phases take as long as their
+ * bytes take to clock out, and only the listed addresses ACK. */
+typedef struct {
+	uint64_t now;
+	uint64_t done_at;
+	uint64_t alarm_at;
+	int rslt;
+	const uint8_t *present;
+	size_t npresent;
+	struct {
+		uint8_t addr;
+		i2c_bus_op op;
+		uint64_t t;
+	} log[SIM_LOG_LEN];
+	unsigned int nlog;
+} sim_bus;
+
+typedef struct {
+	sim_bus sim;
+	i2c_bus bus;
+	i2c_bus_dev devs[4];
+	i2c_bus_xfer xfers[4][2];
+} test_fixture;
+
+static int sim_start(i2c_bus *bus, i2c_bus_xfer *x, i2c_bus_op op)
+{
+	sim_bus *sim = (sim_bus*) bus->ctx;
+	size_t bytes;
+	bool ack = false;
+
+	for (size_t i = 0; i < sim->npresent; ++i) {
+		if (sim->present[i] == x->dev->addr) {
+			ack = true;
+		}
+	}
+
+	switch (op) {
+	case I2C_BUS_OP_WRITE:
+		bytes = 1 + x->wlen;
+		break;
+	case I2C_BUS_OP_READ:
+		bytes = 1 + x->rlen;
+		break;
+	default:
+		bytes = 2 + x->wlen + x->rlen;
+		break;
+	}
+
+	/* A missing device NACKs its address */
+	if (!ack) {
+		bytes = 1;
+	} else if (op != I2C_BUS_OP_WRITE) {
+		memset(x->rbuf, x->dev->addr, x->rlen);
+	}
+
+	if (sim->nlog < SIM_LOG_LEN) {
+		sim->log[sim->nlog].addr = x->dev->addr;
+		sim->log[sim->nlog].op = op;
+		sim->log[sim->nlog].t = sim->now;
+		++sim->nlog;
+	}
+
+	/* Start and stop conditions take about a bit each */
+	sim->done_at = sim->now + bytes * SIM_BYTE_US + 2 * SIM_BIT_US;
+	sim->rslt = ack ? I2C_BUS_OK : I2C_BUS_E_COMM;
+
+	return I2C_BUS_OK;
+}
+
+static void sim_cancel(i2c_bus *bus)
+{
+	((sim_bus*) bus->ctx)->done_at = SIM_NEVER;
+}
+
+static uint64_t sim_now_us(i2c_bus *bus)
+{
+	return ((sim_bus*) bus->ctx)->now;
+}
+
+static void sim_alarm(i2c_bus *bus, uint64_t at_us)
+{
+	((sim_bus*) bus->ctx)->alarm_at = at_us;
+}
+
+static const i2c_bus_ops sim_ops = {
+	.start = sim_start,
+	.cancel = sim_cancel,
+	.now_us = sim_now_us,
+	.alarm = sim_alarm,
+	.lock = NULL,
+	.unlock = NULL
+};
+
+/* Advance the clock from event to event until nothing is left, or
+ * until @p until if it comes first */
+static void sim_run(i2c_bus *bus, uint64_t until)
+{
+	sim_bus *sim = (sim_bus*) bus->ctx;
+
+	for (;;) {
+		uint64_t next = sim->done_at < sim->alarm_at ?
+			sim->done_at : sim->alarm_at;
+
+		if (next == SIM_NEVER || next > until) {
+			break;
+		}
+
+		sim->now = next;
+
+		if (sim->done_at == next) {
+			sim->done_at = SIM_NEVER;
+			i2c_bus_complete(bus, sim->rslt);
+		} else {
+			sim->alarm_at = SIM_NEVER;
+			i2c_bus_poll(bus);
+		}
+	}
+
+	if (until != SIM_NEVER && sim->now < until) {
+		sim->now = until;
+	}
+}
+
+static const uint8_t sim_present[] = {0x44, 0x59, 0x62, 0x77};
+
+static void *test_setup(const MunitParameter params[], void *user_data)
+{
+	test_fixture *f = munit_new(test_fixture);
+
+	memset(f, 0, sizeof(*f));
+
+	f->sim.done_at = SIM_NEVER;
+	f->sim.alarm_at = SIM_NEVER;
+	f->sim.present = sim_present;
+	f->sim.npresent = ARRAY_LEN(sim_present);
+
+	munit_assert_int(i2c_bus_init(&f->bus, &sim_ops, &f->sim), ==,
+			 I2C_BUS_OK);
+
+	return f;
+}
+
+static void test_tear_down(void *fixture)
+{
+	free(fixture);
+}
+
+/* A sensor that repeats the same command a number of times, each
+ * time from the completion callback of the last one */
+typedef struct {
+	const char *name;
+	uint8_t addr;
+	size_t wlen;
+	uint32_t delay_us;
+	size_t rlen;
+	unsigned int repeat;
+	unsigned int done;
+	int rslt;
+	uint8_t rbuf[16];
+} sim_sensor;
+
+static void sim_sensor_cb(i2c_bus_xfer *x, int rslt, void *ctx)
+{
+	sim_sensor *s = (sim_sensor*) ctx;
+	const uint8_t cmd[8] = {0};
+
+	s->rslt = rslt;
+
+	if (++s->done < s->repeat && rslt == I2C_BUS_OK) {
+		i2c_bus_xfer_set(x, cmd, s->wlen, s->rbuf, s->rlen,
+				 s->delay_us, sim_sensor_cb, s);
+		i2c_bus_submit(x->dev, x);
+	}
+}
+
+/* Time one command of the sensor would take on an otherwise idle
+ * bus */
+static uint64_t sim_sensor_us(const sim_sensor *s)
+{
+	uint64_t us = 0;
+
+	if (s->delay_us) {
+		us += (1 + s->wlen) * SIM_BYTE_US + 2 * SIM_BIT_US;
+		us += s->delay_us;
+		us += (1 + s->rlen) * SIM_BYTE_US + 2 * SIM_BIT_US;
+	} else {
+		us += (2 + s->wlen + s->rlen) * SIM_BYTE_US + 2 * SIM_BIT_US;
+	}
+
+	return us;
+}
+
+static MunitResult test_overlap(const MunitParameter params[],
+				void *fixture)
+{
+	test_fixture *f = (test_fixture*) fixture;
+	const uint8_t cmd[8] = {0};
+	i2c_bus_stats st;
+	uint64_t serial_us = 0, chain_max_us = 0;
+
+	/* Long conversions, a short command execution time and a
+	 * plain register read */
+	sim_sensor sensors[] = {
+		{"SGP4x", 0x59, 8, 30000, 3, 2},
+		{"SHT4x", 0x44, 1, 8300, 6, 4},
+		{"SCD4x", 0x62, 2, 1000, 9, 4},
+		{"BME680", 0x77, 1, 0, 15, 8}
+	};
+
+	for (unsigned int i = 0; i < ARRAY_LEN(sensors); ++i) {
+		sim_sensor *s = &sensors[i];
+		uint64_t chain = s->repeat * sim_sensor_us(s);
+
+		serial_us += chain;
+
+		if (chain > chain_max_us) {
+			chain_max_us = chain;
+		}
+
+		i2c_bus_dev_add(&f->bus, &f->devs[i], s->addr, 1);
+
+		munit_assert_int(i2c_bus_xfer_set(&f->xfers[i][0], cmd,
+						  s->wlen, s->rbuf,
+						  s->rlen, s->delay_us,
+						  sim_sensor_cb, s),
+				 ==, I2C_BUS_OK);
+		munit_assert_int(i2c_bus_submit(&f->devs[i],
+						&f->xfers[i][0]),
+				 ==, I2C_BUS_OK);
+	}
+
+	sim_run(&f->bus, SIM_NEVER);
+	i2c_bus_get_stats(&f->bus, &st);
+
+	for (unsigned int i = 0; i < ARRAY_LEN(sensors); ++i) {
+		i2c_bus_stats ds;
+
+		munit_assert_uint(sensors[i].done, ==, sensors[i].repeat);
+		munit_assert_int(sensors[i].rslt, ==, I2C_BUS_OK);
+		munit_assert_uint8(sensors[i].rbuf[0], ==,
+				   sensors[i].addr);
+
+		i2c_bus_dev_get_stats(&f->devs[i], &ds);
+		munit_logf(MUNIT_LOG_INFO,
+			   "%-6s bus %6lu us, queued %5lu us (max %lu us)",
+			   sensors[i].name, (unsigned long) ds.busy_us,
+			   (unsigned long) ds.queue_us,
+			   (unsigned long) ds.queue_max_us);
+	}
+
+	munit_logf(MUNIT_LOG_INFO,
+		   "finished in %lu us, %lu us if serialized, "
+		   "bus utilization %.1f%%",
+		   (unsigned long) st.elapsed_us,
+		   (unsigned long) serial_us,
+		   100.0 * st.busy_us / st.elapsed_us);
+
+	/* Conversions overlap, so the longest chain of commands sets
+	 * the pace and the rest fits in between */
+	munit_assert_uint64(st.elapsed_us, <, serial_us);
+	munit_assert_uint64(st.elapsed_us, >=, chain_max_us);
+	munit_assert_uint64(st.elapsed_us, <=,
+			    chain_max_us + st.busy_us);
+	munit_assert_uint32(st.xfers, ==, 2 + 4 + 4 + 8);
+	munit_assert_uint32(st.errors, ==, 0);
+
+	return MUNIT_OK;
+}
+
+static MunitResult test_priority(const MunitParameter params[],
+				 void *fixture)
+{
+	test_fixture *f = (test_fixture*) fixture;
+	const uint8_t cmd[2] = {0};
+	uint8_t rbuf[3][2];
+	sim_bus *sim = &f->sim;
+
+	i2c_bus_dev_add(&f->bus, &f->devs[0], 0x44, 1);
+	i2c_bus_dev_add(&f->bus, &f->devs[1], 0x62, 5);
+
+	/* First one takes the idle bus, the higher priority device
+	 * goes next even though it queued last */
+	for (unsigned int i = 0; i < 2; ++i) {
+		i2c_bus_xfer_set(&f->xfers[0][i], cmd, 1, rbuf[i], 2, 0,
+				 NULL, NULL);
+		i2c_bus_submit(&f->devs[0], &f->xfers[0][i]);
+	}
+
+	i2c_bus_xfer_set(&f->xfers[1][0], cmd, 1, rbuf[2], 2, 0, NULL,
+			 NULL);
+	i2c_bus_submit(&f->devs[1], &f->xfers[1][0]);
+
+	sim_run(&f->bus, SIM_NEVER);
+
+	munit_assert_uint(sim->nlog, ==, 3);
+	munit_assert_uint8(sim->log[0].addr, ==, 0x44);
+	munit_assert_uint8(sim->log[1].addr, ==, 0x62);
+	munit_assert_uint8(sim->log[2].addr, ==, 0x44);
+
+	for (unsigned int i = 0; i < 2; ++i) {
+		munit_assert_int(i2c_bus_xfer_wait(&f->xfers[0][i], 0), ==,
+				 I2C_BUS_OK);
+	}
+
+	munit_assert_int(i2c_bus_xfer_wait(&f->xfers[1][0], 0), ==,
+			 I2C_BUS_OK);
+	munit_assert_int(f->xfers[1][0].state, ==, I2C_BUS_XFER_FREE);
+
+	return MUNIT_OK;
+}
+
+static MunitResult test_device_order(const MunitParameter params[],
+				     void *fixture)
+{
+	test_fixture *f = (test_fixture*) fixture;
+	const uint8_t cmd[2] = {0};
+	uint8_t rbuf[3][9];
+	sim_bus *sim = &f->sim;
+	unsigned int a = 0, b = 0;
+
+	i2c_bus_dev_add(&f->bus, &f->devs[0], 0x62, 1);
+	i2c_bus_dev_add(&f->bus, &f->devs[1], 0x77, 1);
+
+	/* The second command of a device must wait for the read phase
+	 * of the first, while the other device uses the bus */
+	for (unsigned int i = 0; i < 2; ++i) {
+		i2c_bus_xfer_set(&f->xfers[0][i], cmd, 2, rbuf[i], 9, 1000,
+				 NULL, NULL);
+		i2c_bus_submit(&f->devs[0], &f->xfers[0][i]);
+	}
+
+	i2c_bus_xfer_set(&f->xfers[1][0], cmd, 1, rbuf[2], 9, 0, NULL,
+			 NULL);
+	i2c_bus_submit(&f->devs[1], &f->xfers[1][0]);
+
+	sim_run(&f->bus, SIM_NEVER);
+
+	munit_assert_uint(sim->nlog, ==, 5);
+	munit_assert_uint8(sim->log[0].addr, ==, 0x62);
+	munit_assert_uint8(sim->log[1].addr, ==, 0x77);
+
+	for (unsigned int i = 0; i < sim->nlog; ++i) {
+		if (sim->log[i].addr == 0x62) {
+			munit_assert_int(sim->log[i].op, ==,
+					 a % 2 ? I2C_BUS_OP_READ :
+					 I2C_BUS_OP_WRITE);
+			++a;
+		} else {
+			munit_assert_int(sim->log[i].op, ==,
+					 I2C_BUS_OP_WRITE_READ);
+			++b;
+		}
+	}
+
+	munit_assert_uint(a, ==, 4);
+	munit_assert_uint(b, ==, 1);
+
+	/* Delay is measured from the end of the write phase */
+	munit_assert_uint64(sim->log[2].t, >=, sim->log[0].t + 1000);
+
+	return MUNIT_OK;
+}
+
+static MunitResult test_round_robin(const MunitParameter params[],
+				    void *fixture)
+{
+	test_fixture *f = (test_fixture*) fixture;
+	const uint8_t cmd[2] = {0};
+	sim_bus *sim = &f->sim;
+
+	i2c_bus_dev_add(&f->bus, &f->devs[0], 0x44, 2);
+	i2c_bus_dev_add(&f->bus, &f->devs[1], 0x59, 2);
+
+	for (unsigned int i = 0; i < 2; ++i) {
+		for (unsigned int j = 0; j < 2; ++j) {
+			i2c_bus_xfer_set(&f->xfers[i][j], cmd, 2, NULL, 0,
+					 0, NULL, NULL);
+			i2c_bus_submit(&f->devs[i], &f->xfers[i][j]);
+		}
+	}
+
+	sim_run(&f->bus, SIM_NEVER);
+
+	/* Devices of equal priority take turns */
+	munit_assert_uint(sim->nlog, ==, 4);
+
+	for (unsigned int i = 1; i < sim->nlog; ++i) {
+		munit_assert_uint8(sim->log[i].addr, !=,
+				   sim->log[i - 1].addr);
+	}
+
+	return MUNIT_OK;
+}
+
+static MunitResult test_errors(const MunitParameter params[],
+			       void *fixture)
+{
+	test_fixture *f = (test_fixture*) fixture;
+	const uint8_t cmd[2] = {0};
+	uint8_t rbuf[2][9];
+	i2c_bus_stats st;
+
+	/* Nothing ACKs address 0x10 */
+	i2c_bus_dev_add(&f->bus, &f->devs[0], 0x10, 1);
+	i2c_bus_dev_add(&f->bus, &f->devs[1], 0x62, 1);
+
+	munit_assert_int(i2c_bus_xfer_set(&f->xfers[0][0], cmd, 2, NULL,
+					  I2C_BUS_XFER_MAX_LEN + 1, 0,
+					  NULL, NULL),
+			 ==, I2C_BUS_E_NULL_PTR);
+	munit_assert_int(i2c_bus_xfer_set(&f->xfers[0][0], cmd, 2,
+					  rbuf[0],
+					  I2C_BUS_XFER_MAX_LEN + 1, 0,
+					  NULL, NULL),
+			 ==, I2C_BUS_E_INVALID_LEN);
+
+	i2c_bus_xfer_set(&f->xfers[0][0], cmd, 2, rbuf[0], 9, 0, NULL,
+			 NULL);
+	i2c_bus_submit(&f->devs[0], &f->xfers[0][0]);
+
+	munit_assert_int(i2c_bus_submit(&f->devs[0], &f->xfers[0][0]),
+			 ==, I2C_BUS_E_BUSY);
+
+	/* Cancelled while waiting out its delay */
+	i2c_bus_xfer_set(&f->xfers[1][0], cmd, 2, rbuf[1], 9, 5000, NULL,
+			 NULL);
+	i2c_bus_submit(&f->devs[1], &f->xfers[1][0]);
+
+	sim_run(&f->bus, 2000);
+
+	munit_assert_int(f->xfers[1][0].state, ==, I2C_BUS_XFER_WAIT);
+	i2c_bus_cancel(&f->xfers[1][0]);
+
+	sim_run(&f->bus, SIM_NEVER);
+
+	munit_assert_int(i2c_bus_xfer_wait(&f->xfers[0][0], 0), ==,
+			 I2C_BUS_E_COMM);
+	munit_assert_int(i2c_bus_xfer_wait(&f->xfers[1][0], 0), ==,
+			 I2C_BUS_E_TIMEOUT);
+
+	/* The bus is still usable afterwards */
+	i2c_bus_xfer_set(&f->xfers[1][0], cmd, 2, rbuf[1], 9, 1000, NULL,
+			 NULL);
+	i2c_bus_submit(&f->devs[1], &f->xfers[1][0]);
+	sim_run(&f->bus, SIM_NEVER);
+
+	munit_assert_int(i2c_bus_xfer_wait(&f->xfers[1][0], 0), ==,
+			 I2C_BUS_OK);
+
+	i2c_bus_get_stats(&f->bus, &st);
+	munit_assert_uint32(st.xfers, ==, 3);
+	munit_assert_uint32(st.errors, ==, 2);
+
+	i2c_bus_dev_remove(&f->devs[0]);
+	munit_assert_ptr_equal(f->bus.devs, &f->devs[1]);
+
+	return MUNIT_OK;
+}
+
+static MunitTest i2c_bus_tests[] = {
+	{
+		.name = "/overlap-test",
+		.test = test_overlap,
+		.setup = test_setup,
+		.tear_down = test_tear_down,
+		.options = MUNIT_TEST_OPTION_NONE,
+		.parameters = NULL
+	},
+	{
+		.name = "/priority-test",
+		.test = test_priority,
+		.setup = test_setup,
+		.tear_down = test_tear_down,
+		.options = MUNIT_TEST_OPTION_NONE,
+		.parameters = NULL
+	},
+	{
+		.name = "/device-order-test",
+		.test = test_device_order,
+		.setup = test_setup,
+		.tear_down = test_tear_down,
+		.options = MUNIT_TEST_OPTION_NONE,
+		.parameters = NULL
+	},
+	{
+		.name = "/round-robin-test",
+		.test = test_round_robin,
+		.setup = test_setup,
+		.tear_down = test_tear_down,
+		.options = MUNIT_TEST_OPTION_NONE,
+		.parameters = NULL
+	},
+	{
+		.name = "/error-test",
+		.test = test_errors,
+		.setup = test_setup,
+		.tear_down = test_tear_down,
+		.options = MUNIT_TEST_OPTION_NONE,
+		.parameters = NULL
+	},
+	{
+		.name = NULL,
+		.test = NULL,
+		.setup = NULL,
+		.tear_down = NULL,
+		.options = MUNIT_TEST_OPTION_NONE,
+		.parameters = NULL
+	}
+};
+
+static const MunitSuite i2c_bus_test_suite = {
+	"/i2c-bus-suite",
+	i2c_bus_tests,
+	NULL,
+	1,
+	MUNIT_SUITE_OPTION_NONE
+};
+
+int main(int argc, char *const argv[])
+{
+	return munit_suite_main(&i2c_bus_test_suite, NULL, argc, argv);
+}
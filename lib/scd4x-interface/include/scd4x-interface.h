@@ -0,0 +1,150 @@
+/**
+ * @file scd4x-interface.h
+ * @author Tyler J. Anderson
+ * @brief Pico interface driver for the Sensirion SCD4x CO2 sensor
+ *
+ * The sensor runs in periodic measurement mode and produces a new
+ * measurement every 5 s on its own. Reading it takes two commands,
+ * each with a 1 ms execution time before the response can be read,
+ * which are queued on the shared I2C bus so other devices can use
+ * the bus in the meantime.
+ */
+
+#ifndef SCD4X_INTERFACE_H
+#define SCD4X_INTERFACE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "i2c-bus.h"
+
+#include "hardware/i2c.h"
+
+/** @brief Fixed I2C address of all SCD4x variants */
+#define SCD4X_I2C_ADDR 0x62
+
+/* Bus scheduling priority against other devices on the same bus */
+#ifndef SCD4X_INTERFACE_PRIO
+#define SCD4X_INTERFACE_PRIO 1
+#endif
+
+/* Fast mode, the most the sensor supports, to keep its transfers
+ * short on a shared bus */
+#ifndef SCD4X_INTERFACE_BAUD
+#define SCD4X_INTERFACE_BAUD 400000
+#endif
+
+/* Timeout of each command on the bus, including its wait for the bus */
+#ifndef SCD4X_INTERFACE_TIMEOUT_US
+#define SCD4X_INTERFACE_TIMEOUT_US 100000
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* #ifdef __cplusplus */
+
+	/**
+	 * @brief Return codes, warnings are >0 and errors <0
+	 */
+	typedef enum {
+		SCD4X_OK		= 0,
+		SCD4X_W_NO_NEW_DATA	= 1,
+		SCD4X_E_NULL_PTR	= -1,
+		SCD4X_E_COMM_FAIL	= -2,
+		SCD4X_E_CRC		= -3,
+		SCD4X_E_BUSY		= -4,
+		SCD4X_E_TIMEOUT		= -5
+	} scd4x_err;
+
+	/**
+	 * @brief Progress of a measurement read
+	 */
+	typedef enum {
+		SCD4X_STATE_IDLE,
+		SCD4X_STATE_CHECK, /**< @brief Checking for new data */
+		SCD4X_STATE_READ, /**< @brief Reading the measurement */
+		SCD4X_STATE_DONE /**< @brief Ready to be collected */
+	} scd4x_state;
+
+	/**
+	 * @brief Measurement of the sensor
+	 */
+	typedef struct {
+		uint16_t co2; /**< @brief CO2 in ppm */
+		float temperature; /**< @brief Temperature in degC */
+		float humidity; /**< @brief Relative humidity in % */
+	} scd4x_data;
+
+	/**
+	 * @brief SCD4x interface configuration struct
+	 *
+	 * Fill out @p i2c before calling @ref scd4x_init, NULL
+	 * selects the default I2C block.
+	 */
+	typedef struct scd4x_intf_node {
+		i2c_inst_t *i2c;
+		uint8_t addr;
+		i2c_bus *bus; /**< @brief Shared bus the sensor is on */
+		i2c_bus_dev dev;
+		i2c_bus_xfer xfer;
+		scd4x_state state;
+		int8_t rslt; /**< @brief Result of the last read */
+		uint64_t deadline; /**< @brief End of the command, in us */
+		uint8_t rbuf[9];
+	} scd4x_intf;
+
+	/**
+	 * @brief Set up the bus and start periodic measurements
+	 *
+	 * Blocks for about 500 ms while any measurement already
+	 * running is stopped. The first measurement is available
+	 * 5 s later.
+	 */
+	int8_t scd4x_init(scd4x_intf *intf, uint8_t addr);
+
+	/**
+	 * @brief Queue a read of the latest measurement
+	 */
+	int8_t scd4x_start(scd4x_intf *intf);
+
+	/**
+	 * @brief Advance a read started by @ref scd4x_start
+	 *
+	 * A command still on the bus after
+	 * @ref SCD4X_INTERFACE_TIMEOUT_US is cancelled, and the read
+	 * ends with SCD4X_E_TIMEOUT.
+	 *
+	 * @return true while the read is still in progress
+	 */
+	bool scd4x_busy(scd4x_intf *intf);
+
+	/**
+	 * @brief Abandon a read in progress, so a new one can start
+	 */
+	void scd4x_cancel(scd4x_intf *intf);
+
+	/**
+	 * @brief Get the measurement of a finished read
+	 *
+	 * @return SCD4X_OK with @p d filled out,
+	 * SCD4X_W_NO_NEW_DATA if there was no new measurement since
+	 * the last read, or <0 on error
+	 */
+	int8_t scd4x_collect(scd4x_intf *intf, scd4x_data *d);
+
+	/**
+	 * @brief Stop measurements and release the bus
+	 */
+	int8_t scd4x_deinit(scd4x_intf *intf);
+
+	/**
+	 * @brief Sensirion CRC-8 of a data word
+	 */
+	uint8_t scd4x_crc(const uint8_t *data, size_t len);
+
+#ifdef __cplusplus
+}
+#endif /* #ifdef __cplusplus */
+
+#endif /* #ifndef SCD4X_INTERFACE_H */
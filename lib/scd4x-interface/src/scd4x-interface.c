@@ -0,0 +1,314 @@
+/**
+ * @file scd4x-interface.c
+ * @author Tyler J. Anderson
+ * @brief Pico interface driver for the Sensirion SCD4x CO2 sensor
+ */
+
+#include "scd4x-interface.h"
+#include "i2c-bus-pico.h"
+
+#include "pico/stdlib.h"
+
+/* Commands used from the SCD4x datasheet */
+#define SCD4X_CMD_START_PERIODIC	0x21b1
+#define SCD4X_CMD_READ_MEASUREMENT	0xec05
+#define SCD4X_CMD_STOP_PERIODIC		0x3f86
+#define SCD4X_CMD_GET_DATA_READY	0xe4b8
+
+/* Time before the response of a command can be read */
+#define SCD4X_CMD_EXEC_US		1000
+#define SCD4X_STOP_PERIODIC_MS		500
+
+#define SCD4X_DATA_READY_MASK		0x07ff
+
+#define SCD4X_CRC_POLY			0x31
+#define SCD4X_CRC_INIT			0xff
+
+static int _scd4x_cmd(scd4x_intf *intf, uint16_t cmd, size_t rlen);
+static int _scd4x_cmd_sync(scd4x_intf *intf, uint16_t cmd);
+static int8_t _scd4x_words(const uint8_t *buf, uint16_t *words,
+			   size_t nwords);
+static void _scd4x_finish(scd4x_intf *intf, int8_t rslt);
+static bool _scd4x_pending(scd4x_intf *intf);
+static int8_t _scd4x_bus_err(int ret);
+
+int8_t scd4x_init(scd4x_intf *intf, uint8_t addr)
+{
+	if (!intf) {
+		return SCD4X_E_NULL_PTR;
+	}
+
+	if (!intf->i2c) {
+		intf->i2c = i2c_default;
+	}
+
+	intf->addr = addr;
+	intf->bus = i2c_bus_pico_init(intf->i2c, SCD4X_INTERFACE_BAUD);
+	i2c_bus_dev_add(intf->bus, &intf->dev, addr,
+			SCD4X_INTERFACE_PRIO);
+
+	intf->xfer.state = I2C_BUS_XFER_FREE;
+	intf->state = SCD4X_STATE_IDLE;
+	intf->rslt = SCD4X_OK;
+
+	/* The sensor ignores most commands while measuring, and may
+	 * still be measuring after a reset of the MCU */
+	if (_scd4x_cmd_sync(intf, SCD4X_CMD_STOP_PERIODIC) != I2C_BUS_OK) {
+		return SCD4X_E_COMM_FAIL;
+	}
+
+	sleep_ms(SCD4X_STOP_PERIODIC_MS);
+
+	if (_scd4x_cmd_sync(intf, SCD4X_CMD_START_PERIODIC)
+	    != I2C_BUS_OK) {
+		return SCD4X_E_COMM_FAIL;
+	}
+
+	return SCD4X_OK;
+}
+
+int8_t scd4x_start(scd4x_intf *intf)
+{
+	if (!intf || !intf->bus) {
+		return SCD4X_E_NULL_PTR;
+	}
+
+	if (intf->state == SCD4X_STATE_CHECK ||
+	    intf->state == SCD4X_STATE_READ) {
+		return SCD4X_E_BUSY;
+	}
+
+	/* Reading a measurement that is not ready gives an error, so
+	 * check first */
+	if (_scd4x_cmd(intf, SCD4X_CMD_GET_DATA_READY, 3) != I2C_BUS_OK) {
+		_scd4x_finish(intf, SCD4X_E_COMM_FAIL);
+		return SCD4X_E_COMM_FAIL;
+	}
+
+	intf->state = SCD4X_STATE_CHECK;
+	intf->rslt = SCD4X_OK;
+
+	return SCD4X_OK;
+}
+
+bool scd4x_busy(scd4x_intf *intf)
+{
+	uint16_t status;
+	int8_t ret;
+
+	switch (intf->state) {
+	case SCD4X_STATE_CHECK:
+		if (_scd4x_pending(intf)) {
+			return true;
+		}
+
+		ret = _scd4x_bus_err(i2c_bus_xfer_wait(&intf->xfer, 0));
+
+		if (ret != SCD4X_OK) {
+			_scd4x_finish(intf, ret);
+			return false;
+		}
+
+		ret = _scd4x_words(intf->rbuf, &status, 1);
+
+		if (ret != SCD4X_OK) {
+			_scd4x_finish(intf, ret);
+			return false;
+		}
+
+		if (!(status & SCD4X_DATA_READY_MASK)) {
+			_scd4x_finish(intf, SCD4X_W_NO_NEW_DATA);
+			return false;
+		}
+
+		if (_scd4x_cmd(intf, SCD4X_CMD_READ_MEASUREMENT, 9)
+		    != I2C_BUS_OK) {
+			_scd4x_finish(intf, SCD4X_E_COMM_FAIL);
+			return false;
+		}
+
+		intf->state = SCD4X_STATE_READ;
+
+		return true;
+
+	case SCD4X_STATE_READ:
+		if (_scd4x_pending(intf)) {
+			return true;
+		}
+
+		_scd4x_finish(intf, _scd4x_bus_err(
+				      i2c_bus_xfer_wait(&intf->xfer, 0)));
+
+		return false;
+
+	default:
+		return false;
+	}
+}
+
+void scd4x_cancel(scd4x_intf *intf)
+{
+	if (!intf || (intf->state != SCD4X_STATE_CHECK &&
+		      intf->state != SCD4X_STATE_READ)) {
+		return;
+	}
+
+	i2c_bus_cancel(&intf->xfer);
+	i2c_bus_xfer_wait(&intf->xfer, 0);
+	intf->state = SCD4X_STATE_IDLE;
+	intf->rslt = SCD4X_E_TIMEOUT;
+}
+
+int8_t scd4x_collect(scd4x_intf *intf, scd4x_data *d)
+{
+	uint16_t words[3];
+	int8_t ret;
+
+	if (!intf || !d) {
+		return SCD4X_E_NULL_PTR;
+	}
+
+	if (intf->state != SCD4X_STATE_DONE) {
+		return SCD4X_E_BUSY;
+	}
+
+	intf->state = SCD4X_STATE_IDLE;
+
+	if (intf->rslt != SCD4X_OK) {
+		return intf->rslt;
+	}
+
+	ret = _scd4x_words(intf->rbuf, words, 3);
+
+	if (ret != SCD4X_OK) {
+		return ret;
+	}
+
+	d->co2 = words[0];
+	d->temperature = -45.0f + 175.0f * words[1] / 65535.0f;
+	d->humidity = 100.0f * words[2] / 65535.0f;
+
+	return SCD4X_OK;
+}
+
+int8_t scd4x_deinit(scd4x_intf *intf)
+{
+	if (!intf || !intf->bus) {
+		return SCD4X_E_NULL_PTR;
+	}
+
+	/* Stop measuring to save power, nothing to do if it fails */
+	i2c_bus_cancel(&intf->xfer);
+	i2c_bus_xfer_wait(&intf->xfer, 0);
+	_scd4x_cmd_sync(intf, SCD4X_CMD_STOP_PERIODIC);
+
+	i2c_bus_dev_remove(&intf->dev);
+	i2c_bus_pico_deinit(intf->i2c);
+	intf->bus = NULL;
+	intf->state = SCD4X_STATE_IDLE;
+
+	return SCD4X_OK;
+}
+
+uint8_t scd4x_crc(const uint8_t *data, size_t len)
+{
+	uint8_t crc = SCD4X_CRC_INIT;
+
+	for (size_t i = 0; i < len; ++i) {
+		crc ^= data[i];
+
+		for (unsigned int b = 0; b < 8; ++b) {
+			crc = crc & 0x80 ? (crc << 1) ^ SCD4X_CRC_POLY :
+				crc << 1;
+		}
+	}
+
+	return crc;
+}
+
+/*
+**********************************************************************
+*********************** INTERNAL FUNCTIONS ***************************
+**********************************************************************
+*/
+
+int _scd4x_cmd(scd4x_intf *intf, uint16_t cmd, size_t rlen)
+{
+	const uint8_t buf[2] = {cmd >> 8, cmd & 0xff};
+	int ret;
+
+	/* Commands with a response need time to execute, during
+	 * which the bus is free for other devices */
+	ret = i2c_bus_xfer_set(&intf->xfer, buf, sizeof(buf),
+			       rlen ? intf->rbuf : NULL, rlen,
+			       rlen ? SCD4X_CMD_EXEC_US : 0, NULL, NULL);
+
+	if (ret != I2C_BUS_OK) {
+		return ret;
+	}
+
+	intf->deadline = time_us_64() + SCD4X_INTERFACE_TIMEOUT_US;
+
+	return i2c_bus_submit(&intf->dev, &intf->xfer);
+}
+
+int _scd4x_cmd_sync(scd4x_intf *intf, uint16_t cmd)
+{
+	int ret = _scd4x_cmd(intf, cmd, 0);
+
+	if (ret != I2C_BUS_OK) {
+		return ret;
+	}
+
+	return i2c_bus_xfer_wait(&intf->xfer, SCD4X_INTERFACE_TIMEOUT_US);
+}
+
+int8_t _scd4x_words(const uint8_t *buf, uint16_t *words, size_t nwords)
+{
+	/* Each word is sent MSB first and followed by its CRC */
+	for (size_t i = 0; i < nwords; ++i) {
+		const uint8_t *w = &buf[3 * i];
+
+		if (scd4x_crc(w, 2) != w[2]) {
+			return SCD4X_E_CRC;
+		}
+
+		words[i] = ((uint16_t) w[0] << 8) | w[1];
+	}
+
+	return SCD4X_OK;
+}
+
+void _scd4x_finish(scd4x_intf *intf, int8_t rslt)
+{
+	intf->rslt = rslt;
+	intf->state = SCD4X_STATE_DONE;
+}
+
+bool _scd4x_pending(scd4x_intf *intf)
+{
+	if (!i2c_bus_xfer_busy(&intf->xfer)) {
+		return false;
+	}
+
+	if (time_us_64() < intf->deadline) {
+		return true;
+	}
+
+	/* Finishes the transaction with I2C_BUS_E_TIMEOUT */
+	i2c_bus_cancel(&intf->xfer);
+
+	return false;
+}
+
+int8_t _scd4x_bus_err(int ret)
+{
+	switch (ret) {
+	case I2C_BUS_OK:
+		return SCD4X_OK;
+	case I2C_BUS_E_TIMEOUT:
+		return SCD4X_E_TIMEOUT;
+	default:
+		return SCD4X_E_COMM_FAIL;
+	}
+}
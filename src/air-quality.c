@@ -1,11 +1,13 @@
-#include "bme680-interface.h"
-#include "pm2_5-interface.h"
-#include <pm2_5-error.h>
+#include "aq-sensor.h"
+#include "aq-sensors.h"
 #include "esp-at-modem.h"
 #include "ws2812.pio.h"
 #include "debugmsg.h"
 #include "aq-error-state.h"
 #include "aq-stdio.h"
+#include "aq-http.h"
+#include "aq-ctl.h"
+#include "aq-sub.h"
 #include "pico/multicore.h"
 
 #include <stdint.h>
@@ -14,7 +16,6 @@
 #include <stdarg.h>
 
 #include "pico/stdlib.h"
-#include "hardware/adc.h"
 
 #ifndef AIR_QUALITY_INFO_LED_PIN
 #define AIR_QUALITY_INFO_LED_PIN 16
@@ -40,10 +41,6 @@
 #define AIR_QUALITY_ADC_BATT_ADC_CH 2
 #endif
 
-#ifndef AIR_QUALITY_BATT_LOW_V
-#define AIR_QUALITY_BATT_LOW_V ((double) 3.60)
-#endif
-
 #ifndef AIR_QUALITY_WIFI_TX_PIN
 #define AIR_QUALITY_WIFI_TX_PIN 10
 #endif
@@ -64,10 +61,17 @@
 #define AIR_QUALITY_WIFI_PIO pio1
 #endif
 
+/* Rate the module boots with, a faster one up to ESP_AT_BAUD_MAX is
+ * negotiated at init */
 #ifndef AIR_QUALITY_WIFI_BAUD
 #define AIR_QUALITY_WIFI_BAUD 115200
 #endif
 
+/* Define both to wire the module with RTS/CTS flow control, its RTS
+ * goes to the CTS pin and its CTS to the RTS pin */
+/* #define AIR_QUALITY_WIFI_CTS_PIN 14 */
+/* #define AIR_QUALITY_WIFI_RTS_PIN 15 */
+
 #ifndef AIR_QUALITY_WIFI_TX_SM
 #define AIR_QUALITY_WIFI_TX_SM 0
 #endif
@@ -76,6 +80,29 @@
 #define AIR_QUALITY_WIFI_RX_SM 1
 #endif
 
+/* Sensor instances of the board. Each entry is an initializer for
+ * the context struct of the driver, so a board with more sensors can
+ * list them here without changes to main() */
+#ifndef AIR_QUALITY_BME680_SENSORS
+#define AIR_QUALITY_BME680_SENSORS {NULL, BME68X_I2C_ADDR_LOW}
+#endif
+
+#ifndef AIR_QUALITY_PM2_5_SENSORS
+#define AIR_QUALITY_PM2_5_SENSORS				\
+	{AIR_QUALITY_PM2_5_UART, AIR_QUALITY_PM2_5_TX_PIN,	\
+	 AIR_QUALITY_PM2_5_RX_PIN}
+#endif
+
+/* Optional CO2 sensor, sharing the I2C bus with the BME680 */
+#if defined(AIR_QUALITY_SCD4X) && !defined(AIR_QUALITY_SCD4X_SENSORS)
+#define AIR_QUALITY_SCD4X_SENSORS {NULL, SCD4X_I2C_ADDR}
+#endif
+
+#ifndef AIR_QUALITY_BATT_SENSORS
+#define AIR_QUALITY_BATT_SENSORS				\
+	{AIR_QUALITY_ADC_BATT_GPIO_PIN, AIR_QUALITY_ADC_BATT_ADC_CH}
+#endif
+
 #ifndef PICO_BOARD
 #define PICO_BOARD "unknown"
 #endif
@@ -99,18 +126,23 @@ static esp_at_cfg aq_wifi_cfg;
 
 static esp_at_status aq_wifi_status;
 
-/** @brief Print out data from environmental sensors as json string
- * @p d Data struct from bme68x vendor library
- */
-void air_quality_print_data(struct bme68x_data *d, uint32_t millis);
+static aq_batt_ctx aq_batt[] = { AIR_QUALITY_BATT_SENSORS };
 
-static void aq_bme680_handle_error(int8_t i_errno, aq_status *s);
+static aq_bme680_ctx aq_bme680[] = { AIR_QUALITY_BME680_SENSORS };
 
-static void aq_pm2_5_handle_error(int8_t i_errno, aq_status *s);
+static aq_pm2_5_ctx aq_pm2_5[] = { AIR_QUALITY_PM2_5_SENSORS };
+
+#ifdef AIR_QUALITY_SCD4X_SENSORS
+static aq_scd4x_ctx aq_scd4x[] = { AIR_QUALITY_SCD4X_SENSORS };
+#endif
+
+static void aq_register_sensors();
 
 static void aq_wifi_set_flags(aq_status *s);
 
-static uint16_t aq_abrev_netmask(const char *nm);
+static void aq_print_json(const aq_status *s);
+
+static void aq_print_csv(aq_ctl_settings *settings, const aq_status *s);
 
 /*
 **********************************************************************
@@ -118,210 +150,44 @@ static uint16_t aq_abrev_netmask(const char *nm);
 **********************************************************************
 */
 
-void air_quality_print_data(struct bme68x_data *d, uint32_t millis)
-{
-	aq_nprintf("{\"sensor\": \"BME680\", \"data\": [");
-
-	aq_nprintf("{\"name\": \"temperature\", "
-		   "\"value\": %.2f, "
-		   "\"unit\": \"degC\", "
-		   "\"timemillis\": %lu}, ", d->temperature,
-		   (unsigned long) millis);
-
-	aq_nprintf("{\"name\": \"pressure\", "
-		   "\"value\": %.2f, "
-		   "\"unit\": \"Pa\", "
-		   "\"timemillis\": %lu}, ", d->pressure,
-		   (unsigned long) millis);
-
-	aq_nprintf("{\"name\": \"humidity\", "
-		   "\"value\": %.2f, "
-		   "\"unit\": \"%%\", "
-		   "\"timemillis\": %lu}, ", d->humidity,
-		   (unsigned long) millis);
-
-	aq_nprintf("{\"name\": \"gas resistance\", "
-		   "\"value\": %.2f, "
-		   "\"unit\": \"Ohms\", "
-		   "\"timemillis\": %lu}], ",
-		   d->gas_resistance, (unsigned long) millis);
-
-	aq_nprintf("\"status\": {"
-		   "\"sensor\": \"%#x\"}}",
-		   d->status);
-}
-
-void aq_bme680_handle_error(int8_t i_errno, aq_status *s)
+void aq_register_sensors()
 {
-	switch (i_errno) {
-	case BME68X_OK:
-		aq_status_unset_status(AQ_STATUS_REGION_BME680 ^
-				       AQ_STATUS_I_BME680_READING,
-				       s);
-		break;
-	case BME68X_E_COM_FAIL:
-		aq_status_set_status(AQ_STATUS_E_BME680_COMM_FAIL,
-				     s);
-		break;
-	default:
-		aq_status_set_status(AQ_STATUS_E_BME680_GENERAL_FAIL,
-				     s);
-		break;
+	/* Registration order is the order of the output array */
+	for (unsigned int i = 0; i < ARRAY_LEN(aq_batt); ++i) {
+		aq_sensor_register(&aq_batt_ops, &aq_batt[i]);
 	}
-}
-
-void aq_pm2_5_print_data(pm2_5_dev *dev, pm2_5_data *d,
-			 unsigned long millis)
-{
-	aq_nprintf( "{\"sensor\": \"PMS 5003\", "
-		    "\"data\": [");
-
-	aq_nprintf( "{\"name\": \"PM1.0 Std\", "
-		    "\"value\": %u, "
-		    "\"unit\": \"ug/m^3\", "
-		    "\"timemillis\": %lu}, ",
-		    d->pm1_0_std, millis);
-
-	aq_nprintf( "{\"name\": \"PM2.5 Std\", "
-		    "\"value\": %u, "
-		    "\"unit\": \"ug/m^3\", "
-		    "\"timemillis\": %lu}, ",
-		    d->pm2_5_std, millis);
-
-	aq_nprintf( "{\"name\": \"pm10_std\", "
-		    "\"value\": %u, "
-		    "\"unit\": \"ug/m^3\", "
-		    "\"timemillis\": %lu}, ",
-		    d->pm10_std, millis);
-
-	aq_nprintf( "{\"name\": \"NP > 0.3um\", "
-		    "\"value\": %u, "
-		    "\"unit\": \"num/0.1L air\", "
-		    "\"timemillis\": %lu}, ",
-		    d->np_0_3, millis);
-
-	aq_nprintf( "{\"name\": \"NP > 0.5um\", "
-		    "\"value\": %u, "
-		    "\"unit\": \"num/0.1L air\", "
-		    "\"timemillis\": %lu}, ",
-		    d->np_0_5, millis);
-
-	aq_nprintf( "{\"name\": \"NP > 1.0um\", "
-		    "\"value\": %u, "
-		    "\"unit\": \"num/0.1L air\", "
-		    "\"timemillis\": %lu}, ",
-		    d->np_1_0, millis);
-
-	aq_nprintf( "{\"name\": \"NP > 2.5um\", "
-		    "\"value\": %u, "
-		    "\"unit\": \"num/0.1L air\", "
-		    "\"timemillis\": %lu}, ",
-		    d->np_2_5, millis);
-
-	aq_nprintf( "{\"name\": \"NP > 5.0\", "
-		    "\"value\": %u, "
-		    "\"unit\": \"num/0.1L air\", "
-		    "\"timemillis\": %lu}, ",
-		    d->np_5_0, millis);
-
-	aq_nprintf( "{\"name\": \"NP > 10\", "
-		    "\"value\": %u, "
-		    "\"unit\": \"num/0.1L air\", "
-		    "\"timemillis\": %lu}], ",
-		    d->np_10, millis);
-
-	aq_nprintf( "\"status\": {"
-		    "\"opmode\": \"%s\", "
-		    "\"sleep\": %s}}",
-		    dev->mode == PM2_5_MODE_ACTIVE ? "ACTIVE" : "PASSIVE",
-		    dev->sleep ? "true" : "false");
-}
 
-void aq_pm2_5_handle_error(int8_t i_errno, aq_status *s)
-{
-	char level[16];
-	if (i_errno == PM2_5_OK) {
-		/* All errors/warnings will clear on successful
-		 * library operation */
-		aq_status_unset_status(AQ_STATUS_REGION_PM2_5 ^
-				       AQ_STATUS_I_PM2_5_READING, s);
-		return;
+	for (unsigned int i = 0; i < ARRAY_LEN(aq_bme680); ++i) {
+		aq_sensor_register(&aq_bme680_ops, &aq_bme680[i]);
 	}
 
-	switch (pm2_5_err_level(i_errno)) {
-	case PM2_5_INFO:
-		strcpy(level, "INFO");
-		break;
-	case PM2_5_WARNING:
-		strcpy(level, "WARNING");
-		aq_status_set_status(AQ_STATUS_W_PM2_5_NO_DATA, s);
-		break;
-	case PM2_5_ERROR:
-		strcpy(level, "ERROR");
-		aq_status_set_status(AQ_STATUS_E_PM2_5_GENERAL_FAIL, s);
-		break;
-	default:
-		strcpy(level, "UNKNOWN");
-		break;
+	for (unsigned int i = 0; i < ARRAY_LEN(aq_pm2_5); ++i) {
+		aq_sensor_register(&aq_pm2_5_ops, &aq_pm2_5[i]);
 	}
 
-	printf("%s: %s\n", level,
-	       pm2_5_err_description(i_errno));
-}
-
-void aq_adc_init()
-{
-	adc_init();
-
-	adc_gpio_init(AIR_QUALITY_ADC_BATT_GPIO_PIN);
-}
-
-double aq_batt_voltage(aq_status *s)
-{
-	double vbatt;
-	const double cf = 2 * 3.3 / (1 << 12);
-
-	adc_select_input(AIR_QUALITY_ADC_BATT_ADC_CH);
-	vbatt = cf * (double) adc_read();
-
-	if (vbatt < AIR_QUALITY_BATT_LOW_V) {
-		aq_status_set_status(AQ_STATUS_W_BATT_LOW, s);
-	} else {
-		aq_status_unset_status(AQ_STATUS_W_BATT_LOW, s);
+#ifdef AIR_QUALITY_SCD4X_SENSORS
+	for (unsigned int i = 0; i < ARRAY_LEN(aq_scd4x); ++i) {
+		aq_sensor_register(&aq_scd4x_ops, &aq_scd4x[i]);
 	}
-
-	return vbatt;
-}
-
-void aq_print_batt(aq_status *s)
-{
-	aq_nprintf("{\"sensor\": \"Board\", "
-		   "\"data\": [");
-
-	aq_nprintf("{\"name\": \"V Batt\", "
-		   "\"value\": %0.2f, "
-		   "\"unit\": \"V\", "
-		   "\"timemillis\": %lu}], ",
-		   aq_batt_voltage(s),
-		   to_ms_since_boot(get_absolute_time()));
-
-	aq_nprintf("\"status\": {"
-		   "\"charging\": \"%s\"}}",
-		   "unknown");
+#endif
 }
 
 void aq_wifi_set_flags(aq_status *s)
 {
 	int rslt;
 
-	rslt = esp_at_cipstatus(&aq_wifi_cfg, &aq_wifi_status);
+	/* The module keeps its status cached, and only queries what
+	 * expired or was invalidated by an event. The queries are
+	 * queued for core1, which drives the module, so sampling never
+	 * waits for the radio. */
+	rslt = esp_at_status_refresh(&aq_wifi_cfg, &aq_wifi_status);
 
 	if (rslt) {
 		aq_status_set_status(AQ_STATUS_E_WIFI_FAIL |
 				     AQ_STATUS_W_WIFI_DISCONNECTED, s);
 		aq_status_unset_status(AQ_STATUS_I_CLIENT_CONNECTED, s);
 
-		DEBUGDATA("esp_at_cipstatus() failed with status",
+		DEBUGDATA("esp_at_status_update() failed with status",
 			  rslt, "%d");
 
 		return;
@@ -334,7 +200,8 @@ void aq_wifi_set_flags(aq_status *s)
 
 	/* need to know if clients are connected so we
 	 * don't waste time writing to them */
-	if (aq_wifi_status.status & ESP_AT_STATUS_CLIENT_CONNECTED) {
+	if ((aq_wifi_status.status & ESP_AT_STATUS_CLIENT_CONNECTED) ||
+	    aq_wifi_cfg.transparent) {
 		aq_status_set_status(AQ_STATUS_I_CLIENT_CONNECTED, s);
 	} else {
 		aq_status_unset_status(AQ_STATUS_I_CLIENT_CONNECTED, s);
@@ -347,40 +214,49 @@ void aq_wifi_set_flags(aq_status *s)
 	}
 }
 
-uint16_t aq_abrev_netmask(const char *nm)
+void aq_print_json(const aq_status *s)
 {
-	char str[24];
-	uint32_t mask = 0;
-	char *tk;
-	char *last;
-
-	DEBUGDATA("Full netmask", nm, "%s");
-
-	if (!nm) {
-		return -1;
-	}
-
-	strncpy(str, nm, sizeof(str) - 1);
-	str[ARRAY_LEN(str) - 1] = '\0';
-
-	for (tk = strtok_r(str, ".", &last);
-	     tk;
-	     tk = strtok_r(NULL, ".", &last)) {
-		uint32_t bits;
-
-		mask = mask << 8;
-
-		bits = strtol(tk, NULL, 10);
-		DEBUGDATA("Netmask byte", bits, "%lu");
-		mask = mask | bits;
-	}
+	aq_nprintf("{\"seq\": %lu, "
+		   "\"program\": \"%s\", \"board\": \"%s\", "
+		   "\"status\": %lu, "
+		   "\"ip address\": \"%s/%d\", "
+		   "\"status masks\": {"
+		   "\"wait\": %lu, "
+		   "\"info\": %lu, "
+		   "\"warning\": %lu, "
+		   "\"error\": %lu"
+		   "}, "
+		   "\"output\": [",
+		   (unsigned long) aq_stdio_seq(),
+		   PICO_TARGET_NAME, PICO_BOARD, s->status,
+		   aq_wifi_status.ipv4,
+		   aq_wifi_status.ipv4_prefix,
+		   AQ_STATUS_MASK_WAIT,
+		   AQ_STATUS_MASK_INFO,
+		   AQ_STATUS_MASK_WARNING,
+		   AQ_STATUS_MASK_ERROR);
+
+	aq_sensor_serialize_all();
+
+	aq_nprintf("], \"sentmillis\": %lu}\n",
+		   to_ms_since_boot(get_absolute_time()));
+}
 
-	for (uint16_t i = 0; i < 32; ++i) {
-		if (mask & (1ul << i))
-			return 32 - i;
+void aq_print_csv(aq_ctl_settings *settings, const aq_status *s)
+{
+	/* Column names once, after the format was set */
+	if (settings->header) {
+		aq_nprintf("# seq,millis,status");
+		aq_sensor_csv_all(true);
+		aq_nprintf("\n");
+		settings->header = false;
 	}
 
-	return 0;
+	aq_nprintf("%lu,%lu,%lu", (unsigned long) aq_stdio_seq(),
+		   to_ms_since_boot(get_absolute_time()),
+		   (unsigned long) s->status);
+	aq_sensor_csv_all(false);
+	aq_nprintf("\n");
 }
 
 /*
@@ -392,24 +268,23 @@ uint16_t aq_abrev_netmask(const char *nm)
 int main() {
 	int8_t ret = 0;
 
-	/* Interfaces */
-	bme680_intf b_intf;
-	pm2_5_intf p_intf;
 	aq_status status = {
 		.led_pio = pio0,
 		.led_sm = 0,
 		.led_pin = AIR_QUALITY_INFO_LED_PIN
 	};
 
-	/* Output Data Structures */
-	struct bme68x_data d;
-	pm2_5_data pdata;
-
 	/* Configuration Parameters */
-	bme680_run_mode m = FORCED_MODE;
 	const uint16_t sample_delay_ms = 10000;
+	absolute_time_t sample_time;
 	absolute_time_t next_sample_time;
 
+	/* Commands from clients and USB change these between samples */
+	aq_ctl_settings settings = {
+		.period_ms = sample_delay_ms,
+		.format = AQ_CTL_FORMAT_JSON
+	};
+
 	stdio_usb_init();
 
 	aq_status_init(&status);
@@ -431,34 +306,41 @@ int main() {
 	}
 #endif /* AIR_QUALITY_WAIT_CONNECTION */
 
-	/* initialize variables in interface struct */
-	b_intf.i2c = NULL; /* NULL i2c will select default */
-	b_intf.timeout = 1000; /* 500ms timeout on i2c read/write */
-
 #ifdef BME680_INTERFACE_SELFTEST
 	/* Option to compile in a selft test of sensor at start of
 	 * MCU */
-	printf("Beginning BME680 Selftest...Standby...\n");
-	ret = selftest_bme680_sensor(&b_intf, BME68X_I2C_ADDR_LOW);
-
-	if (ret == BME68X_OK) {
-		printf("BME680 Selftest SUCCESS...Continuing...\n");
-	} else if (ret > 0) {
-		printf("BME680 Selftest WARNING with code %d...Continuing...\n",
-		       ret);
-	} else {
-		printf("BME680 Selftest FAILURE with code %d...Ending...\n",
-			ret);
-		aq_status_set_status(AQ_STATUS_E_BME680_SELFTEST_FAIL,
-				     &status);
-		return 1;
+	for (unsigned int i = 0; i < ARRAY_LEN(aq_bme680); ++i) {
+		aq_bme680[i].intf.i2c = aq_bme680[i].i2c;
+		aq_bme680[i].intf.timeout = 1000;
+
+		printf("Beginning BME680 Selftest...Standby...\n");
+		ret = bme680_selftest(&aq_bme680[i].intf,
+				      aq_bme680[i].addr);
+
+		if (ret == BME68X_OK) {
+			printf("BME680 Selftest SUCCESS...Continuing...\n");
+		} else if (ret > 0) {
+			printf("BME680 Selftest WARNING with code %d...Continuing...\n",
+			       ret);
+		} else {
+			printf("BME680 Selftest FAILURE with code %d...Ending...\n",
+			       ret);
+			aq_status_set_status(AQ_STATUS_E_BME680_SELFTEST_FAIL,
+					     &status);
+			return 1;
+		}
 	}
 #endif /* #ifdef BME680_INTERFACE_SELFTEST */
 
-	/* Initialize battery checker */
-	aq_adc_init();
+	aq_register_sensors();
 
 	/* Initialize WiFi Module */
+#if defined(AIR_QUALITY_WIFI_CTS_PIN) && defined(AIR_QUALITY_WIFI_RTS_PIN)
+	aq_wifi_cfg.uart_cfg.flow = true;
+	aq_wifi_cfg.uart_cfg.pin_cts = AIR_QUALITY_WIFI_CTS_PIN;
+	aq_wifi_cfg.uart_cfg.pin_rts = AIR_QUALITY_WIFI_RTS_PIN;
+#endif
+
 	if (esp_at_init_module(&aq_wifi_cfg, AIR_QUALITY_WIFI_PIO,
 			       AIR_QUALITY_WIFI_TX_SM,
 			       AIR_QUALITY_WIFI_RX_SM,
@@ -475,6 +357,9 @@ int main() {
 		printf("ERROR: Failed to intitialize WiFi module\n");
 	}
 
+	/* With a stream host that takes the output the server stays
+	 * off, the module can't stream while it runs */
+#ifndef AQ_STDIO_STREAM_HOST
 	if (!(status.status & AQ_STATUS_W_WIFI_DISCONNECTED)) {
 		ret = esp_at_cipserver_init(&aq_wifi_cfg);
 
@@ -486,7 +371,14 @@ int main() {
 			aq_status_unset_status(AQ_STATUS_E_WIFI_FAIL,
 					       &status);
 		}
+
+		/* Clients of the server may also fetch the latest
+		 * reading and metrics over HTTP */
+		if (ret >= 0 && aq_http_init(&aq_wifi_cfg) < 0) {
+			printf("Error: Could not start HTTP endpoint\n");
+		}
 	}
+#endif /* #ifndef AQ_STDIO_STREAM_HOST */
 
 #ifdef AIR_QUALITY_WAIT_CONNECTION
 	if (!(status.status & AQ_STATUS_W_WIFI_DISCONNECTED)) {
@@ -498,29 +390,28 @@ int main() {
 	}
 #endif /* #ifdef AIR_QUALITY_WAIT_CONNECTION */
 
-	ret = bme680_init(&b_intf, BME68X_I2C_ADDR_LOW, m);
-	aq_bme680_handle_error(ret, &status);
+	/* Start all sensors of the board */
+	aq_sensor_init_all(&status);
 
-	/* Start PM2_5 Sensor */
-	p_intf.uart = AIR_QUALITY_PM2_5_UART;
-	ret = pm2_5_intf_init(&p_intf, AIR_QUALITY_PM2_5_TX_PIN,
-			      AIR_QUALITY_PM2_5_RX_PIN);
-	aq_pm2_5_handle_error(ret, &status);
+	/* Take commands from USB and from clients, once the HTTP
+	 * endpoint is set up to tell its requests apart */
+	if (aq_ctl_init(&aq_wifi_cfg, &status, &settings) < 0) {
+		printf("Error: Could not take commands from WiFi\n");
+	}
 
-	ret = pm2_5_set_mode(&p_intf.dev, PM2_5_MODE_PASSIVE);
-	aq_pm2_5_handle_error(ret, &status);
+	aq_sub_init(&aq_wifi_cfg);
 
-	next_sample_time = make_timeout_time_ms(sample_delay_ms);
+	sample_time = make_timeout_time_ms(sample_delay_ms);
 
 	/* Initialize stdio processing thread */
 	aq_wifi_set_flags(&status);
 	aq_stdio_init(&status, &aq_wifi_status);
 
-	/* Keep polling the sensor for data if initialization was
-	 * successful. This loop will only break on error. */
+	/* Keep polling the sensors for data. This loop will only
+	 * break if every sensor fails. */
 	for (;;) {
-		absolute_time_t readtime;
-		uint8_t print_pm = 0;
+		/* Commands take effect between samples */
+		aq_ctl_apply(&settings);
 
 		/* Check USB STDIO */
 		if (stdio_usb_connected()) {
@@ -534,100 +425,45 @@ int main() {
 		/* Check wifi */
 		aq_wifi_set_flags(&status);
 
-		aq_status_set_status(AQ_STATUS_I_BME680_READING,
-				     &status);
-		ret = bme680_sample(m, &b_intf, &d);
-
-		/* Get time before handling error so it's as close as
-		 * possible */
-		readtime = get_absolute_time();
-		next_sample_time = delayed_by_ms(next_sample_time,
-						 sample_delay_ms);
-
-		aq_status_unset_status(AQ_STATUS_I_BME680_READING,
-				       &status);
-
-		/* Check BME680 sensor status bit for relevent
-		 * warnings */
-		if (d.status & BME68X_HEAT_STAB_MSK)
-			aq_status_unset_status(AQ_STATUS_W_BME680_GAS_UNSTABLE,
-					       &status);
-		else
-			aq_status_set_status(AQ_STATUS_W_BME680_GAS_UNSTABLE,
-					     &status);
-		if (d.status & BME68X_GASM_VALID_MSK)
-			aq_status_unset_status(AQ_STATUS_W_BME680_GAS_INVALID,
-					       &status);
-		else
-			aq_status_set_status(AQ_STATUS_W_BME680_GAS_INVALID,
-					     &status);
-
-		aq_bme680_handle_error(ret, &status);
-
-		if (ret == BME68X_W_NO_NEW_DATA) {
-			continue;
-		}
+		ret = aq_sensor_sample_all();
 
 		if (ret < 0) {
 			break;
 		}
 
-		/* PM2.5 READ */
-		aq_status_set_status(AQ_STATUS_I_PM2_5_READING,
-				     &status);
-		ret = pm2_5_get_data(&p_intf.dev, &pdata);
-		aq_status_unset_status(AQ_STATUS_I_PM2_5_READING,
-				       &status);
-		aq_pm2_5_handle_error(ret, &status);
-		print_pm = ret == 0 ? 1 : 0;
-
 		/* Print out all the data */
-		aq_nprintf("{\"program\": \"%s\", \"board\": \"%s\", "
-			   "\"status\": %lu, "
-			   "\"ip address\": \"%s/%d\", "
-			   "\"status masks\": {"
-			   "\"wait\": %lu, "
-			   "\"info\": %lu, "
-			   "\"warning\": %lu, "
-			   "\"error\": %lu"
-			   "}, "
-			   "\"output\": [",
-			   PICO_TARGET_NAME, PICO_BOARD, status.status,
-			   aq_wifi_status.ipv4,
-			   aq_abrev_netmask(aq_wifi_status.ipv4_netmask),
-			   AQ_STATUS_MASK_WAIT,
-			   AQ_STATUS_MASK_INFO,
-			   AQ_STATUS_MASK_WARNING,
-			   AQ_STATUS_MASK_ERROR);
-
-		aq_print_batt(&status);
-
-		aq_nprintf(", ");
-
-		air_quality_print_data(&d, to_ms_since_boot(readtime));
-
-		if (print_pm) {
-			aq_nprintf(", ");
-
-			aq_pm2_5_print_data(&p_intf.dev, &pdata,
-					    to_ms_since_boot(readtime));
+		if (settings.format == AQ_CTL_FORMAT_CSV) {
+			aq_print_csv(&settings, &status);
+		} else {
+			aq_print_json(&status);
 		}
 
-		aq_nprintf("], \"sentmillis\": %lu}\n",
-			   to_ms_since_boot(get_absolute_time()));
+		aq_http_sample(&status);
+		aq_sub_sample(&status);
+
+		/* The output is sent by core1 alone, which owns the
+		 * WiFi module and the state of the sinks. Tell stdio
+		 * core to sleep when done, and sleep this core until
+		 * next sample time. A new period counts from this
+		 * sample, and a late sample doesn't make the next ones
+		 * catch up. */
+		do {
+			next_sample_time = delayed_by_ms(
+				sample_time, aq_ctl_period_ms(&settings));
+
+			if (time_reached(next_sample_time)) {
+				next_sample_time = get_absolute_time();
+			}
 
-		/* Help core1 process stdio if it isn't done yet */
-		aq_stdio_process();
+			aq_stdio_sleep_until(next_sample_time);
+		} while (aq_ctl_wait_until(next_sample_time) &&
+			 aq_ctl_apply(&settings));
 
-		/* Tell stdio core to sleep when done, and sleep this
-		 * core until next sample time */
-		aq_stdio_sleep_until(next_sample_time);
-		sleep_until(next_sample_time);
+		sample_time = next_sample_time;
 	}
 
-	/* Deinit i2c if loop broke */
-	bme680_deinit(&b_intf);
-	pm2_5_intf_deinit(&p_intf);
+	/* Release the sensors if loop broke */
+	aq_sensor_deinit_all();
 
 	return 1;
 }
@@ -0,0 +1,473 @@
+/**
+ * @file aq-ctl.c
+ * @author Tyler J. Anderson
+ * @brief Control commands from WiFi clients and USB
+ */
+
+#include "aq-ctl.h"
+#include "aq-sensor.h"
+#include "aq-stdio.h"
+#include "aq-sub.h"
+#include "debugmsg.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pico/critical_section.h"
+#include "pico/util/queue.h"
+
+#define ARRAY_LEN(array) sizeof(array)/sizeof(array[0])
+
+/* Lines waiting to be run */
+#ifndef AQ_CTL_QUEUE_LEN
+#define AQ_CTL_QUEUE_LEN 4
+#endif /* #ifndef AQ_CTL_QUEUE_LEN */
+
+/* Link of lines from USB */
+#define _AQ_CTL_USB -1
+
+typedef struct {
+	char buf[AQ_CTL_LINE_LEN];
+	size_t len;
+	bool drop; /* Rest of a line too long to keep */
+} _aq_ctl_line;
+
+typedef struct {
+	int link;
+	char line[AQ_CTL_LINE_LEN];
+} _aq_ctl_cmd;
+
+static bool _aq_ctl_is_init = false;
+static esp_at_cfg *_cfg = NULL;
+static aq_status *_status = NULL;
+static _aq_ctl_line _links[ESP_AT_MAX_CONN];
+static _aq_ctl_line _usb;
+static queue_t _q_cmds;
+static critical_section_t _cs;
+
+/* Changes for the sampling loop, guarded by _cs */
+static volatile bool _pending = false;
+static uint32_t _period_ms;
+static aq_ctl_format _format;
+static bool _format_set = false;
+static uint32_t _burst_ms;
+static bool _burst_set = false;
+
+/* Settings in use by the sampling loop, guarded by _cs */
+static aq_ctl_settings _cur;
+
+static void _aq_ctl_urc(const esp_at_urc *urc, void *ctx);
+static void _aq_ctl_feed(_aq_ctl_line *l, int link, char c);
+static void _aq_ctl_run(int link, char *line);
+static void _aq_ctl_reply(int link, const char *rsp);
+static int _aq_ctl_parse_ms(const char *s, uint32_t *ms);
+static void _aq_ctl_stats(char *rsp, size_t len);
+static void _aq_ctl_subscribe(int link, int argc, char *argv[], char *rsp,
+			      size_t len);
+static void _aq_ctl_resume(int link, const char *arg, char *rsp,
+			   size_t len);
+
+int aq_ctl_init(esp_at_cfg *cfg, aq_status *status,
+		const aq_ctl_settings *s)
+{
+	_cfg = cfg;
+	_status = status;
+	_cur = *s;
+	_period_ms = s->period_ms;
+	_format = s->format;
+
+	memset(_links, 0, sizeof(_links));
+	memset(&_usb, 0, sizeof(_usb));
+	critical_section_init(&_cs);
+	queue_init(&_q_cmds, sizeof(_aq_ctl_cmd), AQ_CTL_QUEUE_LEN);
+
+	_aq_ctl_is_init = true;
+
+	if (cfg && esp_at_urc_register(cfg, _aq_ctl_urc, NULL) < 0) {
+		return -1;
+	}
+
+	return 0;
+}
+
+void aq_ctl_process()
+{
+	_aq_ctl_cmd cmd;
+	int c;
+
+	if (!_aq_ctl_is_init) {
+		return;
+	}
+
+	/* A line at most per call, so USB can't hold up the module */
+	for (unsigned int i = 0; i < AQ_CTL_LINE_LEN; ++i) {
+		c = getchar_timeout_us(0);
+
+		if (c == PICO_ERROR_TIMEOUT) {
+			break;
+		}
+
+		_aq_ctl_feed(&_usb, _AQ_CTL_USB, c);
+	}
+
+	while (queue_try_remove(&_q_cmds, &cmd)) {
+		_aq_ctl_run(cmd.link, cmd.line);
+	}
+}
+
+bool aq_ctl_wait_until(absolute_time_t time)
+{
+	/* Commands on core1 send an event after a change */
+	while (!_pending) {
+		if (best_effort_wfe_or_timeout(time)) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool aq_ctl_apply(aq_ctl_settings *s)
+{
+	bool changed;
+
+	if (!_aq_ctl_is_init) {
+		return false;
+	}
+
+	critical_section_enter_blocking(&_cs);
+	changed = _pending;
+
+	if (_pending) {
+		s->period_ms = _period_ms;
+
+		if (_format_set) {
+			s->format = _format;
+			s->header = _format == AQ_CTL_FORMAT_CSV;
+			_format_set = false;
+		}
+
+		if (_burst_set) {
+			s->burst_until = _burst_ms ?
+				make_timeout_time_ms(_burst_ms) : nil_time;
+			_burst_set = false;
+		}
+
+		_pending = false;
+	}
+
+	_cur = *s;
+	critical_section_exit(&_cs);
+
+	return changed;
+}
+
+uint32_t aq_ctl_period_ms(const aq_ctl_settings *s)
+{
+	if (!time_reached(s->burst_until) &&
+	    s->period_ms > AQ_CTL_BURST_PERIOD_MS) {
+		return AQ_CTL_BURST_PERIOD_MS;
+	}
+
+	return s->period_ms;
+}
+
+void _aq_ctl_urc(const esp_at_urc *urc, void *ctx)
+{
+	(void) ctx;
+
+	if (urc->type == ESP_AT_URC_WIFI_DISCONNECT) {
+		memset(_links, 0, sizeof(_links));
+
+		for (int i = 0; i < ESP_AT_MAX_CONN; ++i) {
+			aq_sub_drop(i);
+		}
+
+		return;
+	}
+
+	if (urc->link < 0 || urc->link >= ESP_AT_MAX_CONN) {
+		return;
+	}
+
+	switch (urc->type) {
+	case ESP_AT_URC_CONNECT:
+	case ESP_AT_URC_CLOSED:
+		memset(&_links[urc->link], 0, sizeof(_links[urc->link]));
+		aq_sub_drop(urc->link);
+		break;
+	case ESP_AT_URC_IPD:
+		/* Lines of links the HTTP endpoint holds are requests,
+		 * not commands. Subscribed links still take commands. */
+		if (_cfg->http_links & (1u << urc->link)) {
+			break;
+		}
+
+		for (size_t i = 0; i < urc->len; ++i) {
+			_aq_ctl_feed(&_links[urc->link], urc->link,
+				     urc->data[i]);
+		}
+
+		break;
+	default:
+		break;
+	}
+}
+
+void _aq_ctl_feed(_aq_ctl_line *l, int link, char c)
+{
+	_aq_ctl_cmd cmd;
+
+	if (c == '\n' || c == '\r') {
+		if (l->len && !l->drop) {
+			cmd.link = link;
+			memcpy(cmd.line, l->buf, l->len);
+			cmd.line[l->len] = '\0';
+
+			if (!queue_try_add(&_q_cmds, &cmd)) {
+				DEBUGMSG("Command queue full, dropping line");
+			}
+		}
+
+		l->len = 0;
+		l->drop = false;
+		return;
+	}
+
+	if (l->len >= ARRAY_LEN(l->buf) - 1) {
+		l->drop = true;
+		return;
+	}
+
+	l->buf[l->len++] = c;
+}
+
+void _aq_ctl_run(int link, char *line)
+{
+	char *argv[6];
+	char *save;
+	char rsp[192];
+	int argc = 0;
+	uint32_t ms;
+
+	for (char *t = strtok_r(line, " \t", &save);
+	     t && argc < (int) ARRAY_LEN(argv);
+	     t = strtok_r(NULL, " \t", &save)) {
+		argv[argc++] = t;
+	}
+
+	if (argc == 0) {
+		return;
+	}
+
+	DEBUGDATA("Running command", argv[0], "%s");
+	snprintf(rsp, sizeof(rsp), "ERROR unknown command\n");
+
+	if (argc == 3 && strcmp(argv[0], "set") == 0 &&
+	    strcmp(argv[1], "period") == 0) {
+		if (_aq_ctl_parse_ms(argv[2], &ms) < 0 ||
+		    ms < AQ_CTL_PERIOD_MIN_MS || ms > AQ_CTL_PERIOD_MAX_MS) {
+			snprintf(rsp, sizeof(rsp),
+				 "ERROR period out of range\n");
+		} else {
+			critical_section_enter_blocking(&_cs);
+			_period_ms = ms;
+			_pending = true;
+			critical_section_exit(&_cs);
+			snprintf(rsp, sizeof(rsp), "OK period %lu ms\n",
+				 (unsigned long) ms);
+		}
+	} else if (argc == 3 && strcmp(argv[0], "set") == 0 &&
+		   strcmp(argv[1], "format") == 0) {
+		if (strcmp(argv[2], "json") == 0 ||
+		    strcmp(argv[2], "csv") == 0) {
+			critical_section_enter_blocking(&_cs);
+			_format = argv[2][0] == 'j' ?
+				AQ_CTL_FORMAT_JSON : AQ_CTL_FORMAT_CSV;
+			_format_set = true;
+			_pending = true;
+			critical_section_exit(&_cs);
+			snprintf(rsp, sizeof(rsp), "OK format %s\n",
+				 argv[2]);
+		} else {
+			snprintf(rsp, sizeof(rsp),
+				 "ERROR format is json or csv\n");
+		}
+	} else if (argc == 2 && strcmp(argv[0], "burst") == 0) {
+		if (_aq_ctl_parse_ms(argv[1], &ms) < 0 ||
+		    ms > AQ_CTL_BURST_MAX_MS) {
+			snprintf(rsp, sizeof(rsp),
+				 "ERROR burst out of range\n");
+		} else {
+			critical_section_enter_blocking(&_cs);
+			_burst_ms = ms;
+			_burst_set = true;
+			_pending = true;
+			critical_section_exit(&_cs);
+			snprintf(rsp, sizeof(rsp), "OK burst %lu ms\n",
+				 (unsigned long) ms);
+		}
+	} else if (argc == 1 && strcmp(argv[0], "stats") == 0) {
+		_aq_ctl_stats(rsp, sizeof(rsp));
+	} else if (argc >= 2 && strcmp(argv[0], "subscribe") == 0) {
+		_aq_ctl_subscribe(link, argc, argv, rsp, sizeof(rsp));
+	} else if (argc == 1 && strcmp(argv[0], "unsubscribe") == 0) {
+		aq_sub_drop(link);
+		snprintf(rsp, sizeof(rsp), "OK unsubscribed\n");
+	} else if (argc == 2 && strcmp(argv[0], "resume") == 0) {
+		_aq_ctl_resume(link, argv[1], rsp, sizeof(rsp));
+	} else if (argc == 2 && strcmp(argv[0], "flush") == 0 &&
+		   strcmp(argv[1], "log") == 0) {
+		aq_stdio_flush();
+		snprintf(rsp, sizeof(rsp), "OK flushed\n");
+	}
+
+	/* Wake up the sampling loop to take the change */
+	__sev();
+	_aq_ctl_reply(link, rsp);
+}
+
+void _aq_ctl_reply(int link, const char *rsp)
+{
+	if (link == _AQ_CTL_USB) {
+		printf("%s", rsp);
+		return;
+	}
+
+	/* The stream host gets it in its own stream */
+	if (_cfg->transparent ?
+	    esp_at_transparent_write(_cfg, rsp, strlen(rsp)) < 0 :
+	    esp_at_cipsend_data(_cfg, link, rsp, strlen(rsp)) < 0) {
+		DEBUGDATA("Failed to answer link", link, "%d");
+	}
+}
+
+int _aq_ctl_parse_ms(const char *s, uint32_t *ms)
+{
+	char *end;
+	unsigned long n = strtoul(s, &end, 10);
+	unsigned long unit = 1;
+
+	if (end == s) {
+		return -1;
+	}
+
+	if (*end == '\0' || strcmp(end, "s") == 0) {
+		unit = 1000;
+	} else if (strcmp(end, "m") == 0) {
+		unit = 60000;
+	} else if (strcmp(end, "ms") != 0) {
+		return -1;
+	}
+
+	if (n > UINT32_MAX / unit) {
+		return -1;
+	}
+
+	*ms = n * unit;
+
+	return 0;
+}
+
+void _aq_ctl_stats(char *rsp, size_t len)
+{
+	const aq_sensor_stats *stats = aq_sensor_get_stats();
+	aq_ctl_settings cur;
+	int64_t burst_us;
+
+	critical_section_enter_blocking(&_cs);
+	cur = _cur;
+	critical_section_exit(&_cs);
+
+	burst_us = absolute_time_diff_us(get_absolute_time(),
+					 cur.burst_until);
+
+	snprintf(rsp, len,
+		 "OK period %lu ms, format %s, burst %lu s, "
+		 "samples %lu, sample %lu us, dispatch max %lu us, "
+		 "status %#lx\n",
+		 (unsigned long) cur.period_ms,
+		 cur.format == AQ_CTL_FORMAT_CSV ? "csv" : "json",
+		 burst_us > 0 ? (unsigned long) (burst_us / 1000000) : 0,
+		 (unsigned long) stats->samples,
+		 (unsigned long) stats->total_us,
+		 (unsigned long) stats->dispatch_max_us,
+		 (unsigned long) _status->status);
+}
+
+void _aq_ctl_subscribe(int link, int argc, char *argv[], char *rsp,
+		       size_t len)
+{
+	aq_sub_spec spec = {
+		.every = 1,
+		.format = AQ_CTL_FORMAT_JSON
+	};
+
+	if (link == _AQ_CTL_USB) {
+		snprintf(rsp, len, "ERROR subscriptions are for WiFi clients\n");
+		return;
+	}
+
+	if (strlen(argv[1]) >= ARRAY_LEN(spec.metrics)) {
+		snprintf(rsp, len, "ERROR too many metrics\n");
+		return;
+	}
+
+	if (strcmp(argv[1], "all") != 0) {
+		strcpy(spec.metrics, argv[1]);
+	}
+
+	for (int i = 2; i < argc; ++i) {
+		if (strcmp(argv[i], "every") == 0 && i + 1 < argc) {
+			spec.every = strtoul(argv[++i], NULL, 10);
+		} else if (strcmp(argv[i], "json") == 0) {
+			spec.format = AQ_CTL_FORMAT_JSON;
+		} else if (strcmp(argv[i], "csv") == 0) {
+			spec.format = AQ_CTL_FORMAT_CSV;
+		} else {
+			snprintf(rsp, len, "ERROR unknown option %s\n",
+				 argv[i]);
+			return;
+		}
+	}
+
+	if (aq_sub_set(link, &spec) < 0) {
+		snprintf(rsp, len, "ERROR every is 1 to %u\n",
+			 AQ_SUB_EVERY_MAX);
+		return;
+	}
+
+	snprintf(rsp, len, "OK subscribed to %s every %u\n", argv[1],
+		 spec.every);
+}
+
+void _aq_ctl_resume(int link, const char *arg, char *rsp, size_t len)
+{
+	char *end;
+	const unsigned long seq = strtoul(arg, &end, 10);
+	uint32_t lost;
+	int sent;
+
+	if (link == _AQ_CTL_USB || _cfg->transparent) {
+		snprintf(rsp, len, "ERROR resume is for WiFi clients\n");
+		return;
+	}
+
+	if (end == arg || *end != '\0' || seq > UINT32_MAX) {
+		snprintf(rsp, len, "ERROR seq out of range\n");
+		return;
+	}
+
+	/* The missed frames go out now, the live ones queued meanwhile
+	 * follow */
+	sent = aq_stdio_resume(link, seq, &lost);
+
+	if (sent < 0) {
+		snprintf(rsp, len, "ERROR resume failed\n");
+		return;
+	}
+
+	snprintf(rsp, len, "OK resumed %d from %lu, %lu lost\n", sent, seq,
+		 (unsigned long) lost);
+}
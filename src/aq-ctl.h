@@ -0,0 +1,107 @@
+/**
+ * @file aq-ctl.h
+ * @author Tyler J. Anderson
+ * @brief Control commands from WiFi clients and USB
+ *
+ * Lines received from clients of the server, or the stream host, and
+ * from USB are parsed and answered on core1. Changes to the settings
+ * are picked up by the sampling loop on core0 between samples, so it
+ * never restarts. Commands:
+ *
+ * - set period <time>: time between samples
+ * - set format json|csv: format of the output
+ * - burst <time>: sample at @ref AQ_CTL_BURST_PERIOD_MS for a while,
+ *   0 to stop
+ * - stats: print the settings and timing of the sampling loop
+ * - flush log: push out output still held in the stdio layer
+ * - subscribe <metrics>|all [every <n>] [json|csv]: get only some
+ *   metrics every n samples instead of full frames, see
+ *   @ref aq_sub_spec
+ * - unsubscribe: get full frames again
+ * - resume <seq>: get the frames from seq on again, after a
+ *   reconnect. Frames are numbered by their seq field, or first
+ *   column in CSV. Frames no longer kept are counted as lost.
+ *
+ * Times are in seconds, or with a suffix of ms, s or m.
+ */
+
+#ifndef AQ_CTL_H
+#define AQ_CTL_H
+
+#include "aq-error-state.h"
+#include "esp-at-modem.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "pico/stdlib.h"
+
+/** @brief Longest command line, longer ones are dropped */
+#ifndef AQ_CTL_LINE_LEN
+#define AQ_CTL_LINE_LEN 64
+#endif /* #ifndef AQ_CTL_LINE_LEN */
+
+/** @brief Shortest time between samples that may be set */
+#ifndef AQ_CTL_PERIOD_MIN_MS
+#define AQ_CTL_PERIOD_MIN_MS 1000
+#endif /* #ifndef AQ_CTL_PERIOD_MIN_MS */
+
+/** @brief Longest time between samples that may be set */
+#ifndef AQ_CTL_PERIOD_MAX_MS
+#define AQ_CTL_PERIOD_MAX_MS 3600000
+#endif /* #ifndef AQ_CTL_PERIOD_MAX_MS */
+
+/** @brief Time between samples during a burst, in practice as fast as
+ * the sensors allow */
+#ifndef AQ_CTL_BURST_PERIOD_MS
+#define AQ_CTL_BURST_PERIOD_MS 1000
+#endif /* #ifndef AQ_CTL_BURST_PERIOD_MS */
+
+/** @brief Longest burst */
+#ifndef AQ_CTL_BURST_MAX_MS
+#define AQ_CTL_BURST_MAX_MS 600000
+#endif /* #ifndef AQ_CTL_BURST_MAX_MS */
+
+/** @brief Format of the output of each sample */
+typedef enum {
+	AQ_CTL_FORMAT_JSON, /**< One JSON object per line */
+	AQ_CTL_FORMAT_CSV /**< One line of values per sample */
+} aq_ctl_format;
+
+/** @brief Settings of the sampling loop */
+typedef struct {
+	uint32_t period_ms; /**< @brief Time between samples */
+	aq_ctl_format format; /**< @brief Format of the output */
+	absolute_time_t burst_until; /**< @brief End of a burst */
+	bool header; /**< @brief Print the CSV header before the next line */
+} aq_ctl_settings;
+
+/** @brief Start taking commands, with @p s as the first settings
+ *
+ * @param cfg Module of the WiFi clients, or NULL for USB only. Call
+ * after @ref aq_http_init, so HTTP requests are told apart first.
+ *
+ * @return 0 on success, <0 if no URC callback is free
+ */
+int aq_ctl_init(esp_at_cfg *cfg, aq_status *status,
+		const aq_ctl_settings *s);
+
+/** @brief Read USB and run the received commands, from core1 */
+void aq_ctl_process();
+
+/** @brief Wait on core0 until @p time or a change of the settings
+ *
+ * @return true if the wait ended early for a change
+ */
+bool aq_ctl_wait_until(absolute_time_t time);
+
+/** @brief Take over changes of the settings, between samples
+ *
+ * @return true if anything changed
+ */
+bool aq_ctl_apply(aq_ctl_settings *s);
+
+/** @brief Time to the next sample with the settings @p s */
+uint32_t aq_ctl_period_ms(const aq_ctl_settings *s);
+
+#endif /* #ifndef AQ_CTL_H */
@@ -52,6 +52,12 @@
 #define AQ_STATUS_W_PM2_5_NO_DATA		S_T(0x00000040)
 #define AQ_STATUS_I_PM2_5_READING		S_T(0x00000080)
 
+/* SCD4x CO2 sensor */
+#define AQ_STATUS_E_SCD4X_COMM_FAIL		S_T(0x00010000)
+#define AQ_STATUS_E_SCD4X_GENERAL_FAIL		S_T(0x00020000)
+#define AQ_STATUS_W_SCD4X_NO_DATA		S_T(0x00040000)
+#define AQ_STATUS_I_SCD4X_READING		S_T(0x00080000)
+
 /* Masks to define current state */
 #define AQ_STATUS_MASK_WAIT			\
 	(AQ_STATUS_U_REQ_USB |			\
@@ -61,14 +67,16 @@
 	(AQ_STATUS_I_CLIENT_CONNECTED |		\
 	 AQ_STATUS_I_USBCOMM_CONNECTED |	\
 	 AQ_STATUS_I_BME680_READING |		\
-	 AQ_STATUS_I_PM2_5_READING)
+	 AQ_STATUS_I_PM2_5_READING |		\
+	 AQ_STATUS_I_SCD4X_READING)
 
 #define AQ_STATUS_MASK_WARNING			\
 	(AQ_STATUS_W_BATT_LOW |			\
 	 AQ_STATUS_W_WIFI_DISCONNECTED |	\
 	 AQ_STATUS_W_BME680_GAS_INVALID |	\
 	 AQ_STATUS_W_BME680_GAS_UNSTABLE |	\
-	 AQ_STATUS_W_PM2_5_NO_DATA)
+	 AQ_STATUS_W_PM2_5_NO_DATA |		\
+	 AQ_STATUS_W_SCD4X_NO_DATA)
 
 #define AQ_STATUS_MASK_ERROR			\
 	(~(AQ_STATUS_MASK_WAIT |		\
@@ -80,6 +88,7 @@
 #define AQ_STATUS_REGION_WIFI			S_T(0xff000000)
 #define AQ_STATUS_REGION_BME680			S_T(0x0000ff00)
 #define AQ_STATUS_REGION_PM2_5			S_T(0x000000f0)
+#define AQ_STATUS_REGION_SCD4X			S_T(0x000f0000)
 
 /* Color definitions, 24-bit RGB */
 #define AQ_STATUS_COLOR_OK			0x001400
@@ -0,0 +1,144 @@
+/**
+ * @file aq-http.c
+ * @author Tyler J. Anderson
+ * @brief HTTP endpoint with the latest reading and metrics
+ */
+
+#include "aq-http.h"
+#include "aq-sensor.h"
+#include "esp-at-http.h"
+#include "debugmsg.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+
+#define AQ_HTTP_METRICS_TYPE \
+	"application/openmetrics-text; version=1.0.0; charset=utf-8"
+
+#define AQ_HTTP_EOF "# EOF\n"
+
+static esp_at_http _srv;
+static char _latest[2 * AQ_HTTP_LATEST_LEN];
+static char _metrics[2 * AQ_HTTP_METRICS_LEN];
+static int _route_latest = -1;
+static int _route_metrics = -1;
+static bool _aq_http_is_init = false;
+
+/* Frame being collected for /latest, NULL between frames */
+static char *_frame = NULL;
+static size_t _frame_size;
+static size_t _frame_len;
+static bool _frame_drop = false;
+
+int aq_http_init(esp_at_cfg *cfg)
+{
+	if (esp_at_http_init(&_srv, cfg) < 0) {
+		return -1;
+	}
+
+	_route_latest = esp_at_http_route_add(&_srv, "/latest",
+					      "application/json", _latest,
+					      AQ_HTTP_LATEST_LEN);
+	_route_metrics = esp_at_http_route_add(&_srv, "/metrics",
+					       AQ_HTTP_METRICS_TYPE,
+					       _metrics, AQ_HTTP_METRICS_LEN);
+
+	if (_route_latest < 0 || _route_metrics < 0) {
+		return -1;
+	}
+
+	_aq_http_is_init = true;
+
+	return 0;
+}
+
+void aq_http_frame(const char *s, size_t len)
+{
+	if (!_aq_http_is_init) {
+		return;
+	}
+
+	/* A frame is rendered in the spare body of /latest. If that is
+	 * still being sent, or the frame doesn't fit, the last one
+	 * stays up. */
+	if (!_frame && !_frame_drop) {
+		_frame = esp_at_http_render(&_srv, _route_latest,
+					    &_frame_size);
+		_frame_len = 0;
+		_frame_drop = !_frame;
+	}
+
+	if (_frame && _frame_len + len <= _frame_size) {
+		memcpy(&_frame[_frame_len], s, len);
+		_frame_len += len;
+	} else if (_frame) {
+		DEBUGMSG("Frame too long for /latest");
+		_frame = NULL;
+		_frame_drop = true;
+	}
+
+	if (len && s[len - 1] == '\n') {
+		if (_frame) {
+			esp_at_http_publish(&_srv, _route_latest, _frame_len);
+		}
+
+		_frame = NULL;
+		_frame_drop = false;
+	}
+}
+
+void aq_http_sample(const aq_status *s)
+{
+	const aq_sensor_stats *stats = aq_sensor_get_stats();
+	size_t size;
+	char *buf;
+	int len;
+	int ret;
+
+	if (!_aq_http_is_init) {
+		return;
+	}
+
+	buf = esp_at_http_render(&_srv, _route_metrics, &size);
+
+	if (!buf) {
+		return;
+	}
+
+	len = snprintf(buf, size,
+		       "# TYPE aq_status gauge\n"
+		       "aq_status %lu\n"
+		       "# TYPE aq_samples counter\n"
+		       "aq_samples_total %lu\n"
+		       "# TYPE aq_sample_duration_seconds gauge\n"
+		       "aq_sample_duration_seconds %.6f\n",
+		       (unsigned long) s->status,
+		       (unsigned long) stats->samples,
+		       stats->total_us / 1e6);
+
+	if (len < 0 || (size_t) len >= size) {
+		return;
+	}
+
+	ret = aq_sensor_metrics_all(&buf[len], size - len);
+
+	if (ret < 0 ||
+	    (size_t) (len + ret) + strlen(AQ_HTTP_EOF) >= size) {
+		DEBUGMSG("Metrics too long for /metrics");
+		return;
+	}
+
+	len += ret;
+	memcpy(&buf[len], AQ_HTTP_EOF, strlen(AQ_HTTP_EOF));
+	len += strlen(AQ_HTTP_EOF);
+
+	esp_at_http_publish(&_srv, _route_metrics, len);
+}
+
+void aq_http_process()
+{
+	if (_aq_http_is_init) {
+		esp_at_http_process(&_srv);
+	}
+}
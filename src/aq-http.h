@@ -0,0 +1,49 @@
+/**
+ * @file aq-http.h
+ * @author Tyler J. Anderson
+ * @brief HTTP endpoint with the latest reading and metrics
+ *
+ * Serves /latest, the last whole frame of output, and /metrics, the
+ * readings in the OpenMetrics text format, from the WiFi server. Both
+ * are rendered once per sample, so scrapes cost no sensor I/O.
+ */
+
+#ifndef AQ_HTTP_H
+#define AQ_HTTP_H
+
+#include "aq-error-state.h"
+#include "esp-at-modem.h"
+
+#include <stddef.h>
+
+/** @brief Room for the frame served at /latest */
+#ifndef AQ_HTTP_LATEST_LEN
+#define AQ_HTTP_LATEST_LEN 3072
+#endif /* #ifndef AQ_HTTP_LATEST_LEN */
+
+/** @brief Room for the text served at /metrics */
+#ifndef AQ_HTTP_METRICS_LEN
+#define AQ_HTTP_METRICS_LEN 3072
+#endif /* #ifndef AQ_HTTP_METRICS_LEN */
+
+/** @brief Serve /latest and /metrics on the server of @p cfg
+ *
+ * Call before @ref aq_stdio_init starts the core that serves them.
+ *
+ * @return 0 on success, <0 on failure
+ */
+int aq_http_init(esp_at_cfg *cfg);
+
+/** @brief Add a piece of output to the frame for /latest
+ *
+ * The frame is published when a piece ends a line.
+ */
+void aq_http_frame(const char *s, size_t len);
+
+/** @brief Render /metrics from the last sample */
+void aq_http_sample(const aq_status *s);
+
+/** @brief Answer the requests received, from the core of the module */
+void aq_http_process();
+
+#endif /* #ifndef AQ_HTTP_H */
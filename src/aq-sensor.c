@@ -0,0 +1,410 @@
+/**
+ * @file aq-sensor.c
+ * @author Tyler J. Anderson
+ * @brief Sensor registry and sampling loop implementation
+ */
+
+#include "aq-sensor.h"
+#include "aq-stdio.h"
+#include "debugmsg.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define ARRAY_LEN(array) sizeof(array)/sizeof(array[0])
+
+static aq_sensor _aq_sensors[AQ_SENSOR_MAX];
+static unsigned int _aq_nsensors = 0;
+static aq_sensor_stats _aq_stats;
+static uint32_t _aq_driver_us;
+
+/* Metrics of all sensors, and the sensor of each */
+static aq_sensor_metric _aq_metrics[AQ_SENSOR_MAX * AQ_SENSOR_METRICS_MAX];
+static uint8_t _aq_metric_sensor[AQ_SENSOR_MAX * AQ_SENSOR_METRICS_MAX];
+
+static int _aq_sensor_call(int (*op)(aq_sensor*), aq_sensor *s);
+static void _aq_sensor_expire();
+
+int aq_sensor_register(const aq_sensor_ops *ops, void *ctx)
+{
+	aq_sensor *s;
+
+	if (!ops || _aq_nsensors >= ARRAY_LEN(_aq_sensors)) {
+		return -1;
+	}
+
+	s = &_aq_sensors[_aq_nsensors];
+	s->ops = ops;
+	s->ctx = ctx;
+	s->status = NULL;
+	s->rslt = 0;
+	s->valid = false;
+	s->millis = 0;
+
+	DEBUGDATA("Registered sensor", ops->name, "%s");
+
+	return _aq_nsensors++;
+}
+
+int aq_sensor_init_all(aq_status *status)
+{
+	int n = 0;
+
+	for (unsigned int i = 0; i < _aq_nsensors; ++i) {
+		aq_sensor *s = &_aq_sensors[i];
+
+		s->status = status;
+		s->rslt = s->ops->init ? s->ops->init(s) : 0;
+
+		if (s->rslt < 0) {
+			printf("ERROR: Failed to initialize %s with code %d\n",
+			       s->ops->name, s->rslt);
+			continue;
+		}
+
+		++n;
+	}
+
+	return n;
+}
+
+int aq_sensor_sample_all()
+{
+	const absolute_time_t deadline =
+		make_timeout_time_ms(AQ_SENSOR_DEADLINE_MS);
+	uint32_t start = time_us_32();
+	uint32_t wait_us = 0;
+	unsigned int pending = 0;
+	int n = 0;
+
+	_aq_driver_us = 0;
+
+	/* Start every sensor first so the conversion times overlap.
+	 * Sensors without start and poll only run in collect. */
+	for (unsigned int i = 0; i < _aq_nsensors; ++i) {
+		aq_sensor *s = &_aq_sensors[i];
+
+		s->valid = false;
+		s->rslt = _aq_sensor_call(s->ops->start, s);
+
+		if (s->rslt >= 0) {
+			++pending;
+		}
+	}
+
+	while (pending) {
+		pending = 0;
+
+		for (unsigned int i = 0; i < _aq_nsensors; ++i) {
+			aq_sensor *s = &_aq_sensors[i];
+
+			if (s->rslt != AQ_SENSOR_PENDING) {
+				continue;
+			}
+
+			s->rslt = s->ops->poll ?
+				_aq_sensor_call(s->ops->poll, s) :
+				AQ_SENSOR_READY;
+
+			if (s->rslt == AQ_SENSOR_PENDING) {
+				++pending;
+			}
+		}
+
+		/* One sensor stuck on its bus can't hold up sampling */
+		if (pending && time_reached(deadline)) {
+			_aq_sensor_expire();
+			break;
+		}
+
+		if (pending) {
+			uint32_t t = time_us_32();
+
+			sleep_us(AQ_SENSOR_POLL_US);
+			wait_us += time_us_32() - t;
+		}
+	}
+
+	for (unsigned int i = 0; i < _aq_nsensors; ++i) {
+		aq_sensor *s = &_aq_sensors[i];
+
+		if (s->rslt < 0) {
+			continue;
+		}
+
+		s->rslt = _aq_sensor_call(s->ops->collect, s);
+		s->millis = to_ms_since_boot(get_absolute_time());
+
+		if (s->rslt >= 0) {
+			s->valid = true;
+			++n;
+		}
+	}
+
+	_aq_stats.samples++;
+	_aq_stats.total_us = time_us_32() - start;
+	_aq_stats.driver_us = _aq_driver_us;
+	_aq_stats.wait_us = wait_us;
+	_aq_stats.dispatch_us = _aq_stats.total_us - _aq_driver_us - wait_us;
+
+	if (_aq_stats.dispatch_us > _aq_stats.dispatch_max_us) {
+		_aq_stats.dispatch_max_us = _aq_stats.dispatch_us;
+	}
+
+	DEBUGDATA("Sensor sample time us", _aq_stats.total_us, "%lu");
+	DEBUGDATA("Sensor dispatch overhead us", _aq_stats.dispatch_us,
+		  "%lu");
+
+	if (n == 0 && _aq_nsensors > 0) {
+		return -1;
+	}
+
+	return n;
+}
+
+void aq_sensor_serialize_all()
+{
+	bool first = true;
+
+	for (unsigned int i = 0; i < _aq_nsensors; ++i) {
+		aq_sensor *s = &_aq_sensors[i];
+
+		if (!s->valid || !s->ops->serialize) {
+			continue;
+		}
+
+		if (!first) {
+			aq_nprintf(", ");
+		}
+
+		s->ops->serialize(s);
+		first = false;
+	}
+}
+
+unsigned int aq_sensor_metrics_get(aq_sensor_metric *m, uint8_t *sensor,
+				   unsigned int max)
+{
+	unsigned int n = 0;
+
+	for (unsigned int i = 0; i < _aq_nsensors && n < max; ++i) {
+		aq_sensor *s = &_aq_sensors[i];
+		unsigned int k;
+
+		if (!s->ops->metrics) {
+			continue;
+		}
+
+		k = s->ops->metrics(s, &m[n], max - n);
+
+		for (unsigned int j = 0; j < k; ++j) {
+			sensor[n++] = i;
+		}
+	}
+
+	return n;
+}
+
+int aq_sensor_metric_column(char *buf, size_t size, unsigned int sensor,
+			    const aq_sensor_metric *m)
+{
+	int len = snprintf(buf, size, "%u.%s%s", sensor, m->name,
+			   m->label ? "." : "");
+
+	if (len < 0 || (size_t) len >= size) {
+		return -1;
+	}
+
+	/* The label without quotes, so the name needs none either */
+	for (const char *c = m->label; c && *c; ++c) {
+		if (*c == '"') {
+			continue;
+		}
+
+		if ((size_t) len >= size - 1) {
+			return -1;
+		}
+
+		buf[len++] = *c;
+	}
+
+	buf[len] = '\0';
+
+	return len;
+}
+
+int aq_sensor_metrics_all(char *buf, size_t size)
+{
+	unsigned int n = 0;
+	unsigned int k;
+	size_t len = 0;
+
+	k = aq_sensor_metrics_get(_aq_metrics, _aq_metric_sensor,
+				  ARRAY_LEN(_aq_metrics));
+
+	/* Only sensors with valid data are listed */
+	for (unsigned int i = 0; i < k; ++i) {
+		if (_aq_sensors[_aq_metric_sensor[i]].valid) {
+			_aq_metrics[n] = _aq_metrics[i];
+			_aq_metric_sensor[n++] = _aq_metric_sensor[i];
+		}
+	}
+
+	/* A family may only be listed once, so gather its samples from
+	 * all sensors when it first comes up */
+	for (unsigned int i = 0; i < n; ++i) {
+		const char *name = _aq_metrics[i].name;
+		bool seen = false;
+		int ret;
+
+		for (unsigned int j = 0; j < i && !seen; ++j) {
+			seen = strcmp(_aq_metrics[j].name, name) == 0;
+		}
+
+		if (seen) {
+			continue;
+		}
+
+		ret = snprintf(&buf[len], size - len, "# TYPE %s gauge\n", name);
+
+		if (ret < 0 || (size_t) ret >= size - len) {
+			return -1;
+		}
+
+		len += ret;
+
+		for (unsigned int j = i; j < n; ++j) {
+			aq_sensor_metric *m = &_aq_metrics[j];
+			aq_sensor *s = &_aq_sensors[_aq_metric_sensor[j]];
+
+			if (strcmp(m->name, name) != 0) {
+				continue;
+			}
+
+			ret = snprintf(&buf[len], size - len,
+				       "%s{sensor=\"%s\",index=\"%u\"%s%s} %.9g\n",
+				       name, s->ops->name, _aq_metric_sensor[j],
+				       m->label ? "," : "",
+				       m->label ? m->label : "", m->value);
+
+			if (ret < 0 || (size_t) ret >= size - len) {
+				return -1;
+			}
+
+			len += ret;
+		}
+	}
+
+	return len;
+}
+
+void aq_sensor_csv_all(bool header)
+{
+	aq_sensor_metric m[AQ_SENSOR_METRICS_MAX];
+
+	for (unsigned int i = 0; i < _aq_nsensors; ++i) {
+		aq_sensor *s = &_aq_sensors[i];
+		char line[AQ_STDIO_BUFFER_SIZE];
+		size_t len = 0;
+		unsigned int n;
+
+		if (!s->ops->metrics) {
+			continue;
+		}
+
+		n = s->ops->metrics(s, m, ARRAY_LEN(m));
+
+		for (unsigned int j = 0; j < n && header; ++j) {
+			line[0] = ',';
+
+			if (aq_sensor_metric_column(&line[1], sizeof(line) - 1,
+						    i, &m[j]) >= 0) {
+				aq_nprintf("%s", line);
+			}
+		}
+
+		/* The values of a sensor go out in one piece */
+		for (unsigned int j = 0; j < n && !header; ++j) {
+			int ret = s->valid ?
+				snprintf(&line[len], sizeof(line) - len,
+					 ",%.9g", m[j].value) :
+				snprintf(&line[len], sizeof(line) - len, ",");
+
+			if (ret < 0 || (size_t) ret >= sizeof(line) - len) {
+				break;
+			}
+
+			len += ret;
+		}
+
+		if (!header && len) {
+			aq_nprintf("%s", line);
+		}
+	}
+}
+
+void aq_sensor_deinit_all()
+{
+	for (unsigned int i = 0; i < _aq_nsensors; ++i) {
+		aq_sensor *s = &_aq_sensors[i];
+
+		if (s->ops->deinit) {
+			s->ops->deinit(s);
+		}
+	}
+}
+
+unsigned int aq_sensor_count()
+{
+	return _aq_nsensors;
+}
+
+aq_sensor *aq_sensor_get(unsigned int i)
+{
+	if (i >= _aq_nsensors) {
+		return NULL;
+	}
+
+	return &_aq_sensors[i];
+}
+
+const aq_sensor_stats *aq_sensor_get_stats()
+{
+	return &_aq_stats;
+}
+
+int _aq_sensor_call(int (*op)(aq_sensor*), aq_sensor *s)
+{
+	uint32_t t;
+	int rslt;
+
+	if (!op) {
+		return 0;
+	}
+
+	t = time_us_32();
+	rslt = op(s);
+	_aq_driver_us += time_us_32() - t;
+
+	return rslt;
+}
+
+void _aq_sensor_expire()
+{
+	for (unsigned int i = 0; i < _aq_nsensors; ++i) {
+		aq_sensor *s = &_aq_sensors[i];
+
+		if (s->rslt != AQ_SENSOR_PENDING) {
+			continue;
+		}
+
+		DEBUGDATA("Sensor timed out", s->ops->name, "%s");
+
+		if (s->ops->cancel) {
+			s->ops->cancel(s);
+		}
+
+		s->rslt = AQ_SENSOR_E_TIMEOUT;
+		_aq_stats.timeouts++;
+	}
+}
@@ -0,0 +1,210 @@
+/**
+ * @file aq-sensor.h
+ * @author Tyler J. Anderson
+ * @brief Generic sensor driver interface and sampling registry
+ */
+
+#ifndef AQ_SENSOR_H
+#define AQ_SENSOR_H
+
+#include "aq-error-state.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "pico/stdlib.h"
+
+/**
+ * @defgroup aq-sensor Air Quality Sensor Registry
+ * @{
+ */
+
+#ifndef AQ_SENSOR_MAX
+#define AQ_SENSOR_MAX 8
+#endif /* #ifndef AQ_SENSOR_MAX */
+
+/** @brief Microseconds to wait between polls of pending sensors */
+#ifndef AQ_SENSOR_POLL_US
+#define AQ_SENSOR_POLL_US 1000
+#endif /* #ifndef AQ_SENSOR_POLL_US */
+
+/** @brief Longest a sample waits for pending sensors, the ones still
+ * pending then are cancelled and fail */
+#ifndef AQ_SENSOR_DEADLINE_MS
+#define AQ_SENSOR_DEADLINE_MS 2000
+#endif /* #ifndef AQ_SENSOR_DEADLINE_MS */
+
+/** @brief Max metrics a sensor reports, see @ref aq_sensor_ops */
+#ifndef AQ_SENSOR_METRICS_MAX
+#define AQ_SENSOR_METRICS_MAX 12
+#endif /* #ifndef AQ_SENSOR_METRICS_MAX */
+
+/* Return values of the poll operation */
+#define AQ_SENSOR_PENDING			0
+#define AQ_SENSOR_READY				1
+
+/* Result of a sensor cancelled at the deadline */
+#define AQ_SENSOR_E_TIMEOUT			-2
+
+typedef struct aq_sensor_node aq_sensor;
+
+/** @brief A collected value as an OpenMetrics sample */
+typedef struct {
+	const char *name; /**< @brief Metric family, like aq_co2_ppm */
+	const char *label; /**< @brief Extra label like size="2.5", or NULL */
+	double value;
+} aq_sensor_metric;
+
+/** @brief Driver operations for a sensor type
+ *
+ * All operations return 0 (or @ref AQ_SENSOR_READY for poll) on
+ * success and <0 on failure. Drivers report their own status bits
+ * through the @p status member of the instance. Any operation may be
+ * NULL if the sensor type has nothing to do in that step.
+ */
+typedef struct {
+	const char *name; /**< @brief Sensor type name */
+
+	/** @brief Bring up the hardware for the instance */
+	int (*init)(aq_sensor *s);
+
+	/** @brief Trigger a new measurement */
+	int (*start)(aq_sensor *s);
+
+	/** @brief Check if a started measurement can be collected
+	 *
+	 * @return @ref AQ_SENSOR_READY, @ref AQ_SENSOR_PENDING or
+	 * <0 on failure
+	 */
+	int (*poll)(aq_sensor *s);
+
+	/** @brief Abandon a measurement still pending at the deadline
+	 * of the sample, so the next one can be started */
+	void (*cancel)(aq_sensor *s);
+
+	/** @brief Read the finished measurement into the context */
+	int (*collect)(aq_sensor *s);
+
+	/** @brief Print the collected data as a JSON object */
+	void (*serialize)(aq_sensor *s);
+
+	/** @brief Report the collected data as metrics
+	 *
+	 * @return Number of entries of @p m filled, at most @p max
+	 */
+	unsigned int (*metrics)(aq_sensor *s, aq_sensor_metric *m,
+				unsigned int max);
+
+	/** @brief Release the hardware for the instance */
+	void (*deinit)(aq_sensor *s);
+} aq_sensor_ops;
+
+/** @brief A registered sensor instance */
+struct aq_sensor_node {
+	const aq_sensor_ops *ops; /**< @brief Driver for the instance */
+	void *ctx; /**< @brief Driver specific instance data */
+	aq_status *status; /**< @brief Program status register */
+	int rslt; /**< @brief Result of the last sample */
+	bool valid; /**< @brief Collected data may be serialized */
+	uint32_t millis; /**< @brief Time data was collected */
+};
+
+/** @brief Timing of the last call to @ref aq_sensor_sample_all
+ *
+ * @p dispatch_us is the time spent in the registry itself, that is
+ * the total time less the time spent inside driver operations and
+ * waiting for pending sensors.
+ */
+typedef struct {
+	uint32_t samples; /**< @brief Number of samples taken */
+	uint32_t total_us; /**< @brief Duration of the last sample */
+	uint32_t driver_us; /**< @brief Time in driver operations */
+	uint32_t wait_us; /**< @brief Time waiting on pending sensors */
+	uint32_t dispatch_us; /**< @brief Registry overhead */
+	uint32_t dispatch_max_us; /**< @brief Worst overhead seen */
+	uint32_t timeouts; /**< @brief Sensors cancelled at the deadline */
+} aq_sensor_stats;
+
+/** @brief Add a sensor instance to the registry
+ *
+ * @return Index of the sensor on success, <0 if the registry is full
+ */
+int aq_sensor_register(const aq_sensor_ops *ops, void *ctx);
+
+/** @brief Initialize all registered sensors
+ *
+ * @return Number of sensors that initialized successfully
+ */
+int aq_sensor_init_all(aq_status *status);
+
+/** @brief Start, wait for, and collect all registered sensors
+ *
+ * Measurements are started on every sensor before any of them is
+ * waited on, so conversion times overlap. Sensors still pending after
+ * @ref AQ_SENSOR_DEADLINE_MS are cancelled and left out.
+ *
+ * @return Number of sensors with valid data, <0 if all failed
+ */
+int aq_sensor_sample_all();
+
+/** @brief Print the data of all sensors with valid data, separated
+ * by commas
+ */
+void aq_sensor_serialize_all();
+
+/** @brief Gather the metrics of all sensors, valid data or not
+ *
+ * @param sensor Set to the index of the sensor of each entry
+ *
+ * @return Number of entries filled, at most @p max
+ */
+unsigned int aq_sensor_metrics_get(aq_sensor_metric *m, uint8_t *sensor,
+				   unsigned int max);
+
+/** @brief Write the column name of a metric, like
+ * 2.aq_particles_per_deciliter.size=0.3
+ *
+ * @return Length of the name, <0 if it didn't fit in @p size
+ */
+int aq_sensor_metric_column(char *buf, size_t size, unsigned int sensor,
+			    const aq_sensor_metric *m);
+
+/** @brief Render the metrics of all sensors with valid data in the
+ * OpenMetrics text format
+ *
+ * Samples of a family are grouped under one TYPE line, and labeled
+ * with the sensor name and index. The closing EOF line is left to the
+ * caller.
+ *
+ * @return Length of the text, <0 if it didn't fit in @p size
+ */
+int aq_sensor_metrics_all(char *buf, size_t size);
+
+/** @brief Print the metrics of all sensors as CSV fields, each
+ * preceded by a comma
+ *
+ * Sensors without valid data leave their fields empty, so columns
+ * stay in place from one line to the next.
+ *
+ * @param header Print the column names instead of the values
+ */
+void aq_sensor_csv_all(bool header);
+
+/** @brief De-initialize all registered sensors */
+void aq_sensor_deinit_all();
+
+/** @brief Number of registered sensors */
+unsigned int aq_sensor_count();
+
+/** @brief Get registered sensor by index, NULL if out of range */
+aq_sensor *aq_sensor_get(unsigned int i);
+
+/** @brief Get timing of the last sample */
+const aq_sensor_stats *aq_sensor_get_stats();
+
+/**
+ * @}
+ */
+
+#endif /* #ifndef AQ_SENSOR_H */
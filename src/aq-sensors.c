@@ -0,0 +1,659 @@
+/**
+ * @file aq-sensors.c
+ * @author Tyler J. Anderson
+ * @brief Sensor drivers for the Air Quality sensor registry
+ */
+
+#include "aq-sensors.h"
+#include "aq-stdio.h"
+#include "debugmsg.h"
+
+#include <pm2_5-error.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#include "hardware/adc.h"
+
+#ifndef AIR_QUALITY_BATT_LOW_V
+#define AIR_QUALITY_BATT_LOW_V ((double) 3.60)
+#endif
+
+static void _aq_bme680_handle_error(int8_t i_errno, aq_status *s);
+static void _aq_bme680_fetched(bme680_intf *intf, int8_t rslt, void *ctx);
+static void _aq_pm2_5_handle_error(int8_t i_errno, aq_status *s);
+static void _aq_scd4x_handle_error(int8_t i_errno, aq_status *s);
+static unsigned int _aq_copy_metrics(aq_sensor_metric *m, unsigned int max,
+				     const aq_sensor_metric *v,
+				     unsigned int n);
+
+#define ARRAY_LEN(array) sizeof(array)/sizeof(array[0])
+
+/*
+**********************************************************************
+************************** BME680 DRIVER *****************************
+**********************************************************************
+*/
+
+static int _aq_bme680_init(aq_sensor *s)
+{
+	aq_bme680_ctx *c = (aq_bme680_ctx*) s->ctx;
+	int ret;
+
+	c->intf.i2c = c->i2c; /* NULL i2c will select default */
+	c->intf.timeout = 1000; /* 1s timeout on i2c read/write */
+	c->mode = FORCED_MODE;
+
+	ret = bme680_init(&c->intf, c->addr, c->mode);
+	_aq_bme680_handle_error(ret, s->status);
+
+	return ret < 0 ? ret : 0;
+}
+
+static int _aq_bme680_start(aq_sensor *s)
+{
+	aq_bme680_ctx *c = (aq_bme680_ctx*) s->ctx;
+	uint32_t dur;
+	int ret;
+
+	aq_status_set_status(AQ_STATUS_I_BME680_READING, s->status);
+
+	ret = bme680_start(c->mode, &c->intf, &dur);
+
+	if (ret != 0) {
+		aq_status_unset_status(AQ_STATUS_I_BME680_READING,
+				       s->status);
+		_aq_bme680_handle_error(ret, s->status);
+		return ret < 0 ? ret : -1;
+	}
+
+	c->ready = make_timeout_time_us(dur);
+	c->fetching = false;
+	c->fetched = false;
+
+	return 0;
+}
+
+static int _aq_bme680_poll(aq_sensor *s)
+{
+	aq_bme680_ctx *c = (aq_bme680_ctx*) s->ctx;
+
+	if (absolute_time_diff_us(get_absolute_time(), c->ready) > 0) {
+		return AQ_SENSOR_PENDING;
+	}
+
+	/* Burst read the results in the background. If the read
+	 * cannot be queued or fails, collect reads them itself */
+	if (!c->fetching) {
+		c->fetching = true;
+
+		if (bme680_read_field_block_async(&c->intf,
+						  _aq_bme680_fetched,
+						  c) != BME68X_OK) {
+			return AQ_SENSOR_READY;
+		}
+	}
+
+	if (!c->fetched && !bme680_i2c_idle(&c->intf)) {
+		return AQ_SENSOR_PENDING;
+	}
+
+	return AQ_SENSOR_READY;
+}
+
+static void _aq_bme680_cancel(aq_sensor *s)
+{
+	aq_bme680_ctx *c = (aq_bme680_ctx*) s->ctx;
+
+	/* The forced measurement ends on its own, the next start
+	 * begins another */
+	bme680_i2c_cancel(&c->intf);
+	aq_status_unset_status(AQ_STATUS_I_BME680_READING, s->status);
+}
+
+static int _aq_bme680_collect(aq_sensor *s)
+{
+	aq_bme680_ctx *c = (aq_bme680_ctx*) s->ctx;
+	int ret;
+
+	/* Decodes the fetched field block, if any */
+	ret = bme680_collect(c->mode, &c->intf, &c->data);
+
+	aq_status_unset_status(AQ_STATUS_I_BME680_READING, s->status);
+
+	/* Check BME680 sensor status bit for relevent
+	 * warnings */
+	if (c->data.status & BME68X_HEAT_STAB_MSK)
+		aq_status_unset_status(AQ_STATUS_W_BME680_GAS_UNSTABLE,
+				       s->status);
+	else
+		aq_status_set_status(AQ_STATUS_W_BME680_GAS_UNSTABLE,
+				     s->status);
+	if (c->data.status & BME68X_GASM_VALID_MSK)
+		aq_status_unset_status(AQ_STATUS_W_BME680_GAS_INVALID,
+				       s->status);
+	else
+		aq_status_set_status(AQ_STATUS_W_BME680_GAS_INVALID,
+				     s->status);
+
+	_aq_bme680_handle_error(ret, s->status);
+
+	/* Nothing to print without new data */
+	return ret == 0 ? 0 : -1;
+}
+
+static void _aq_bme680_serialize(aq_sensor *s)
+{
+	aq_bme680_ctx *c = (aq_bme680_ctx*) s->ctx;
+	struct bme68x_data *d = &c->data;
+	unsigned long millis = s->millis;
+
+	aq_nprintf("{\"sensor\": \"BME680\", \"data\": [");
+
+	aq_nprintf("{\"name\": \"temperature\", "
+		   "\"value\": %.2f, "
+		   "\"unit\": \"degC\", "
+		   "\"timemillis\": %lu}, ", d->temperature, millis);
+
+	aq_nprintf("{\"name\": \"pressure\", "
+		   "\"value\": %.2f, "
+		   "\"unit\": \"Pa\", "
+		   "\"timemillis\": %lu}, ", d->pressure, millis);
+
+	aq_nprintf("{\"name\": \"humidity\", "
+		   "\"value\": %.2f, "
+		   "\"unit\": \"%%\", "
+		   "\"timemillis\": %lu}, ", d->humidity, millis);
+
+	aq_nprintf("{\"name\": \"gas resistance\", "
+		   "\"value\": %.2f, "
+		   "\"unit\": \"Ohms\", "
+		   "\"timemillis\": %lu}], ",
+		   d->gas_resistance, millis);
+
+	aq_nprintf("\"status\": {"
+		   "\"sensor\": \"%#x\", "
+		   "\"address\": \"%#x\"}}",
+		   d->status, c->intf.dev_addr);
+}
+
+static unsigned int _aq_bme680_metrics(aq_sensor *s, aq_sensor_metric *m,
+				       unsigned int max)
+{
+	aq_bme680_ctx *c = (aq_bme680_ctx*) s->ctx;
+	struct bme68x_data *d = &c->data;
+	const aq_sensor_metric v[] = {
+		{"aq_temperature_celsius", NULL, d->temperature},
+		{"aq_pressure_pascals", NULL, d->pressure},
+		{"aq_humidity_percent", NULL, d->humidity},
+		{"aq_gas_resistance_ohms", NULL, d->gas_resistance}
+	};
+
+	return _aq_copy_metrics(m, max, v, ARRAY_LEN(v));
+}
+
+static void _aq_bme680_deinit(aq_sensor *s)
+{
+	aq_bme680_ctx *c = (aq_bme680_ctx*) s->ctx;
+
+	bme680_deinit(&c->intf);
+}
+
+const aq_sensor_ops aq_bme680_ops = {
+	.name = "BME680",
+	.init = _aq_bme680_init,
+	.start = _aq_bme680_start,
+	.poll = _aq_bme680_poll,
+	.cancel = _aq_bme680_cancel,
+	.collect = _aq_bme680_collect,
+	.serialize = _aq_bme680_serialize,
+	.metrics = _aq_bme680_metrics,
+	.deinit = _aq_bme680_deinit
+};
+
+void _aq_bme680_fetched(bme680_intf *intf, int8_t rslt, void *ctx)
+{
+	aq_bme680_ctx *c = (aq_bme680_ctx*) ctx;
+
+	c->fetched = true;
+}
+
+void _aq_bme680_handle_error(int8_t i_errno, aq_status *s)
+{
+	switch (i_errno) {
+	case BME68X_OK:
+		aq_status_unset_status(AQ_STATUS_REGION_BME680 ^
+				       AQ_STATUS_I_BME680_READING,
+				       s);
+		break;
+	case BME68X_E_COM_FAIL:
+		aq_status_set_status(AQ_STATUS_E_BME680_COMM_FAIL,
+				     s);
+		break;
+	default:
+		aq_status_set_status(AQ_STATUS_E_BME680_GENERAL_FAIL,
+				     s);
+		break;
+	}
+}
+
+/*
+**********************************************************************
+************************** PM2.5 DRIVER ******************************
+**********************************************************************
+*/
+
+static int _aq_pm2_5_init(aq_sensor *s)
+{
+	aq_pm2_5_ctx *c = (aq_pm2_5_ctx*) s->ctx;
+	int8_t ret;
+
+	c->intf.uart = c->uart;
+	ret = pm2_5_intf_init(&c->intf, c->tx_pin, c->rx_pin);
+	_aq_pm2_5_handle_error(ret, s->status);
+
+	if (ret != PM2_5_OK) {
+		return -1;
+	}
+
+	ret = pm2_5_set_mode(&c->intf.dev, PM2_5_MODE_PASSIVE);
+	_aq_pm2_5_handle_error(ret, s->status);
+
+	return ret == PM2_5_OK ? 0 : -1;
+}
+
+static int _aq_pm2_5_collect(aq_sensor *s)
+{
+	aq_pm2_5_ctx *c = (aq_pm2_5_ctx*) s->ctx;
+	int8_t ret;
+
+	aq_status_set_status(AQ_STATUS_I_PM2_5_READING, s->status);
+	ret = pm2_5_get_data(&c->intf.dev, &c->data);
+	aq_status_unset_status(AQ_STATUS_I_PM2_5_READING, s->status);
+	_aq_pm2_5_handle_error(ret, s->status);
+
+	return ret == PM2_5_OK ? 0 : -1;
+}
+
+static void _aq_pm2_5_serialize(aq_sensor *s)
+{
+	aq_pm2_5_ctx *c = (aq_pm2_5_ctx*) s->ctx;
+	pm2_5_dev *dev = &c->intf.dev;
+	pm2_5_data *d = &c->data;
+	unsigned long millis = s->millis;
+
+	aq_nprintf( "{\"sensor\": \"PMS 5003\", "
+		    "\"data\": [");
+
+	aq_nprintf( "{\"name\": \"PM1.0 Std\", "
+		    "\"value\": %u, "
+		    "\"unit\": \"ug/m^3\", "
+		    "\"timemillis\": %lu}, ",
+		    d->pm1_0_std, millis);
+
+	aq_nprintf( "{\"name\": \"PM2.5 Std\", "
+		    "\"value\": %u, "
+		    "\"unit\": \"ug/m^3\", "
+		    "\"timemillis\": %lu}, ",
+		    d->pm2_5_std, millis);
+
+	aq_nprintf( "{\"name\": \"pm10_std\", "
+		    "\"value\": %u, "
+		    "\"unit\": \"ug/m^3\", "
+		    "\"timemillis\": %lu}, ",
+		    d->pm10_std, millis);
+
+	aq_nprintf( "{\"name\": \"NP > 0.3um\", "
+		    "\"value\": %u, "
+		    "\"unit\": \"num/0.1L air\", "
+		    "\"timemillis\": %lu}, ",
+		    d->np_0_3, millis);
+
+	aq_nprintf( "{\"name\": \"NP > 0.5um\", "
+		    "\"value\": %u, "
+		    "\"unit\": \"num/0.1L air\", "
+		    "\"timemillis\": %lu}, ",
+		    d->np_0_5, millis);
+
+	aq_nprintf( "{\"name\": \"NP > 1.0um\", "
+		    "\"value\": %u, "
+		    "\"unit\": \"num/0.1L air\", "
+		    "\"timemillis\": %lu}, ",
+		    d->np_1_0, millis);
+
+	aq_nprintf( "{\"name\": \"NP > 2.5um\", "
+		    "\"value\": %u, "
+		    "\"unit\": \"num/0.1L air\", "
+		    "\"timemillis\": %lu}, ",
+		    d->np_2_5, millis);
+
+	aq_nprintf( "{\"name\": \"NP > 5.0\", "
+		    "\"value\": %u, "
+		    "\"unit\": \"num/0.1L air\", "
+		    "\"timemillis\": %lu}, ",
+		    d->np_5_0, millis);
+
+	aq_nprintf( "{\"name\": \"NP > 10\", "
+		    "\"value\": %u, "
+		    "\"unit\": \"num/0.1L air\", "
+		    "\"timemillis\": %lu}], ",
+		    d->np_10, millis);
+
+	aq_nprintf( "\"status\": {"
+		    "\"opmode\": \"%s\", "
+		    "\"sleep\": %s}}",
+		    dev->mode == PM2_5_MODE_ACTIVE ? "ACTIVE" : "PASSIVE",
+		    dev->sleep ? "true" : "false");
+}
+
+static unsigned int _aq_pm2_5_metrics(aq_sensor *s, aq_sensor_metric *m,
+				      unsigned int max)
+{
+	aq_pm2_5_ctx *c = (aq_pm2_5_ctx*) s->ctx;
+	pm2_5_data *d = &c->data;
+	const aq_sensor_metric v[] = {
+		{"aq_pm_micrograms_per_cubic_meter", "size=\"1.0\"",
+		 d->pm1_0_std},
+		{"aq_pm_micrograms_per_cubic_meter", "size=\"2.5\"",
+		 d->pm2_5_std},
+		{"aq_pm_micrograms_per_cubic_meter", "size=\"10\"",
+		 d->pm10_std},
+		{"aq_particles_per_deciliter", "size=\"0.3\"", d->np_0_3},
+		{"aq_particles_per_deciliter", "size=\"0.5\"", d->np_0_5},
+		{"aq_particles_per_deciliter", "size=\"1.0\"", d->np_1_0},
+		{"aq_particles_per_deciliter", "size=\"2.5\"", d->np_2_5},
+		{"aq_particles_per_deciliter", "size=\"5.0\"", d->np_5_0},
+		{"aq_particles_per_deciliter", "size=\"10\"", d->np_10}
+	};
+
+	return _aq_copy_metrics(m, max, v, ARRAY_LEN(v));
+}
+
+static void _aq_pm2_5_deinit(aq_sensor *s)
+{
+	aq_pm2_5_ctx *c = (aq_pm2_5_ctx*) s->ctx;
+
+	pm2_5_intf_deinit(&c->intf);
+}
+
+/* The sensor API sends the passive mode request and waits for the
+ * answer in one call, so the UART exchange happens in collect, after
+ * the other sensors are done waiting, and doesn't overlap them */
+const aq_sensor_ops aq_pm2_5_ops = {
+	.name = "PMS 5003",
+	.init = _aq_pm2_5_init,
+	.start = NULL,
+	.poll = NULL,
+	.collect = _aq_pm2_5_collect,
+	.serialize = _aq_pm2_5_serialize,
+	.metrics = _aq_pm2_5_metrics,
+	.deinit = _aq_pm2_5_deinit
+};
+
+void _aq_pm2_5_handle_error(int8_t i_errno, aq_status *s)
+{
+	char level[16];
+	if (i_errno == PM2_5_OK) {
+		/* All errors/warnings will clear on successful
+		 * library operation */
+		aq_status_unset_status(AQ_STATUS_REGION_PM2_5 ^
+				       AQ_STATUS_I_PM2_5_READING, s);
+		return;
+	}
+
+	switch (pm2_5_err_level(i_errno)) {
+	case PM2_5_INFO:
+		strcpy(level, "INFO");
+		break;
+	case PM2_5_WARNING:
+		strcpy(level, "WARNING");
+		aq_status_set_status(AQ_STATUS_W_PM2_5_NO_DATA, s);
+		break;
+	case PM2_5_ERROR:
+		strcpy(level, "ERROR");
+		aq_status_set_status(AQ_STATUS_E_PM2_5_GENERAL_FAIL, s);
+		break;
+	default:
+		strcpy(level, "UNKNOWN");
+		break;
+	}
+
+	printf("%s: %s\n", level,
+	       pm2_5_err_description(i_errno));
+}
+
+/*
+**********************************************************************
+************************** SCD4X DRIVER ******************************
+**********************************************************************
+*/
+
+static int _aq_scd4x_init(aq_sensor *s)
+{
+	aq_scd4x_ctx *c = (aq_scd4x_ctx*) s->ctx;
+	int8_t ret;
+
+	c->intf.i2c = c->i2c; /* NULL i2c will select default */
+
+	ret = scd4x_init(&c->intf, c->addr);
+	_aq_scd4x_handle_error(ret, s->status);
+
+	return ret < 0 ? ret : 0;
+}
+
+static int _aq_scd4x_start(aq_sensor *s)
+{
+	aq_scd4x_ctx *c = (aq_scd4x_ctx*) s->ctx;
+	int8_t ret;
+
+	aq_status_set_status(AQ_STATUS_I_SCD4X_READING, s->status);
+
+	ret = scd4x_start(&c->intf);
+
+	if (ret != SCD4X_OK) {
+		aq_status_unset_status(AQ_STATUS_I_SCD4X_READING,
+				       s->status);
+		_aq_scd4x_handle_error(ret, s->status);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int _aq_scd4x_poll(aq_sensor *s)
+{
+	aq_scd4x_ctx *c = (aq_scd4x_ctx*) s->ctx;
+
+	/* The read runs on the shared bus, this only moves it on to
+	 * the next command once the last one finished */
+	return scd4x_busy(&c->intf) ? AQ_SENSOR_PENDING : AQ_SENSOR_READY;
+}
+
+static void _aq_scd4x_cancel(aq_sensor *s)
+{
+	aq_scd4x_ctx *c = (aq_scd4x_ctx*) s->ctx;
+
+	scd4x_cancel(&c->intf);
+
+	aq_status_unset_status(AQ_STATUS_I_SCD4X_READING, s->status);
+	_aq_scd4x_handle_error(SCD4X_E_TIMEOUT, s->status);
+}
+
+static int _aq_scd4x_collect(aq_sensor *s)
+{
+	aq_scd4x_ctx *c = (aq_scd4x_ctx*) s->ctx;
+	int8_t ret;
+
+	ret = scd4x_collect(&c->intf, &c->data);
+
+	aq_status_unset_status(AQ_STATUS_I_SCD4X_READING, s->status);
+	_aq_scd4x_handle_error(ret, s->status);
+
+	return ret == SCD4X_OK ? 0 : -1;
+}
+
+static void _aq_scd4x_serialize(aq_sensor *s)
+{
+	aq_scd4x_ctx *c = (aq_scd4x_ctx*) s->ctx;
+	scd4x_data *d = &c->data;
+	unsigned long millis = s->millis;
+
+	aq_nprintf("{\"sensor\": \"SCD4x\", \"data\": [");
+
+	aq_nprintf("{\"name\": \"co2\", "
+		   "\"value\": %u, "
+		   "\"unit\": \"ppm\", "
+		   "\"timemillis\": %lu}, ", d->co2, millis);
+
+	aq_nprintf("{\"name\": \"temperature\", "
+		   "\"value\": %.2f, "
+		   "\"unit\": \"degC\", "
+		   "\"timemillis\": %lu}, ", d->temperature, millis);
+
+	aq_nprintf("{\"name\": \"humidity\", "
+		   "\"value\": %.2f, "
+		   "\"unit\": \"%%\", "
+		   "\"timemillis\": %lu}], ", d->humidity, millis);
+
+	aq_nprintf("\"status\": {"
+		   "\"address\": \"%#x\"}}", c->intf.addr);
+}
+
+static unsigned int _aq_scd4x_metrics(aq_sensor *s, aq_sensor_metric *m,
+				      unsigned int max)
+{
+	aq_scd4x_ctx *c = (aq_scd4x_ctx*) s->ctx;
+	scd4x_data *d = &c->data;
+	const aq_sensor_metric v[] = {
+		{"aq_co2_ppm", NULL, d->co2},
+		{"aq_temperature_celsius", NULL, d->temperature},
+		{"aq_humidity_percent", NULL, d->humidity}
+	};
+
+	return _aq_copy_metrics(m, max, v, ARRAY_LEN(v));
+}
+
+static void _aq_scd4x_deinit(aq_sensor *s)
+{
+	aq_scd4x_ctx *c = (aq_scd4x_ctx*) s->ctx;
+
+	scd4x_deinit(&c->intf);
+}
+
+const aq_sensor_ops aq_scd4x_ops = {
+	.name = "SCD4x",
+	.init = _aq_scd4x_init,
+	.start = _aq_scd4x_start,
+	.poll = _aq_scd4x_poll,
+	.cancel = _aq_scd4x_cancel,
+	.collect = _aq_scd4x_collect,
+	.serialize = _aq_scd4x_serialize,
+	.metrics = _aq_scd4x_metrics,
+	.deinit = _aq_scd4x_deinit
+};
+
+void _aq_scd4x_handle_error(int8_t i_errno, aq_status *s)
+{
+	switch (i_errno) {
+	case SCD4X_OK:
+		aq_status_unset_status(AQ_STATUS_REGION_SCD4X ^
+				       AQ_STATUS_I_SCD4X_READING, s);
+		break;
+	case SCD4X_W_NO_NEW_DATA:
+		aq_status_set_status(AQ_STATUS_W_SCD4X_NO_DATA, s);
+		break;
+	case SCD4X_E_COMM_FAIL:
+	case SCD4X_E_TIMEOUT:
+		aq_status_set_status(AQ_STATUS_E_SCD4X_COMM_FAIL, s);
+		break;
+	default:
+		aq_status_set_status(AQ_STATUS_E_SCD4X_GENERAL_FAIL, s);
+		break;
+	}
+}
+
+/*
+**********************************************************************
+************************* BATTERY DRIVER *****************************
+**********************************************************************
+*/
+
+static int _aq_batt_init(aq_sensor *s)
+{
+	aq_batt_ctx *c = (aq_batt_ctx*) s->ctx;
+
+	adc_init();
+
+	adc_gpio_init(c->gpio);
+
+	return 0;
+}
+
+static int _aq_batt_collect(aq_sensor *s)
+{
+	aq_batt_ctx *c = (aq_batt_ctx*) s->ctx;
+	const double cf = 2 * 3.3 / (1 << 12);
+
+	adc_select_input(c->adc_ch);
+	c->vbatt = cf * (double) adc_read();
+
+	if (c->vbatt < AIR_QUALITY_BATT_LOW_V) {
+		aq_status_set_status(AQ_STATUS_W_BATT_LOW, s->status);
+	} else {
+		aq_status_unset_status(AQ_STATUS_W_BATT_LOW, s->status);
+	}
+
+	return 0;
+}
+
+static void _aq_batt_serialize(aq_sensor *s)
+{
+	aq_batt_ctx *c = (aq_batt_ctx*) s->ctx;
+
+	aq_nprintf("{\"sensor\": \"Board\", "
+		   "\"data\": [");
+
+	aq_nprintf("{\"name\": \"V Batt\", "
+		   "\"value\": %0.2f, "
+		   "\"unit\": \"V\", "
+		   "\"timemillis\": %lu}], ",
+		   c->vbatt, (unsigned long) s->millis);
+
+	aq_nprintf("\"status\": {"
+		   "\"charging\": \"%s\"}}",
+		   "unknown");
+}
+
+static unsigned int _aq_batt_metrics(aq_sensor *s, aq_sensor_metric *m,
+				     unsigned int max)
+{
+	aq_batt_ctx *c = (aq_batt_ctx*) s->ctx;
+	const aq_sensor_metric v[] = {
+		{"aq_battery_volts", NULL, c->vbatt}
+	};
+
+	return _aq_copy_metrics(m, max, v, ARRAY_LEN(v));
+}
+
+const aq_sensor_ops aq_batt_ops = {
+	.name = "Board",
+	.init = _aq_batt_init,
+	.start = NULL,
+	.poll = NULL,
+	.collect = _aq_batt_collect,
+	.serialize = _aq_batt_serialize,
+	.metrics = _aq_batt_metrics,
+	.deinit = NULL
+};
+
+unsigned int _aq_copy_metrics(aq_sensor_metric *m, unsigned int max,
+			      const aq_sensor_metric *v, unsigned int n)
+{
+	if (n > max) {
+		n = max;
+	}
+
+	memcpy(m, v, n * sizeof(*v));
+
+	return n;
+}
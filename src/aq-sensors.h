@@ -0,0 +1,83 @@
+/**
+ * @file aq-sensors.h
+ * @author Tyler J. Anderson
+ * @brief Sensor drivers for the Air Quality sensor registry
+ */
+
+#ifndef AQ_SENSORS_H
+#define AQ_SENSORS_H
+
+#include "aq-sensor.h"
+#include "bme680-interface.h"
+#include "pm2_5-interface.h"
+#include "scd4x-interface.h"
+
+#include "hardware/i2c.h"
+#include "hardware/uart.h"
+
+/**
+ * @addtogroup aq-sensor
+ * @{
+ */
+
+/** @brief Instance of a BME680 gas sensor
+ *
+ * Fill out @p i2c and @p addr before registering. A NULL @p i2c
+ * selects the default I2C block.
+ */
+typedef struct {
+	i2c_inst_t *i2c; /**< @brief I2C block the sensor is on */
+	uint8_t addr; /**< @brief 7-bit I2C address of the sensor */
+	bme680_intf intf;
+	bme680_run_mode mode;
+	absolute_time_t ready; /**< @brief When a measurement is done */
+	bool fetching; /**< @brief Field block read was queued */
+	volatile bool fetched; /**< @brief Field block read finished */
+	struct bme68x_data data;
+} aq_bme680_ctx;
+
+/** @brief Instance of a PMS 5003 particle sensor
+ *
+ * Fill out @p uart, @p tx_pin and @p rx_pin before registering
+ */
+typedef struct {
+	uart_inst_t *uart; /**< @brief UART the sensor is on */
+	uint tx_pin; /**< @brief GPIO pin for TX */
+	uint rx_pin; /**< @brief GPIO pin for RX */
+	pm2_5_intf intf;
+	pm2_5_data data;
+} aq_pm2_5_ctx;
+
+/** @brief Instance of an SCD4x CO2 sensor
+ *
+ * Fill out @p i2c and @p addr before registering. A NULL @p i2c
+ * selects the default I2C block, which may be shared with other
+ * sensors.
+ */
+typedef struct {
+	i2c_inst_t *i2c; /**< @brief I2C block the sensor is on */
+	uint8_t addr; /**< @brief 7-bit I2C address of the sensor */
+	scd4x_intf intf;
+	scd4x_data data;
+} aq_scd4x_ctx;
+
+/** @brief Battery voltage measured on an ADC channel
+ *
+ * Fill out @p gpio and @p adc_ch before registering
+ */
+typedef struct {
+	uint gpio; /**< @brief GPIO pin of the ADC input */
+	uint adc_ch; /**< @brief ADC channel of the GPIO pin */
+	double vbatt;
+} aq_batt_ctx;
+
+extern const aq_sensor_ops aq_bme680_ops;
+extern const aq_sensor_ops aq_pm2_5_ops;
+extern const aq_sensor_ops aq_scd4x_ops;
+extern const aq_sensor_ops aq_batt_ops;
+
+/**
+ * @}
+ */
+
+#endif /* #ifndef AQ_SENSORS_H */
@@ -1,9 +1,14 @@
 #include "aq-stdio.h"
+#include "aq-http.h"
+#include "aq-ctl.h"
+#include "aq-sub.h"
+#include "esp-at-replay.h"
 #include "debugmsg.h"
 
 #include <stdio.h>
 #include <stdarg.h>
 #include <stdbool.h>
+#include <string.h>
 
 #include "pico/stdlib.h"
 #include "pico/multicore.h"
@@ -38,6 +43,27 @@ static semaphore_t _task_sem;
 static queue_t _q_tasks;
 static absolute_time_t _wup_time;
 
+/* Frames kept for clients to resume from. Only core1 runs WiFi tasks
+ * and resumes, so it adds them in the order core0 numbered them, and
+ * a resume never lands inside a frame being sent. */
+static esp_at_replay _replay;
+static char _replay_store[AQ_STDIO_REPLAY_LEN];
+static char _replay_frame[AQ_STDIO_REPLAY_FRAME_LEN];
+static size_t _replay_len;
+static bool _replay_drop = false;
+static char _resume_buf[AQ_STDIO_REPLAY_FRAME_LEN];
+static uint32_t _seq;
+
+#ifdef AQ_STDIO_STREAM_HOST
+static absolute_time_t _stream_retry;
+#endif /* #ifdef AQ_STDIO_STREAM_HOST */
+
+#ifdef AQ_STDIO_UDP_PORT
+static char _udp_frame[AQ_STDIO_UDP_FRAME_LEN];
+static size_t _udp_len;
+static absolute_time_t _udp_retry;
+#endif /* #ifdef AQ_STDIO_UDP_PORT */
+
 static _aq_iobuf *_aq_retrieve_buf();
 static bool _aq_release_buf(_aq_iobuf *buf);
 static void _aq_enqueue_uart(_aq_iobuf *buf);
@@ -45,6 +71,15 @@ static void _aq_enqueue_wifi(_aq_iobuf *buf);
 static void _aq_sort_tasks();
 static void _aq_send_uart(void *buf);
 static void _aq_send_wifi(void *buf);
+static void _aq_replay_collect(_aq_iobuf *buf);
+#ifdef AQ_STDIO_STREAM_HOST
+static bool _aq_send_stream(_aq_iobuf *buf);
+#endif /* #ifdef AQ_STDIO_STREAM_HOST */
+#ifdef AQ_STDIO_UDP_PORT
+static void _aq_send_udp(_aq_iobuf *buf);
+static void _aq_udp_flush();
+#endif /* #ifdef AQ_STDIO_UDP_PORT */
+static void _aq_flush(void *data);
 static void _aq_sleep_until(void *time);
 static void _aq_stdio_thread_entry();
 static void _aq_process_tasks();
@@ -77,6 +112,10 @@ void aq_stdio_init(aq_status *s, esp_at_status *e)
 	queue_init(&_q_tasks, sizeof(_aq_stdio_task),
 		   2 * AQ_STDIO_BUFFER_NUM);
 
+	_seq = 0;
+	esp_at_replay_init(&_replay, _replay_store,
+			   ARRAY_LEN(_replay_store), _seq);
+
 	multicore_launch_core1(_aq_stdio_thread_entry);
 
 	_aq_stdio_is_init = true;
@@ -95,6 +134,12 @@ void aq_nprintf(const char * restrict format, ...)
 
 	va_end(ap);
 
+	for (const char *c = s->buf; (c = strchr(c, '\n')); ++c) {
+		++_seq;
+	}
+
+	aq_http_frame(s->buf, strlen(s->buf));
+
 	_aq_enqueue_uart(s);
 	_aq_enqueue_wifi(s);
 	
@@ -114,6 +159,25 @@ void aq_stdio_process()
 	_aq_process_tasks();
 }
 
+void aq_stdio_flush()
+{
+	_aq_stdio_task flush_task = {
+		.next = NULL,
+		.prev = NULL,
+		.priority = 3, /* After the output queued before it */
+		.task = _aq_flush,
+		.data = NULL
+	};
+
+	/* The frame collected for a datagram belongs to core1, which
+	 * runs the flush between buffers */
+	if (get_core_num() == 1) {
+		_aq_flush(NULL);
+	} else if (_aq_stdio_is_init) {
+		queue_add_blocking(&_q_tasks, &flush_task);
+	}
+}
+
 void aq_stdio_sleep_until(absolute_time_t time)
 {
 	_wup_time = time;
@@ -128,6 +192,23 @@ void aq_stdio_sleep_until(absolute_time_t time)
 	queue_add_blocking(&_q_tasks, &sleep_task);
 }
 
+uint32_t aq_stdio_seq()
+{
+	return _seq;
+}
+
+int aq_stdio_resume(int link, uint32_t seq, uint32_t *lost)
+{
+	/* Would interleave with the live frames of core1 */
+	if (get_core_num() != 1) {
+		*lost = 0;
+		return -1;
+	}
+
+	return esp_at_replay_send(&_replay, _esp_cfg, link, seq, _resume_buf,
+				  ARRAY_LEN(_resume_buf), lost);
+}
+
 _aq_iobuf *_aq_retrieve_buf()
 {
 	_aq_iobuf *ret = NULL;
@@ -270,6 +351,21 @@ void _aq_send_wifi(void *buf)
 {
 	_aq_iobuf *s = (_aq_iobuf*) buf;
 
+	/* Kept before it goes out, a resume on this core either comes
+	 * before the frame or after all of it */
+	_aq_replay_collect(s);
+
+#ifdef AQ_STDIO_STREAM_HOST
+	if (_aq_send_stream(s)) {
+		_aq_release_buf(buf);
+		return;
+	}
+#endif /* #ifdef AQ_STDIO_STREAM_HOST */
+
+#ifdef AQ_STDIO_UDP_PORT
+	_aq_send_udp(s);
+#endif /* #ifdef AQ_STDIO_UDP_PORT */
+
 	if (_aq_s->status & AQ_STATUS_I_CLIENT_CONNECTED) {
 		int rslt = 0;
 
@@ -288,11 +384,156 @@ void _aq_send_wifi(void *buf)
 	_aq_release_buf(buf);
 }
 
+void _aq_replay_collect(_aq_iobuf *buf)
+{
+	const size_t len = strnlen(buf->buf, sizeof(buf->buf));
+
+	/* A frame ends with its line, as core0 counts them */
+	for (size_t i = 0; i < len; ++i) {
+		if (_replay_len < ARRAY_LEN(_replay_frame)) {
+			_replay_frame[_replay_len++] = buf->buf[i];
+		} else {
+			_replay_drop = true;
+		}
+
+		if (buf->buf[i] == '\n') {
+			/* One too long still takes its number */
+			esp_at_replay_add(&_replay,
+					  _replay_drop ? NULL : _replay_frame,
+					  _replay_len);
+			_replay_len = 0;
+			_replay_drop = false;
+		}
+	}
+}
+
+#ifdef AQ_STDIO_STREAM_HOST
+bool _aq_send_stream(_aq_iobuf *buf)
+{
+	/* Connect once WiFi is up, and again a while after the host
+	 * could not be reached */
+	if (!_esp_cfg->transparent) {
+		if ((_aq_s->status & AQ_STATUS_W_WIFI_DISCONNECTED) ||
+		    !time_reached(_stream_retry)) {
+			return false;
+		}
+
+		DEBUGDATA("Connecting stream to", AQ_STDIO_STREAM_HOST, "%s");
+
+		if (esp_at_transparent_enter(_esp_cfg, AQ_STDIO_STREAM_PROTO,
+					     AQ_STDIO_STREAM_HOST,
+					     AQ_STDIO_STREAM_PORT) < 0) {
+			_aq_s->status |= AQ_STATUS_E_WIFI_FAIL;
+			_stream_retry =
+				make_timeout_time_ms(AQ_STDIO_STREAM_RETRY_MS);
+			return false;
+		}
+	}
+
+	if (esp_at_transparent_write(_esp_cfg, buf->buf,
+				     strnlen(buf->buf,
+					     sizeof(buf->buf))) < 0) {
+		_aq_s->status |= AQ_STATUS_E_WIFI_FAIL;
+		esp_at_transparent_exit(_esp_cfg);
+		_stream_retry = make_timeout_time_ms(AQ_STDIO_STREAM_RETRY_MS);
+	} else {
+		_aq_s->status &= ~AQ_STATUS_E_WIFI_FAIL;
+	}
+
+	return true;
+}
+#endif /* #ifdef AQ_STDIO_STREAM_HOST */
+
+#ifdef AQ_STDIO_UDP_PORT
+void _aq_send_udp(_aq_iobuf *buf)
+{
+	const size_t len = strnlen(buf->buf, sizeof(buf->buf));
+
+	/* A frame of output ends with its line, and goes out in pieces
+	 * if it doesn't fit in one datagram */
+	for (size_t i = 0; i < len; ++i) {
+		_udp_frame[_udp_len++] = buf->buf[i];
+
+		if (buf->buf[i] == '\n' || _udp_len == ARRAY_LEN(_udp_frame)) {
+			_aq_udp_flush();
+		}
+	}
+}
+
+void _aq_udp_flush()
+{
+	const size_t len = _udp_len;
+#ifdef AQ_STDIO_UDP_HOST
+	const char *host = AQ_STDIO_UDP_HOST;
+#else
+	char host[16];
+#endif /* #ifdef AQ_STDIO_UDP_HOST */
+
+	_udp_len = 0;
+
+	/* Open once WiFi is up, and again a while after it failed. The
+	 * module closes the link when WiFi goes away. */
+	if (!(_esp_cfg->udp_links & (1u << AQ_STDIO_UDP_LINK))) {
+		if ((_aq_s->status & AQ_STATUS_W_WIFI_DISCONNECTED) ||
+		    !time_reached(_udp_retry)) {
+			return;
+		}
+
+#ifndef AQ_STDIO_UDP_HOST
+		if (esp_at_broadcast_addr(_esp_s, host, ARRAY_LEN(host)) < 0) {
+			return;
+		}
+#endif /* #ifndef AQ_STDIO_UDP_HOST */
+
+		DEBUGDATA("Opening UDP sink to", host, "%s");
+
+		if (esp_at_udp_open(_esp_cfg, AQ_STDIO_UDP_LINK, host,
+				    AQ_STDIO_UDP_PORT) < 0) {
+			_aq_s->status |= AQ_STATUS_E_WIFI_FAIL;
+			_udp_retry = make_timeout_time_ms(AQ_STDIO_UDP_RETRY_MS);
+			return;
+		}
+	}
+
+	/* Lost datagrams show as gaps in the sequence numbers, nothing
+	 * is sent again */
+	if (esp_at_udp_send(_esp_cfg, AQ_STDIO_UDP_LINK, _udp_frame,
+			    len) < 0) {
+		_aq_s->status |= AQ_STATUS_E_WIFI_FAIL;
+	} else {
+		_aq_s->status &= ~AQ_STATUS_E_WIFI_FAIL;
+	}
+}
+#endif /* #ifdef AQ_STDIO_UDP_PORT */
+
+void _aq_flush(void *data)
+{
+	(void) data;
+
+#ifdef AQ_STDIO_UDP_PORT
+	/* The rest of a frame collected for a datagram */
+	if (_udp_len) {
+		_aq_udp_flush();
+	}
+#endif /* #ifdef AQ_STDIO_UDP_PORT */
+
+	stdio_flush();
+}
+
 void _aq_sleep_until(void *time)
 {
 	absolute_time_t *wup = (absolute_time_t*) time;
 
-	sleep_until(*wup);
+	/* Keep answering clients while idle, and stop early once core0
+	 * queues output for a sample that came sooner */
+	while (!time_reached(*wup) && queue_is_empty(&_q_tasks)) {
+		esp_at_poll(_esp_cfg);
+		aq_http_process();
+		aq_ctl_process();
+		aq_sub_process();
+		sleep_until(absolute_time_min(*wup, make_timeout_time_ms(
+						      AQ_STDIO_IDLE_POLL_MS)));
+	}
 }
 
 void _aq_stdio_thread_entry()
@@ -301,6 +542,13 @@ void _aq_stdio_thread_entry()
 
 	for (;;) {
 		_aq_process_tasks();
+
+		/* Core1 owns the WiFi module, so it runs the commands
+		 * core0 queued */
+		esp_at_poll(_esp_cfg);
+		aq_http_process();
+		aq_ctl_process();
+		aq_sub_process();
 	}
 }
 
@@ -17,10 +17,76 @@
 #define AQ_STDIO_BUFFER_NUM 20
 #endif /* #ifndef AQ_STDIO_BUFFER_SIZE */
 
+/* Define AQ_STDIO_STREAM_HOST to stream the output to that host in
+ * transparent transmission, without a CIPSEND per buffer, instead of
+ * to the clients of the server */
+#ifndef AQ_STDIO_STREAM_PORT
+#define AQ_STDIO_STREAM_PORT 5000
+#endif /* #ifndef AQ_STDIO_STREAM_PORT */
+
+#ifndef AQ_STDIO_STREAM_PROTO
+#define AQ_STDIO_STREAM_PROTO ESP_AT_CIP_PROTO_TCP
+#endif /* #ifndef AQ_STDIO_STREAM_PROTO */
+
+/* Wait before trying to connect to the stream host again */
+#ifndef AQ_STDIO_STREAM_RETRY_MS
+#define AQ_STDIO_STREAM_RETRY_MS 10000
+#endif /* #ifndef AQ_STDIO_STREAM_RETRY_MS */
+
+/* Define AQ_STDIO_UDP_PORT to also send each frame of output once as
+ * a datagram on a UDP link, to AQ_STDIO_UDP_HOST or else to the
+ * broadcast address of the network, for any number of listeners */
+#if defined(AQ_STDIO_UDP_PORT) && defined(AQ_STDIO_STREAM_HOST)
+#error "AQ_STDIO_UDP_PORT and AQ_STDIO_STREAM_HOST exclude each other"
+#endif
+
+#ifndef AQ_STDIO_UDP_LINK
+#define AQ_STDIO_UDP_LINK 4
+#endif /* #ifndef AQ_STDIO_UDP_LINK */
+
+/* Wait before trying to open the UDP link again */
+#ifndef AQ_STDIO_UDP_RETRY_MS
+#define AQ_STDIO_UDP_RETRY_MS 10000
+#endif /* #ifndef AQ_STDIO_UDP_RETRY_MS */
+
+/* Longest frame sent in one datagram, longer ones go in pieces */
+#define AQ_STDIO_UDP_FRAME_LEN (ESP_AT_CIPSEND_MAX_LEN - ESP_AT_UDP_SEQ_LEN)
+
+/* Time core1 sleeps between polls of the WiFi module while waiting
+ * for the next sample, to answer clients in the meantime */
+#ifndef AQ_STDIO_IDLE_POLL_MS
+#define AQ_STDIO_IDLE_POLL_MS 20
+#endif /* #ifndef AQ_STDIO_IDLE_POLL_MS */
+
+/* Room for the latest frames of output, which clients that reconnect
+ * resume from */
+#ifndef AQ_STDIO_REPLAY_LEN
+#define AQ_STDIO_REPLAY_LEN 16384
+#endif /* #ifndef AQ_STDIO_REPLAY_LEN */
+
+/* Longest frame kept for clients to resume from */
+#ifndef AQ_STDIO_REPLAY_FRAME_LEN
+#define AQ_STDIO_REPLAY_FRAME_LEN 3072
+#endif /* #ifndef AQ_STDIO_REPLAY_FRAME_LEN */
+
 void aq_stdio_init(aq_status *s, esp_at_status *e);
 void aq_nprintf(const char *restrict format, ...);
 void aq_stdio_deinit();
+/* Run the queued output, from core1 only. WiFi tasks connect and
+ * write the sinks, which must not happen on the sampling core. */
 void aq_stdio_process();
+/* Push out output still held, from either core. Core1 does it right
+ * away, core0 queues it after its output. */
+void aq_stdio_flush();
 void aq_stdio_sleep_until(absolute_time_t time);
 
+/* Sequence number of the next frame of output, from core0. Each line
+ * printed is a frame. */
+uint32_t aq_stdio_seq();
+
+/* Send the frames from seq on to a client, from core1 only, with the
+ * number of frames no longer kept in lost. Returns the frames sent, <0
+ * if a send failed or it was called from core0. */
+int aq_stdio_resume(int link, uint32_t seq, uint32_t *lost);
+
 #endif /* #ifndef AQ_STDIO_H */
@@ -0,0 +1,366 @@
+/**
+ * @file aq-sub.c
+ * @author Tyler J. Anderson
+ * @brief Subscriptions of WiFi clients to part of the output
+ */
+
+#include "aq-sub.h"
+#include "aq-sensor.h"
+#include "debugmsg.h"
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+
+#include "pico/critical_section.h"
+#include "pico/util/queue.h"
+
+#define ARRAY_LEN(array) sizeof(array)/sizeof(array[0])
+
+typedef struct {
+	aq_sub_spec spec;
+	bool active;
+	uint32_t gen; /* Counts the subscriptions of the link */
+} _aq_sub;
+
+/* A render and the links it goes to */
+typedef struct {
+	char buf[AQ_SUB_FRAME_LEN];
+	size_t len;
+	unsigned int links;
+	volatile bool busy; /* Queued for core1 and not sent yet */
+} _aq_sub_slot;
+
+static bool _aq_sub_is_init = false;
+static esp_at_cfg *_cfg = NULL;
+
+/* Written on core1, read on core0 under _cs */
+static _aq_sub _subs[ESP_AT_MAX_CONN];
+static critical_section_t _cs;
+
+/* Renders handed from core0 to core1 */
+static _aq_sub_slot _slots[ESP_AT_MAX_CONN];
+static queue_t _q_slots;
+
+/* Kept by core0 */
+static uint32_t _seen_gen[ESP_AT_MAX_CONN];
+static uint32_t _count[ESP_AT_MAX_CONN];
+static aq_sensor_metric _metrics[AQ_SENSOR_MAX * AQ_SENSOR_METRICS_MAX];
+static uint8_t _sensor[AQ_SENSOR_MAX * AQ_SENSOR_METRICS_MAX];
+
+static bool _aq_sub_same(const _aq_sub *a, const _aq_sub *b);
+static bool _aq_sub_match(const char *metrics, const aq_sensor_metric *m);
+static int _aq_sub_render(_aq_sub_slot *slot, const aq_sub_spec *spec,
+			  bool header, unsigned int n, const aq_status *s);
+static int _aq_sub_append(_aq_sub_slot *slot, const char *format, ...);
+
+void aq_sub_init(esp_at_cfg *cfg)
+{
+	_cfg = cfg;
+	memset(_subs, 0, sizeof(_subs));
+	critical_section_init(&_cs);
+	queue_init(&_q_slots, sizeof(unsigned int), ARRAY_LEN(_slots));
+
+	_aq_sub_is_init = true;
+}
+
+int aq_sub_set(int link, const aq_sub_spec *spec)
+{
+	if (!_aq_sub_is_init || link < 0 || link >= ESP_AT_MAX_CONN ||
+	    spec->every == 0 || spec->every > AQ_SUB_EVERY_MAX) {
+		return -1;
+	}
+
+	critical_section_enter_blocking(&_cs);
+	_subs[link].spec = *spec;
+	_subs[link].active = true;
+	_subs[link].gen++;
+	critical_section_exit(&_cs);
+
+	_cfg->quiet_links |= 1u << link;
+
+	return 0;
+}
+
+void aq_sub_drop(int link)
+{
+	bool active;
+
+	if (!_aq_sub_is_init || link < 0 || link >= ESP_AT_MAX_CONN) {
+		return;
+	}
+
+	critical_section_enter_blocking(&_cs);
+	active = _subs[link].active;
+	_subs[link].active = false;
+	critical_section_exit(&_cs);
+
+	/* Only a link it made quiet */
+	if (active) {
+		_cfg->quiet_links &= ~(1u << link);
+	}
+}
+
+void aq_sub_sample(const aq_status *s)
+{
+	_aq_sub subs[ESP_AT_MAX_CONN];
+	unsigned int due = 0;
+	unsigned int header = 0;
+	unsigned int n;
+
+	if (!_aq_sub_is_init) {
+		return;
+	}
+
+	critical_section_enter_blocking(&_cs);
+	memcpy(subs, _subs, sizeof(subs));
+	critical_section_exit(&_cs);
+
+	for (int i = 0; i < ESP_AT_MAX_CONN; ++i) {
+		if (!subs[i].active) {
+			continue;
+		}
+
+		/* A new subscription starts now, with a CSV header */
+		if (subs[i].gen != _seen_gen[i]) {
+			_seen_gen[i] = subs[i].gen;
+			_count[i] = 0;
+
+			if (subs[i].spec.format == AQ_CTL_FORMAT_CSV) {
+				header |= 1u << i;
+			}
+		}
+
+		if (_count[i]++ % subs[i].spec.every == 0) {
+			due |= 1u << i;
+		}
+	}
+
+	if (!due) {
+		return;
+	}
+
+	n = aq_sensor_metrics_get(_metrics, _sensor, ARRAY_LEN(_metrics));
+
+	/* Links with the same subscription share one render */
+	for (int i = 0; i < ESP_AT_MAX_CONN; ++i) {
+		const bool h = header & (1u << i);
+		_aq_sub_slot *slot = NULL;
+		unsigned int links = 0;
+
+		if (!(due & (1u << i))) {
+			continue;
+		}
+
+		for (int j = i; j < ESP_AT_MAX_CONN; ++j) {
+			if ((due & (1u << j)) &&
+			    !(header & (1u << j)) == !h &&
+			    _aq_sub_same(&subs[i], &subs[j])) {
+				links |= 1u << j;
+			}
+		}
+
+		due &= ~links;
+
+		for (unsigned int k = 0; k < ARRAY_LEN(_slots); ++k) {
+			if (!_slots[k].busy) {
+				slot = &_slots[k];
+
+				if (_aq_sub_render(slot, &subs[i].spec, h, n,
+						   s) < 0) {
+					DEBUGMSG("Subscription too long to render");
+					break;
+				}
+
+				slot->links = links;
+				slot->busy = true;
+
+				if (!queue_try_add(&_q_slots, &k)) {
+					slot->busy = false;
+				}
+
+				break;
+			}
+		}
+
+		/* Core1 is behind, these links miss a sample */
+		if (!slot) {
+			DEBUGDATA("No slot free for links", links, "%#x");
+		}
+	}
+}
+
+void aq_sub_process()
+{
+	unsigned int k;
+
+	if (!_aq_sub_is_init) {
+		return;
+	}
+
+	while (queue_try_remove(&_q_slots, &k)) {
+		_aq_sub_slot *slot = &_slots[k];
+
+		for (int i = 0; i < ESP_AT_MAX_CONN; ++i) {
+			/* Subscriptions only change on this core */
+			if (!(slot->links & (1u << i)) || !_subs[i].active) {
+				continue;
+			}
+
+			if (esp_at_cipsend_data(_cfg, i, slot->buf,
+						slot->len) < 0) {
+				DEBUGDATA("Failed to send subscription of link",
+					  i, "%d");
+			}
+		}
+
+		slot->busy = false;
+	}
+}
+
+bool _aq_sub_same(const _aq_sub *a, const _aq_sub *b)
+{
+	return a->spec.format == b->spec.format &&
+		strcmp(a->spec.metrics, b->spec.metrics) == 0;
+}
+
+bool _aq_sub_match(const char *metrics, const aq_sensor_metric *m)
+{
+	const char *name = m->name;
+
+	if (metrics[0] == '\0') {
+		return true;
+	}
+
+	if (strncmp(name, "aq_", 3) == 0) {
+		name += 3;
+	}
+
+	for (const char *sel = metrics; *sel; ) {
+		const size_t len = strcspn(sel, ",");
+		const char *eq = memchr(sel, '=', len);
+		const size_t nlen = eq ? (size_t) (eq - sel) : len;
+		const char *value;
+
+		if (strncmp(name, sel, nlen) == 0) {
+			if (!eq) {
+				return true;
+			}
+
+			/* Value of the label, between its quotes */
+			value = m->label ? strchr(m->label, '"') : NULL;
+
+			if (value &&
+			    strcspn(value + 1, "\"") == len - nlen - 1 &&
+			    strncmp(value + 1, eq + 1, len - nlen - 1) == 0) {
+				return true;
+			}
+		}
+
+		sel += len;
+
+		if (*sel == ',') {
+			++sel;
+		}
+	}
+
+	return false;
+}
+
+int _aq_sub_render(_aq_sub_slot *slot, const aq_sub_spec *spec,
+		   bool header, unsigned int n, const aq_status *s)
+{
+	const bool csv = spec->format == AQ_CTL_FORMAT_CSV;
+	const unsigned long millis = to_ms_since_boot(get_absolute_time());
+	bool first = true;
+	char col[64];
+
+	slot->len = 0;
+
+	if (csv && header) {
+		if (_aq_sub_append(slot, "# millis,status") < 0) {
+			return -1;
+		}
+
+		for (unsigned int i = 0; i < n; ++i) {
+			if (!_aq_sub_match(spec->metrics, &_metrics[i])) {
+				continue;
+			}
+
+			if (aq_sensor_metric_column(col, sizeof(col),
+						    _sensor[i],
+						    &_metrics[i]) < 0 ||
+			    _aq_sub_append(slot, ",%s", col) < 0) {
+				return -1;
+			}
+		}
+
+		if (_aq_sub_append(slot, "\n") < 0) {
+			return -1;
+		}
+	}
+
+	if (_aq_sub_append(slot, csv ? "%lu,%lu" :
+			   "{\"millis\": %lu, \"status\": %lu, \"data\": {",
+			   millis, (unsigned long) s->status) < 0) {
+		return -1;
+	}
+
+	/* Sensors without valid data keep their place, empty */
+	for (unsigned int i = 0; i < n; ++i) {
+		const bool valid = aq_sensor_get(_sensor[i])->valid;
+		int ret;
+
+		if (!_aq_sub_match(spec->metrics, &_metrics[i])) {
+			continue;
+		}
+
+		if (csv) {
+			ret = valid ?
+				_aq_sub_append(slot, ",%.9g", _metrics[i].value) :
+				_aq_sub_append(slot, ",");
+		} else {
+			ret = aq_sensor_metric_column(col, sizeof(col),
+						      _sensor[i], &_metrics[i]);
+
+			if (ret >= 0) {
+				ret = _aq_sub_append(slot, "%s\"%s\": ",
+						     first ? "" : ", ", col);
+			}
+
+			if (ret >= 0) {
+				ret = valid ?
+					_aq_sub_append(slot, "%.9g",
+						       _metrics[i].value) :
+					_aq_sub_append(slot, "null");
+			}
+		}
+
+		if (ret < 0) {
+			return -1;
+		}
+
+		first = false;
+	}
+
+	return _aq_sub_append(slot, csv ? "\n" : "}}\n");
+}
+
+int _aq_sub_append(_aq_sub_slot *slot, const char *format, ...)
+{
+	const size_t size = ARRAY_LEN(slot->buf) - slot->len;
+	va_list ap;
+	int ret;
+
+	va_start(ap, format);
+	ret = vsnprintf(&slot->buf[slot->len], size, format, ap);
+	va_end(ap);
+
+	if (ret < 0 || (size_t) ret >= size) {
+		return -1;
+	}
+
+	slot->len += ret;
+
+	return ret;
+}
@@ -0,0 +1,75 @@
+/**
+ * @file aq-sub.h
+ * @author Tyler J. Anderson
+ * @brief Subscriptions of WiFi clients to part of the output
+ *
+ * A client that subscribes gets only the metrics it selected, every
+ * so many samples and in its own format, instead of the full frame
+ * of every sample. Clients with the same subscription share one
+ * render per sample, so the cost over the air follows what clients
+ * ask for.
+ */
+
+#ifndef AQ_SUB_H
+#define AQ_SUB_H
+
+#include "aq-ctl.h"
+#include "aq-error-state.h"
+#include "esp-at-modem.h"
+
+/** @brief Room for the metric selectors of a subscription */
+#ifndef AQ_SUB_METRICS_LEN
+#define AQ_SUB_METRICS_LEN 48
+#endif /* #ifndef AQ_SUB_METRICS_LEN */
+
+/** @brief Room for one render of a subscription */
+#ifndef AQ_SUB_FRAME_LEN
+#define AQ_SUB_FRAME_LEN 1536
+#endif /* #ifndef AQ_SUB_FRAME_LEN */
+
+/** @brief Largest decimation of a subscription */
+#ifndef AQ_SUB_EVERY_MAX
+#define AQ_SUB_EVERY_MAX 1000
+#endif /* #ifndef AQ_SUB_EVERY_MAX */
+
+/** @brief What a client subscribed to */
+typedef struct {
+	/** @brief Selectors split by commas, or empty for all metrics
+	 *
+	 * A selector matches metrics whose name, less the aq_ in
+	 * front, starts with it, like co2 or pm. With =value it only
+	 * matches metrics with that label value, like pm=2.5.
+	 */
+	char metrics[AQ_SUB_METRICS_LEN];
+	unsigned int every; /**< @brief Send one in this many samples */
+	aq_ctl_format format; /**< @brief Format of the lines sent */
+} aq_sub_spec;
+
+/** @brief Set up subscriptions for the clients of @p cfg
+ *
+ * Call before @ref aq_stdio_init starts the core that sends them.
+ */
+void aq_sub_init(esp_at_cfg *cfg);
+
+/** @brief Subscribe the client on @p link, from core1
+ *
+ * Replaces an earlier subscription of the link, and leaves the link
+ * out of the full frames.
+ *
+ * @return 0 on success, <0 if @p link or @p spec is invalid
+ */
+int aq_sub_set(int link, const aq_sub_spec *spec);
+
+/** @brief End the subscription of @p link, from core1
+ *
+ * The link gets full frames again, if it is still connected.
+ */
+void aq_sub_drop(int link);
+
+/** @brief Render the subscriptions due after a sample, from core0 */
+void aq_sub_sample(const aq_status *s);
+
+/** @brief Send the rendered subscriptions, from core1 */
+void aq_sub_process();
+
+#endif /* #ifndef AQ_SUB_H */